@@ -6,11 +6,14 @@
 
 #include <lib/crypto/global_prng.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
 #include <explicit-memory/bytes.h>
 #include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/atomic.h>
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
@@ -33,11 +36,57 @@ namespace GlobalPRNG {
 
 static PRNG* kGlobalPrng = nullptr;
 
+// One per cpu, so that draws on different cpus don't all serialize on the
+// global PRNG's lock.
+struct LocalPRNG {
+    PRNG* prng;
+    // Calls to GetLocalInstance() since the last reseed.
+    fbl::atomic<uint64_t> draws;
+    // The value of kGeneration when the instance was last reseeded.
+    fbl::atomic<uint64_t> generation;
+} __CPU_ALIGN;
+
+static LocalPRNG kLocalPrngs[SMP_MAX_CPUS];
+static fbl::atomic<bool> kLocalPrngsReady;
+
+// Bumped every time entropy is added to the global PRNG after boot.
+static fbl::atomic<uint64_t> kGeneration;
+
 PRNG* GetInstance() {
     ASSERT(kGlobalPrng);
     return kGlobalPrng;
 }
 
+static void Reseed(LocalPRNG* local, uint64_t generation) {
+    uint8_t seed[PRNG::kMinEntropy];
+    GetInstance()->Draw(seed, sizeof(seed));
+    local->prng->AddEntropy(seed, sizeof(seed));
+    mandatory_memset(seed, 0, sizeof(seed));
+    local->generation.store(generation, fbl::memory_order_relaxed);
+}
+
+PRNG* GetLocalInstance() {
+    if (!kLocalPrngsReady.load(fbl::memory_order_acquire)) {
+        return GetInstance();
+    }
+
+    LocalPRNG* local = &kLocalPrngs[arch_curr_cpu_num()];
+    // Two threads may both decide to reseed the same instance, which is
+    // harmless.
+    uint64_t generation = kGeneration.load(fbl::memory_order_relaxed);
+    if (local->draws.fetch_add(1, fbl::memory_order_relaxed) + 1 >= kLocalReseedDraws ||
+        local->generation.load(fbl::memory_order_relaxed) != generation) {
+        local->draws.store(0, fbl::memory_order_relaxed);
+        Reseed(local, generation);
+    }
+    return local->prng;
+}
+
+void AddEntropy(const void* data, size_t size) {
+    GetInstance()->AddEntropy(data, size);
+    kGeneration.fetch_add(1, fbl::memory_order_relaxed);
+}
+
 // Returns true if the kernel cmdline provided at least PRNG::kMinEntropy bytes
 // of entropy, and false otherwise.
 //
@@ -162,9 +211,25 @@ static void EarlyBootSeed(uint level) {
     }
 }
 
-// Migrate the global PRNG to enter thread-safe mode.
+// Migrate the global PRNG to enter thread-safe mode, and set up the
+// per-cpu instances.
 static void BecomeThreadSafe(uint level) {
     GetInstance()->BecomeThreadSafe();
+
+    const uint num_cpus = arch_max_num_cpus();
+    for (uint i = 0; i < num_cpus; ++i) {
+        uint8_t seed[PRNG::kMinEntropy];
+        GetInstance()->Draw(seed, sizeof(seed));
+        fbl::AllocChecker ac;
+        kLocalPrngs[i].prng = new (&ac) PRNG(seed, sizeof(seed));
+        mandatory_memset(seed, 0, sizeof(seed));
+        if (!ac.check()) {
+            // Leave every cpu on the global instance.
+            printf("WARNING: unable to allocate per-cpu PRNGs\n");
+            return;
+        }
+    }
+    kLocalPrngsReady.store(true, fbl::memory_order_release);
 }
 
 } //namespace GlobalPRNG
@@ -6,7 +6,12 @@
 
 #include <lib/crypto/global_prng.h>
 
+#include <inttypes.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <platform.h>
 #include <stdint.h>
+#include <string.h>
 #include <unittest.h>
 
 namespace crypto {
@@ -24,10 +29,84 @@ bool identical(void*) {
     END_TEST;
 }
 
+bool local_instances(void*) {
+    BEGIN_TEST;
+
+    PRNG* local = GlobalPRNG::GetLocalInstance();
+    EXPECT_NONNULL(local, "");
+    EXPECT_NE(local, GlobalPRNG::GetInstance(), "");
+    EXPECT_TRUE(local->is_thread_safe(), "");
+
+    // Run past a reseed, and make sure the output keeps changing.
+    uint8_t prev[32] = {};
+    for (uint64_t i = 0; i < 2 * GlobalPRNG::kLocalReseedDraws; ++i) {
+        uint8_t buf[sizeof(prev)];
+        GlobalPRNG::GetLocalInstance()->Draw(buf, sizeof(buf));
+        EXPECT_NE(0, memcmp(buf, prev, sizeof(buf)), "");
+        memcpy(prev, buf, sizeof(buf));
+    }
+
+    END_TEST;
+}
+
+constexpr size_t kBenchDrawLen = 32;
+constexpr size_t kBenchDraws = 20000;
+
+int bench_thread(void* arg) {
+    const bool local = *static_cast<bool*>(arg);
+    uint8_t buf[kBenchDrawLen];
+    for (size_t i = 0; i < kBenchDraws; ++i) {
+        PRNG* prng = local ? GlobalPRNG::GetLocalInstance() : GlobalPRNG::GetInstance();
+        prng->Draw(buf, sizeof(buf));
+    }
+    return 0;
+}
+
+// Draws from a thread on every cpu at once, first all from the global PRNG
+// and then each from its cpu's instance, and reports the combined rate.
+bool contention_bench(void*) {
+    BEGIN_TEST;
+
+    for (bool local : {false, true}) {
+        thread_t* threads[SMP_MAX_CPUS];
+        uint num_threads = 0;
+        cpu_mask_t active = mp_get_active_mask();
+        for (cpu_num_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+            if (!(active & cpu_num_to_mask(cpu))) {
+                continue;
+            }
+            threads[num_threads] = thread_create("prng bench", bench_thread, &local,
+                                                 DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            ASSERT_NONNULL(threads[num_threads], "");
+            thread_set_cpu_affinity(threads[num_threads], cpu_num_to_mask(cpu));
+            ++num_threads;
+        }
+
+        zx_time_t start = current_time();
+        for (uint i = 0; i < num_threads; ++i) {
+            thread_resume(threads[i]);
+        }
+        for (uint i = 0; i < num_threads; ++i) {
+            thread_join(threads[i], nullptr, ZX_TIME_INFINITE);
+        }
+        zx_time_t elapsed = current_time() - start;
+
+        uint64_t bytes = num_threads * kBenchDraws * kBenchDrawLen;
+        uint64_t usec = elapsed / ZX_USEC(1);
+        unittest_printf("%s PRNG, %u threads: %" PRIu64 " KB/s\n",
+                        local ? "per-cpu" : "global", num_threads,
+                        usec ? bytes * 1000000 / usec / 1024 : 0);
+    }
+
+    END_TEST;
+}
+
 } // namespace
 
 UNITTEST_START_TESTCASE(global_prng_tests)
 UNITTEST("Identical", identical)
+UNITTEST("Local instances", local_instances)
+UNITTEST("Contention benchmark", contention_bench)
 UNITTEST_END_TESTCASE(global_prng_tests, "global_prng",
                       "Validate global PRNG singleton",
                       nullptr, nullptr);
@@ -16,6 +16,22 @@ namespace GlobalPRNG {
 // guaranteed to be non-null.
 PRNG* GetInstance();
 
+// Returns the PRNG for the calling cpu.  These are seeded from the global
+// PRNG, and reseeded from it whenever entropy is added with AddEntropy() and
+// every kLocalReseedDraws calls.  A thread may migrate after getting one, in
+// which case it just shares the instance with that cpu's threads.  Before
+// the per-cpu instances are set up, this returns the global instance.  The
+// pointer is guaranteed to be non-null.
+PRNG* GetLocalInstance();
+
+// Mixes |size| bytes of entropy at |data| into the global PRNG, and has the
+// per-cpu instances reseed from it the next time they are used.
+void AddEntropy(const void* data, size_t size);
+
+// The number of calls to GetLocalInstance() after which a cpu's PRNG is
+// reseeded from the global one.
+constexpr uint64_t kLocalReseedDraws = 4096;
+
 } //namespace GlobalPRNG
 
 } // namespace crypto
@@ -8,68 +8,124 @@
 
 #include <err.h>
 #include <dev/udisplay.h>
+#include <kernel/atomic.h>
+#include <kernel/cmdline.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/io.h>
 #include <lib/version.h>
 #include <lk/init.h>
 #include <platform.h>
+#include <pow2.h>
+#include <stdlib.h>
 #include <string.h>
 #include <vm/vm.h>
 #include <zircon/types.h>
 
+#include "debuglog_priv.h"
+
 #define DLOG_SIZE (128u * 1024u)
 #define DLOG_MASK (DLOG_SIZE - 1u)
 
 static_assert((DLOG_SIZE & DLOG_MASK) == 0u, "must be power of two");
 static_assert(DLOG_MAX_RECORD <= DLOG_SIZE, "wat");
 static_assert((DLOG_MAX_RECORD & 3) == 0, "E_DONT_DO_THAT");
+static_assert(DLOG_MAX_RINGS <= UINT8_MAX, "cpu_ring holds ring indexes in a uint8_t");
+
+// The smallest per-cpu ring we'll set up; anything smaller would hold only a
+// handful of records.
+#define DLOG_MIN_RING_SIZE (4u * 1024u)
 
 static uint8_t DLOG_DATA[DLOG_SIZE];
 
 static dlog_t DLOG = {
-    .lock = SPIN_LOCK_INITIAL_VALUE,
-    .head = 0,
-    .tail = 0,
-    .data = DLOG_DATA,
+    .rings = {
+        [0] = {
+            .lock = SPIN_LOCK_INITIAL_VALUE,
+            .head = 0,
+            .tail = 0,
+            .size = DLOG_SIZE,
+            .data = DLOG_DATA,
+        },
+    },
+    .ring_count = 1,
     .event = EVENT_INITIAL_VALUE(DLOG.event, 0, EVENT_FLAG_AUTOUNSIGNAL),
 
     .readers_lock = MUTEX_INITIAL_VALUE(DLOG.readers_lock),
     .readers = LIST_INITIAL_VALUE(DLOG.readers),
 };
 
-// The debug log maintains a circular buffer of debug log records,
-// consisting of a common header (dlog_header_t) followed by up
+KCOUNTER(dlog_records_count, "kernel.dlog.records");
+KCOUNTER(dlog_discarded_count, "kernel.dlog.discarded");
+
+// The debug log is a set of circular buffers of debug log records,
+// each consisting of a common header (dlog_header_t) followed by up
 // to 224 bytes of textual log message.  Records are aligned on
 // uint32_t boundaries, so the header word which indicates the
 // true size of the record and the space it takes in the fifo
 // can always be read with a single uint32_t* read (the header
 // or body may wrap but the initial header word never does).
 //
-// The ring buffer position is maintained by continuously incrementing
+// Each ring's position is maintained by continuously incrementing
 // head and tail pointers (type size_t, so uint64_t on 64bit systems),
 //
 // This allows readers to trivial compute if their local tail
 // pointer has "fallen out" of the fifo (an entire fifo's worth
 // of messages were written since they last tried to read) and then
-// they can snap their tail to the global tail and restart
+// they can snap their tail to the ring's tail and restart
 //
 //
-// Tail indicates the oldest message in the debug log to read
-// from, Head indicates the next space in the debug log to write
+// Tail indicates the oldest message in the ring to read
+// from, Head indicates the next space in the ring to write
 // a new message to.  They are clipped to the actual buffer by
-// DLOG_MASK.
+// the ring's size.
 //
 //       T                     T
 //  [....XXXX....]  [XX........XX]
 //           H         H
+//
+// A record's timestamp is taken with the ring's lock held, so the records
+// in any one ring are in timestamp order.  Readers merge the rings by
+// always returning the oldest record they can see at the head of any ring.
 
 
 #define ALIGN4(n) (((n) + 3) & (~3))
 
-zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
-    dlog_t* log = &DLOG;
+static void ring_copy_in(dlog_ring_t* ring, size_t pos, const void* ptr, size_t len) {
+    size_t offset = pos & (ring->size - 1);
+    size_t fifospace = ring->size - offset;
+
+    if (fifospace >= len) {
+        memcpy(ring->data + offset, ptr, len);
+    } else {
+        memcpy(ring->data + offset, ptr, fifospace);
+        memcpy(ring->data, ptr + fifospace, len - fifospace);
+    }
+}
 
+static void ring_copy_out(const dlog_ring_t* ring, size_t pos, void* ptr, size_t len) {
+    size_t offset = pos & (ring->size - 1);
+    size_t fifospace = ring->size - offset;
+
+    if (fifospace >= len) {
+        memcpy(ptr, ring->data + offset, len);
+    } else {
+        memcpy(ptr, ring->data + offset, fifospace);
+        memcpy(ptr + fifospace, ring->data, len - fifospace);
+    }
+}
+
+static void ring_init(dlog_ring_t* ring, void* data, size_t size) {
+    spin_lock_init(&ring->lock);
+    ring->head = 0;
+    ring->tail = 0;
+    ring->discarded = 0;
+    ring->size = size;
+    ring->data = data;
+}
+
+zx_status_t dlog_write_etc(dlog_t* log, uint32_t flags, const void* ptr, size_t len) {
     if (len > DLOG_MAX_DATA) {
         return ZX_ERR_OUT_OF_RANGE;
     }
@@ -88,7 +144,6 @@ zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     hdr.header = DLOG_HDR_SET(wiresize, DLOG_MIN_RECORD + len);
     hdr.datalen = len;
     hdr.flags = flags;
-    hdr.timestamp = current_time();
     thread_t *t = get_current_thread();
     if (t) {
         hdr.pid = t->user_pid;
@@ -98,38 +153,31 @@ zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
         hdr.tid = 0;
     }
 
+    // Only this cpu's writers use its ring, so the lock is normally
+    // uncontended; a reader holds it just long enough to copy one record.
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint index = __atomic_load_n(&log->cpu_ring[arch_curr_cpu_num()], __ATOMIC_ACQUIRE);
+    dlog_ring_t* ring = &log->rings[index];
+    spin_lock(&ring->lock);
+
+    hdr.timestamp = current_time();
 
     // Discard records at tail until there is enough
     // space for the new record.
-    while ((log->head - log->tail) > (DLOG_SIZE - wiresize)) {
-        uint32_t header = *((uint32_t*) (log->data + (log->tail & DLOG_MASK)));
-        log->tail += DLOG_HDR_GET_FIFOLEN(header);
+    uint64_t discarded = 0;
+    while ((ring->head - ring->tail) > (ring->size - wiresize)) {
+        uint32_t header = *((uint32_t*) (ring->data + (ring->tail & (ring->size - 1))));
+        ring->tail += DLOG_HDR_GET_FIFOLEN(header);
+        discarded++;
     }
+    ring->discarded += discarded;
 
-    size_t offset = (log->head & DLOG_MASK);
+    ring_copy_in(ring, ring->head, &hdr, sizeof(hdr));
+    ring_copy_in(ring, ring->head + sizeof(hdr), ptr, len);
 
-    size_t fifospace = DLOG_SIZE - offset;
-
-    if (fifospace >= wiresize) {
-        // everything fits in one write, simple case!
-        memcpy(log->data + offset, &hdr, sizeof(hdr));
-        memcpy(log->data + offset + sizeof(hdr), ptr, len);
-    } else if (fifospace < sizeof(hdr)) {
-        // the wrap happens in the header
-        memcpy(log->data + offset, &hdr, fifospace);
-        memcpy(log->data, ((void*) &hdr) + fifospace, sizeof(hdr) - fifospace);
-        memcpy(log->data + (sizeof(hdr) - fifospace), ptr, len);
-    } else {
-        // the wrap happens in the data
-        memcpy(log->data + offset, &hdr, sizeof(hdr));
-        offset += sizeof(hdr);
-        fifospace -= sizeof(hdr);
-        memcpy(log->data + offset, ptr, fifospace);
-        memcpy(log->data, ptr + fifospace, len - fifospace);
-    }
-    log->head += wiresize;
+    // Readers glance at head without the lock to skip empty rings.
+    __atomic_store_n(&ring->head, ring->head + wiresize, __ATOMIC_RELEASE);
 
     // Need to check this before re-releasing the log lock, since we may
     // re-enable interrupts while doing that.  If interrupts are enabled when we
@@ -143,7 +191,17 @@ zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     // C2: Running this thread, evaluate arch_curr_cpu_num() -> C2
     bool holding_thread_lock = spin_lock_holder_cpu(&thread_lock) == arch_curr_cpu_num();
 
-    spin_unlock_irqrestore(&log->lock, state);
+    kcounter_add(dlog_records_count, 1);
+    kcounter_add(dlog_discarded_count, discarded);
+
+    spin_unlock(&ring->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Signaling the event takes the thread lock, so only do it when the
+    // notifier thread hasn't already been told there are new records.
+    if (atomic_swap(&log->notify_pending, 1) != 0) {
+        return ZX_OK;
+    }
 
     // if we happen to be called from within the global thread lock, use a
     // special version of event signal
@@ -156,7 +214,34 @@ zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     return ZX_OK;
 }
 
-// TODO: support reading multiple messages at a time
+zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
+    return dlog_write_etc(&DLOG, flags, ptr, len);
+}
+
+// Returns where |rdr|'s next record in ring |i| starts, first moving it up to
+// the ring's tail if writers have lapped the reader.  The ring's lock must be
+// held.
+static size_t dlog_reader_sync(dlog_reader_t* rdr, dlog_ring_t* ring, int i) {
+    if ((ring->head - ring->tail) < (ring->head - rdr->tail[i])) {
+        rdr->dropped += ring->discarded - rdr->seq[i];
+        rdr->tail[i] = ring->tail;
+        rdr->seq[i] = ring->discarded;
+    }
+    return rdr->tail[i];
+}
+
+// Notes the timestamp of |rdr|'s next record in ring |i|, if there is one.
+// The ring's lock must be held.
+static void dlog_reader_peek(dlog_reader_t* rdr, dlog_ring_t* ring, int i) {
+    size_t rtail = rdr->tail[i];
+    if (rtail != ring->head) {
+        dlog_header_t hdr;
+        ring_copy_out(ring, rtail, &hdr, sizeof(hdr));
+        rdr->peek_tail[i] = rtail;
+        rdr->peek_time[i] = hdr.timestamp;
+    }
+}
+
 // TODO: filter with flags
 zx_status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, size_t* _actual) {
     // must be room for worst-case read
@@ -165,52 +250,72 @@ zx_status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len,
     }
 
     dlog_t* log = rdr->log;
-    zx_status_t status = ZX_ERR_SHOULD_WAIT;
-
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
+    int count = atomic_load(&log->ring_count);
 
-    size_t rtail = rdr->tail;
+    for (;;) {
+        // Find the ring whose next record is the oldest.  Only rings whose
+        // next record hasn't been looked at yet need their lock taken.  A
+        // timestamp which has gone stale because writers lapped the reader
+        // is older than anything that replaced it, so at worst it gets its
+        // ring picked early, which is caught below.
+        int oldest = -1;
+        zx_time_t oldest_time = 0;
+        for (int i = 0; i < count; i++) {
+            dlog_ring_t* ring = &log->rings[i];
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == rdr->tail[i]) {
+                continue;
+            }
 
-    // If the read-tail is not within the range of log-tail..log-head
-    // this reader has been lapped by a writer and we reset our read-tail
-    // to the current log-tail.
-    //
-    if ((log->head - log->tail) < (log->head - rtail)) {
-        rtail = log->tail;
-    }
+            if (rdr->peek_tail[i] != rdr->tail[i]) {
+                spin_lock_saved_state_t state;
+                spin_lock_irqsave(&ring->lock, state);
+                dlog_reader_sync(rdr, ring, i);
+                dlog_reader_peek(rdr, ring, i);
+                spin_unlock_irqrestore(&ring->lock, state);
+                if (rdr->peek_tail[i] != rdr->tail[i]) {
+                    continue;
+                }
+            }
+            if (oldest < 0 || rdr->peek_time[i] < oldest_time) {
+                oldest = i;
+                oldest_time = rdr->peek_time[i];
+            }
+        }
 
-    if (rtail != log->head) {
-        size_t offset = (rtail & DLOG_MASK);
-        uint32_t header = *((uint32_t*) (log->data + offset));
+        if (oldest < 0) {
+            return ZX_ERR_SHOULD_WAIT;
+        }
 
-        size_t actual = DLOG_HDR_GET_READLEN(header);
-        size_t fifospace = DLOG_SIZE - offset;
+        dlog_ring_t* ring = &log->rings[oldest];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&ring->lock, state);
 
-        if (fifospace >= actual) {
-            memcpy(ptr, log->data + offset, actual);
-        } else {
-            memcpy(ptr, log->data + offset, fifospace);
-            memcpy(ptr + fifospace, log->data, actual - fifospace);
+        // If the record was overwritten since we looked at it, start over.
+        size_t rtail = dlog_reader_sync(rdr, ring, oldest);
+        if (rtail != rdr->peek_tail[oldest]) {
+            spin_unlock_irqrestore(&ring->lock, state);
+            continue;
         }
 
-        *_actual = actual;
-        status = ZX_OK;
-
-        rtail += DLOG_HDR_GET_FIFOLEN(header);
-    }
+        uint32_t header = *((uint32_t*) (ring->data + (rtail & (ring->size - 1))));
+        size_t actual = DLOG_HDR_GET_READLEN(header);
+        ring_copy_out(ring, rtail, ptr, actual);
+        rdr->tail[oldest] = rtail + DLOG_HDR_GET_FIFOLEN(header);
+        rdr->seq[oldest]++;
 
-    rdr->tail = rtail;
+        // Look at the ring's next record while we hold the lock anyway.
+        dlog_reader_peek(rdr, ring, oldest);
 
-    spin_unlock_irqrestore(&log->lock, state);
+        spin_unlock_irqrestore(&ring->lock, state);
 
-    return status;
+        *_actual = actual;
+        return ZX_OK;
+    }
 }
 
-void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
-    dlog_t* log = &DLOG;
-
+void dlog_reader_init_etc(dlog_t* log, dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
     rdr->log = log;
+    rdr->dropped = 0;
     rdr->notify = notify;
     rdr->cookie = cookie;
 
@@ -219,11 +324,23 @@ void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
 
     bool do_notify = false;
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
-    rdr->tail = log->tail;
-    do_notify = (log->tail != log->head);
-    spin_unlock_irqrestore(&log->lock, state);
+    // Rings that aren't set up yet start out empty.
+    int count = atomic_load(&log->ring_count);
+    for (int i = 0; i < DLOG_MAX_RINGS; i++) {
+        rdr->tail[i] = 0;
+        rdr->seq[i] = 0;
+        // positions only grow, so this never matches a tail
+        rdr->peek_tail[i] = SIZE_MAX;
+    }
+    for (int i = 0; i < count; i++) {
+        dlog_ring_t* ring = &log->rings[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&ring->lock, state);
+        rdr->tail[i] = ring->tail;
+        rdr->seq[i] = ring->discarded;
+        do_notify |= (ring->tail != ring->head);
+        spin_unlock_irqrestore(&ring->lock, state);
+    }
 
     // simulate notify callback for events that arrived
     // before we were initialized
@@ -234,6 +351,10 @@ void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
     mutex_release(&log->readers_lock);
 }
 
+void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
+    dlog_reader_init_etc(&DLOG, rdr, notify, cookie);
+}
+
 void dlog_reader_destroy(dlog_reader_t* rdr) {
     dlog_t* log = rdr->log;
 
@@ -242,6 +363,53 @@ void dlog_reader_destroy(dlog_reader_t* rdr) {
     mutex_release(&log->readers_lock);
 }
 
+// Gives each of the first |num_cpus| cpus a ring of its own.  Cpus we can't
+// allocate a ring for keep writing to the boot ring.
+static void dlog_init_rings(dlog_t* log, uint num_cpus, size_t ring_size) {
+    DEBUG_ASSERT(num_cpus < DLOG_MAX_RINGS);
+    DEBUG_ASSERT(ispow2(ring_size) && ring_size >= DLOG_MAX_RECORD);
+
+    int count = atomic_load(&log->ring_count);
+    for (uint cpu = 0; cpu < num_cpus; cpu++) {
+        void* data = malloc(ring_size);
+        if (data == NULL) {
+            break;
+        }
+        ring_init(&log->rings[count], data, ring_size);
+        atomic_store(&log->ring_count, count + 1);
+        __atomic_store_n(&log->cpu_ring[cpu], (uint8_t)count, __ATOMIC_RELEASE);
+        count++;
+    }
+}
+
+zx_status_t dlog_init_etc(dlog_t* log, void* boot_data, size_t boot_size,
+                          uint num_cpus, size_t ring_size) {
+    memset(log, 0, sizeof(*log));
+    ring_init(&log->rings[0], boot_data, boot_size);
+    log->ring_count = 1;
+    event_init(&log->event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    mutex_init(&log->readers_lock);
+    list_initialize(&log->readers);
+
+    dlog_init_rings(log, num_cpus, ring_size);
+    if (atomic_load(&log->ring_count) != (int)num_cpus + 1) {
+        dlog_destroy_etc(log);
+        return ZX_ERR_NO_MEMORY;
+    }
+    return ZX_OK;
+}
+
+void dlog_destroy_etc(dlog_t* log) {
+    DEBUG_ASSERT(list_is_empty(&log->readers));
+
+    int count = atomic_load(&log->ring_count);
+    for (int i = 1; i < count; i++) {
+        free(log->rings[i].data);
+    }
+    event_destroy(&log->event);
+    mutex_destroy(&log->readers_lock);
+}
+
 
 // The debuglog notifier thread observes when the debuglog is
 // written and calls the notify callback on any readers that
@@ -251,6 +419,7 @@ static int debuglog_notifier(void* arg) {
 
     for (;;) {
         event_wait(&log->event);
+        atomic_swap(&log->notify_pending, 0);
 
         // notify readers that new log items were posted
         mutex_acquire(&log->readers_lock);
@@ -339,6 +508,13 @@ void dlog_bluescreen_init(void) {
 static void dlog_init_hook(uint level) {
     thread_t* rthread;
 
+    // kernel.dlog.percpu-kb=0 leaves every cpu writing to the boot ring.
+    uint32_t ring_size = cmdline_get_uint32("kernel.dlog.percpu-kb", 64) * 1024u;
+    if (ring_size != 0) {
+        ring_size = round_up_pow2_u32(MAX(ring_size, DLOG_MIN_RING_SIZE));
+        dlog_init_rings(&DLOG, arch_max_num_cpus(), ring_size);
+    }
+
     if ((rthread = thread_create("debuglog-notifier", debuglog_notifier, NULL,
                                  HIGH_PRIORITY - 1, DEFAULT_STACK_SIZE)) != NULL) {
         thread_resume(rthread);
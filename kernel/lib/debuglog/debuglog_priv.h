@@ -0,0 +1,28 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <lib/debuglog.h>
+
+__BEGIN_CDECLS
+
+// These operate on a log other than the global one, so the tests can exercise
+// the rings without flooding the console.
+
+// Sets up |log| with |boot_data| as its boot ring and a ring of |ring_size|
+// bytes for each of the first |num_cpus| cpus.  Sizes must be powers of two.
+zx_status_t dlog_init_etc(dlog_t* log, void* boot_data, size_t boot_size,
+                          uint num_cpus, size_t ring_size);
+
+// Frees the per-cpu rings allocated by dlog_init_etc().  |log| must have no
+// readers left.
+void dlog_destroy_etc(dlog_t* log);
+
+zx_status_t dlog_write_etc(dlog_t* log, uint32_t flags, const void* ptr, size_t len);
+void dlog_reader_init_etc(dlog_t* log, dlog_reader_t* rdr, void (*notify)(void*), void* cookie);
+
+__END_CDECLS
@@ -0,0 +1,250 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/debuglog.h>
+
+#include <inttypes.h>
+#include <kernel/atomic.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lib/heap.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unittest.h>
+
+#include "debuglog_priv.h"
+
+#define TEST_BOOT_SIZE (4u * 1024u)
+#define TEST_RING_SIZE (4u * 1024u)
+
+// What the tests put at the start of every record they write.
+typedef struct {
+    uint32_t writer;
+    uint32_t seq;
+} test_payload_t;
+
+static dlog_t* create_test_log(uint num_cpus, size_t ring_size) {
+    dlog_t* log = memalign(MAX_CACHE_LINE, sizeof(*log));
+    void* boot_data = malloc(TEST_BOOT_SIZE);
+    if (log == NULL || boot_data == NULL ||
+        dlog_init_etc(log, boot_data, TEST_BOOT_SIZE, num_cpus, ring_size) != ZX_OK) {
+        free(log);
+        free(boot_data);
+        return NULL;
+    }
+    return log;
+}
+
+static void destroy_test_log(dlog_t* log) {
+    void* boot_data = log->rings[0].data;
+    dlog_destroy_etc(log);
+    free(boot_data);
+    free(log);
+}
+
+static zx_status_t write_payload(dlog_t* log, uint32_t writer, uint32_t seq, size_t len) {
+    char buf[DLOG_MAX_DATA];
+    test_payload_t payload = {writer, seq};
+    memcpy(buf, &payload, sizeof(payload));
+    memset(buf + sizeof(payload), 'a' + (char)(seq % 26), len - sizeof(payload));
+    return dlog_write_etc(log, 0, buf, len);
+}
+
+static bool read_payload(dlog_reader_t* rdr, test_payload_t* payload, size_t* datalen) {
+    dlog_record_t rec;
+    size_t actual;
+    if (dlog_read(rdr, 0, &rec, sizeof(rec), &actual) != ZX_OK) {
+        return false;
+    }
+    memcpy(payload, rec.data, sizeof(*payload));
+    *datalen = rec.hdr.datalen;
+    return true;
+}
+
+// Writes from each cpu in turn, and checks that the reader gets the records
+// back in the order they were written.
+static bool merge_test(void* context) {
+    BEGIN_TEST;
+
+    dlog_t* log = create_test_log(arch_max_num_cpus(), TEST_RING_SIZE);
+    ASSERT_NONNULL(log, "");
+
+    dlog_reader_t rdr;
+    dlog_reader_init_etc(log, &rdr, NULL, NULL);
+
+    const uint32_t records = 64;
+    cpu_mask_t active = mp_get_active_mask();
+    cpu_num_t cpu = lowest_cpu_set(active);
+    for (uint32_t i = 0; i < records; i++) {
+        thread_migrate_to_cpu(cpu);
+        EXPECT_EQ(ZX_OK, write_payload(log, cpu, i, sizeof(test_payload_t) + i), "");
+        do {
+            cpu = (cpu + 1) % SMP_MAX_CPUS;
+        } while (!(active & cpu_num_to_mask(cpu)));
+    }
+    thread_set_cpu_affinity(get_current_thread(), CPU_MASK_ALL);
+
+    test_payload_t payload;
+    size_t datalen;
+    for (uint32_t i = 0; i < records; i++) {
+        ASSERT_TRUE(read_payload(&rdr, &payload, &datalen), "");
+        EXPECT_EQ(i, payload.seq, "records out of order");
+        EXPECT_EQ(sizeof(test_payload_t) + i, datalen, "");
+    }
+    EXPECT_FALSE(read_payload(&rdr, &payload, &datalen), "");
+    EXPECT_EQ(0u, rdr.dropped, "");
+
+    dlog_reader_destroy(&rdr);
+    destroy_test_log(log);
+
+    END_TEST;
+}
+
+// Overfills a ring and checks that the reader is told how many records it
+// lost and gets the rest in order.
+static bool overflow_test(void* context) {
+    BEGIN_TEST;
+
+    // With no per-cpu rings everything goes to the boot ring.
+    dlog_t* log = create_test_log(0, TEST_RING_SIZE);
+    ASSERT_NONNULL(log, "");
+
+    dlog_reader_t rdr;
+    dlog_reader_init_etc(log, &rdr, NULL, NULL);
+
+    const uint32_t records = 4 * TEST_BOOT_SIZE / DLOG_MIN_RECORD;
+    for (uint32_t i = 0; i < records; i++) {
+        EXPECT_EQ(ZX_OK, write_payload(log, 0, i, sizeof(test_payload_t)), "");
+    }
+
+    test_payload_t payload;
+    size_t datalen;
+    uint32_t read = 0;
+    uint32_t next = 0;
+    while (read_payload(&rdr, &payload, &datalen)) {
+        if (read == 0) {
+            next = payload.seq;
+        }
+        EXPECT_EQ(next, payload.seq, "records out of order");
+        next++;
+        read++;
+    }
+    EXPECT_EQ(records, next, "newest record missing");
+    EXPECT_LT(read, records, "ring didn't overflow");
+    EXPECT_EQ((uint64_t)(records - read), rdr.dropped, "");
+
+    dlog_reader_destroy(&rdr);
+    destroy_test_log(log);
+
+    END_TEST;
+}
+
+#define STRESS_RECORDS 20000u
+
+typedef struct {
+    dlog_t* log;
+    uint32_t writer;
+    int* writers_left;
+} stress_writer_t;
+
+static int stress_writer(void* arg) {
+    stress_writer_t* w = arg;
+    for (uint32_t i = 0; i < STRESS_RECORDS; i++) {
+        size_t len = sizeof(test_payload_t) + i % (DLOG_MAX_DATA - sizeof(test_payload_t) + 1);
+        write_payload(w->log, w->writer, i, len);
+    }
+    atomic_add(w->writers_left, -1);
+    return 0;
+}
+
+// Has a writer on every cpu log as fast as it can while a reader drains the
+// log, and reports the rate and how many records the reader lost.
+static bool stress_test(void* context) {
+    BEGIN_TEST;
+
+    dlog_t* log = create_test_log(arch_max_num_cpus(), 64u * 1024u);
+    ASSERT_NONNULL(log, "");
+
+    dlog_reader_t rdr;
+    dlog_reader_init_etc(log, &rdr, NULL, NULL);
+
+    stress_writer_t writers[SMP_MAX_CPUS];
+    thread_t* threads[SMP_MAX_CPUS];
+    uint32_t next_seq[SMP_MAX_CPUS];
+    int writers_left = 0;
+    uint32_t num_writers = 0;
+    cpu_mask_t active = mp_get_active_mask();
+    for (cpu_num_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(active & cpu_num_to_mask(cpu))) {
+            continue;
+        }
+        stress_writer_t* w = &writers[num_writers];
+        w->log = log;
+        w->writer = num_writers;
+        w->writers_left = &writers_left;
+        threads[num_writers] = thread_create("dlog stress", stress_writer, w,
+                                             DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        ASSERT_NONNULL(threads[num_writers], "");
+        thread_set_cpu_affinity(threads[num_writers], cpu_num_to_mask(cpu));
+        next_seq[num_writers] = 0;
+        num_writers++;
+    }
+
+    zx_time_t start = current_time();
+    atomic_store(&writers_left, (int)num_writers);
+    for (uint32_t i = 0; i < num_writers; i++) {
+        thread_resume(threads[i]);
+    }
+
+    uint64_t read = 0;
+    for (;;) {
+        // Check before reading, so the last records aren't missed.
+        bool done = atomic_load(&writers_left) == 0;
+        test_payload_t payload;
+        size_t datalen;
+        if (!read_payload(&rdr, &payload, &datalen)) {
+            if (done) {
+                break;
+            }
+            thread_yield();
+            continue;
+        }
+        EXPECT_LT(payload.writer, num_writers, "corrupt record");
+        if (payload.writer >= num_writers) {
+            continue;
+        }
+        EXPECT_GE(payload.seq, next_seq[payload.writer], "records out of order");
+        next_seq[payload.writer] = payload.seq + 1;
+        read++;
+    }
+    zx_time_t elapsed = current_time() - start;
+
+    for (uint32_t i = 0; i < num_writers; i++) {
+        thread_join(threads[i], NULL, ZX_TIME_INFINITE);
+    }
+
+    uint64_t written = (uint64_t)num_writers * STRESS_RECORDS;
+    EXPECT_EQ(written, read + rdr.dropped, "records unaccounted for");
+
+    uint64_t usec = elapsed / ZX_USEC(1);
+    unittest_printf("%u writers: %" PRIu64 " records in %" PRIu64 " us (%" PRIu64
+                    " records/s), %" PRIu64 " read, %" PRIu64 " dropped\n",
+                    num_writers, written, usec, usec ? written * 1000000 / usec : 0,
+                    read, rdr.dropped);
+
+    dlog_reader_destroy(&rdr);
+    destroy_test_log(log);
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(debuglog_tests)
+UNITTEST("merge", merge_test)
+UNITTEST("overflow", overflow_test)
+UNITTEST("stress", stress_test)
+UNITTEST_END_TESTCASE(debuglog_tests, "debuglog", "debuglog tests", NULL, NULL);
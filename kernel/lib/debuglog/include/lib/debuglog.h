@@ -8,6 +8,7 @@
 
 #include <zircon/compiler.h>
 #include <zircon/types.h>
+#include <arch/ops.h>
 #include <kernel/event.h>
 #include <kernel/mutex.h>
 #include <list.h>
@@ -19,18 +20,43 @@ typedef struct dlog dlog_t;
 typedef struct dlog_header dlog_header_t;
 typedef struct dlog_record dlog_record_t;
 typedef struct dlog_reader dlog_reader_t;
+typedef struct dlog_ring dlog_ring_t;
 
-struct dlog {
+// Ring 0 is the boot ring: it takes every record written before the
+// per-cpu rings are set up, and any from cpus that didn't get a ring of
+// their own.  After that each cpu writes to its own ring, so writers on
+// different cpus never contend for a lock.  Readers merge the rings by
+// timestamp.
+#define DLOG_MAX_RINGS (SMP_MAX_CPUS + 1)
+
+struct dlog_ring {
     spin_lock_t lock;
 
+    // Byte positions of the next record to write and the oldest record
+    // still in the ring.
     size_t head;
     size_t tail;
 
+    // The number of records pushed out of the ring to make room for new
+    // ones, which is also the sequence number of the record at |tail|.
+    uint64_t discarded;
+
+    // Power of two.
+    size_t size;
     void* data;
+} __CPU_ALIGN;
+
+struct dlog {
+    dlog_ring_t rings[DLOG_MAX_RINGS];
+    int ring_count;
+
+    // The ring each cpu writes to.
+    uint8_t cpu_ring[SMP_MAX_CPUS];
 
     bool panic;
 
     event_t event;
+    int notify_pending;
 
     mutex_t readers_lock;
     struct list_node readers;
@@ -40,7 +66,19 @@ struct dlog_reader {
     struct list_node node;
 
     dlog_t* log;
-    size_t tail;
+
+    // Position and sequence number of the next record to read in each ring.
+    size_t tail[DLOG_MAX_RINGS];
+    uint64_t seq[DLOG_MAX_RINGS];
+
+    // Timestamp of the record at |peek_tail| in each ring, so picking the
+    // oldest record doesn't take every ring's lock.  Only good while
+    // |peek_tail| matches |tail|.
+    size_t peek_tail[DLOG_MAX_RINGS];
+    zx_time_t peek_time[DLOG_MAX_RINGS];
+
+    // Records this reader lost because writers lapped it.
+    uint64_t dropped;
 
     void (*notify)(void* cookie);
     void *cookie;
@@ -76,6 +114,10 @@ static_assert(sizeof(dlog_record_t) == DLOG_MAX_RECORD, "");
 void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie);
 void dlog_reader_destroy(dlog_reader_t* rdr);
 zx_status_t dlog_write(uint32_t flags, const void* ptr, size_t len);
+
+// Reads the oldest record not yet seen by |rdr| from any of the rings.
+// |len| must be at least DLOG_MAX_RECORD.  Returns ZX_ERR_SHOULD_WAIT if
+// there is nothing to read.
 zx_status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, size_t* actual);
 
 // bluescreen_init should be called at the "start" of a fatal fault or
@@ -10,14 +10,14 @@
 #include <kernel/wait.h>
 #include <list.h>
 #include <zircon/types.h>
-#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_resizing_hash_table.h>
 #include <fbl/mutex.h>
 
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a ThreadDispatcher Instance
 class FutexNode : public fbl::SinglyLinkedListable<FutexNode*> {
 public:
-    using HashTable = fbl::HashTable<uintptr_t, FutexNode*>;
+    using HashTable = fbl::ResizingHashTable<uintptr_t, FutexNode*>;
 
     FutexNode();
     ~FutexNode();
@@ -48,7 +48,7 @@ public:
         hash_key_ = key;
     }
 
-    // Trait implementation for fbl::HashTable
+    // Trait implementation for fbl::ResizingHashTable
     uintptr_t GetKey() const { return hash_key_; }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
 
@@ -101,7 +101,7 @@ ProcessDispatcher::ProcessDispatcher(fbl::RefPtr<JobDispatcher> job,
 
     // Generate handle XOR mask with top bit and bottom two bits cleared
     uint32_t secret;
-    auto prng = crypto::GlobalPRNG::GetInstance();
+    auto prng = crypto::GlobalPRNG::GetLocalInstance();
     prng->Draw(&secret, sizeof(secret));
 
     // Handle values cannot be negative values, so we mask the high bit.
@@ -35,9 +35,13 @@ zx_status_t VmObjectDispatcher::Create(fbl::RefPtr<VmObject> vmo,
 }
 
 VmObjectDispatcher::VmObjectDispatcher(fbl::RefPtr<VmObject> vmo)
-    : vmo_(vmo) {}
+    : vmo_(vmo) {
+    vmo_->AddDispatcher();
+}
 
 VmObjectDispatcher::~VmObjectDispatcher() {
+    vmo_->RemoveDispatcher();
+
     // Intentionally leave vmo_->user_id() set to our koid even though we're
     // dying and the koid will no longer map to a Dispatcher. koids are never
     // recycled, and it could be a useful breadcrumb.
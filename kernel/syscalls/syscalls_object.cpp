@@ -10,7 +10,9 @@
 
 #include <kernel/mp.h>
 #include <kernel/stats.h>
+#include <vm/page_compressor.h>
 #include <vm/pmm.h>
+#include <vm/zero_page_scanner.h>
 #include <lib/heap.h>
 #include <platform.h>
 #include <zircon/types.h>
@@ -510,6 +512,12 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             // All other VM_PAGE_STATE_* counts get lumped into other_bytes.
             stats.other_bytes = other_bytes;
 
+            stats.zero_reclaimed_bytes = zero_page_scanner_reclaimed_bytes();
+
+            uint64_t compressed_pages;
+            page_compressor_get_stats(&compressed_pages, &stats.compressed_bytes);
+            stats.compressed_original_bytes = compressed_pages * PAGE_SIZE;
+
             return single_record_result(
                 _buffer, buffer_size, _actual, _avail, &stats, sizeof(stats));
         }
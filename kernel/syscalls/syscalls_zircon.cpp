@@ -26,6 +26,7 @@
 #include <object/resources.h>
 #include <object/thread_dispatcher.h>
 
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/atomic.h>
 #include <fbl/ref_ptr.h>
@@ -229,7 +230,7 @@ zx_status_t sys_debuglog_read(zx_handle_t log_handle, uint32_t options,
                               user_out_ptr<void> ptr, size_t len) {
     LTRACEF("log handle %x, opt %x, ptr 0x%p, len %zu\n", log_handle, options, ptr.get(), len);
 
-    if (options != 0)
+    if (options & ~ZX_LOG_READ_BATCH)
         return ZX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -241,13 +242,37 @@ zx_status_t sys_debuglog_read(zx_handle_t log_handle, uint32_t options,
 
     char buf[DLOG_MAX_RECORD];
     size_t actual;
-    if ((status = log->Read(options, buf, DLOG_MAX_RECORD, &actual)) < 0)
-        return status;
+    if (!(options & ZX_LOG_READ_BATCH)) {
+        if ((status = log->Read(0, buf, DLOG_MAX_RECORD, &actual)) < 0)
+            return status;
 
-    if (ptr.copy_array_to_user(buf, actual) != ZX_OK)
-        return ZX_ERR_INVALID_ARGS;
+        if (ptr.copy_array_to_user(buf, actual) != ZX_OK)
+            return ZX_ERR_INVALID_ARGS;
+
+        return static_cast<zx_status_t>(actual);
+    }
+
+    // Records are copied out one at a time, and we stop once there might not
+    // be room for another, since a record can't be put back once it's read.
+    if (len < DLOG_MAX_RECORD)
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    len = fbl::min(len, static_cast<size_t>(INT32_MAX));
+
+    size_t total = 0;
+    while (len - total >= DLOG_MAX_RECORD) {
+        if ((status = log->Read(0, buf, DLOG_MAX_RECORD, &actual)) < 0)
+            break;
 
-    return static_cast<zx_status_t>(actual);
+        if (ptr.byte_offset(total).copy_array_to_user(buf, actual) != ZX_OK)
+            return ZX_ERR_INVALID_ARGS;
+
+        total += fbl::round_up(actual, 8u);
+    }
+
+    if (total == 0)
+        return status;
+
+    return static_cast<zx_status_t>(total);
 }
 
 zx_status_t sys_log_write(zx_handle_t log_handle, uint32_t len, user_in_ptr<const void> ptr, uint32_t options) {
@@ -267,7 +292,7 @@ zx_status_t sys_cprng_draw(user_out_ptr<void> buffer, size_t len, user_out_ptr<s
     // returns.
     explicit_memory::ZeroDtor<uint8_t> zero_guard(kernel_buf, sizeof(kernel_buf));
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
+    auto prng = crypto::GlobalPRNG::GetLocalInstance();
     ASSERT(prng->is_thread_safe());
     prng->Draw(kernel_buf, static_cast<int>(len));
 
@@ -292,9 +317,8 @@ zx_status_t sys_cprng_add_entropy(user_in_ptr<const void> buffer, size_t len) {
     if (buffer.copy_array_from_user(kernel_buf, len) != ZX_OK)
         return ZX_ERR_INVALID_ARGS;
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    ASSERT(prng->is_thread_safe());
-    prng->AddEntropy(kernel_buf, static_cast<int>(len));
+    ASSERT(crypto::GlobalPRNG::GetInstance()->is_thread_safe());
+    crypto::GlobalPRNG::AddEntropy(kernel_buf, static_cast<int>(len));
 
     return ZX_OK;
 }
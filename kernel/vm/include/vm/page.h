@@ -39,6 +39,15 @@ typedef struct vm_page {
             // If true, one pin slot is used by the VmObject to keep a run
             // contiguous.
             bool contiguous_pin : 1;
+            // Set by the page compressor when it unmaps the page, and cleared
+            // when the page is next used.
+            bool cold : 1;
+            // Number of compressor passes to leave the page mapped for, after
+            // it was found to be in use while cold.
+            uint8_t warm_passes;
+            // When the page was made cold, in the coarse units the VmObject
+            // keeps it in.
+            uint32_t cold_time;
         } object;
 
         uint8_t pad[24]; // pad out to 32 bytes
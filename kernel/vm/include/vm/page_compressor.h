@@ -0,0 +1,49 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/array.h>
+#include <fbl/intrusive_wavl_tree.h>
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+#include <stdint.h>
+#include <zircon/types.h>
+
+// The page compressor is a kernel thread that, while free memory is below a
+// threshold, compresses pages of user VMOs that haven't been touched since it
+// last looked at them and frees the originals. The VMO decompresses them again
+// the next time they're used.
+
+// A page of VMO data compressed with lz4 and held on the kernel heap, keyed by
+// its offset in the VMO.
+class CompressedPage final
+    : public fbl::WAVLTreeContainable<fbl::unique_ptr<CompressedPage>> {
+public:
+    // Compresses the page at |page|. Returns ZX_ERR_OUT_OF_RANGE if it doesn't
+    // compress well enough to be worth keeping this way, and
+    // ZX_ERR_NO_RESOURCES if compressed pages already take up as much of the
+    // heap as they're allowed.
+    static zx_status_t Create(uint64_t offset, const void* page,
+                              fbl::unique_ptr<CompressedPage>* out);
+    ~CompressedPage();
+
+    // Decompresses into the page at |page|.
+    zx_status_t Decompress(void* page) const;
+
+    uint64_t GetKey() const { return offset_; }
+
+private:
+    CompressedPage(uint64_t offset, fbl::Array<uint8_t> data);
+    DISALLOW_COPY_ASSIGN_AND_MOVE(CompressedPage);
+
+    const uint64_t offset_;
+    const fbl::Array<uint8_t> data_;
+};
+
+// Returns the number of pages currently held compressed, and the number of
+// bytes of heap holding them.
+void page_compressor_get_stats(uint64_t* pages, uint64_t* compressed_bytes);
@@ -71,6 +71,31 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // Looks at up to |max_pages| of the committed pages at or after |*offset|
+    // and frees the ones that are entirely zero, so that they fault back in as
+    // the shared zero page. Returns the number of pages looked at, stores the
+    // number freed in |*freed| and advances |*offset| past the last page looked
+    // at, to size() once there are none left.
+    virtual size_t ReclaimZeroPages(uint64_t* offset, size_t max_pages, size_t* freed) {
+        *offset = size();
+        *freed = 0;
+        return 0;
+    }
+
+    // Looks at up to |max_pages| of the committed pages at or after |*offset|.
+    // Pages that haven't been used for at least |min_cold_time|, and since the
+    // last call that looked at them, are compressed and freed, and the rest
+    // are unmapped so that their next use can be noticed. Pages that were used
+    // recently after being unmapped are left alone for a few calls. Returns the
+    // number of pages looked at, stores the number compressed in |*compressed|
+    // and advances |*offset| as ReclaimZeroPages() does.
+    virtual size_t CompressColdPages(uint64_t* offset, size_t max_pages,
+                                     zx_duration_t min_cold_time, size_t* compressed) {
+        *offset = size();
+        *compressed = 0;
+        return 0;
+    }
+
     // Pin the given range of the vmo.  If any pages are not committed, this
     // returns a ZX_ERR_NO_MEMORY.
     virtual zx_status_t Pin(uint64_t offset, uint64_t len) {
@@ -194,6 +219,42 @@ public:
     void RemoveChildLocked(VmObject* r) TA_REQ(lock_);
     uint32_t num_children() const;
 
+    // Called as VmObjectDispatchers are created and destroyed, so the VMO can
+    // tell whether userspace can reach it other than through its children.
+    void AddDispatcher();
+    void RemoveDispatcher();
+
+    // A place in the global VMO list, for walking it a little at a time
+    // without keeping the VMO it's at alive in between. If that VMO is
+    // destroyed, the cursor is left where it was in the list.
+    class GlobalListCursor final : public fbl::DoublyLinkedListable<GlobalListCursor*> {
+    public:
+        GlobalListCursor();
+        ~GlobalListCursor();
+
+        // Returns a reference to the VMO the cursor is at, or null if it's not
+        // at one or that VMO is being destroyed.
+        fbl::RefPtr<VmObject> Get();
+
+        // Moves to the VMO created after the current place, or to the oldest
+        // VMO if the cursor is at the start, skipping any that are being
+        // destroyed, and returns a reference to it. Returns null, and goes
+        // back to the start, once there are no more.
+        fbl::RefPtr<VmObject> Next();
+
+        // Goes back to the start of the list.
+        void Reset();
+
+    private:
+        DISALLOW_COPY_ASSIGN_AND_MOVE(GlobalListCursor);
+        friend VmObject;
+
+        // The VMO the cursor is at, or just after if |at_vmo_| is false. Null
+        // at the start of the list.
+        VmObject* vmo_ TA_GUARDED(all_vmos_lock_) = nullptr;
+        bool at_vmo_ TA_GUARDED(all_vmos_lock_) = false;
+    };
+
     // Calls the provided |func(const VmObject&)| on every VMO in the system,
     // from oldest to newest. Stops if |func| returns an error, returning the
     // error value.
@@ -255,6 +316,9 @@ protected:
     uint32_t mapping_list_len_ TA_GUARDED(lock_) = 0;
     uint32_t children_list_len_ TA_GUARDED(lock_) = 0;
 
+    // number of VmObjectDispatchers for this object
+    uint32_t dispatcher_count_ TA_GUARDED(lock_) = 0;
+
     uint64_t user_id_ TA_GUARDED(lock_) = 0;
 
     // The user-friendly VMO name. For debug purposes only. That
@@ -275,4 +339,8 @@ private:
     using GlobalList = fbl::DoublyLinkedList<VmObject*, GlobalListTraits>;
     static fbl::Mutex all_vmos_lock_;
     static GlobalList all_vmos_ TA_GUARDED(all_vmos_lock_);
+
+    // Every GlobalListCursor, so that they can be moved off a VMO which is
+    // being destroyed.
+    static fbl::DoublyLinkedList<GlobalListCursor*> all_cursors_ TA_GUARDED(all_vmos_lock_);
 };
@@ -17,6 +17,7 @@
 #include <lib/user_copy/user_ptr.h>
 #include <list.h>
 #include <stdint.h>
+#include <vm/page_compressor.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
 #include <vm/vm_object.h>
@@ -46,6 +47,10 @@ public:
                                       uint8_t alignment_log2) override;
     zx_status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
 
+    size_t ReclaimZeroPages(uint64_t* offset, size_t max_pages, size_t* freed) override;
+    size_t CompressColdPages(uint64_t* offset, size_t max_pages,
+                             zx_duration_t min_cold_time, size_t* compressed) override;
+
     zx_status_t Pin(uint64_t offset, uint64_t len) override;
     void Unpin(uint64_t offset, uint64_t len) override;
 
@@ -110,9 +115,27 @@ private:
     zx_status_t PinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
     void UnpinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
 
+    // note that physical addresses of pages seen through this object have
+    // been handed out, which exposes the pages of all of our ancestors too
+    void MarkPhysExposedLocked()
+        // Walks the parent chain under the shared lock, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
     // internal check if any pages in a range are pinned
     bool AnyPagesPinnedLocked(uint64_t offset, size_t len) TA_REQ(lock_);
 
+    // whether pages can be freed without their users being able to tell,
+    // provided they are unmapped first
+    bool CanReclaimPagesLocked() const TA_REQ(lock_);
+
+    // bring a compressed page back into the page list, allocating the page from
+    // |free_list| if it isn't empty
+    zx_status_t DecompressPageLocked(uint64_t offset, list_node* free_list,
+                                     vm_page_t** page) TA_REQ(lock_);
+
+    // throw away the compressed pages in a range of the object
+    size_t DropCompressedPagesLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
     zx_status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
@@ -121,14 +144,30 @@ private:
     // set our offset within our parent
     zx_status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // Shorten the chain of parents above us by skipping over any parent that
+    // nothing but its children can reach. Returns true if the chain changed.
+    bool CollapseParentsLocked()
+        // Walks the parent chain under the shared lock, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
     // members
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
+    // offsets at or above this are not backed by the parent, set when a
+    // collapsed ancestor was smaller than the view it provided to us
+    uint64_t parent_limit_ TA_GUARDED(lock_) = UINT64_MAX;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
 
+    // set once Lookup has handed out the physical addresses of our pages,
+    // which may have been given to hardware without pinning them
+    bool phys_exposed_ TA_GUARDED(lock_) = false;
+
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // pages the compressor has taken out of page_list_, by offset
+    fbl::WAVLTree<uint64_t, fbl::unique_ptr<CompressedPage>> compressed_pages_ TA_GUARDED(lock_);
 };
@@ -0,0 +1,16 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// The zero page scanner is a low priority kernel thread that walks the pages
+// committed to user VMOs and frees the ones that are entirely zero, so that
+// they fault back in as the shared zero page.
+
+// Returns the total number of bytes the scanner has returned to the pmm.
+uint64_t zero_page_scanner_reclaimed_bytes();
@@ -0,0 +1,187 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/page_compressor.h>
+
+#include "vm_priv.h"
+
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/atomic.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <lz4/lz4.h>
+#include <string.h>
+#include <trace.h>
+#include <vm/pmm.h>
+#include <vm/vm.h>
+#include <vm/vm_object.h>
+#include <zircon/types.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+KCOUNTER(compress_pages, "kernel.vm.compress.pages");
+KCOUNTER(compress_rejected, "kernel.vm.compress.rejected");
+KCOUNTER(compress_full, "kernel.vm.compress.full");
+KCOUNTER(compress_decompressed, "kernel.vm.compress.decompressed");
+
+// Pages that don't compress to at least this size aren't worth the trouble.
+static constexpr int kMaxCompressedSize = PAGE_SIZE * 3 / 4;
+
+// How often the compressor wakes up to check on free memory.
+static constexpr zx_duration_t kCompressInterval = ZX_MSEC(100);
+static constexpr uint64_t kCompressesPerSecond = ZX_SEC(1) / kCompressInterval;
+
+// How long a page has to have gone unused before it's compressed.
+static constexpr zx_duration_t kMinColdTime = ZX_SEC(2);
+
+// lz4's compression state is too big for the stack, so compression is
+// serialized through these.
+static fbl::Mutex compress_lock;
+static LZ4_stream_t compress_state TA_GUARDED(compress_lock);
+static char compress_buffer[kMaxCompressedSize] TA_GUARDED(compress_lock);
+
+static fbl::atomic<uint64_t> stored_pages;
+static fbl::atomic<uint64_t> stored_bytes;
+
+// Compressed pages live on the heap, which has to grow to hold them just when
+// memory is short, so they're kept to this many bytes.
+static uint64_t max_stored_bytes = UINT64_MAX;
+
+static size_t StoredSize(size_t len) {
+    return sizeof(CompressedPage) + len;
+}
+
+CompressedPage::CompressedPage(uint64_t offset, fbl::Array<uint8_t> data)
+    : offset_(offset), data_(fbl::move(data)) {
+    stored_pages.fetch_add(1);
+}
+
+CompressedPage::~CompressedPage() {
+    stored_pages.fetch_sub(1);
+    stored_bytes.fetch_sub(StoredSize(data_.size()));
+}
+
+zx_status_t CompressedPage::Create(uint64_t offset, const void* page,
+                                   fbl::unique_ptr<CompressedPage>* out) {
+    fbl::Array<uint8_t> data;
+    {
+        fbl::AutoLock lock(&compress_lock);
+        int len = LZ4_compress_fast_extState(&compress_state, static_cast<const char*>(page),
+                                             compress_buffer, PAGE_SIZE, kMaxCompressedSize, 1);
+        if (len <= 0) {
+            kcounter_add(compress_rejected, 1);
+            return ZX_ERR_OUT_OF_RANGE;
+        }
+
+        // claim the space before allocating it, so the limit holds even with
+        // several callers at once
+        const size_t size = StoredSize(len);
+        if (stored_bytes.fetch_add(size) + size > max_stored_bytes) {
+            stored_bytes.fetch_sub(size);
+            kcounter_add(compress_full, 1);
+            return ZX_ERR_NO_RESOURCES;
+        }
+
+        fbl::AllocChecker ac;
+        data.reset(new (&ac) uint8_t[len], len);
+        if (!ac.check()) {
+            stored_bytes.fetch_sub(size);
+            return ZX_ERR_NO_MEMORY;
+        }
+        memcpy(data.get(), compress_buffer, len);
+    }
+
+    const size_t size = StoredSize(data.size());
+    fbl::AllocChecker ac;
+    out->reset(new (&ac) CompressedPage(offset, fbl::move(data)));
+    if (!ac.check()) {
+        stored_bytes.fetch_sub(size);
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    kcounter_add(compress_pages, 1);
+    return ZX_OK;
+}
+
+zx_status_t CompressedPage::Decompress(void* page) const {
+    int len = LZ4_decompress_safe(reinterpret_cast<const char*>(data_.get()),
+                                  static_cast<char*>(page),
+                                  static_cast<int>(data_.size()), PAGE_SIZE);
+    if (len != PAGE_SIZE)
+        return ZX_ERR_IO_DATA_INTEGRITY;
+
+    kcounter_add(compress_decompressed, 1);
+    return ZX_OK;
+}
+
+void page_compressor_get_stats(uint64_t* pages, uint64_t* compressed_bytes) {
+    *pages = stored_pages.load();
+    *compressed_bytes = stored_bytes.load();
+}
+
+struct compressor_args {
+    size_t threshold_bytes;
+    size_t pages_per_sec;
+};
+
+static int page_compressor_loop(void* arg) {
+    const compressor_args* args = static_cast<const compressor_args*>(arg);
+    const size_t pages_per_pass = fbl::max<size_t>(args->pages_per_sec / kCompressesPerSecond, 1);
+
+    VmoScanCursor cursor;
+    while (true) {
+        thread_sleep_relative(kCompressInterval);
+
+        if (pmm_count_free_pages() * PAGE_SIZE >= args->threshold_bytes) {
+            cursor.Reset();
+            continue;
+        }
+
+        // once there's no room for more, unmapping pages would only cost
+        // faults
+        if (stored_bytes.load() + StoredSize(kMaxCompressedSize) > max_stored_bytes)
+            continue;
+
+        cursor.Scan(pages_per_pass, [](VmObject* vmo, uint64_t* offset, size_t max_pages) {
+            size_t compressed;
+            size_t scanned = vmo->CompressColdPages(offset, max_pages, kMinColdTime, &compressed);
+            if (compressed > 0)
+                LTRACEF("compressed %zu pages from vmo %p\n", compressed, vmo);
+            return scanned;
+        });
+    }
+
+    return 0;
+}
+
+static void page_compressor_init(uint level) {
+    static compressor_args args;
+
+    // Be sure to update kernel_cmdline.md if any of these defaults change.
+    if (!cmdline_get_bool("kernel.compressor.enable", true)) {
+        printf("page compressor: disabled\n");
+        return;
+    }
+    args.threshold_bytes = cmdline_get_uint64("kernel.compressor.threshold-mb", 100) * MB;
+    args.pages_per_sec = cmdline_get_uint64("kernel.compressor.pages-per-sec", 4096);
+    max_stored_bytes = cmdline_get_uint64("kernel.compressor.max-mb", 64) * MB;
+
+    thread_t* t = thread_create("page-compressor", page_compressor_loop, &args,
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        printf("page compressor: failed to create thread\n");
+        return;
+    }
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(page_compressor, page_compressor_init, LK_INIT_LEVEL_LAST);
@@ -29,6 +29,7 @@ using fbl::AutoLock;
 
 fbl::Mutex VmObject::all_vmos_lock_ = {};
 VmObject::GlobalList VmObject::all_vmos_ = {};
+fbl::DoublyLinkedList<VmObject::GlobalListCursor*> VmObject::all_cursors_ = {};
 
 VmObject::VmObject(fbl::RefPtr<VmObject> parent)
     : lock_(parent ? parent->lock_ref() : local_lock_),
@@ -64,14 +65,64 @@ VmObject::~VmObject() {
     DEBUG_ASSERT(mapping_list_.is_empty());
     DEBUG_ASSERT(children_list_.is_empty());
 
-    // Remove ourself from the global VMO list.
+    // Remove ourself from the global VMO list, leaving any cursors that were
+    // at us just after the VMO before us.
     {
         AutoLock a(&all_vmos_lock_);
         DEBUG_ASSERT(global_list_state_.InContainer() == true);
+        auto iter = all_vmos_.make_iterator(*this);
+        VmObject* prev = iter == all_vmos_.begin() ? nullptr : &*(--iter);
+        for (auto& cursor : all_cursors_) {
+            if (cursor.vmo_ == this) {
+                cursor.vmo_ = prev;
+                cursor.at_vmo_ = false;
+            }
+        }
         all_vmos_.erase(*this);
     }
 }
 
+VmObject::GlobalListCursor::GlobalListCursor() {
+    AutoLock a(&all_vmos_lock_);
+    all_cursors_.push_back(this);
+}
+
+VmObject::GlobalListCursor::~GlobalListCursor() {
+    AutoLock a(&all_vmos_lock_);
+    all_cursors_.erase(*this);
+}
+
+fbl::RefPtr<VmObject> VmObject::GlobalListCursor::Get() {
+    AutoLock a(&all_vmos_lock_);
+    if (!at_vmo_)
+        return nullptr;
+    return fbl::internal::MakeRefPtrUpgradeFromRaw(vmo_, all_vmos_lock_);
+}
+
+fbl::RefPtr<VmObject> VmObject::GlobalListCursor::Next() {
+    AutoLock a(&all_vmos_lock_);
+    auto iter = vmo_ ? ++all_vmos_.make_iterator(*vmo_) : all_vmos_.begin();
+    for (; iter.IsValid(); ++iter) {
+        vmo_ = &*iter;
+        at_vmo_ = true;
+        // objects on their way out are still on the list until their
+        // destructor takes this lock, so only hand out ones we can still
+        // take a reference to
+        auto ref = fbl::internal::MakeRefPtrUpgradeFromRaw(vmo_, all_vmos_lock_);
+        if (ref)
+            return ref;
+    }
+    vmo_ = nullptr;
+    at_vmo_ = false;
+    return nullptr;
+}
+
+void VmObject::GlobalListCursor::Reset() {
+    AutoLock a(&all_vmos_lock_);
+    vmo_ = nullptr;
+    at_vmo_ = false;
+}
+
 void VmObject::get_name(char* out_name, size_t len) const {
     canary_.Assert();
     name_.get(len, out_name);
@@ -209,6 +260,19 @@ void VmObject::RemoveChildLocked(VmObject* o) {
     children_list_len_--;
 }
 
+void VmObject::AddDispatcher() {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    dispatcher_count_++;
+}
+
+void VmObject::RemoveDispatcher() {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    DEBUG_ASSERT(dispatcher_count_ > 0);
+    dispatcher_count_--;
+}
+
 uint32_t VmObject::num_children() const {
     canary_.Assert();
     AutoLock a(&lock_);
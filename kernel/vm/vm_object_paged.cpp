@@ -15,6 +15,7 @@
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
 #include <lib/console.h>
+#include <platform.h>
 #include <safeint/safe_math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,11 +44,38 @@ void ZeroPage(vm_page_t* p) {
     ZeroPage(pa);
 }
 
+bool IsZeroPage(vm_page_t* p) {
+    const uint64_t* ptr = static_cast<const uint64_t*>(paddr_to_physmap(vm_page_to_paddr(p)));
+    DEBUG_ASSERT(ptr);
+
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(*ptr); i++) {
+        if (ptr[i])
+            return false;
+    }
+    return true;
+}
+
+// A page which turns out to be in use while cold is left mapped for this many
+// of the compressor's passes, so that pages in a working set aren't unmapped
+// and faulted back in over and over.
+constexpr uint8_t kWarmPasses = 8;
+
+// vm_page_t::object.cold_time is kept in units of 2^24ns (about 17ms), which
+// takes a couple of years to wrap.
+constexpr uint kColdTimeShift = 24;
+
+uint32_t ColdTimeNow() {
+    return static_cast<uint32_t>(current_time() >> kColdTimeShift);
+}
+
 void InitializeVmPage(vm_page_t* p) {
     DEBUG_ASSERT(p->state == VM_PAGE_STATE_ALLOC);
     p->state = VM_PAGE_STATE_OBJECT;
     p->object.pin_count = 0;
     p->object.contiguous_pin = 0;
+    p->object.cold = 0;
+    p->object.warm_passes = 0;
+    p->object.cold_time = 0;
 }
 
 } // namespace
@@ -73,6 +101,7 @@ VmObjectPaged::~VmObjectPaged() {
 
     // free all of the pages attached to us
     page_list_.FreeAllPages();
+    compressed_pages_.clear();
 }
 
 zx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::RefPtr<VmObject>* obj) {
@@ -106,6 +135,9 @@ zx_status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, bool copy_na
 
     AutoLock a(&lock_);
 
+    // don't stack the new clone on top of parents nobody else can see
+    CollapseParentsLocked();
+
     // add it as a child to us
     AddChildLocked(vmo.get());
 
@@ -274,9 +306,22 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     vm_page_t* p;
     paddr_t pa;
 
-    // see if we already have a page at that offset
+    // see if we already have a page at that offset, first trimming any
+    // parents that only exist to hold pages for us since that may bring the
+    // page down to us
     p = page_list_.GetPage(offset);
+    if (!p && CollapseParentsLocked())
+        p = page_list_.GetPage(offset);
+    if (!p && !compressed_pages_.is_empty()) {
+        zx_status_t status = DecompressPageLocked(offset, free_list, &p);
+        if (status != ZX_OK && status != ZX_ERR_NOT_FOUND)
+            return status;
+    }
     if (p) {
+        if (p->object.cold) {
+            p->object.cold = 0;
+            p->object.warm_passes = kWarmPasses;
+        }
         if (page_out)
             *page_out = p;
         if (pa_out)
@@ -289,7 +334,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
             vmm_pf_flags_to_string(pf_flags, pf_string));
 
     // if we have a parent see if they have a page for us
-    if (parent_) {
+    if (parent_ && offset < parent_limit_) {
         safeint::CheckedNumeric<uint64_t> parent_offset = parent_offset_;
         parent_offset += offset;
         DEBUG_ASSERT(parent_offset.IsValid());
@@ -405,6 +450,69 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::DecompressPageLocked(uint64_t offset, list_node* free_list,
+                                                vm_page_t** page) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    auto compressed = compressed_pages_.find(offset);
+    if (!compressed.IsValid())
+        return ZX_ERR_NOT_FOUND;
+
+    vm_page_t* p = nullptr;
+    paddr_t pa;
+    bool from_free_list = false;
+    if (free_list) {
+        p = list_remove_head_type(free_list, vm_page_t, free.node);
+        if (p) {
+            pa = vm_page_to_paddr(p);
+            from_free_list = true;
+        }
+    }
+    if (!p) {
+        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    }
+    if (!p) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    zx_status_t status = compressed->Decompress(paddr_to_physmap(pa));
+    if (status != ZX_OK) {
+        // leave the compressed copy where it is, so that every later use of
+        // the page fails the same way rather than seeing zeroes
+        TRACEF("vmo %p failed to decompress page at %#" PRIx64 ": %d\n", this, offset, status);
+        if (from_free_list) {
+            list_add_head(free_list, &p->free.node);
+        } else {
+            pmm_free_page(p);
+        }
+        return status;
+    }
+    compressed_pages_.erase(compressed);
+
+    InitializeVmPage(p);
+    status = AddPageLocked(p, offset);
+    DEBUG_ASSERT(status == ZX_OK);
+
+    LTRACEF("decompressed page %p, pa %#" PRIxPTR " at offset %#" PRIx64 "\n", p, pa, offset);
+
+    *page = p;
+    return ZX_OK;
+}
+
+size_t VmObjectPaged::DropCompressedPagesLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    size_t dropped = 0;
+    auto iter = compressed_pages_.lower_bound(start);
+    while (iter.IsValid() && iter->GetKey() < end) {
+        auto cur = iter++;
+        compressed_pages_.erase(cur);
+        dropped++;
+    }
+    return dropped;
+}
+
 zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
@@ -518,6 +626,10 @@ zx_status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len,
     DEBUG_ASSERT(end > offset);
 
     // make a pass through the list, making sure we have an empty run on the object
+    auto compressed = compressed_pages_.lower_bound(offset);
+    if (compressed.IsValid() && compressed->GetKey() < end) {
+        return ZX_ERR_BAD_STATE;
+    }
     size_t count = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
         if (!page_list_.GetPage(o))
@@ -611,6 +723,12 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
+    // compressed pages are committed too, as far as our callers know
+    size_t dropped = DropCompressedPagesLocked(start, end);
+    if (decommitted) {
+        *decommitted += dropped * PAGE_SIZE;
+    }
+
     // iterate through the pages, freeing them
     while (start < end) {
         auto status = page_list_.FreePage(start);
@@ -623,6 +741,143 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     return ZX_OK;
 }
 
+size_t VmObjectPaged::ReclaimZeroPages(uint64_t* offset, size_t max_pages, size_t* freed) {
+    canary_.Assert();
+
+    *freed = 0;
+
+    AutoLock a(&lock_);
+
+    const uint64_t end = ROUNDUP_PAGE_SIZE(size_);
+    const uint64_t start = ROUNDDOWN(*offset, PAGE_SIZE);
+    *offset = end;
+    if (start >= end)
+        return 0;
+
+    if (!CanReclaimPagesLocked())
+        return 0;
+
+    // look for candidates first, since pages can't be freed while walking the list
+    static constexpr size_t kMaxBatch = 64;
+    uint64_t candidates[kMaxBatch];
+    size_t num_candidates = 0;
+    size_t scanned = 0;
+    max_pages = MIN(max_pages, kMaxBatch);
+    page_list_.ForEveryPageInRange(
+        [&](const auto p, uint64_t off) {
+            if (scanned == max_pages) {
+                *offset = off;
+                return ZX_ERR_STOP;
+            }
+            scanned++;
+            if (p->state == VM_PAGE_STATE_OBJECT && p->object.pin_count == 0 && IsZeroPage(p))
+                candidates[num_candidates++] = off;
+            return ZX_ERR_NEXT;
+        },
+        start, end);
+
+    for (size_t i = 0; i < num_candidates; i++) {
+        const uint64_t off = candidates[i];
+
+        // the page may be mapped writable, so take it away from everyone and
+        // check again before freeing it; with our lock held nobody can map
+        // it back in until we're done
+        RangeChangeUpdateLocked(off, PAGE_SIZE);
+        if (!IsZeroPage(page_list_.GetPage(off)))
+            continue;
+
+        page_list_.FreePage(off);
+        (*freed)++;
+    }
+
+    LTRACEF("vmo %p scanned %zu pages, freed %zu\n", this, scanned, *freed);
+
+    return scanned;
+}
+
+size_t VmObjectPaged::CompressColdPages(uint64_t* offset, size_t max_pages,
+                                        zx_duration_t min_cold_time, size_t* compressed) {
+    canary_.Assert();
+
+    *compressed = 0;
+
+    AutoLock a(&lock_);
+
+    const uint64_t end = ROUNDUP_PAGE_SIZE(size_);
+    const uint64_t start = ROUNDDOWN(*offset, PAGE_SIZE);
+    *offset = end;
+    if (start >= end)
+        return 0;
+
+    if (!CanReclaimPagesLocked())
+        return 0;
+
+    // There's no portable way to ask the hardware whether a page has been
+    // accessed, so age pages by unmapping them instead: the first pass marks
+    // a page cold and takes it away from everyone, and any use of it faults
+    // it back in through GetPageLocked(), which warms it up again and keeps
+    // it from being unmapped for the next few passes. Pages that are still
+    // cold on a later pass, and have been for at least |min_cold_time|, are
+    // compressed.
+    const uint32_t now = ColdTimeNow();
+    const uint32_t min_cold = static_cast<uint32_t>(min_cold_time >> kColdTimeShift);
+    static constexpr size_t kMaxBatch = 64;
+    uint64_t candidates[kMaxBatch];
+    size_t num_candidates = 0;
+    size_t scanned = 0;
+    max_pages = MIN(max_pages, kMaxBatch);
+    page_list_.ForEveryPageInRange(
+        [&](const auto p, uint64_t off) {
+            if (scanned == max_pages) {
+                *offset = off;
+                return ZX_ERR_STOP;
+            }
+            scanned++;
+            if (p->state == VM_PAGE_STATE_OBJECT && p->object.pin_count == 0)
+                candidates[num_candidates++] = off;
+            return ZX_ERR_NEXT;
+        },
+        start, end);
+
+    for (size_t i = 0; i < num_candidates; i++) {
+        const uint64_t off = candidates[i];
+        vm_page_t* p = page_list_.GetPage(off);
+
+        if (!p->object.cold) {
+            if (p->object.warm_passes > 0) {
+                p->object.warm_passes--;
+                continue;
+            }
+            p->object.cold = 1;
+            p->object.cold_time = now;
+            RangeChangeUpdateLocked(off, PAGE_SIZE);
+            continue;
+        }
+        if (static_cast<uint32_t>(now - p->object.cold_time) < min_cold)
+            continue;
+
+        // a cold page isn't mapped anywhere, and with our lock held nobody can
+        // map it back in until we're done
+        fbl::unique_ptr<CompressedPage> page;
+        zx_status_t status = CompressedPage::Create(off, paddr_to_physmap(vm_page_to_paddr(p)),
+                                                    &page);
+        if (status != ZX_OK) {
+            // leave it alone for a while before trying again
+            p->object.cold = 0;
+            p->object.warm_passes = kWarmPasses;
+            continue;
+        }
+
+        compressed_pages_.insert(fbl::move(page));
+        page_list_.FreePage(off);
+        (*compressed)++;
+    }
+
+    LTRACEF("vmo %p scanned %zu pages, compressed %zu\n", this, scanned, *compressed);
+
+    return scanned;
+}
+
 zx_status_t VmObjectPaged::Pin(uint64_t offset, uint64_t len) {
     canary_.Assert();
 
@@ -643,6 +898,16 @@ zx_status_t VmObjectPaged::PinLocked(uint64_t offset, uint64_t len) {
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
+    // pinned pages have to be in memory, so bring back any that were compressed
+    for (auto iter = compressed_pages_.lower_bound(start_page_offset);
+         iter.IsValid() && iter->GetKey() < end_page_offset;) {
+        const uint64_t off = (iter++)->GetKey();
+        vm_page_t* p;
+        zx_status_t status = DecompressPageLocked(off, nullptr, &p);
+        if (status != ZX_OK)
+            return status;
+    }
+
     uint64_t expected_next_off = start_page_offset;
     zx_status_t status = page_list_.ForEveryPageInRange(
         [&expected_next_off](const auto p, uint64_t off) {
@@ -709,6 +974,38 @@ void VmObjectPaged::UnpinLocked(uint64_t offset, uint64_t len) {
     return;
 }
 
+// In a clone, freeing a page would expose the parent's page rather than
+// zeros. Pages whose physical address has been handed out or that are mapped
+// into the kernel may be used behind our back, and pages mapped with anything
+// other than the default cache policy may not read back as they were written.
+bool VmObjectPaged::CanReclaimPagesLocked() const {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (parent_ || phys_exposed_)
+        return false;
+    for (const auto& m : mapping_list_) {
+        if (!m.aspace()->is_user())
+            return false;
+        if ((m.arch_mmu_flags() & ARCH_MMU_FLAG_CACHE_MASK) != ARCH_MMU_FLAG_CACHED)
+            return false;
+    }
+    return true;
+}
+
+// Pages we don't have a copy of yet are handed out straight from whichever
+// ancestor holds them, so every object up the chain has to stop reclaiming.
+void VmObjectPaged::MarkPhysExposedLocked() {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (VmObjectPaged* vmo = this; vmo;) {
+        vmo->phys_exposed_ = true;
+        if (!vmo->parent_)
+            break;
+        DEBUG_ASSERT(vmo->parent_->is_paged());
+        vmo = static_cast<VmObjectPaged*>(vmo->parent_.get());
+    }
+}
+
 bool VmObjectPaged::AnyPagesPinnedLocked(uint64_t offset, size_t len) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -759,12 +1056,18 @@ zx_status_t VmObjectPaged::ResizeLocked(uint64_t s) {
             // unmap all of the pages in this range on all the mapping regions
             RangeChangeUpdateLocked(start, page_aligned_len);
 
+            DropCompressedPagesLocked(start, end);
+
             // iterate through the pages, freeing them
             while (start < end) {
                 page_list_.FreePage(start);
                 start += PAGE_SIZE;
             }
         }
+
+        // growing again mustn't bring back what the parent has past the new
+        // end, the same as once our parents have been collapsed
+        parent_limit_ = MIN(parent_limit_, ROUNDUP_PAGE_SIZE(s));
     } else if (s > size_) {
         // expanding
         // figure the starting and ending page offset that is affected
@@ -811,6 +1114,108 @@ zx_status_t VmObjectPaged::SetParentOffsetLocked(uint64_t offset) {
     return ZX_OK;
 }
 
+// A parent that is only referenced by its children's parent_ pointers has no
+// handles, mappings or pins left, so nothing can change its contents or size
+// again and it only exists to hold pages for us. If it has no pages in the
+// range we can see, or we are its last child and can take those pages over,
+// we can hang off our grandparent directly. Repeated until the chain stops
+// shrinking, this keeps a chain of clones whose intermediate links have been
+// closed from costing a level per clone on every fault.
+bool VmObjectPaged::CollapseParentsLocked() {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    bool collapsed = false;
+    while (parent_) {
+        DEBUG_ASSERT(parent_->is_paged());
+        auto parent = static_cast<VmObjectPaged*>(parent_.get());
+
+        // the root of the tree owns the lock we all share, so it stays put
+        if (!parent->parent_)
+            break;
+
+        // only VMOs without a parent have their pages compressed
+        DEBUG_ASSERT(parent->compressed_pages_.is_empty());
+
+        // the parent's pages can only move if nothing but its children can
+        // get at them: userspace needs a handle or a mapping to, and pinned
+        // pages are checked for below. Handles can only be made from existing
+        // ones, and mappings are added under the lock we hold, so this can't
+        // change underneath us.
+        if (parent->dispatcher_count_ != 0 || parent->mapping_list_len_ != 0)
+            break;
+
+        safeint::CheckedNumeric<uint64_t> new_offset = parent->parent_offset_;
+        new_offset += parent_offset_;
+        if (!new_offset.IsValid())
+            break;
+
+        // work out how much of the parent we can see, in our offsets, and
+        // how much of that the grandparent provides
+        uint64_t visible = 0;
+        if (parent->size_ > parent_offset_)
+            visible = MIN(parent_limit_, parent->size_ - parent_offset_);
+        visible = MIN(visible, ROUNDUP_PAGE_SIZE(size_));
+        uint64_t new_limit = 0;
+        if (parent->parent_limit_ > parent_offset_)
+            new_limit = MIN(visible, parent->parent_limit_ - parent_offset_);
+
+        const uint64_t start = parent_offset_;
+        const uint64_t end = ROUNDUP_PAGE_SIZE(start + visible);
+
+        if (parent->children_list_len_ == 1) {
+            // we're the only one left who can see the parent's pages, so take
+            // over the ones we haven't already replaced with our own copy
+            zx_status_t status = parent->page_list_.ForEveryPageInRange(
+                [this, start](vm_page*& p, uint64_t off) -> zx_status_t {
+                    if (page_list_.GetPage(off - start))
+                        return ZX_ERR_NEXT;
+                    // pinned by someone holding on to the parent
+                    if (p->object.pin_count != 0)
+                        return ZX_ERR_BAD_STATE;
+                    zx_status_t status = page_list_.AddPage(p, off - start);
+                    if (status != ZX_OK)
+                        return status;
+                    p = nullptr;
+                    return ZX_ERR_NEXT;
+                },
+                start, end);
+            if (status != ZX_OK)
+                break;
+            // some of those pages may have been handed to hardware
+            phys_exposed_ |= parent->phys_exposed_;
+        } else {
+            // our siblings still need the parent's pages, so we can only skip
+            // it if none of them are in our range
+            bool empty = true;
+            parent->page_list_.ForEveryPageInRange(
+                [&empty](const auto p, uint64_t off) {
+                    empty = false;
+                    return ZX_ERR_STOP;
+                },
+                start, end);
+            if (!empty)
+                break;
+        }
+
+        LTRACEF("vmo %p skipping parent %p, offset %#" PRIx64 " limit %#" PRIx64 "\n",
+                this, parent, new_offset.ValueOrDie(), new_limit);
+
+        // hold the old parent until we're done with it; if we were its last
+        // child, dropping this frees it along with any pages we didn't need
+        fbl::RefPtr<VmObject> old_parent = fbl::move(parent_);
+        old_parent->RemoveChildLocked(this);
+        parent_ = parent->parent_;
+        parent_->AddChildLocked(this);
+        parent_offset_ = new_offset.ValueOrDie();
+        parent_limit_ = new_limit;
+
+        collapsed = true;
+    }
+
+    return collapsed;
+}
+
 // perform some sort of copy in/out on a range of the object using a passed in lambda
 // for the copy routine
 template <typename T>
@@ -912,6 +1317,8 @@ zx_status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     if (unlikely(!InRange(offset, len, size_)))
         return ZX_ERR_OUT_OF_RANGE;
 
+    MarkPhysExposedLocked();
+
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
@@ -9,11 +9,13 @@
 
 #include <fbl/algorithm.h>
 #include <fbl/limits.h>
+#include <fbl/ref_ptr.h>
 #include <kernel/mutex.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <vm/vm.h>
 #include <vm/vm_aspace.h>
+#include <vm/vm_object.h>
 
 #define VM_GLOBAL_TRACE 0
 
@@ -129,3 +131,51 @@ static inline paddr_t vm_get_zero_page_paddr(void) {
 
     return zero_page_paddr;
 }
+
+// Tracks a background scanner's position among the pages of user VMOs, so it
+// can look at a bounded number of them at a time.
+class VmoScanCursor {
+public:
+    // Calls |scan(VmObject* vmo, uint64_t* offset, size_t max_pages)|, which
+    // returns the number of pages it looked at, on the VMOs that have koids,
+    // carrying on from where the last call left off. Stops once |budget| pages
+    // have been looked at or the end of the VMO list is reached. Every VMO
+    // visited costs at least one page of budget, so that walking lots of
+    // empty ones is rate limited too.
+    template <typename F>
+    void Scan(size_t budget, F scan) {
+        // only hold a reference for the duration of the scan, so that a VMO
+        // that goes away while the caller sleeps is freed straight away
+        fbl::RefPtr<VmObject> vmo = cursor_.Get();
+        while (budget > 0) {
+            if (!vmo || offset_ >= vmo->size()) {
+                vmo = cursor_.Next();
+                offset_ = 0;
+                if (!vmo) {
+                    // start again from the oldest next time
+                    return;
+                }
+
+                // kernel-internal VMOs don't have koids and are left alone
+                if (vmo->user_id() == 0) {
+                    offset_ = UINT64_MAX;
+                    budget--;
+                    continue;
+                }
+            }
+
+            size_t scanned = scan(vmo.get(), &offset_, budget);
+            budget -= fbl::min(fbl::max<size_t>(scanned, 1), budget);
+        }
+    }
+
+    // Goes back to the start; the next scan starts from the oldest VMO.
+    void Reset() {
+        cursor_.Reset();
+        offset_ = 0;
+    }
+
+private:
+    VmObject::GlobalListCursor cursor_;
+    uint64_t offset_ = 0;
+};
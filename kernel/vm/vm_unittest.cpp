@@ -887,6 +887,198 @@ static bool vmo_lookup_test(void* context) {
     END_TEST;
 }
 
+// Commits a VMO, dirties some of it, and makes sure only the clean, unpinned
+// pages are reclaimed.
+static bool vmo_reclaim_zero_pages_test(void* context) {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = PAGE_SIZE * 8;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    status = vmo->CommitRange(0, alloc_size, nullptr);
+    REQUIRE_EQ(ZX_OK, status, "committing vm object\n");
+
+    // dirty the second page and pin the third
+    const uint64_t val = 0x1234;
+    status = vmo->Write(&val, PAGE_SIZE + 8, sizeof(val), nullptr);
+    EXPECT_EQ(ZX_OK, status, "writing to object\n");
+    status = vmo->Pin(2 * PAGE_SIZE, PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "pinning object\n");
+
+    // look at half of it
+    uint64_t offset = 0;
+    size_t freed;
+    size_t scanned = vmo->ReclaimZeroPages(&offset, 4, &freed);
+    EXPECT_EQ(4u, scanned, "scanned pages\n");
+    EXPECT_EQ(2u, freed, "freed pages\n");
+    EXPECT_EQ(4u * PAGE_SIZE, offset, "next offset\n");
+
+    // and the rest
+    scanned = vmo->ReclaimZeroPages(&offset, 64, &freed);
+    EXPECT_EQ(4u, scanned, "scanned pages\n");
+    EXPECT_EQ(4u, freed, "freed pages\n");
+    EXPECT_EQ(alloc_size, offset, "next offset\n");
+    EXPECT_EQ(2u, vmo->AllocatedPages(), "allocated pages\n");
+
+    // the contents didn't change
+    uint64_t read_val = 0;
+    status = vmo->Read(&read_val, PAGE_SIZE + 8, sizeof(read_val), nullptr);
+    EXPECT_EQ(ZX_OK, status, "reading from object\n");
+    EXPECT_EQ(val, read_val, "dirty page contents\n");
+    read_val = 1;
+    status = vmo->Read(&read_val, 0, sizeof(read_val), nullptr);
+    EXPECT_EQ(ZX_OK, status, "reading from object\n");
+    EXPECT_EQ(0u, read_val, "reclaimed page contents\n");
+
+    vmo->Unpin(2 * PAGE_SIZE, PAGE_SIZE);
+
+    // once physical addresses have been handed out, nothing is reclaimed
+    status = vmo->CommitRange(0, alloc_size, nullptr);
+    EXPECT_EQ(ZX_OK, status, "committing vm object\n");
+    auto lookup_fn = [](void* context, size_t offset, size_t index, paddr_t pa) {
+        return ZX_OK;
+    };
+    status = vmo->Lookup(0, alloc_size, 0, lookup_fn, nullptr);
+    EXPECT_EQ(ZX_OK, status, "lookup\n");
+    offset = 0;
+    vmo->ReclaimZeroPages(&offset, 64, &freed);
+    EXPECT_EQ(0u, freed, "freed pages after lookup\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "allocated pages\n");
+
+    END_TEST;
+}
+
+// Hands out the physical address of a page a clone still shares with its
+// parent, and makes sure the parent doesn't reclaim it.
+static bool vmo_lookup_clone_reclaim_test(void* context) {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = PAGE_SIZE * 4;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    status = vmo->CommitRange(0, alloc_size, nullptr);
+    REQUIRE_EQ(ZX_OK, status, "committing vm object\n");
+
+    fbl::RefPtr<VmObject> clone;
+    status = vmo->CloneCOW(0, alloc_size, false, &clone);
+    REQUIRE_EQ(ZX_OK, status, "cloning vm object\n");
+    EXPECT_EQ(0u, clone->AllocatedPages(), "clone allocated pages\n");
+
+    paddr_t pa = 0;
+    auto lookup_fn = [](void* context, size_t offset, size_t index, paddr_t pa) {
+        *static_cast<paddr_t*>(context) = pa;
+        return ZX_OK;
+    };
+    status = clone->Lookup(PAGE_SIZE, PAGE_SIZE, 0, lookup_fn, &pa);
+    EXPECT_EQ(ZX_OK, status, "lookup\n");
+    EXPECT_EQ(0u, clone->AllocatedPages(), "clone allocated pages\n");
+
+    // the parent's zero pages are now in use behind its back
+    uint64_t offset = 0;
+    size_t freed;
+    vmo->ReclaimZeroPages(&offset, 64, &freed);
+    EXPECT_EQ(0u, freed, "freed pages after lookup through clone\n");
+    for (int pass = 0; pass < 2; pass++) {
+        size_t compressed;
+        offset = 0;
+        vmo->CompressColdPages(&offset, 64, 0, &compressed);
+        EXPECT_EQ(0u, compressed, "compressed pages after lookup through clone\n");
+    }
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "allocated pages\n");
+
+    paddr_t pa_after = 1;
+    status = clone->Lookup(PAGE_SIZE, PAGE_SIZE, 0, lookup_fn, &pa_after);
+    EXPECT_EQ(ZX_OK, status, "lookup\n");
+    EXPECT_EQ(pa, pa_after, "page moved\n");
+
+    END_TEST;
+}
+
+static bool vmo_compress_cold_pages_test(void* context) {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = PAGE_SIZE * 8;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    // fill it with something that compresses well but isn't zero
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> buf(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+    for (size_t i = 0; i < alloc_size; i++)
+        buf[i] = static_cast<uint8_t>(i / 64);
+    status = vmo->Write(buf.get(), 0, alloc_size, nullptr);
+    REQUIRE_EQ(ZX_OK, status, "writing to object\n");
+
+    // the first pass only marks the pages cold
+    uint64_t offset = 0;
+    size_t compressed;
+    size_t scanned = vmo->CompressColdPages(&offset, 64, 0, &compressed);
+    EXPECT_EQ(alloc_size / PAGE_SIZE, scanned, "scanned pages\n");
+    EXPECT_EQ(0u, compressed, "compressed pages\n");
+    EXPECT_EQ(alloc_size, offset, "next offset\n");
+
+    // and they're left alone until they've been cold for long enough
+    offset = 0;
+    vmo->CompressColdPages(&offset, 64, ZX_SEC(3600), &compressed);
+    EXPECT_EQ(0u, compressed, "compressed pages\n");
+
+    // touching a page warms it up again
+    uint8_t val;
+    status = vmo->Read(&val, PAGE_SIZE, sizeof(val), nullptr);
+    EXPECT_EQ(ZX_OK, status, "reading from object\n");
+
+    offset = 0;
+    vmo->CompressColdPages(&offset, 64, 0, &compressed);
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, compressed, "compressed pages\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+
+    // the contents come back
+    fbl::Array<uint8_t> read_buf(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+    status = vmo->Read(read_buf.get(), 0, alloc_size, nullptr);
+    EXPECT_EQ(ZX_OK, status, "reading from object\n");
+    EXPECT_EQ(0, memcmp(buf.get(), read_buf.get(), alloc_size), "decompressed contents\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "allocated pages\n");
+
+    // the page that was used while cold is left mapped for a few passes
+    offset = 0;
+    vmo->CompressColdPages(&offset, 64, 0, &compressed);
+    offset = 0;
+    vmo->CompressColdPages(&offset, 64, 0, &compressed);
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, compressed, "compressed pages\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+
+    // but gets there in the end
+    size_t total = 0;
+    for (int pass = 0; pass < 16 && vmo->AllocatedPages() > 0; pass++) {
+        offset = 0;
+        vmo->CompressColdPages(&offset, 64, 0, &compressed);
+        total += compressed;
+    }
+    EXPECT_EQ(1u, total, "compressed pages\n");
+
+    // compressed pages can be pinned and decommitted
+    status = vmo->Pin(0, PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "pinning object\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+    vmo->Unpin(0, PAGE_SIZE);
+    uint64_t decommitted;
+    status = vmo->DecommitRange(0, alloc_size, &decommitted);
+    EXPECT_EQ(ZX_OK, status, "decommitting object\n");
+    EXPECT_EQ(alloc_size, decommitted, "decommitted bytes\n");
+
+    END_TEST;
+}
+
 // TODO(ZX-1431): The ARM code's error codes are always ZX_ERR_INTERNAL, so
 // special case that.
 #if ARCH_ARM64
@@ -994,6 +1186,9 @@ VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
 VM_UNITTEST(vmo_cache_test)
 VM_UNITTEST(vmo_lookup_test)
+VM_UNITTEST(vmo_reclaim_zero_pages_test)
+VM_UNITTEST(vmo_lookup_clone_reclaim_test)
+VM_UNITTEST(vmo_compress_cold_pages_test)
 VM_UNITTEST(arch_noncontiguous_map)
 // Uncomment for debugging
 // VM_UNITTEST(dump_all_aspaces)  // Run last
@@ -0,0 +1,92 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/zero_page_scanner.h>
+
+#include "vm_priv.h"
+
+#include <fbl/algorithm.h>
+#include <fbl/atomic.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <trace.h>
+#include <vm/arch_vm_aspace.h>
+#include <vm/vm.h>
+#include <vm/vm_object.h>
+#include <zircon/types.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+KCOUNTER(zero_scan_vmos, "kernel.vm.zero_scan.vmos");
+KCOUNTER(zero_scan_pages, "kernel.vm.zero_scan.pages");
+KCOUNTER(zero_scan_reclaimed, "kernel.vm.zero_scan.reclaimed");
+
+// How often the scanner wakes up, and how much it may look at each time.
+static constexpr zx_duration_t kScanInterval = ZX_MSEC(100);
+static constexpr uint64_t kScansPerSecond = ZX_SEC(1) / kScanInterval;
+
+static fbl::atomic<uint64_t> reclaimed_bytes;
+
+uint64_t zero_page_scanner_reclaimed_bytes() {
+    return reclaimed_bytes.load();
+}
+
+static int zero_page_scanner_loop(void* arg) {
+    const size_t pages_per_scan =
+        fbl::max<size_t>(static_cast<size_t>(reinterpret_cast<uintptr_t>(arg)) / kScansPerSecond, 1);
+
+    VmoScanCursor cursor;
+    while (true) {
+        thread_sleep_relative(kScanInterval);
+
+        cursor.Scan(pages_per_scan, [](VmObject* vmo, uint64_t* offset, size_t max_pages) {
+            kcounter_add(zero_scan_vmos, *offset == 0);
+
+            // Device and uncached memory is not ours to deduplicate.
+            uint32_t cache_policy;
+            if (vmo->GetMappingCachePolicy(&cache_policy) == ZX_OK &&
+                cache_policy != ARCH_MMU_FLAG_CACHED) {
+                *offset = UINT64_MAX;
+                return static_cast<size_t>(0);
+            }
+
+            size_t freed;
+            size_t scanned = vmo->ReclaimZeroPages(offset, max_pages, &freed);
+            kcounter_add(zero_scan_pages, scanned);
+            if (freed > 0) {
+                kcounter_add(zero_scan_reclaimed, freed);
+                reclaimed_bytes.fetch_add(freed * PAGE_SIZE);
+                LTRACEF("freed %zu zero pages from vmo %p\n", freed, vmo);
+            }
+            return scanned;
+        });
+    }
+
+    return 0;
+}
+
+static void zero_page_scanner_init(uint level) {
+    // Be sure to update kernel_cmdline.md if any of these defaults change.
+    if (!cmdline_get_bool("kernel.zero-scanner.enable", true)) {
+        printf("zero page scanner: disabled\n");
+        return;
+    }
+    const uint64_t pages_per_sec = cmdline_get_uint64("kernel.zero-scanner.pages-per-sec", 1024);
+
+    thread_t* t = thread_create("zero-scanner", zero_page_scanner_loop,
+                                reinterpret_cast<void*>(static_cast<uintptr_t>(pages_per_sec)),
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        printf("zero page scanner: failed to create thread\n");
+        return;
+    }
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(zero_page_scanner, zero_page_scanner_init, LK_INIT_LEVEL_LAST);
@@ -23,9 +23,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <threads.h>
 
 #include "block-watcher.h"
 
@@ -150,6 +152,57 @@ static int ramctl_watcher(void* arg) {
 #define HND_BOOTFS(n) PA_HND(PA_VMO_BOOTFS, n)
 #define HND_BOOTDATA(n) PA_HND(PA_VMO_BOOTDATA, n)
 
+#define MAX_DECOMPRESS_THREADS 16
+
+struct for_each_work {
+    void (*fn)(void* arg, size_t n);
+    void* arg;
+    size_t count;
+    atomic_size_t next;
+};
+
+static int for_each_worker(void* arg) {
+    struct for_each_work* work = arg;
+    size_t n;
+    while ((n = atomic_fetch_add(&work->next, 1)) < work->count) {
+        work->fn(work->arg, n);
+    }
+    return 0;
+}
+
+// Spreads the blocks of compressed bootdata across a thread per CPU.
+static void for_each_parallel(void (*fn)(void* arg, size_t n), void* arg, size_t count) {
+    struct for_each_work work = {
+        .fn = fn,
+        .arg = arg,
+        .count = count,
+        .next = ATOMIC_VAR_INIT(0),
+    };
+
+    size_t nthreads = zx_system_get_num_cpus();
+    if (nthreads > count) {
+        nthreads = count;
+    }
+    if (nthreads > MAX_DECOMPRESS_THREADS) {
+        nthreads = MAX_DECOMPRESS_THREADS;
+    }
+
+    // This thread does its share of the work too, and picks up the slack
+    // if any of the others can't be started.
+    thrd_t threads[MAX_DECOMPRESS_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < nthreads; i++) {
+        if (thrd_create_with_name(&threads[started], for_each_worker, &work,
+                                  "bootfs-decompress") == thrd_success) {
+            started++;
+        }
+    }
+    for_each_worker(&work);
+    for (size_t i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+}
+
 static void setup_bootfs(void) {
     zx_handle_t vmo;
     unsigned idx = 0;
@@ -200,9 +253,9 @@ static void setup_bootfs(void) {
             case BOOTDATA_BOOTFS_SYSTEM: {
                 const char* errmsg;
                 zx_handle_t bootfs_vmo;
-                status = decompress_bootdata(zx_vmar_root_self(), vmo,
-                                             off, bootdata.length + sizeof(bootdata_t),
-                                             &bootfs_vmo, &errmsg);
+                status = decompress_bootdata_parallel(zx_vmar_root_self(), vmo,
+                                                      off, bootdata.length + sizeof(bootdata_t),
+                                                      for_each_parallel, &bootfs_vmo, &errmsg);
                 if (status < 0) {
                     printf("devmgr: failed to decompress bootdata: %s\n", errmsg);
                 } else {
@@ -213,10 +266,10 @@ static void setup_bootfs(void) {
             case BOOTDATA_RAMDISK: {
                 const char* errmsg;
                 zx_handle_t ramdisk_vmo;
-                status = decompress_bootdata(
+                status = decompress_bootdata_parallel(
                     zx_vmar_root_self(), vmo,
                     off, bootdata.length + sizeof(bootdata_t),
-                    &ramdisk_vmo, &errmsg);
+                    for_each_parallel, &ramdisk_vmo, &errmsg);
                 if (status != ZX_OK) {
                     printf("fshost: failed to decompress bootdata: %s\n",
                            errmsg);
@@ -179,7 +179,8 @@ static bool cmd_is_read(uint8_t cmd) {
 static bool cmd_is_write(uint8_t cmd) {
     if (cmd == SATA_CMD_WRITE_DMA ||
         cmd == SATA_CMD_WRITE_DMA_EXT ||
-        cmd == SATA_CMD_WRITE_FPDMA_QUEUED) {
+        cmd == SATA_CMD_WRITE_FPDMA_QUEUED ||
+        cmd == SATA_CMD_DATA_SET_MANAGEMENT) {
         return true;
     } else {
         return false;
@@ -208,11 +209,15 @@ static zx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
     assert(!ahci_port_cmd_busy(port, slot));
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    zx_status_t status = iotxn_physmap(txn);
-    if (status != ZX_OK) {
-        iotxn_complete(txn, status, 0);
-        completion_signal(&dev->worker_completion);
-        return status;
+    zx_status_t status;
+    // commands without a data phase, like flush, have nothing to map
+    if (txn->length > 0) {
+        status = iotxn_physmap(txn);
+        if (status != ZX_OK) {
+            iotxn_complete(txn, status, 0);
+            completion_signal(&dev->worker_completion);
+            return status;
+        }
     }
     iotxn_phys_iter_t iter;
     iotxn_phys_iter_init(&iter, txn, AHCI_PRD_MAX_SIZE);
@@ -262,6 +267,10 @@ static zx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
         cfis[11] = (pdata->count >> 8) & 0xff;
         cfis[12] = (slot << 3) & 0xff; // tag
         cfis[13] = 0; // normal priority
+    } else if (pdata->cmd == SATA_CMD_DATA_SET_MANAGEMENT) {
+        cfis[3] = SATA_DSM_FEATURE_TRIM;
+        cfis[12] = pdata->count & 0xff; // blocks of ranges
+        cfis[13] = (pdata->count >> 8) & 0xff;
     }
 
     cl->prdtl = 0;
@@ -317,7 +326,12 @@ static zx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
 
     // set the watchdog
     // TODO: general timeout mechanism
-    pdata->timeout = zx_time_get(ZX_CLOCK_MONOTONIC) + ZX_SEC(1);
+    // flushing a large write cache or trimming a large range can take a while
+    zx_duration_t timeout = ZX_SEC(1);
+    if (pdata->cmd == SATA_CMD_FLUSH_EXT || pdata->cmd == SATA_CMD_DATA_SET_MANAGEMENT) {
+        timeout = ZX_SEC(30);
+    }
+    pdata->timeout = zx_time_get(ZX_CLOCK_MONOTONIC) + timeout;
     completion_signal(&dev->watchdog_completion);
     return ZX_OK;
 }
@@ -428,8 +442,8 @@ static void ahci_iotxn_queue(void* ctx, iotxn_t* txn) {
     zxlogf(SPEW, "ahci.%d: queue_txn txn %p offset 0x%" PRIx64 " length 0x%" PRIx64 "\n",
             port->nr, txn, txn->offset, txn->length);
 
-    // complete empty txns immediately
-    if (txn->length == 0) {
+    // complete empty txns immediately, unless the command itself does something
+    if (txn->length == 0 && pdata->cmd != SATA_CMD_FLUSH_EXT) {
         iotxn_complete(txn, ZX_OK, txn->length);
         return;
     }
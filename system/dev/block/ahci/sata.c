@@ -27,6 +27,7 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_TRIM  (1 << 2)
 
 typedef struct sata_device {
     zx_device_t* zxdev;
@@ -147,9 +148,16 @@ static zx_status_t sata_device_identify(sata_device_t* dev, zx_device_t* control
     } else {
         zxlogf(INFO, "  CHS unsupported!\n");
     }
+    if (*(devinfo + SATA_DEVINFO_DATA_SET_MGMT) & (1 << 0)) {
+        flags |= SATA_FLAG_TRIM;
+        zxlogf(INFO, "  TRIM\n");
+    }
     dev->flags = flags;
 
     memset(&dev->info, 0, sizeof(dev->info));
+    if (flags & SATA_FLAG_TRIM) {
+        dev->info.flags |= BLOCK_FLAG_TRIM_SUPPORT;
+    }
     dev->info.block_size = dev->sector_sz;
     dev->info.block_count = dev->capacity / dev->sector_sz;
 
@@ -163,12 +171,115 @@ static zx_status_t sata_device_identify(sata_device_t* dev, zx_device_t* control
     return ZX_OK;
 }
 
+// A trim in progress. Each DATA SET MANAGEMENT command covers one block of
+// ranges; anything left over is sent as the previous command completes.
+typedef struct sata_trim {
+    sata_device_t* device;
+    iotxn_t* txn;
+    uint64_t lba;
+    uint64_t remaining; // in sectors
+} sata_trim_t;
+
+static void sata_trim_fill(sata_trim_t* trim, iotxn_t* dsm) {
+    uint64_t ranges[SATA_DSM_RANGES_PER_BLOCK];
+    memset(ranges, 0, sizeof(ranges));
+    for (size_t i = 0; i < SATA_DSM_RANGES_PER_BLOCK && trim->remaining > 0; i++) {
+        uint64_t count = MIN(trim->remaining, SATA_DSM_RANGE_MAX);
+        ranges[i] = (trim->lba & 0xffffffffffffull) | (count << 48);
+        trim->lba += count;
+        trim->remaining -= count;
+    }
+    iotxn_copyto(dsm, ranges, sizeof(ranges), 0);
+
+    sata_pdata_t* pdata = sata_iotxn_pdata(dsm);
+    pdata->cmd = SATA_CMD_DATA_SET_MANAGEMENT;
+    pdata->device = 0x40;
+    pdata->lba = 0;
+    pdata->count = 1;
+    pdata->max_cmd = trim->device->max_cmd;
+    pdata->port = trim->device->port;
+    dsm->opcode = IOTXN_OP_WRITE;
+    dsm->offset = 0;
+    dsm->length = SATA_DSM_BLOCK_SIZE;
+    // not an NCQ command, so it can't overlap the queued ones
+    dsm->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
+}
+
+static void sata_trim_complete(iotxn_t* dsm, void* cookie) {
+    sata_trim_t* trim = cookie;
+    if (dsm->status == ZX_OK && trim->remaining > 0) {
+        sata_trim_fill(trim, dsm);
+        iotxn_queue(trim->device->parent, dsm);
+        return;
+    }
+    iotxn_complete(trim->txn, dsm->status, 0);
+    iotxn_release(dsm);
+    free(trim);
+}
+
+static void sata_trim(sata_device_t* device, iotxn_t* txn) {
+    if (!(device->flags & SATA_FLAG_TRIM)) {
+        iotxn_complete(txn, ZX_ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+    if ((txn->offset % device->sector_sz) || (txn->length % device->sector_sz)) {
+        iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
+        return;
+    }
+    if (txn->offset >= device->capacity) {
+        iotxn_complete(txn, ZX_ERR_OUT_OF_RANGE, 0);
+        return;
+    }
+    uint64_t length = MIN(txn->length, device->capacity - txn->offset);
+    if (length == 0) {
+        iotxn_complete(txn, ZX_OK, 0);
+        return;
+    }
+
+    sata_trim_t* trim = malloc(sizeof(sata_trim_t));
+    if (trim == NULL) {
+        iotxn_complete(txn, ZX_ERR_NO_MEMORY, 0);
+        return;
+    }
+    iotxn_t* dsm;
+    zx_status_t status = iotxn_alloc(&dsm, IOTXN_ALLOC_POOL, SATA_DSM_BLOCK_SIZE);
+    if (status != ZX_OK) {
+        free(trim);
+        iotxn_complete(txn, status, 0);
+        return;
+    }
+    trim->device = device;
+    trim->txn = txn;
+    trim->lba = txn->offset / device->sector_sz;
+    trim->remaining = length / device->sector_sz;
+    dsm->complete_cb = sata_trim_complete;
+    dsm->cookie = trim;
+    sata_trim_fill(trim, dsm);
+    iotxn_queue(device->parent, dsm);
+}
+
 // implement device protocol:
 
 static zx_protocol_device_t sata_device_proto;
 
 static void sata_iotxn_queue(void* ctx, iotxn_t* txn) {
     sata_device_t* device = ctx;
+    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+
+    if (txn->opcode == IOTXN_OP_FLUSH) {
+        pdata->cmd = SATA_CMD_FLUSH_EXT;
+        pdata->device = 0x40;
+        pdata->lba = 0;
+        pdata->count = 0;
+        pdata->max_cmd = device->max_cmd;
+        pdata->port = device->port;
+        txn->length = 0;
+        iotxn_queue(device->parent, txn);
+        return;
+    } else if (txn->opcode == IOTXN_OP_TRIM) {
+        sata_trim(device, txn);
+        return;
+    }
 
     // offset must be aligned to block size
     if (txn->offset % device->sector_sz) {
@@ -191,7 +302,6 @@ static void sata_iotxn_queue(void* ctx, iotxn_t* txn) {
         return;
     }
 
-    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
     pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
     pdata->device = 0x40;
     pdata->lba = txn->offset / device->sector_sz;
@@ -234,8 +344,8 @@ static zx_status_t sata_ioctl(void* ctx, uint32_t op, const void* cmd, size_t cm
             return status;
         }
         completion_t completion = COMPLETION_INIT;
-        txn->opcode = IOTXN_OP_READ;
-        txn->flags = IOTXN_SYNC_BEFORE;
+        txn->opcode = IOTXN_OP_FLUSH;
+        txn->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
         txn->offset = 0;
         txn->length = 0;
         txn->complete_cb = sata_sync_complete;
@@ -7,12 +7,14 @@
 #include "ahci.h"
 
 #define SATA_CMD_IDENTIFY_DEVICE      0xec
+#define SATA_CMD_DATA_SET_MANAGEMENT  0x06
 #define SATA_CMD_READ_DMA             0xc8
 #define SATA_CMD_READ_DMA_EXT         0x25
 #define SATA_CMD_READ_FPDMA_QUEUED    0x60
 #define SATA_CMD_WRITE_DMA            0xca
 #define SATA_CMD_WRITE_DMA_EXT        0x35
 #define SATA_CMD_WRITE_FPDMA_QUEUED   0x61
+#define SATA_CMD_FLUSH_EXT            0xea
 
 #define SATA_DEVINFO_SERIAL              10
 #define SATA_DEVINFO_FW_REV              23
@@ -27,6 +29,7 @@
 #define SATA_DEVINFO_LBA_CAPACITY_2      100
 #define SATA_DEVINFO_SECTOR_SIZE         106
 #define SATA_DEVINFO_LOGICAL_SECTOR_SIZE 117
+#define SATA_DEVINFO_DATA_SET_MGMT       169
 
 #define SATA_DEVINFO_SERIAL_LEN   20
 #define SATA_DEVINFO_FW_REV_LEN   8
@@ -34,6 +37,12 @@
 
 #define SATA_MAX_BLOCK_COUNT  0x10000 // 16-bit count
 
+// DATA SET MANAGEMENT takes 512 byte blocks of 8 byte (lba, count) ranges
+#define SATA_DSM_FEATURE_TRIM     0x01
+#define SATA_DSM_BLOCK_SIZE       512
+#define SATA_DSM_RANGES_PER_BLOCK (SATA_DSM_BLOCK_SIZE / sizeof(uint64_t))
+#define SATA_DSM_RANGE_MAX        0xffff // sectors
+
 typedef struct sata_pdata {
     zx_time_t timeout; // for ahci driver watchdog
     uint64_t lba;   // in blocks
@@ -5,6 +5,7 @@
 #include <unistd.h>
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <ddk/device.h>
@@ -48,8 +49,10 @@ void OutOfBandErrorRespond(const zx::fifo& fifo, zx_status_t status, txnid_t txn
 void BlockComplete(void* cookie, zx_status_t status) {
     block_msg_t* msg = static_cast<block_msg_t*>(cookie);
     // Since iobuf is a RefPtr, it lives at least as long as the txn,
-    // and is not discarded underneath the block device driver.
-    ZX_DEBUG_ASSERT(msg->iobuf != nullptr);
+    // and is not discarded underneath the block device driver.  Flushes
+    // and trims don't touch a vmo.
+    ZX_DEBUG_ASSERT(msg->iobuf != nullptr || msg->opcode == BLOCKIO_SYNC ||
+                    msg->opcode == BLOCKIO_TRIM);
     ZX_DEBUG_ASSERT(msg->txn != nullptr);
     // Hold an extra copy of the 'blktxn' refptr; if we don't, and 'msg->txn' is
     // the last copy, then when we nullify 'msg->txn' in Complete we end up
@@ -61,7 +64,15 @@ void BlockComplete(void* cookie, zx_status_t status) {
 }
 
 void BlockCompleteIotxn(iotxn_t* txn, void* cookie) {
-    BlockComplete(cookie, txn->status);
+    // A merged iotxn completes every message it was built from.
+    block_msg_t* msg = static_cast<block_msg_t*>(cookie);
+    while (msg != nullptr) {
+        // Completing the message may free it along with its transaction.
+        block_msg_t* next = msg->merge_next;
+        msg->merge_next = nullptr;
+        BlockComplete(msg, txn->status);
+        msg = next;
+    }
     iotxn_release(txn);
 }
 
@@ -82,11 +93,53 @@ void IotxnQueue(zx_device_t* dev, uint32_t flags, zx_handle_t vmo, uint64_t leng
     iotxn_queue(dev, txn);
 }
 
+// Queues an iotxn with no data buffer, for a flush or a trim.
+void NoDataQueue(zx_device_t* dev, uint32_t flags, uint32_t opcode, uint64_t length,
+                 uint64_t dev_offset, block_msg_t* msg) {
+    iotxn_t* txn;
+    zx_status_t status;
+    if ((status = iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0)) != ZX_OK) {
+        BlockComplete(msg, status);
+        return;
+    }
+    txn->flags = flags;
+    txn->opcode = opcode;
+    txn->offset = dev_offset;
+    txn->length = length;
+    txn->cookie = msg;
+    txn->complete_cb = BlockCompleteIotxn;
+    iotxn_queue(dev, txn);
+}
+
 }  // namespace
 
+SplitTracker::SplitTracker() : count_(0), done_() {
+    completion_signal(&done_);
+}
+
+void SplitTracker::Begin() {
+    fbl::AutoLock lock(&lock_);
+    if (count_++ == 0) {
+        completion_reset(&done_);
+    }
+}
+
+void SplitTracker::End() {
+    fbl::AutoLock lock(&lock_);
+    ZX_DEBUG_ASSERT(count_ > 0);
+    if (--count_ == 0) {
+        completion_signal(&done_);
+    }
+}
+
+void SplitTracker::Wait() {
+    completion_wait(&done_, ZX_TIME_INFINITE);
+}
+
 BlockTransaction::BlockTransaction(zx_handle_t fifo, txnid_t txnid, zx_device_t* dev,
-                                   uint32_t max_xfer) :
-    fifo_(fifo), dev_(dev), max_xfer_(max_xfer), flags_(0), goal_(0) {
+                                   uint32_t max_xfer, fbl::RefPtr<SplitTracker> splits) :
+    fifo_(fifo), dev_(dev), max_xfer_(max_xfer), splits_(fbl::move(splits)), flags_(0),
+    goal_(0) {
     memset(&response_, 0, sizeof(response_));
     response_.txnid = txnid;
 }
@@ -113,6 +166,7 @@ zx_status_t BlockTransaction::Enqueue(bool do_respond, block_msg_t** msg_out) {
     } else {
         msgs_[goal_].flags = 0;
     }
+    msgs_[goal_].merge_next = nullptr;
     *msg_out = &msgs_[goal_++];
     flags_ |= do_respond ? kTxnFlagRespond : 0;
     return ZX_OK;
@@ -143,9 +197,17 @@ void BlockTransaction::Complete(block_msg_t* msg, zx_status_t status) {
         uint32_t flags = msg->flags & ~(IOTXN_SYNC_BEFORE |
                                         (msg->len_remaining > 0 ? IOTXN_SYNC_AFTER : 0));
 
+        const bool last = msg->len_remaining == 0;
         IotxnQueue(dev_, flags, msg->iobuf->vmo(), length, vmo_offset, dev_offset, msg);
+        if (last) {
+            splits_->End();
+        }
         return;
     }
+    if (msg->len_remaining != 0) {
+        // The rest of this message failed along with it.
+        splits_->End();
+    }
     fbl::AutoLock lock(&lock_);
     response_.count++;
     ZX_DEBUG_ASSERT(goal_ != 0);
@@ -253,7 +315,8 @@ zx_status_t BlockServer::AllocateTxn(txnid_t* out) {
             fbl::AllocChecker ac;
             txns_[i] = fbl::AdoptRef(new (&ac) BlockTransaction(fifo_.get(),
                                                                 txnid, dev_,
-                                                                info_.max_transfer_size));
+                                                                info_.max_transfer_size,
+                                                                splits_));
             if (!ac.check()) {
                 return ZX_ERR_NO_MEMORY;
             }
@@ -279,6 +342,11 @@ zx_status_t BlockServer::Create(zx_device_t* dev, zx::fifo* fifo_out, BlockServe
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
     }
+    bs->splits_ = fbl::AdoptRef(new (&ac) SplitTracker());
+    if (!ac.check()) {
+        delete bs;
+        return ZX_ERR_NO_MEMORY;
+    }
 
     zx_status_t status;
     if ((status = zx::fifo::create(BLOCK_FIFO_MAX_DEPTH, BLOCK_FIFO_ESIZE, 0,
@@ -307,7 +375,8 @@ zx_status_t BlockServer::Serve() {
 
             fbl::AutoLock server_lock(&server_lock_);
             auto iobuf = tree_.find(vmoid);
-            if (!iobuf.IsValid()) {
+            const uint32_t opcode = requests[i].opcode & BLOCKIO_OP_MASK;
+            if (!iobuf.IsValid() && opcode != BLOCKIO_SYNC && opcode != BLOCKIO_TRIM) {
                 // Operation which is not accessing a valid vmo
                 if (wants_reply) {
                     OutOfBandErrorRespond(fifo_, ZX_ERR_IO, txnid);
@@ -322,7 +391,7 @@ zx_status_t BlockServer::Serve() {
                 continue;
             }
 
-            switch (requests[i].opcode & BLOCKIO_OP_MASK) {
+            switch (opcode) {
             case BLOCKIO_READ:
             case BLOCKIO_WRITE: {
                 if (requests[i].length > fbl::numeric_limits<uint32_t>::max()) {
@@ -352,31 +421,58 @@ zx_status_t BlockServer::Serve() {
                     break;
                 }
 
-                uint32_t flags = msg->flags;
-                uint64_t length = requests[i].length;
+                pending_op_t op;
+                op.head = msg;
+                op.tail = msg;
+                op.iobuf = msg->iobuf.get();
+                op.flags = msg->flags;
+                op.length = requests[i].length;
+                op.vmo_offset = requests[i].vmo_offset;
+                op.dev_offset = requests[i].dev_offset;
                 const uint32_t max_xfer = info_.max_transfer_size;
                 if (max_xfer != 0 && max_xfer < requests[i].length) {
                     msg->len_remaining = static_cast<uint32_t>(requests[i].length) - max_xfer;
                     msg->vmo_offset = requests[i].vmo_offset + max_xfer;
                     msg->dev_offset = requests[i].dev_offset + max_xfer;
-                    length = max_xfer;
-
-                    // If the final message in this transaction group
-                    // is split across multiple sub-messages, then only sync on
-                    // the final sub-message.
-                    flags |= ~IOTXN_SYNC_AFTER;
+                    op.length = max_xfer;
+                    op.split = true;
                 } else {
                     msg->len_remaining = 0;
+                    op.split = false;
                 }
                 msg->opcode = requests[i].opcode & BLOCKIO_OP_MASK;
+                op.opcode = msg->opcode;
 
-                IotxnQueue(dev_, flags, iobuf->vmo(), length, requests[i].vmo_offset,
-                           requests[i].dev_offset, msg);
+                Queue(op);
                 break;
             }
-            case BLOCKIO_SYNC: {
-                // TODO(smklein): It might be more useful to have this on a per-vmo basis
-                fprintf(stderr, "Warning: BLOCKIO_SYNC is currently unimplemented\n");
+            case BLOCKIO_SYNC:
+            case BLOCKIO_TRIM: {
+                block_msg_t* msg;
+                status = txns_[txnid]->Enqueue(wants_reply, &msg);
+                if (status != ZX_OK) {
+                    break;
+                }
+                ZX_DEBUG_ASSERT(msg->txn == nullptr);
+                msg->txn = txns_[txnid];
+                msg->len_remaining = 0;
+                msg->opcode = opcode;
+                // A flush covers every write queued ahead of it, and a trim
+                // may not pass the writes around it, so nothing queued behind
+                // either may start until it is done.
+                msg->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
+
+                pending_op_t op;
+                op.head = msg;
+                op.tail = msg;
+                op.iobuf = nullptr;
+                op.opcode = opcode;
+                op.flags = msg->flags;
+                op.split = false;
+                op.length = opcode == BLOCKIO_TRIM ? requests[i].length : 0;
+                op.vmo_offset = 0;
+                op.dev_offset = opcode == BLOCKIO_TRIM ? requests[i].dev_offset : 0;
+                Queue(op);
                 break;
             }
             case BLOCKIO_CLOSE_VMO: {
@@ -392,10 +488,112 @@ zx_status_t BlockServer::Serve() {
             }
             }
         }
+        FlushPending();
+    }
+}
+
+void BlockServer::Queue(const pending_op_t& op) {
+    if (!merge_) {
+        pending_[0] = op;
+        IssueUnordered(&pending_[0], 1);
+        return;
+    }
+    ZX_DEBUG_ASSERT(pending_count_ < fbl::count_of(pending_));
+    pending_[pending_count_++] = op;
+}
+
+void BlockServer::FlushPending() {
+    // The window is whatever was read from the fifo in one go.  Barriers
+    // split it into runs which may be reordered internally, but not past
+    // each other.
+    size_t start = 0;
+    for (size_t i = 0; i < pending_count_; i++) {
+        if ((i + 1 == pending_count_) || (pending_[i].flags & IOTXN_SYNC_AFTER) ||
+            (pending_[i + 1].flags & IOTXN_SYNC_BEFORE)) {
+            IssueUnordered(&pending_[start], i + 1 - start);
+            start = i + 1;
+        }
+    }
+    pending_count_ = 0;
+}
+
+bool BlockServer::CanMerge(const pending_op_t& a, const pending_op_t& b) const {
+    if (a.opcode != b.opcode || a.iobuf != b.iobuf || a.split || b.split) {
+        return false;
+    }
+    if (a.dev_offset + a.length != b.dev_offset || a.vmo_offset + a.length != b.vmo_offset) {
+        return false;
+    }
+    const uint32_t max_xfer = info_.max_transfer_size;
+    return max_xfer == 0 || a.length + b.length <= max_xfer;
+}
+
+void BlockServer::IssueUnordered(pending_op_t* ops, size_t count) {
+    const uint32_t sync_before = ops[0].flags & IOTXN_SYNC_BEFORE;
+    const uint32_t sync_after = ops[count - 1].flags & IOTXN_SYNC_AFTER;
+
+    // Sort by device offset, keeping arrival order for ties.  The window is
+    // small, so insertion sort is fine.
+    for (size_t i = 1; i < count; i++) {
+        pending_op_t op = ops[i];
+        size_t j = i;
+        while (j > 0 && ops[j - 1].dev_offset > op.dev_offset) {
+            ops[j] = ops[j - 1];
+            j--;
+        }
+        ops[j] = op;
+    }
+
+    // Coalesce requests which are contiguous both on the device and in the vmo.
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out > 0 && CanMerge(ops[out - 1], ops[i])) {
+            pending_op_t* prev = &ops[out - 1];
+            prev->tail->merge_next = ops[i].head;
+            prev->tail = ops[i].tail;
+            prev->length += ops[i].length;
+            continue;
+        }
+        ops[out++] = ops[i];
+    }
+
+    for (size_t i = 0; i < out; i++) {
+        uint32_t flags = (i == 0 ? sync_before : 0) | (i == out - 1 ? sync_after : 0);
+        // The flags are kept on the message so that the remainder of a split
+        // request is issued with them.  Only the final piece of a split
+        // request syncs after.
+        ops[i].head->flags = flags;
+        if (ops[i].split) {
+            flags &= ~IOTXN_SYNC_AFTER;
+        }
+        if (ops[i].opcode == BLOCKIO_SYNC || ops[i].opcode == BLOCKIO_TRIM) {
+            // The rest of a split request is only issued as its earlier pieces
+            // complete, so the device can't order the flush or trim after it
+            // yet.
+            splits_->Wait();
+            if (ops[i].opcode == BLOCKIO_SYNC) {
+                NoDataQueue(dev_, flags, IOTXN_OP_FLUSH, 0, 0, ops[i].head);
+            } else {
+                NoDataQueue(dev_, flags, IOTXN_OP_TRIM, ops[i].length, ops[i].dev_offset,
+                            ops[i].head);
+            }
+            continue;
+        }
+        if (ops[i].split) {
+            // Counted only once issued, so that a barrier ahead of it in the
+            // same window doesn't wait for a request that hasn't started.
+            splits_->Begin();
+        }
+        IotxnQueue(dev_, flags, ops[i].iobuf->vmo(), ops[i].length, ops[i].vmo_offset,
+                   ops[i].dev_offset, ops[i].head);
     }
 }
 
-BlockServer::BlockServer(zx_device_t* dev) : dev_(dev), last_id_(VMOID_INVALID + 1) {
+BlockServer::BlockServer(zx_device_t* dev) :
+    dev_(dev), merge_(false), pending_count_(0), last_id_(VMOID_INVALID + 1) {
+    const char* merge = getenv("driver.block.merge");
+    merge_ = merge != nullptr && strcmp(merge, "0") && strcmp(merge, "false") &&
+             strcmp(merge, "off");
     size_t actual;
     device_ioctl(dev_, IOCTL_BLOCK_GET_INFO, nullptr, 0, &info_, sizeof(info_), &actual);
 }
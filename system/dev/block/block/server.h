@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <sync/completion.h>
 #include <zircon/device/block.h>
 #include <zircon/thread_annotations.h>
 #include <zircon/types.h>
@@ -49,9 +50,32 @@ private:
 
 constexpr uint32_t kTxnFlagRespond = 0x00000001; // Should a reponse be sent when we hit goal?
 
+// Counts messages which were split into several iotxns and still have pieces
+// to hand to the device. Transactions may outlive the server, so they share
+// ownership of it.
+class SplitTracker : public fbl::RefCounted<SplitTracker> {
+public:
+    SplitTracker();
+
+    void Begin();
+    void End();
+    // Blocks until every split message has been handed to the device in full.
+    // Only the thread which calls Begin() may wait.
+    void Wait();
+
+private:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(SplitTracker);
+
+    fbl::Mutex lock_;
+    uint32_t count_ TA_GUARDED(lock_);
+    completion_t done_;
+};
+
 class BlockTransaction;
 
-typedef struct {
+typedef struct block_msg block_msg_t;
+
+struct block_msg {
     fbl::RefPtr<BlockTransaction> txn;
     fbl::RefPtr<IoBuffer> iobuf;
     uint32_t opcode;
@@ -59,12 +83,14 @@ typedef struct {
     uint32_t len_remaining;
     uint64_t vmo_offset;
     uint64_t dev_offset;
-} block_msg_t;
+    // The next message served by the same iotxn, if requests were merged.
+    block_msg_t* merge_next;
+};
 
 class BlockTransaction : public fbl::RefCounted<BlockTransaction> {
 public:
     BlockTransaction(zx_handle_t fifo, txnid_t txnid, zx_device_t* dev,
-                     uint32_t max_xfer);
+                     uint32_t max_xfer, fbl::RefPtr<SplitTracker> splits);
     ~BlockTransaction();
 
     // Verifies that the incoming txn does not break the Block IO fifo protocol.
@@ -81,6 +107,7 @@ private:
     const zx_handle_t fifo_;
     zx_device_t* dev_;
     const uint32_t max_xfer_;
+    const fbl::RefPtr<SplitTracker> splits_;
 
     fbl::Mutex lock_;
     block_msg_t msgs_[MAX_TXN_MESSAGES] TA_GUARDED(lock_);
@@ -107,12 +134,42 @@ private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(BlockServer);
     BlockServer(zx_device_t* dev);
 
+    // A request which has been accepted from the fifo, but not yet
+    // handed to the device.
+    typedef struct {
+        block_msg_t* head;
+        block_msg_t* tail;
+        IoBuffer* iobuf;
+        uint32_t opcode;
+        uint32_t flags;
+        bool split; // Larger than max_transfer_size; the rest follows on completion.
+        uint64_t length;
+        uint64_t vmo_offset;
+        uint64_t dev_offset;
+    } pending_op_t;
+
     zx_status_t Read(block_fifo_request_t* requests, uint32_t* count);
     zx_status_t FindVmoIDLocked(vmoid_t* out) TA_REQ(server_lock_);
 
+    // Hands a message to the device, or holds it in the scheduling window if
+    // merging is enabled.
+    void Queue(const pending_op_t& op);
+    // Issues everything in the scheduling window.
+    void FlushPending();
+    // Sorts and coalesces a run of ops with no ordering between them, and
+    // issues the result with the run's barriers on its first and last iotxns.
+    void IssueUnordered(pending_op_t* ops, size_t count);
+    bool CanMerge(const pending_op_t& a, const pending_op_t& b) const;
+
     zx::fifo fifo_;
     zx_device_t* dev_;
     block_info_t info_;
+    fbl::RefPtr<SplitTracker> splits_;
+
+    // Only touched by the thread running Serve().
+    bool merge_;
+    pending_op_t pending_[BLOCK_FIFO_MAX_DEPTH];
+    size_t pending_count_;
 
     fbl::Mutex server_lock_;
     fbl::WAVLTree<vmoid_t, fbl::RefPtr<IoBuffer>> tree_ TA_GUARDED(server_lock_);
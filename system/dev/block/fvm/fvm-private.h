@@ -16,6 +16,8 @@
 
 #ifdef __cplusplus
 
+#include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
 #include <ddktl/device.h>
 #include <ddktl/protocol/block.h>
 #include <fs/mapped-vmo.h>
@@ -83,6 +85,27 @@ private:
     const size_t vslice_start_;
 };
 
+// A run of unallocated physical slices, [start(), end()).
+class FreeSliceExtent : public fbl::WAVLTreeContainable<fbl::unique_ptr<FreeSliceExtent>> {
+public:
+    size_t GetKey() const { return start_; }
+    size_t start() const { return start_; }
+    size_t end() const { return end_; }
+    size_t size() const { return end_ - start_; }
+
+    FreeSliceExtent(size_t start, size_t end)
+        : start_(start), end_(end) {}
+
+private:
+    friend class VPartitionManager;
+    DISALLOW_COPY_ASSIGN_AND_MOVE(FreeSliceExtent);
+
+    // |start_| is the key, and may only change while the extent is not in a
+    // tree.
+    size_t start_;
+    size_t end_;
+};
+
 class VPartitionManager : public ManagerDeviceType {
 public:
     static zx_status_t Create(zx_device_t* dev, fbl::unique_ptr<VPartitionManager>* out);
@@ -95,6 +118,7 @@ public:
 
     // Update, hash, and write back the current copy of the FVM metadata.
     // Automatically handles alternating writes to primary / backup copy of FVM.
+    // Only the blocks which differ from the copy being overwritten are written.
     zx_status_t WriteFvmLocked() TA_REQ(lock_);
 
     // Acquire access to a VPart Entry which has already been modified (and
@@ -156,7 +180,25 @@ private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(VPartitionManager);
 
     zx_status_t FindFreeVPartEntryLocked(size_t* out) const TA_REQ(lock_);
-    zx_status_t FindFreeSliceLocked(size_t* out, size_t hint) const TA_REQ(lock_);
+
+    // Removes a free physical slice from |free_slices_|, preferring |hint|,
+    // then the first free slice after it, and wrapping around to the start
+    // of the disk.  The caller must fill in its slice entry.
+    zx_status_t TakeFreeSliceLocked(size_t* out, size_t hint) TA_REQ(lock_);
+    // Marks |pslice| free in the slice table and returns it to |free_slices_|.
+    void FreeSliceEntryLocked(size_t pslice) TA_REQ(lock_);
+    // Returns |pslice| to |free_slices_|, merging it with its neighbours.
+    void ReleaseFreeSliceLocked(size_t pslice) TA_REQ(lock_);
+    // Recreates |free_slices_| from the slice table.
+    zx_status_t RebuildFreeSlicesLocked() TA_REQ(lock_);
+
+    // Records that [ptr, ptr + len) of the in-memory metadata was modified,
+    // and must be written to both copies on disk.
+    void MarkDirtyLocked(const void* ptr, size_t len) TA_REQ(lock_);
+
+    // Tells the parent device that the physical slices in |pslices| no
+    // longer hold data, if it supports trim.  Failures are ignored.
+    void TrimSlicesLocked(const fbl::Vector<uint32_t>& pslices) TA_REQ(lock_);
 
     fvm_t* GetFvmLocked() const TA_REQ(lock_) {
         return reinterpret_cast<fvm_t*>(metadata_->GetData());
@@ -187,6 +229,16 @@ private:
     fbl::Mutex lock_;
     fbl::unique_ptr<MappedVmo> metadata_ TA_GUARDED(lock_);
     bool first_metadata_is_primary_ TA_GUARDED(lock_);
+
+    // Index of the unallocated physical slices, keyed by the first slice of
+    // each run.  If a memory allocation failure leaves it incomplete, it is
+    // marked stale and rebuilt from the slice table before its next use.
+    fbl::WAVLTree<size_t, fbl::unique_ptr<FreeSliceExtent>> free_slices_ TA_GUARDED(lock_);
+    bool free_slices_stale_ TA_GUARDED(lock_);
+
+    // The FVM_BLOCK_SIZE blocks of metadata which are out of date in the
+    // first (index 0) and second (index 1) on-disk copies of the metadata.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> dirty_[2] TA_GUARDED(lock_);
     size_t metadata_size_;
     size_t slice_size_;
 };
@@ -57,8 +57,8 @@ bool SliceExtent::Merge(const SliceExtent& other) {
 }
 
 VPartitionManager::VPartitionManager(zx_device_t* parent, const block_info_t& info)
-    : ManagerDeviceType(parent), info_(info), metadata_(nullptr), metadata_size_(0),
-      slice_size_(0) {}
+    : ManagerDeviceType(parent), info_(info), metadata_(nullptr), free_slices_stale_(true),
+      metadata_size_(0), slice_size_(0) {}
 
 VPartitionManager::~VPartitionManager() = default;
 
@@ -208,6 +208,21 @@ zx_status_t VPartitionManager::Load() {
         metadata_ = fbl::move(mvmo_backup);
     }
 
+    // The copy which was not loaded may be arbitrarily out of date, so the
+    // first write to it rewrites all of it.
+    const size_t metadata_blocks = MetadataSize() / FVM_BLOCK_SIZE;
+    for (auto& dirty : dirty_) {
+        if ((status = dirty.Reset(metadata_blocks)) != ZX_OK) {
+            return status;
+        }
+    }
+    dirty_[first_metadata_is_primary_ ? 1 : 0].Set(0, metadata_blocks);
+
+    if ((status = RebuildFreeSlicesLocked()) != ZX_OK) {
+        fprintf(stderr, "fvm: Failed to index free slices: %d\n", status);
+        return status;
+    }
+
     // Begin initializing the underlying partitions
     DdkMakeVisible();
     auto_detach.cancel();
@@ -263,35 +278,69 @@ zx_status_t VPartitionManager::Load() {
 }
 
 zx_status_t VPartitionManager::WriteFvmLocked() {
-    iotxn_t* txn = nullptr;
-
-    zx_status_t status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL,
-                                         metadata_->GetVmo(), 0,
-                                         MetadataSize());
-    if (status != ZX_OK) {
-        return status;
+    // If we were reading from the primary, write to the backup.  The backup
+    // was last written one update ago (or not since loading), so every block
+    // modified since then is marked dirty for it.  The superblock changes
+    // on every write.
+    auto& dirty = dirty_[first_metadata_is_primary_ ? 1 : 0];
+    const size_t metadata_blocks = dirty.size();
+    if (FVM_BLOCK_SIZE % info_.block_size) {
+        dirty.Set(0, metadata_blocks);
+    } else {
+        dirty.Set(0, 1);
     }
-    txn->opcode = IOTXN_OP_WRITE;
-    // If we were reading from the primary, write to the backup.
-    txn->offset = BackupOffsetLocked();
-    txn->length = MetadataSize();
 
+    // The hash still covers the entire copy of the metadata, which is how
+    // a torn write is detected on the next load.
     GetFvmLocked()->generation++;
     fvm_update_hash(GetFvmLocked(), MetadataSize());
 
-    iotxn_synchronous_op(parent_, txn);
-    status = txn->status;
-    iotxn_release(txn);
-    if (status != ZX_OK) {
-        return status;
+    size_t end = 0;
+    while ((end = dirty.Scan(end, metadata_blocks, false)) < metadata_blocks) {
+        const size_t start = end;
+        end = dirty.Scan(start, metadata_blocks, true);
+
+        iotxn_t* txn = nullptr;
+        const size_t offset = start * FVM_BLOCK_SIZE;
+        const size_t length = (end - start) * FVM_BLOCK_SIZE;
+        zx_status_t status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL,
+                                             metadata_->GetVmo(), offset, length);
+        if (status != ZX_OK) {
+            return status;
+        }
+        txn->opcode = IOTXN_OP_WRITE;
+        txn->offset = BackupOffsetLocked() + offset;
+        txn->length = length;
+
+        iotxn_synchronous_op(parent_, txn);
+        status = txn->status;
+        iotxn_release(txn);
+        if (status != ZX_OK) {
+            // Anything partially written stays dirty, and is written again
+            // on the next attempt.
+            return status;
+        }
     }
 
     // We only allow the switch of "write to the other copy of metadata"
     // once a valid version has been written entirely.
+    dirty.ClearAll();
     first_metadata_is_primary_ = !first_metadata_is_primary_;
     return ZX_OK;
 }
 
+void VPartitionManager::MarkDirtyLocked(const void* ptr, size_t len) {
+    uintptr_t metadata_start = reinterpret_cast<uintptr_t>(GetFvmLocked());
+    size_t offset = reinterpret_cast<uintptr_t>(ptr) - metadata_start;
+    ZX_DEBUG_ASSERT(len > 0);
+    ZX_DEBUG_ASSERT(offset + len <= MetadataSize());
+    size_t first = offset / FVM_BLOCK_SIZE;
+    size_t last = (offset + len - 1) / FVM_BLOCK_SIZE;
+    for (auto& dirty : dirty_) {
+        dirty.Set(first, last + 1);
+    }
+}
+
 zx_status_t VPartitionManager::FindFreeVPartEntryLocked(size_t* out) const {
     for (size_t i = 1; i < FVM_MAX_ENTRIES; i++) {
         const vpart_entry_t* entry = GetVPartEntryLocked(i);
@@ -303,22 +352,121 @@ zx_status_t VPartitionManager::FindFreeVPartEntryLocked(size_t* out) const {
     return ZX_ERR_NO_SPACE;
 }
 
-zx_status_t VPartitionManager::FindFreeSliceLocked(size_t* out, size_t hint) const {
-    const size_t maxSlices = UsableSlicesCount(DiskSize(), SliceSize());
+zx_status_t VPartitionManager::TakeFreeSliceLocked(size_t* out, size_t hint) {
+    zx_status_t status;
+    if (free_slices_stale_ && (status = RebuildFreeSlicesLocked()) != ZX_OK) {
+        return status;
+    }
+
     hint = fbl::max(hint, 1lu);
-    for (size_t i = hint; i <= maxSlices; i++) {
-        if (GetSliceEntryLocked(i)->vpart == 0) {
-            *out = i;
-            return ZX_OK;
+    size_t pslice;
+    auto extent = --free_slices_.upper_bound(hint);
+    if (extent.IsValid() && hint < extent->end()) {
+        pslice = hint;
+    } else {
+        extent = free_slices_.upper_bound(hint);
+        if (!extent.IsValid()) {
+            extent = free_slices_.begin();
+            if (!extent.IsValid()) {
+                return ZX_ERR_NO_SPACE;
+            }
         }
+        pslice = extent->start();
     }
-    for (size_t i = 1; i < hint; i++) {
-        if (GetSliceEntryLocked(i)->vpart == 0) {
-            *out = i;
-            return ZX_OK;
+
+    if (pslice == extent->start()) {
+        auto remainder = free_slices_.erase(extent);
+        if (remainder->size() > 1) {
+            remainder->start_++;
+            free_slices_.insert(fbl::move(remainder));
         }
+    } else if (pslice + 1 == extent->end()) {
+        extent->end_--;
+    } else {
+        // Taking a slice from the middle of a free run splits it in two.
+        fbl::AllocChecker ac;
+        fbl::unique_ptr<FreeSliceExtent> tail(new (&ac) FreeSliceExtent(pslice + 1,
+                                                                        extent->end()));
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        extent->end_ = pslice;
+        free_slices_.insert(fbl::move(tail));
+    }
+
+    *out = pslice;
+    return ZX_OK;
+}
+
+void VPartitionManager::FreeSliceEntryLocked(size_t pslice) {
+    slice_entry_t* entry = GetSliceEntryLocked(pslice);
+    entry->vpart = PSLICE_UNALLOCATED;
+    MarkDirtyLocked(entry, sizeof(*entry));
+    ReleaseFreeSliceLocked(pslice);
+}
+
+void VPartitionManager::ReleaseFreeSliceLocked(size_t pslice) {
+    if (free_slices_stale_) {
+        return;
+    }
+
+    auto prev = --free_slices_.upper_bound(pslice);
+    auto next = free_slices_.upper_bound(pslice);
+    ZX_DEBUG_ASSERT(!prev.IsValid() || prev->end() <= pslice);
+    bool join_prev = prev.IsValid() && prev->end() == pslice;
+    bool join_next = next.IsValid() && next->start() == pslice + 1;
+
+    if (join_prev && join_next) {
+        prev->end_ = next->end();
+        free_slices_.erase(next);
+    } else if (join_prev) {
+        prev->end_ = pslice + 1;
+    } else if (join_next) {
+        auto extent = free_slices_.erase(next);
+        extent->start_ = pslice;
+        free_slices_.insert(fbl::move(extent));
+    } else {
+        fbl::AllocChecker ac;
+        fbl::unique_ptr<FreeSliceExtent> extent(new (&ac) FreeSliceExtent(pslice, pslice + 1));
+        if (!ac.check()) {
+            // The slice table is still correct; the index is recreated from
+            // it when it is next needed.
+            free_slices_stale_ = true;
+            free_slices_.clear();
+            return;
+        }
+        free_slices_.insert(fbl::move(extent));
     }
-    return ZX_ERR_NO_SPACE;
+}
+
+zx_status_t VPartitionManager::RebuildFreeSlicesLocked() {
+    free_slices_.clear();
+    free_slices_stale_ = true;
+
+    const size_t max_slices = UsableSlicesCount(DiskSize(), SliceSize());
+    size_t pslice = 1;
+    while (pslice <= max_slices) {
+        if (GetSliceEntryLocked(pslice)->vpart != FVM_SLICE_FREE) {
+            pslice++;
+            continue;
+        }
+        size_t end = pslice + 1;
+        while (end <= max_slices && GetSliceEntryLocked(end)->vpart == FVM_SLICE_FREE) {
+            end++;
+        }
+
+        fbl::AllocChecker ac;
+        fbl::unique_ptr<FreeSliceExtent> extent(new (&ac) FreeSliceExtent(pslice, end));
+        if (!ac.check()) {
+            free_slices_.clear();
+            return ZX_ERR_NO_MEMORY;
+        }
+        free_slices_.insert(fbl::move(extent));
+        pslice = end;
+    }
+
+    free_slices_stale_ = false;
+    return ZX_OK;
 }
 
 zx_status_t VPartitionManager::AllocateSlices(VPartition* vp, size_t vslice_start,
@@ -336,11 +484,28 @@ zx_status_t VPartitionManager::AllocateSlicesLocked(VPartition* vp, size_t vslic
     zx_status_t status = ZX_OK;
     size_t hint = 0;
 
+    // Returns the first |allocated| slices of the request to the free pool.
+    auto unwind = [&](size_t allocated) TA_NO_THREAD_SAFETY_ANALYSIS {
+        for (size_t j = allocated; j-- > 0;) {
+            auto vslice = vslice_start + j;
+            FreeSliceEntryLocked(vp->SliceGetLocked(vslice));
+            vp->SliceFreeLocked(vslice);
+        }
+    };
+
     {
         fbl::AutoLock lock(&vp->lock_);
         if (vp->IsKilledLocked()) {
             return ZX_ERR_BAD_STATE;
         }
+        // Growing a partition continues physically after the slice before
+        // the new ones, if that one is allocated.
+        if (vslice_start > 0) {
+            uint32_t prev = vp->SliceGetLocked(vslice_start - 1);
+            if (prev != PSLICE_UNALLOCATED) {
+                hint = prev + 1;
+            }
+        }
         for (size_t i = 0; i < count; i++) {
             size_t pslice;
             auto vslice = vslice_start + i;
@@ -348,14 +513,13 @@ zx_status_t VPartitionManager::AllocateSlicesLocked(VPartition* vp, size_t vslic
                 status = ZX_ERR_INVALID_ARGS;
             }
             if ((status != ZX_OK) ||
-                ((status = FindFreeSliceLocked(&pslice, hint)) != ZX_OK) ||
-                ((status = vp->SliceSetLocked(vslice, static_cast<uint32_t>(pslice)) != ZX_OK))) {
-                for (int j = static_cast<int>(i - 1); j >= 0; j--) {
-                    vslice = vslice_start + j;
-                    GetSliceEntryLocked(vp->SliceGetLocked(vslice))->vpart = PSLICE_UNALLOCATED;
-                    vp->SliceFreeLocked(vslice);
-                }
-
+                ((status = TakeFreeSliceLocked(&pslice, hint)) != ZX_OK)) {
+                unwind(i);
+                return status;
+            }
+            if ((status = vp->SliceSetLocked(vslice, static_cast<uint32_t>(pslice))) != ZX_OK) {
+                ReleaseFreeSliceLocked(pslice);
+                unwind(i);
                 return status;
             }
             slice_entry_t* alloc_entry = GetSliceEntryLocked(pslice);
@@ -364,6 +528,7 @@ zx_status_t VPartitionManager::AllocateSlicesLocked(VPartition* vp, size_t vslic
             ZX_DEBUG_ASSERT(vslice <= VSLICE_MAX);
             alloc_entry->vpart = vpart & VPART_MAX;
             alloc_entry->vslice = vslice & VSLICE_MAX;
+            MarkDirtyLocked(alloc_entry, sizeof(*alloc_entry));
             hint = pslice + 1;
         }
     }
@@ -372,11 +537,7 @@ zx_status_t VPartitionManager::AllocateSlicesLocked(VPartition* vp, size_t vslic
         // Undo allocation in the event of failure; avoid holding VPartition
         // lock while writing to fvm.
         fbl::AutoLock lock(&vp->lock_);
-        for (int j = static_cast<int>(count - 1); j >= 0; j--) {
-            auto vslice = vslice_start + j;
-            GetSliceEntryLocked(vp->SliceGetLocked(vslice))->vpart = PSLICE_UNALLOCATED;
-            vp->SliceFreeLocked(vslice);
-        }
+        unwind(count);
     }
 
     return status;
@@ -409,9 +570,13 @@ zx_status_t VPartitionManager::Upgrade(const uint8_t* old_guid, const uint8_t* n
     }
 
     if (old_index) {
-        GetVPartEntryLocked(old_index)->flags |= kVPartFlagInactive;
+        auto entry = GetVPartEntryLocked(old_index);
+        entry->flags |= kVPartFlagInactive;
+        MarkDirtyLocked(entry, sizeof(*entry));
     }
-    GetVPartEntryLocked(new_index)->flags &= ~kVPartFlagInactive;
+    auto entry = GetVPartEntryLocked(new_index);
+    entry->flags &= ~kVPartFlagInactive;
+    MarkDirtyLocked(entry, sizeof(*entry));
 
     return WriteFvmLocked();
 }
@@ -429,6 +594,15 @@ zx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
     }
 
     bool freed_something = false;
+    // The physical slices given up, for trimming once the free is durable.
+    // Trimming is only a hint, so running out of memory here just skips it.
+    fbl::Vector<uint32_t> freed;
+    bool trim = true;
+    auto note_freed = [&freed, &trim](size_t pslice) {
+        fbl::AllocChecker ac;
+        freed.push_back(static_cast<uint32_t>(pslice), &ac);
+        trim &= ac.check();
+    };
     {
         fbl::AutoLock lock(&vp->lock_);
         if (vp->IsKilledLocked())
@@ -446,7 +620,9 @@ zx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
             // Special case: Freeing entire VPartition
             for (auto extent = vp->ExtentBegin(); extent.IsValid(); extent = vp->ExtentBegin()) {
                 for (size_t i = extent->start(); i < extent->end(); i++) {
-                    GetSliceEntryLocked(vp->SliceGetLocked(i))->vpart = PSLICE_UNALLOCATED;
+                    size_t pslice = vp->SliceGetLocked(i);
+                    FreeSliceEntryLocked(pslice);
+                    note_freed(pslice);
                 }
                 vp->ExtentDestroyLocked(extent->start());
             }
@@ -455,6 +631,7 @@ zx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
             vp->DdkRemove();
             auto entry = GetVPartEntryLocked(vp->GetEntryIndex());
             entry->clear();
+            MarkDirtyLocked(entry, sizeof(*entry));
             vp->KillLocked();
             freed_something = true;
         } else {
@@ -472,7 +649,8 @@ zx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
                     } else {
                         ZX_ASSERT(vp->SliceFreeLocked(vslice));
                     }
-                    GetSliceEntryLocked(pslice)->vpart = 0;
+                    FreeSliceEntryLocked(pslice);
+                    note_freed(pslice);
                     freed_something = true;
                 }
             }
@@ -482,7 +660,46 @@ zx_status_t VPartitionManager::FreeSlicesLocked(VPartition* vp, size_t vslice_st
     if (!freed_something) {
         return ZX_ERR_INVALID_ARGS;
     }
-    return WriteFvmLocked();
+    zx_status_t status = WriteFvmLocked();
+    if (status == ZX_OK && trim) {
+        TrimSlicesLocked(freed);
+    }
+    return status;
+}
+
+void VPartitionManager::TrimSlicesLocked(const fbl::Vector<uint32_t>& pslices) {
+    if (!(info_.flags & BLOCK_FLAG_TRIM_SUPPORT) || pslices.is_empty()) {
+        return;
+    }
+
+    // Slices are freed from the end of a range back to its start, so a run of
+    // physical slices may show up in either order.
+    const size_t disk_size = DiskSize();
+    const size_t slice_size = SliceSize();
+    size_t i = 0;
+    while (i < pslices.size()) {
+        uint32_t first = pslices[i];
+        uint32_t last = pslices[i];
+        for (i++; i < pslices.size(); i++) {
+            if (pslices[i] + 1 == first) {
+                first = pslices[i];
+            } else if (pslices[i] == last + 1) {
+                last = pslices[i];
+            } else {
+                break;
+            }
+        }
+
+        iotxn_t* txn;
+        if (iotxn_alloc(&txn, IOTXN_ALLOC_POOL, 0) != ZX_OK) {
+            return;
+        }
+        txn->opcode = IOTXN_OP_TRIM;
+        txn->offset = SliceStart(disk_size, slice_size, first);
+        txn->length = (last - first + 1) * slice_size;
+        iotxn_synchronous_op(parent_, txn);
+        iotxn_release(txn);
+    }
 }
 
 // Device protocol (FVM)
@@ -519,6 +736,7 @@ zx_status_t VPartitionManager::DdkIoctl(uint32_t op, const void* cmd,
             entry->init(request->type, request->guid,
                         static_cast<uint32_t>(request->slice_count),
                         request->name, request->flags & kVPartAllocateMask);
+            MarkDirtyLocked(entry, sizeof(*entry));
 
             if ((status = AllocateSlicesLocked(vpart.get(), 0,
                                                request->slice_count)) != ZX_OK) {
@@ -873,6 +1091,11 @@ static void multi_iotxn_completion(iotxn_t* txn, void* cookie) {
 }
 
 void VPartition::DdkIotxnQueue(iotxn_t* txn) {
+    if (txn->opcode == IOTXN_OP_FLUSH) {
+        // Flushes cover the whole device, so there is nothing to translate.
+        iotxn_queue(GetParent(), txn);
+        return;
+    }
     if (txn->offset % BlockSize()) {
         iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
         return;
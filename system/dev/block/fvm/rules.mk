@@ -13,12 +13,14 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/fvm.cpp \
 
 MODULE_STATIC_LIBS := \
+    system/ulib/bitmap \
     system/ulib/ddk \
     system/ulib/ddktl \
     system/ulib/fs \
     system/ulib/fvm \
     system/ulib/gpt \
     system/ulib/digest \
+    system/ulib/zx \
     system/ulib/zxcpp \
     system/ulib/fbl \
     system/ulib/sync \
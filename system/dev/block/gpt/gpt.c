@@ -156,6 +156,11 @@ static zx_status_t gpt_ioctl(void* ctx, uint32_t op, const void* cmd, size_t cmd
 
 static void gpt_iotxn_queue(void* ctx, iotxn_t* txn) {
     gptpart_device_t* device = ctx;
+    if (txn->opcode == IOTXN_OP_FLUSH) {
+        // flushes cover the whole device, so there is nothing to translate
+        iotxn_queue(device->parent, txn);
+        return;
+    }
     if (txn->offset % device->info.block_size) {
         iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
         return;
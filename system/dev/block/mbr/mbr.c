@@ -140,6 +140,11 @@ static zx_off_t to_parent_offset(mbrpart_device_t* dev, zx_off_t offset) {
 
 static void mbr_iotxn_queue(void* ctx, iotxn_t* txn) {
     mbrpart_device_t* dev = ctx;
+    if (txn->opcode == IOTXN_OP_FLUSH) {
+        // flushes cover the whole device, so there is nothing to translate
+        iotxn_queue(dev->parent, txn);
+        return;
+    }
     if (txn->offset % dev->info.block_size) {
         iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
         return;
@@ -0,0 +1,154 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <zircon/compiler.h>
+
+// clang-format off
+
+// controller registers (BAR 0)
+#define NVME_REG_CAP      0x00 // 64 bit
+#define NVME_REG_VS       0x08
+#define NVME_REG_INTMS    0x0c
+#define NVME_REG_INTMC    0x10
+#define NVME_REG_CC       0x14
+#define NVME_REG_CSTS     0x1c
+#define NVME_REG_AQA      0x24
+#define NVME_REG_ASQ      0x28 // 64 bit
+#define NVME_REG_ACQ      0x30 // 64 bit
+#define NVME_REG_DOORBELL 0x1000
+
+#define NVME_CAP_MQES(cap)   ((uint32_t)((cap) & 0xffff)) // 0-based
+#define NVME_CAP_TO(cap)     ((uint32_t)(((cap) >> 24) & 0xff)) // in 500ms units
+#define NVME_CAP_DSTRD(cap)  ((uint32_t)(((cap) >> 32) & 0xf))
+#define NVME_CAP_MPSMIN(cap) ((uint32_t)(((cap) >> 48) & 0xf))
+#define NVME_CAP_MPSMAX(cap) ((uint32_t)(((cap) >> 52) & 0xf))
+
+#define NVME_CC_EN           (1u << 0)
+#define NVME_CC_CSS_NVM      (0u << 4)
+#define NVME_CC_MPS(shift)   (((shift) - 12u) << 7)
+#define NVME_CC_AMS_RR       (0u << 11)
+#define NVME_CC_SHN_NORMAL   (1u << 14)
+#define NVME_CC_IOSQES(n)    ((n) << 16) // log2 of the entry size
+#define NVME_CC_IOCQES(n)    ((n) << 20)
+
+#define NVME_CSTS_RDY        (1u << 0)
+#define NVME_CSTS_CFS        (1u << 1)
+#define NVME_CSTS_SHST_MASK  (3u << 2)
+#define NVME_CSTS_SHST_DONE  (2u << 2)
+
+// admin command set opcodes
+#define NVME_ADMIN_OP_DELETE_SQ    0x00
+#define NVME_ADMIN_OP_CREATE_SQ    0x01
+#define NVME_ADMIN_OP_DELETE_CQ    0x04
+#define NVME_ADMIN_OP_CREATE_CQ    0x05
+#define NVME_ADMIN_OP_IDENTIFY     0x06
+#define NVME_ADMIN_OP_SET_FEATURES 0x09
+
+// nvm command set opcodes
+#define NVME_OP_FLUSH 0x00
+#define NVME_OP_WRITE 0x01
+#define NVME_OP_READ  0x02
+
+// identify cns values
+#define NVME_IDENTIFY_NS   0
+#define NVME_IDENTIFY_CTRL 1
+
+#define NVME_FEATURE_NUM_QUEUES 0x07
+
+// create i/o queue flags (cdw11)
+#define NVME_QUEUE_PHYS_CONTIG (1u << 0)
+#define NVME_CQ_IRQ_ENABLED    (1u << 1)
+
+// completion status field: phase tag in bit 0, status code and type above it
+#define NVME_CPL_PHASE(s)  ((s) & 1u)
+#define NVME_CPL_STATUS(s) (((s) >> 1) & 0x7ffu)
+
+#define NVME_ID_CTRL_VWC_PRESENT (1u << 0)
+
+// clang-format on
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t cid;
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __PACKED nvme_cmd_t;
+
+static_assert(sizeof(nvme_cmd_t) == 64, "nvme_cmd_t must be 64 bytes");
+
+typedef struct {
+    uint32_t cdw0;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;
+} __PACKED nvme_cpl_t;
+
+static_assert(sizeof(nvme_cpl_t) == 16, "nvme_cpl_t must be 16 bytes");
+
+typedef struct {
+    uint16_t vid;
+    uint16_t ssvid;
+    char sn[20];
+    char mn[40];
+    char fr[8];
+    uint8_t rab;
+    uint8_t ieee[3];
+    uint8_t cmic;
+    uint8_t mdts; // max transfer as a power of two of the minimum page size
+    uint16_t cntlid;
+    uint32_t ver;
+    uint8_t reserved0[428];
+    uint8_t sqes;
+    uint8_t cqes;
+    uint16_t maxcmd;
+    uint32_t nn; // number of namespaces
+    uint16_t oncs;
+    uint16_t fuses;
+    uint8_t fna;
+    uint8_t vwc;
+    uint8_t reserved1[3570];
+} __PACKED nvme_identify_ctrl_t;
+
+static_assert(sizeof(nvme_identify_ctrl_t) == 4096, "nvme_identify_ctrl_t must be 4096 bytes");
+
+typedef struct {
+    uint16_t ms; // metadata size
+    uint8_t lbads; // log2 of the block size
+    uint8_t rp;
+} __PACKED nvme_lba_format_t;
+
+typedef struct {
+    uint64_t nsze;
+    uint64_t ncap;
+    uint64_t nuse;
+    uint8_t nsfeat;
+    uint8_t nlbaf;
+    uint8_t flbas; // low 4 bits index lbaf
+    uint8_t mc;
+    uint8_t dpc;
+    uint8_t dps;
+    uint8_t nmic;
+    uint8_t rescap;
+    uint8_t reserved0[96];
+    nvme_lba_format_t lbaf[16];
+    uint8_t reserved1[3904];
+} __PACKED nvme_identify_ns_t;
+
+static_assert(sizeof(nvme_identify_ns_t) == 4096, "nvme_identify_ns_t must be 4096 bytes");
@@ -0,0 +1,1070 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <ddk/binding.h>
+#include <ddk/debug.h>
+#include <ddk/device.h>
+#include <ddk/driver.h>
+#include <ddk/io-buffer.h>
+#include <ddk/iotxn.h>
+#include <ddk/protocol/pci.h>
+#include <hw/arch_ops.h>
+#include <hw/pci.h>
+
+#include <zircon/assert.h>
+#include <zircon/device/block.h>
+#include <zircon/listnode.h>
+#include <zircon/syscalls.h>
+#include <zircon/types.h>
+#include <sync/completion.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <threads.h>
+
+#include "nvme-hw.h"
+
+#define HI32(val) (((val) >> 32) & 0xffffffff)
+#define LO32(val) ((val) & 0xffffffff)
+
+#define NVME_ADMIN_QUEUE_ENTRIES 32
+#define NVME_IO_QUEUE_ENTRIES    128
+#define NVME_MAX_IO_QUEUES       32
+#define NVME_MAX_NAMESPACES      16
+
+// Each command gets one page of PRP entries, which together with PRP1 covers
+// this much even when the buffer doesn't start on a page boundary.
+#define NVME_PRPS_PER_PAGE (PAGE_SIZE / sizeof(uint64_t))
+#define NVME_MAX_TRANSFER  (NVME_PRPS_PER_PAGE * PAGE_SIZE)
+
+#define NVME_ADMIN_TIMEOUT ZX_SEC(5)
+
+// memory page size used for queues and PRPs (CC.MPS)
+#define NVME_PAGE_SHIFT 12
+static_assert((1u << NVME_PAGE_SHIFT) == PAGE_SIZE, "PRPs assume 4k pages");
+
+typedef struct nvme_device nvme_device_t;
+
+typedef struct {
+    uint16_t qid;
+    uint16_t entries;
+    uint16_t vector;
+
+    mtx_t lock;
+
+    io_buffer_t buffer; // submission queue followed by completion queue
+    nvme_cmd_t* sq;
+    volatile nvme_cpl_t* cq;
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t cq_phase;
+    bool sq_dirty; // sq_tail has moved since the doorbell was last written
+
+    // commands in flight, indexed by command id
+    iotxn_t* commands[NVME_IO_QUEUE_ENTRIES];
+    uint16_t free_cids[NVME_IO_QUEUE_ENTRIES];
+    uint16_t free_count;
+
+    io_buffer_t prp_buffer; // a page of PRP entries per command id
+} nvme_queue_t;
+
+typedef struct {
+    nvme_device_t* dev;
+    uint32_t nr;
+    zx_handle_t irq_handle;
+    thrd_t thread;
+    bool thread_started;
+} nvme_vector_t;
+
+struct nvme_device {
+    zx_device_t* zxdev;
+    pci_protocol_t pci;
+
+    void* regs;
+    size_t regs_size;
+    zx_handle_t regs_handle;
+
+    uint64_t cap;
+    uint32_t doorbell_stride;
+    uint32_t max_transfer;
+    bool volatile_cache;
+
+    nvme_queue_t admin;
+    io_buffer_t identify; // scratch page for identify data
+
+    nvme_queue_t* io_queues;
+    uint32_t num_io_queues;
+    uint32_t max_io_queues; // entries allocated in io_queues
+
+    zx_pci_irq_mode_t irq_mode;
+    nvme_vector_t vectors[NVME_MAX_IO_QUEUES];
+    uint32_t num_vectors;
+
+    // Orders iotxns against IOTXN_SYNC_BEFORE and IOTXN_SYNC_AFTER, which apply
+    // across all of the queues.  Unordered txns skip the lock and go straight
+    // to a queue unless |ordered| is set.
+    mtx_t lock;
+    list_node_t pending;
+    bool barrier; // an IOTXN_SYNC_AFTER txn is in flight
+    atomic_bool ordered; // |pending| is not empty or |barrier| is set
+    atomic_uint inflight;
+    atomic_uint next_queue;
+};
+
+typedef struct {
+    nvme_device_t* ctrl;
+    zx_device_t* zxdev;
+    uint32_t nsid;
+    uint32_t block_size;
+    uint64_t block_count;
+    block_info_t info;
+} nvme_ns_t;
+
+typedef struct {
+    uint64_t lba;
+    uint32_t nsid;
+    uint16_t count; // 0-based
+    uint8_t opcode;
+    zx_status_t status;
+} nvme_pdata_t;
+
+static_assert(sizeof(nvme_pdata_t) <= sizeof(iotxn_proto_data_t), "nvme_pdata_t too large");
+
+#define nvme_iotxn_pdata(txn) iotxn_pdata(txn, nvme_pdata_t)
+
+static inline uint32_t nvme_read32(nvme_device_t* dev, uint32_t reg) {
+    return pcie_read32((volatile uint32_t*)(dev->regs + reg));
+}
+
+static inline void nvme_write32(nvme_device_t* dev, uint32_t reg, uint32_t val) {
+    pcie_write32((volatile uint32_t*)(dev->regs + reg), val);
+}
+
+static inline uint64_t nvme_read64(nvme_device_t* dev, uint32_t reg) {
+    uint64_t lo = nvme_read32(dev, reg);
+    return lo | ((uint64_t)nvme_read32(dev, reg + 4) << 32);
+}
+
+static inline void nvme_write64(nvme_device_t* dev, uint32_t reg, uint64_t val) {
+    nvme_write32(dev, reg, LO32(val));
+    nvme_write32(dev, reg + 4, HI32(val));
+}
+
+static zx_status_t nvme_wait_ready(nvme_device_t* dev, bool ready) {
+    // CAP.TO is the worst case time for CSTS.RDY to follow CC.EN
+    zx_time_t deadline = zx_deadline_after(MAX(NVME_CAP_TO(dev->cap), 1u) * ZX_MSEC(500));
+    for (;;) {
+        uint32_t csts = nvme_read32(dev, NVME_REG_CSTS);
+        if (!!(csts & NVME_CSTS_RDY) == ready) {
+            return ZX_OK;
+        }
+        if (ready && (csts & NVME_CSTS_CFS)) {
+            zxlogf(ERROR, "nvme: controller fatal status\n");
+            return ZX_ERR_IO;
+        }
+        if (zx_time_get(ZX_CLOCK_MONOTONIC) > deadline) {
+            zxlogf(ERROR, "nvme: timed out waiting for ready=%d\n", ready);
+            return ZX_ERR_TIMED_OUT;
+        }
+        zx_nanosleep(zx_deadline_after(ZX_MSEC(1)));
+    }
+}
+
+static zx_status_t nvme_queue_init(nvme_device_t* dev, nvme_queue_t* q, uint16_t qid,
+                                   uint16_t entries, uint16_t vector) {
+    q->qid = qid;
+    q->entries = entries;
+    q->vector = vector;
+    mtx_init(&q->lock, mtx_plain);
+
+    // both queues must start on a page boundary
+    size_t sq_size = ROUNDUP(entries * sizeof(nvme_cmd_t), PAGE_SIZE);
+    size_t cq_size = ROUNDUP(entries * sizeof(nvme_cpl_t), PAGE_SIZE);
+    zx_status_t status = io_buffer_init(&q->buffer, sq_size + cq_size,
+                                        IO_BUFFER_RW | IO_BUFFER_CONTIG);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d allocating queue %u\n", status, qid);
+        return status;
+    }
+    void* mem = io_buffer_virt(&q->buffer);
+    memset(mem, 0, sq_size + cq_size);
+    q->sq = mem;
+    q->cq = mem + sq_size;
+
+    void* doorbells = dev->regs + NVME_REG_DOORBELL;
+    q->sq_doorbell = doorbells + (2 * qid) * dev->doorbell_stride;
+    q->cq_doorbell = doorbells + (2 * qid + 1) * dev->doorbell_stride;
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->cq_phase = 1;
+    q->sq_dirty = false;
+
+    // the admin queue is only used synchronously, one command at a time
+    if (qid == 0) {
+        return ZX_OK;
+    }
+
+    // a full submission queue has one empty entry
+    q->free_count = 0;
+    for (uint16_t cid = entries - 1; cid > 0; cid--) {
+        q->free_cids[q->free_count++] = cid - 1;
+    }
+
+    status = io_buffer_init(&q->prp_buffer, (entries - 1) * PAGE_SIZE, IO_BUFFER_RW);
+    if (status == ZX_OK) {
+        status = io_buffer_physmap(&q->prp_buffer);
+    }
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d allocating prp lists for queue %u\n", status, qid);
+        io_buffer_release(&q->prp_buffer);
+        io_buffer_release(&q->buffer);
+        return status;
+    }
+    return ZX_OK;
+}
+
+static void nvme_queue_release(nvme_queue_t* q) {
+    io_buffer_release(&q->prp_buffer);
+    io_buffer_release(&q->buffer);
+}
+
+static zx_paddr_t nvme_queue_sq_phys(nvme_queue_t* q) {
+    return io_buffer_phys(&q->buffer);
+}
+
+static zx_paddr_t nvme_queue_cq_phys(nvme_queue_t* q) {
+    return io_buffer_phys(&q->buffer) + ((void*)q->cq - (void*)q->sq);
+}
+
+// Issues an admin command and polls for its completion.  The admin queue is
+// only used while the controller is being brought up.
+static zx_status_t nvme_admin_cmd(nvme_device_t* dev, nvme_cmd_t* cmd, uint32_t* out_cdw0) {
+    nvme_queue_t* q = &dev->admin;
+
+    cmd->cid = q->sq_tail;
+    q->sq[q->sq_tail] = *cmd;
+    if (++q->sq_tail == q->entries) {
+        q->sq_tail = 0;
+    }
+    hw_wmb();
+    pcie_write32(q->sq_doorbell, q->sq_tail);
+
+    zx_time_t deadline = zx_deadline_after(NVME_ADMIN_TIMEOUT);
+    volatile nvme_cpl_t* cpl = &q->cq[q->cq_head];
+    while (NVME_CPL_PHASE(cpl->status) != q->cq_phase) {
+        if (zx_time_get(ZX_CLOCK_MONOTONIC) > deadline) {
+            zxlogf(ERROR, "nvme: admin command 0x%02x timed out\n", cmd->opcode);
+            return ZX_ERR_TIMED_OUT;
+        }
+        zx_nanosleep(zx_deadline_after(ZX_USEC(10)));
+    }
+    hw_rmb();
+    uint16_t cpl_status = cpl->status;
+    if (out_cdw0) {
+        *out_cdw0 = cpl->cdw0;
+    }
+    if (++q->cq_head == q->entries) {
+        q->cq_head = 0;
+        q->cq_phase ^= 1;
+    }
+    pcie_write32(q->cq_doorbell, q->cq_head);
+
+    if (NVME_CPL_STATUS(cpl_status)) {
+        zxlogf(ERROR, "nvme: admin command 0x%02x failed, status 0x%03x\n",
+               cmd->opcode, NVME_CPL_STATUS(cpl_status));
+        return ZX_ERR_IO;
+    }
+    return ZX_OK;
+}
+
+static zx_status_t nvme_identify(nvme_device_t* dev, uint32_t cns, uint32_t nsid) {
+    nvme_cmd_t cmd = {
+        .opcode = NVME_ADMIN_OP_IDENTIFY,
+        .nsid = nsid,
+        .prp1 = io_buffer_phys(&dev->identify),
+        .cdw10 = cns,
+    };
+    return nvme_admin_cmd(dev, &cmd, NULL);
+}
+
+// Fills in the PRP entries of |cmd| from the pages backing |txn|.  Every
+// entry after the first must be page aligned, which the phys iterator gives
+// us when it is limited to a page at a time.
+static void nvme_build_prps(nvme_queue_t* q, uint16_t cid, iotxn_t* txn, nvme_cmd_t* cmd) {
+    iotxn_phys_iter_t iter;
+    iotxn_phys_iter_init(&iter, txn, PAGE_SIZE);
+
+    zx_paddr_t paddr;
+    iotxn_phys_iter_next(&iter, &paddr);
+    cmd->prp1 = paddr;
+    if (iotxn_phys_iter_next(&iter, &paddr) == 0) {
+        return;
+    }
+    zx_paddr_t second = paddr;
+    if (iotxn_phys_iter_next(&iter, &paddr) == 0) {
+        cmd->prp2 = second;
+        return;
+    }
+
+    // more than two pages: prp2 points at a list of the rest
+    uint64_t* list = io_buffer_virt(&q->prp_buffer) + cid * PAGE_SIZE;
+    size_t count = 0;
+    list[count++] = second;
+    do {
+        list[count++] = paddr;
+    } while (iotxn_phys_iter_next(&iter, &paddr) != 0);
+    ZX_DEBUG_ASSERT(count <= NVME_PRPS_PER_PAGE);
+    cmd->prp2 = q->prp_buffer.phys_list[cid];
+}
+
+static bool nvme_queue_submit_locked(nvme_queue_t* q, iotxn_t* txn) {
+    if (q->free_count == 0) {
+        return false;
+    }
+    uint16_t cid = q->free_cids[--q->free_count];
+    nvme_pdata_t* pdata = nvme_iotxn_pdata(txn);
+
+    nvme_cmd_t* cmd = &q->sq[q->sq_tail];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->opcode = pdata->opcode;
+    cmd->cid = cid;
+    cmd->nsid = pdata->nsid;
+    if (pdata->opcode != NVME_OP_FLUSH) {
+        nvme_build_prps(q, cid, txn, cmd);
+        cmd->cdw10 = LO32(pdata->lba);
+        cmd->cdw11 = HI32(pdata->lba);
+        cmd->cdw12 = pdata->count;
+    }
+    q->commands[cid] = txn;
+    if (++q->sq_tail == q->entries) {
+        q->sq_tail = 0;
+    }
+    q->sq_dirty = true;
+
+    zxlogf(SPEW, "nvme: queue %u cid %u op 0x%02x lba 0x%" PRIx64 " count %u\n",
+           q->qid, cid, pdata->opcode, pdata->lba, pdata->count + 1);
+    return true;
+}
+
+// Starts as many pending txns as the queues have room for, honoring the
+// ordering flags.  Queues are picked round robin; userspace has no notion of
+// the current cpu, so spreading the load is the best we can do.  Doorbells
+// are written once per batch rather than once per command.
+static void nvme_process_pending_locked(nvme_device_t* dev) {
+    iotxn_t* txn;
+    while ((txn = list_peek_head_type(&dev->pending, iotxn_t, node)) != NULL) {
+        if (dev->barrier) {
+            break;
+        }
+        if ((txn->flags & IOTXN_SYNC_BEFORE) && atomic_load(&dev->inflight) > 0) {
+            break;
+        }
+
+        // unlink before submitting: the completion path reuses the node
+        list_delete(&txn->node);
+        bool submitted = false;
+        uint32_t next = atomic_load(&dev->next_queue);
+        for (uint32_t i = 0; i < dev->num_io_queues && !submitted; i++) {
+            uint32_t idx = (next + i) % dev->num_io_queues;
+            nvme_queue_t* q = &dev->io_queues[idx];
+            mtx_lock(&q->lock);
+            submitted = nvme_queue_submit_locked(q, txn);
+            mtx_unlock(&q->lock);
+            if (submitted) {
+                atomic_store(&dev->next_queue, idx + 1);
+            }
+        }
+        if (!submitted) {
+            list_add_head(&dev->pending, &txn->node);
+            break;
+        }
+
+        atomic_fetch_add(&dev->inflight, 1);
+        if (txn->flags & IOTXN_SYNC_AFTER) {
+            dev->barrier = true;
+        }
+    }
+    atomic_store(&dev->ordered, dev->barrier || !list_is_empty(&dev->pending));
+
+    hw_wmb();
+    for (uint32_t i = 0; i < dev->num_io_queues; i++) {
+        nvme_queue_t* q = &dev->io_queues[i];
+        mtx_lock(&q->lock);
+        if (q->sq_dirty) {
+            pcie_write32(q->sq_doorbell, q->sq_tail);
+            q->sq_dirty = false;
+        }
+        mtx_unlock(&q->lock);
+    }
+}
+
+// Submits |txn| to the first queue with room, ringing its doorbell, without
+// taking the device lock.  Returns false if every queue is full.
+static bool nvme_submit_unordered(nvme_device_t* dev, iotxn_t* txn) {
+    uint32_t next = atomic_fetch_add(&dev->next_queue, 1);
+    for (uint32_t i = 0; i < dev->num_io_queues; i++) {
+        nvme_queue_t* q = &dev->io_queues[(next + i) % dev->num_io_queues];
+        mtx_lock(&q->lock);
+        bool submitted = nvme_queue_submit_locked(q, txn);
+        if (submitted) {
+            hw_wmb();
+            pcie_write32(q->sq_doorbell, q->sq_tail);
+            q->sq_dirty = false;
+        }
+        mtx_unlock(&q->lock);
+        if (submitted) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void nvme_queue_txn(nvme_device_t* dev, iotxn_t* txn) {
+    // Txns which don't order against anything only have to stay behind the
+    // ones already waiting on the device lock.  Racing submitters may end up
+    // either side of an ordered txn, as they could if they were serialized.
+    if (!(txn->flags & (IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER)) &&
+        !atomic_load(&dev->ordered)) {
+        atomic_fetch_add(&dev->inflight, 1);
+        if (nvme_submit_unordered(dev, txn)) {
+            return;
+        }
+        atomic_fetch_sub(&dev->inflight, 1);
+    }
+
+    mtx_lock(&dev->lock);
+    list_add_tail(&dev->pending, &txn->node);
+    // set before trying the queues, so a completion which makes room after
+    // we've found them full knows to come back for this txn
+    atomic_store(&dev->ordered, true);
+    nvme_process_pending_locked(dev);
+    mtx_unlock(&dev->lock);
+}
+
+// Reaps the completion queue of |q| and completes the txns that finished.
+static void nvme_queue_process(nvme_device_t* dev, nvme_queue_t* q) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
+    uint32_t count = 0;
+    bool barrier_done = false;
+
+    mtx_lock(&q->lock);
+    for (;;) {
+        volatile nvme_cpl_t* cpl = &q->cq[q->cq_head];
+        uint16_t status = cpl->status;
+        if (NVME_CPL_PHASE(status) != q->cq_phase) {
+            break;
+        }
+        hw_rmb();
+        uint16_t cid = cpl->cid;
+        if (++q->cq_head == q->entries) {
+            q->cq_head = 0;
+            q->cq_phase ^= 1;
+        }
+
+        iotxn_t* txn = cid < q->entries ? q->commands[cid] : NULL;
+        if (txn == NULL) {
+            zxlogf(ERROR, "nvme: queue %u completion for idle cid %u\n", q->qid, cid);
+            continue;
+        }
+        q->commands[cid] = NULL;
+        q->free_cids[q->free_count++] = cid;
+
+        nvme_pdata_t* pdata = nvme_iotxn_pdata(txn);
+        if (NVME_CPL_STATUS(status)) {
+            zxlogf(ERROR, "nvme: queue %u cid %u op 0x%02x failed, status 0x%03x\n",
+                   q->qid, cid, pdata->opcode, NVME_CPL_STATUS(status));
+            pdata->status = ZX_ERR_IO;
+        } else {
+            pdata->status = ZX_OK;
+        }
+        if (txn->flags & IOTXN_SYNC_AFTER) {
+            barrier_done = true;
+        }
+        list_add_tail(&done, &txn->node);
+        count++;
+    }
+    if (count > 0) {
+        pcie_write32(q->cq_doorbell, q->cq_head);
+    }
+    mtx_unlock(&q->lock);
+
+    if (count == 0) {
+        return;
+    }
+
+    // barrier_done implies |ordered|, since the barrier is still set
+    atomic_fetch_sub(&dev->inflight, count);
+    if (atomic_load(&dev->ordered)) {
+        mtx_lock(&dev->lock);
+        if (barrier_done) {
+            dev->barrier = false;
+        }
+        nvme_process_pending_locked(dev);
+        mtx_unlock(&dev->lock);
+    }
+
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&done, iotxn_t, node)) != NULL) {
+        nvme_pdata_t* pdata = nvme_iotxn_pdata(txn);
+        iotxn_complete(txn, pdata->status, pdata->status == ZX_OK ? txn->length : 0);
+    }
+}
+
+static int nvme_irq_thread(void* arg) {
+    nvme_vector_t* vec = arg;
+    nvme_device_t* dev = vec->dev;
+    bool legacy = dev->irq_mode == ZX_PCIE_IRQ_MODE_LEGACY;
+    zx_status_t status;
+    for (;;) {
+        status = zx_interrupt_wait(vec->irq_handle);
+        if (status != ZX_OK) {
+            // nvme_release() cancels the wait to stop us
+            if (status != ZX_ERR_CANCELED) {
+                zxlogf(ERROR, "nvme: error %d waiting for interrupt\n", status);
+            }
+            break;
+        }
+        // a level triggered interrupt stays asserted until the queues are
+        // drained, so mask it at the controller meanwhile
+        if (legacy) {
+            nvme_write32(dev, NVME_REG_INTMS, 1);
+        }
+        zx_interrupt_complete(vec->irq_handle);
+
+        for (uint32_t i = vec->nr; i < dev->num_io_queues; i += dev->num_vectors) {
+            nvme_queue_process(dev, &dev->io_queues[i]);
+        }
+
+        if (legacy) {
+            nvme_write32(dev, NVME_REG_INTMC, 1);
+        }
+    }
+    return 0;
+}
+
+// Picks the interrupt mode, preferring as many message signaled vectors as
+// there are queues.  MSI-X is tried first; MSI with multiple messages works
+// the same way for us, and legacy interrupts get a single vector.
+static zx_status_t nvme_setup_irqs(nvme_device_t* dev, uint32_t wanted) {
+    static const zx_pci_irq_mode_t modes[] = {
+        ZX_PCIE_IRQ_MODE_MSI_X,
+        ZX_PCIE_IRQ_MODE_MSI,
+        ZX_PCIE_IRQ_MODE_LEGACY,
+    };
+    zx_status_t status = ZX_ERR_NOT_SUPPORTED;
+    for (size_t i = 0; i < countof(modes); i++) {
+        uint32_t irq_cnt;
+        status = pci_query_irq_mode_caps(&dev->pci, modes[i], &irq_cnt);
+        if (status != ZX_OK || irq_cnt == 0) {
+            continue;
+        }
+        uint32_t count = MIN(irq_cnt, wanted);
+        if (modes[i] == ZX_PCIE_IRQ_MODE_LEGACY) {
+            count = 1;
+        }
+        // multi-message MSI hands out power of two blocks
+        while (count & (count - 1)) {
+            count &= count - 1;
+        }
+        status = pci_set_irq_mode(&dev->pci, modes[i], count);
+        if (status == ZX_OK) {
+            dev->irq_mode = modes[i];
+            dev->num_vectors = count;
+            break;
+        }
+    }
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: no usable interrupt mode\n");
+        return status;
+    }
+
+    for (uint32_t i = 0; i < dev->num_vectors; i++) {
+        nvme_vector_t* vec = &dev->vectors[i];
+        vec->dev = dev;
+        vec->nr = i;
+        status = pci_map_interrupt(&dev->pci, i, &vec->irq_handle);
+        if (status != ZX_OK) {
+            zxlogf(ERROR, "nvme: error %d getting irq handle %u\n", status, i);
+            return status;
+        }
+    }
+
+    zxlogf(INFO, "nvme: using %u %s interrupt(s)\n", dev->num_vectors,
+           dev->irq_mode == ZX_PCIE_IRQ_MODE_MSI_X ? "MSI-X" :
+           dev->irq_mode == ZX_PCIE_IRQ_MODE_MSI ? "MSI" : "legacy");
+    return ZX_OK;
+}
+
+static zx_status_t nvme_create_io_queue(nvme_device_t* dev, nvme_queue_t* q, uint16_t qid,
+                                        uint16_t entries, uint16_t vector) {
+    zx_status_t status = nvme_queue_init(dev, q, qid, entries, vector);
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    nvme_cmd_t cmd = {
+        .opcode = NVME_ADMIN_OP_CREATE_CQ,
+        .prp1 = nvme_queue_cq_phys(q),
+        .cdw10 = ((uint32_t)(entries - 1) << 16) | qid,
+        .cdw11 = ((uint32_t)vector << 16) | NVME_CQ_IRQ_ENABLED | NVME_QUEUE_PHYS_CONTIG,
+    };
+    status = nvme_admin_cmd(dev, &cmd, NULL);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d creating completion queue %u\n", status, qid);
+        nvme_queue_release(q);
+        return status;
+    }
+
+    cmd = (nvme_cmd_t){
+        .opcode = NVME_ADMIN_OP_CREATE_SQ,
+        .prp1 = nvme_queue_sq_phys(q),
+        .cdw10 = ((uint32_t)(entries - 1) << 16) | qid,
+        .cdw11 = ((uint32_t)qid << 16) | NVME_QUEUE_PHYS_CONTIG,
+    };
+    status = nvme_admin_cmd(dev, &cmd, NULL);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d creating submission queue %u\n", status, qid);
+        // the controller drops the completion queue along with the device
+        nvme_queue_release(q);
+        return status;
+    }
+    return ZX_OK;
+}
+
+// implement namespace device protocol:
+
+static void nvme_ns_iotxn_queue(void* ctx, iotxn_t* txn) {
+    nvme_ns_t* ns = ctx;
+    nvme_pdata_t* pdata = nvme_iotxn_pdata(txn);
+    uint64_t capacity = ns->block_count * ns->block_size;
+
+    if (txn->opcode == IOTXN_OP_FLUSH) {
+        if (!ns->ctrl->volatile_cache) {
+            // completed writes are already on the media, which is all a
+            // flush would promise
+            iotxn_complete(txn, ZX_OK, 0);
+            return;
+        }
+        pdata->opcode = NVME_OP_FLUSH;
+        pdata->nsid = ns->nsid;
+        nvme_queue_txn(ns->ctrl, txn);
+        return;
+    }
+
+    if (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE) {
+        iotxn_complete(txn, ZX_ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+
+    if (txn->length == 0) {
+        iotxn_complete(txn, ZX_OK, 0);
+        return;
+    }
+
+    // offset and length must be aligned to block size
+    if ((txn->offset % ns->block_size) || (txn->length % ns->block_size)) {
+        iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
+        return;
+    }
+    if (txn->offset >= capacity) {
+        iotxn_complete(txn, ZX_ERR_OUT_OF_RANGE, 0);
+        return;
+    }
+
+    // constrain to device capacity
+    txn->length = MIN(txn->length, capacity - txn->offset);
+
+    // transfer must be smaller than max size
+    if (txn->length > ns->info.max_transfer_size) {
+        iotxn_complete(txn, ZX_ERR_OUT_OF_RANGE, 0);
+        return;
+    }
+
+    zx_status_t status = iotxn_physmap(txn);
+    if (status != ZX_OK) {
+        iotxn_complete(txn, status, 0);
+        return;
+    }
+
+    pdata->opcode = txn->opcode == IOTXN_OP_READ ? NVME_OP_READ : NVME_OP_WRITE;
+    pdata->nsid = ns->nsid;
+    pdata->lba = txn->offset / ns->block_size;
+    pdata->count = (uint16_t)(txn->length / ns->block_size - 1);
+    nvme_queue_txn(ns->ctrl, txn);
+}
+
+static void nvme_ns_sync_complete(iotxn_t* txn, void* cookie) {
+    completion_signal((completion_t*)cookie);
+}
+
+static zx_status_t nvme_ns_ioctl(void* ctx, uint32_t op, const void* cmd, size_t cmdlen,
+                                 void* reply, size_t max, size_t* out_actual) {
+    nvme_ns_t* ns = ctx;
+    switch (op) {
+    case IOCTL_BLOCK_GET_INFO: {
+        block_info_t* info = reply;
+        if (max < sizeof(*info))
+            return ZX_ERR_BUFFER_TOO_SMALL;
+        memcpy(info, &ns->info, sizeof(*info));
+        *out_actual = sizeof(*info);
+        return ZX_OK;
+    }
+    case IOCTL_BLOCK_RR_PART: {
+        // rebind to reread the partition table
+        return device_rebind(ns->zxdev);
+    }
+    case IOCTL_DEVICE_SYNC: {
+        iotxn_t* txn;
+        zx_status_t status = iotxn_alloc(&txn, 0, 0);
+        if (status != ZX_OK) {
+            return status;
+        }
+        completion_t completion = COMPLETION_INIT;
+        txn->opcode = IOTXN_OP_FLUSH;
+        txn->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
+        txn->offset = 0;
+        txn->length = 0;
+        txn->complete_cb = nvme_ns_sync_complete;
+        txn->cookie = &completion;
+        iotxn_queue(ns->zxdev, txn);
+        completion_wait(&completion, ZX_TIME_INFINITE);
+        status = txn->status;
+        iotxn_release(txn);
+        return status;
+    }
+    default:
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+}
+
+static zx_off_t nvme_ns_get_size(void* ctx) {
+    nvme_ns_t* ns = ctx;
+    return ns->block_count * ns->block_size;
+}
+
+static void nvme_ns_release(void* ctx) {
+    nvme_ns_t* ns = ctx;
+    free(ns);
+}
+
+static zx_protocol_device_t nvme_ns_device_proto = {
+    .version = DEVICE_OPS_VERSION,
+    .ioctl = nvme_ns_ioctl,
+    .iotxn_queue = nvme_ns_iotxn_queue,
+    .get_size = nvme_ns_get_size,
+    .release = nvme_ns_release,
+};
+
+static zx_status_t nvme_ns_add(nvme_device_t* dev, uint32_t nsid) {
+    zx_status_t status = nvme_identify(dev, NVME_IDENTIFY_NS, nsid);
+    if (status != ZX_OK) {
+        return status;
+    }
+    nvme_identify_ns_t* id = io_buffer_virt(&dev->identify);
+    if (id->nsze == 0) {
+        // inactive namespace
+        return ZX_OK;
+    }
+    nvme_lba_format_t* fmt = &id->lbaf[id->flbas & 0xf];
+    if (fmt->ms != 0 || fmt->lbads < 9 || fmt->lbads > NVME_PAGE_SHIFT) {
+        zxlogf(ERROR, "nvme: namespace %u has unsupported format (ms %u lbads %u)\n",
+               nsid, fmt->ms, fmt->lbads);
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    nvme_ns_t* ns = calloc(1, sizeof(nvme_ns_t));
+    if (!ns) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    ns->ctrl = dev;
+    ns->nsid = nsid;
+    ns->block_size = 1u << fmt->lbads;
+    ns->block_count = id->nsze;
+    ns->info.block_size = ns->block_size;
+    ns->info.block_count = ns->block_count;
+    // the command's block count field is 16 bits
+    ns->info.max_transfer_size = MIN(dev->max_transfer, 0x10000u * ns->block_size);
+
+    char name[16];
+    snprintf(name, sizeof(name), "nvme-ns%u", nsid);
+    zxlogf(INFO, "nvme: namespace %u: %" PRIu64 " blocks of %u bytes\n",
+           nsid, ns->block_count, ns->block_size);
+
+    device_add_args_t args = {
+        .version = DEVICE_ADD_ARGS_VERSION,
+        .name = name,
+        .ctx = ns,
+        .ops = &nvme_ns_device_proto,
+        .proto_id = ZX_PROTOCOL_BLOCK_CORE,
+    };
+    status = device_add(dev->zxdev, &args, &ns->zxdev);
+    if (status != ZX_OK) {
+        free(ns);
+        return status;
+    }
+    return ZX_OK;
+}
+
+// implement controller device protocol:
+
+// Frees everything nvme_bind() and nvme_init() set up.  The controller must
+// already be stopped, so nothing is left for it to DMA to.
+static void nvme_free(nvme_device_t* dev) {
+    for (uint32_t i = 0; i < dev->num_vectors; i++) {
+        nvme_vector_t* vec = &dev->vectors[i];
+        if (vec->thread_started) {
+            zx_interrupt_signal(vec->irq_handle);
+            thrd_join(vec->thread, NULL);
+        }
+        if (vec->irq_handle != ZX_HANDLE_INVALID) {
+            zx_handle_close(vec->irq_handle);
+        }
+    }
+    if (dev->num_vectors > 0) {
+        pci_set_irq_mode(&dev->pci, ZX_PCIE_IRQ_MODE_DISABLED, 0);
+    }
+
+    for (uint32_t i = 0; i < dev->max_io_queues; i++) {
+        nvme_queue_release(&dev->io_queues[i]);
+    }
+    free(dev->io_queues);
+    nvme_queue_release(&dev->admin);
+    io_buffer_release(&dev->identify);
+
+    if (dev->regs_handle != ZX_HANDLE_INVALID) {
+        zx_vmar_unmap(zx_vmar_root_self(), (uintptr_t)dev->regs, dev->regs_size);
+        zx_handle_close(dev->regs_handle);
+    }
+    free(dev);
+}
+
+static void nvme_release(void* ctx) {
+    nvme_device_t* dev = ctx;
+    // shut the controller down cleanly so its cache makes it to media
+    uint32_t cc = nvme_read32(dev, NVME_REG_CC);
+    if (cc & NVME_CC_EN) {
+        nvme_write32(dev, NVME_REG_CC, cc | NVME_CC_SHN_NORMAL);
+        zx_time_t deadline = zx_deadline_after(ZX_SEC(1));
+        while ((nvme_read32(dev, NVME_REG_CSTS) & NVME_CSTS_SHST_MASK) != NVME_CSTS_SHST_DONE &&
+               zx_time_get(ZX_CLOCK_MONOTONIC) < deadline) {
+            zx_nanosleep(zx_deadline_after(ZX_MSEC(1)));
+        }
+        // then disable it, so it lets go of the queues
+        nvme_write32(dev, NVME_REG_CC, 0);
+        nvme_wait_ready(dev, false);
+    }
+    pci_enable_bus_master(&dev->pci, false);
+    nvme_free(dev);
+}
+
+static zx_protocol_device_t nvme_device_proto = {
+    .version = DEVICE_OPS_VERSION,
+    .release = nvme_release,
+};
+
+static zx_status_t nvme_init(nvme_device_t* dev) {
+    zx_status_t status;
+
+    dev->cap = nvme_read64(dev, NVME_REG_CAP);
+    dev->doorbell_stride = 4u << NVME_CAP_DSTRD(dev->cap);
+    uint32_t vs = nvme_read32(dev, NVME_REG_VS);
+    zxlogf(INFO, "nvme: version %u.%u, cap 0x%016" PRIx64 "\n", vs >> 16, (vs >> 8) & 0xff,
+           dev->cap);
+
+    if (12 + NVME_CAP_MPSMIN(dev->cap) > NVME_PAGE_SHIFT ||
+        12 + NVME_CAP_MPSMAX(dev->cap) < NVME_PAGE_SHIFT) {
+        zxlogf(ERROR, "nvme: controller doesn't support %u byte pages\n", PAGE_SIZE);
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // reset
+    if (nvme_read32(dev, NVME_REG_CC) & NVME_CC_EN) {
+        nvme_write32(dev, NVME_REG_CC, 0);
+    }
+    if ((status = nvme_wait_ready(dev, false)) != ZX_OK) {
+        return status;
+    }
+
+    // set up the admin queue and enable the controller
+    uint16_t admin_entries = MIN(NVME_ADMIN_QUEUE_ENTRIES, NVME_CAP_MQES(dev->cap) + 1);
+    if ((status = nvme_queue_init(dev, &dev->admin, 0, admin_entries, 0)) != ZX_OK) {
+        return status;
+    }
+    nvme_write32(dev, NVME_REG_AQA, ((uint32_t)(admin_entries - 1) << 16) | (admin_entries - 1));
+    nvme_write64(dev, NVME_REG_ASQ, nvme_queue_sq_phys(&dev->admin));
+    nvme_write64(dev, NVME_REG_ACQ, nvme_queue_cq_phys(&dev->admin));
+    nvme_write32(dev, NVME_REG_CC, NVME_CC_EN | NVME_CC_CSS_NVM | NVME_CC_MPS(NVME_PAGE_SHIFT) |
+                                   NVME_CC_AMS_RR | NVME_CC_IOSQES(6) | NVME_CC_IOCQES(4));
+    if ((status = nvme_wait_ready(dev, true)) != ZX_OK) {
+        return status;
+    }
+
+    status = io_buffer_init(&dev->identify, PAGE_SIZE, IO_BUFFER_RW | IO_BUFFER_CONTIG);
+    if (status != ZX_OK) {
+        return status;
+    }
+    if ((status = nvme_identify(dev, NVME_IDENTIFY_CTRL, 0)) != ZX_OK) {
+        return status;
+    }
+    nvme_identify_ctrl_t* id = io_buffer_virt(&dev->identify);
+    zxlogf(INFO, "nvme: model '%.40s' serial '%.20s' firmware '%.8s'\n", id->mn, id->sn, id->fr);
+    uint32_t nn = id->nn;
+    dev->volatile_cache = id->vwc & NVME_ID_CTRL_VWC_PRESENT;
+    dev->max_transfer = NVME_MAX_TRANSFER;
+    if (id->mdts) {
+        uint64_t mdts = (uint64_t)PAGE_SIZE << id->mdts;
+        dev->max_transfer = MIN(dev->max_transfer, mdts);
+    }
+
+    // ask for a queue pair per cpu, and take what the controller gives us
+    uint32_t wanted = MIN(zx_system_get_num_cpus(), NVME_MAX_IO_QUEUES);
+    nvme_cmd_t cmd = {
+        .opcode = NVME_ADMIN_OP_SET_FEATURES,
+        .cdw10 = NVME_FEATURE_NUM_QUEUES,
+        .cdw11 = ((wanted - 1) << 16) | (wanted - 1),
+    };
+    uint32_t granted;
+    if ((status = nvme_admin_cmd(dev, &cmd, &granted)) != ZX_OK) {
+        return status;
+    }
+    wanted = MIN(wanted, (granted & 0xffff) + 1);
+    wanted = MIN(wanted, (granted >> 16) + 1);
+
+    if ((status = nvme_setup_irqs(dev, wanted)) != ZX_OK) {
+        return status;
+    }
+
+    dev->io_queues = calloc(wanted, sizeof(nvme_queue_t));
+    if (!dev->io_queues) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    dev->max_io_queues = wanted;
+    uint16_t entries = MIN(NVME_IO_QUEUE_ENTRIES, NVME_CAP_MQES(dev->cap) + 1);
+    for (uint32_t i = 0; i < wanted; i++) {
+        status = nvme_create_io_queue(dev, &dev->io_queues[i], i + 1, entries,
+                                      i % dev->num_vectors);
+        if (status != ZX_OK) {
+            if (i == 0) {
+                return status;
+            }
+            break;
+        }
+        dev->num_io_queues++;
+    }
+
+    for (uint32_t i = 0; i < dev->num_vectors; i++) {
+        int ret = thrd_create_with_name(&dev->vectors[i].thread, nvme_irq_thread,
+                                        &dev->vectors[i], "nvme-irq");
+        if (ret != thrd_success) {
+            zxlogf(ERROR, "nvme: error %d in irq thread create\n", ret);
+            return ZX_ERR_NO_RESOURCES;
+        }
+        dev->vectors[i].thread_started = true;
+    }
+    zxlogf(INFO, "nvme: %u i/o queues of %u entries, max transfer %u bytes\n",
+           dev->num_io_queues, entries, dev->max_transfer);
+
+    for (uint32_t nsid = 1; nsid <= MIN(nn, NVME_MAX_NAMESPACES); nsid++) {
+        status = nvme_ns_add(dev, nsid);
+        if (status != ZX_OK) {
+            zxlogf(ERROR, "nvme: error %d adding namespace %u\n", status, nsid);
+        }
+    }
+    return ZX_OK;
+}
+
+static int nvme_init_thread(void* arg) {
+    nvme_device_t* dev = arg;
+    zx_status_t status = nvme_init(dev);
+    if (status != ZX_OK) {
+        // nothing was published, so take the controller device away again;
+        // its release cleans up whatever was set up
+        zxlogf(ERROR, "nvme: error %d initializing controller\n", status);
+        device_remove(dev->zxdev);
+    }
+    return status;
+}
+
+// implement driver object:
+
+static zx_status_t nvme_bind(void* ctx, zx_device_t* parent) {
+    nvme_device_t* dev = calloc(1, sizeof(nvme_device_t));
+    if (!dev) {
+        zxlogf(ERROR, "nvme: out of memory\n");
+        return ZX_ERR_NO_MEMORY;
+    }
+    mtx_init(&dev->lock, mtx_plain);
+    list_initialize(&dev->pending);
+    atomic_init(&dev->ordered, false);
+    atomic_init(&dev->inflight, 0);
+    atomic_init(&dev->next_queue, 0);
+
+    if (device_get_protocol(parent, ZX_PROTOCOL_PCI, &dev->pci)) {
+        free(dev);
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // map register window
+    zx_status_t status = pci_map_resource(&dev->pci, PCI_RESOURCE_BAR_0,
+                                          ZX_CACHE_POLICY_UNCACHED_DEVICE,
+                                          &dev->regs, &dev->regs_size, &dev->regs_handle);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d mapping register window\n", status);
+        goto fail;
+    }
+
+    status = pci_enable_bus_master(&dev->pci, true);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d in enable bus master\n", status);
+        goto fail;
+    }
+
+    // add the device for the controller
+    device_add_args_t args = {
+        .version = DEVICE_ADD_ARGS_VERSION,
+        .name = "nvme",
+        .ctx = dev,
+        .ops = &nvme_device_proto,
+        .flags = DEVICE_ADD_NON_BINDABLE,
+    };
+    status = device_add(parent, &args, &dev->zxdev);
+    if (status != ZX_OK) {
+        zxlogf(ERROR, "nvme: error %d in device_add\n", status);
+        goto fail;
+    }
+
+    // initialize controller and publish namespaces
+    thrd_t t;
+    int ret = thrd_create_with_name(&t, nvme_init_thread, dev, "nvme-init");
+    if (ret != thrd_success) {
+        zxlogf(ERROR, "nvme: error %d in init thread create\n", ret);
+        device_remove(dev->zxdev);
+        return ZX_ERR_NO_RESOURCES;
+    }
+    thrd_detach(t);
+    return ZX_OK;
+
+fail:
+    nvme_free(dev);
+    return status;
+}
+
+static zx_driver_ops_t nvme_driver_ops = {
+    .version = DRIVER_OPS_VERSION,
+    .bind = nvme_bind,
+};
+
+// clang-format off
+ZIRCON_DRIVER_BEGIN(nvme, nvme_driver_ops, "zircon", "0.1", 4)
+    BI_ABORT_IF(NE, BIND_PROTOCOL, ZX_PROTOCOL_PCI),
+    BI_ABORT_IF(NE, BIND_PCI_CLASS, 0x01),
+    BI_ABORT_IF(NE, BIND_PCI_SUBCLASS, 0x08),
+    BI_MATCH_IF(EQ, BIND_PCI_INTERFACE, 0x02),
+ZIRCON_DRIVER_END(nvme)
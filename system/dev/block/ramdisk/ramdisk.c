@@ -40,8 +40,123 @@ typedef struct ramdisk_device {
     thrd_t worker;
     cnd_t work_cvar;
     list_node_t txn_list;
+
+    // When simulating a write cache, the contents as of the last flush, and
+    // the range of bytes written since then.  Protected by lock.
+    zx_handle_t durable_vmo;
+    uintptr_t durable_addr;
+    zx_off_t dirty_start;
+    zx_off_t dirty_end;
+
+    // Fault injection: once |sleep_after| more blocks have been written (if
+    // |sleep_armed|), the ramdisk is |asleep|, and fails all I/O until woken.
+    // Protected by lock.
+    bool sleep_armed;
+    bool asleep;
+    uint64_t sleep_after;
 } ramdisk_device_t;
 
+static uint64_t sizebytes(ramdisk_device_t* rdev);
+
+// Makes everything written so far durable.
+static void ramdisk_commit_locked(ramdisk_device_t* dev) {
+    if (dev->durable_addr && dev->dirty_end > dev->dirty_start) {
+        memcpy((void*)dev->durable_addr + dev->dirty_start,
+               (void*)dev->mapped_addr + dev->dirty_start, dev->dirty_end - dev->dirty_start);
+    }
+    dev->dirty_start = 0;
+    dev->dirty_end = 0;
+}
+
+// Throws away everything written since the last commit.
+static void ramdisk_revert_locked(ramdisk_device_t* dev) {
+    if (dev->dirty_end > dev->dirty_start) {
+        memcpy((void*)dev->mapped_addr + dev->dirty_start,
+               (void*)dev->durable_addr + dev->dirty_start, dev->dirty_end - dev->dirty_start);
+    }
+    dev->dirty_start = 0;
+    dev->dirty_end = 0;
+}
+
+// Notes that [offset, offset + length) has changed since the last commit.
+static void ramdisk_mark_dirty_locked(ramdisk_device_t* dev, zx_off_t offset, zx_off_t length) {
+    if (length == 0) {
+        return;
+    }
+    zx_off_t end = offset + length;
+    if (dev->dirty_end == dev->dirty_start) {
+        dev->dirty_start = offset;
+        dev->dirty_end = end;
+    } else {
+        dev->dirty_start = MIN(dev->dirty_start, offset);
+        dev->dirty_end = MAX(dev->dirty_end, end);
+    }
+}
+
+// Zeroes [offset, offset + length), handing whole pages back to the system.
+static void ramdisk_trim(ramdisk_device_t* dev, zx_off_t offset, zx_off_t length) {
+    zx_off_t end = offset + length;
+    zx_off_t page_start = ROUNDUP(offset, PAGE_SIZE);
+    zx_off_t page_end = ROUNDDOWN(end, PAGE_SIZE);
+    if (page_start >= page_end) {
+        memset((void*)dev->mapped_addr + offset, 0, length);
+        return;
+    }
+    memset((void*)dev->mapped_addr + offset, 0, page_start - offset);
+    zx_vmo_op_range(dev->vmo, ZX_VMO_OP_DECOMMIT, page_start, page_end - page_start, NULL, 0);
+    memset((void*)dev->mapped_addr + page_end, 0, end - page_end);
+}
+
+static zx_status_t ramdisk_simulate_write_cache(ramdisk_device_t* dev) {
+    mtx_lock(&dev->lock);
+    if (dev->durable_addr) {
+        mtx_unlock(&dev->lock);
+        return ZX_OK;
+    }
+    zx_status_t status = zx_vmo_create(sizebytes(dev), 0, &dev->durable_vmo);
+    if (status != ZX_OK) {
+        mtx_unlock(&dev->lock);
+        return status;
+    }
+    status = zx_vmar_map(zx_vmar_root_self(), 0, dev->durable_vmo, 0, sizebytes(dev),
+                         ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &dev->durable_addr);
+    if (status != ZX_OK) {
+        zx_handle_close(dev->durable_vmo);
+        dev->durable_vmo = ZX_HANDLE_INVALID;
+        mtx_unlock(&dev->lock);
+        return status;
+    }
+    // Whatever is there now is treated as already flushed.
+    memcpy((void*)dev->durable_addr, (void*)dev->mapped_addr, sizebytes(dev));
+    dev->dirty_start = 0;
+    dev->dirty_end = 0;
+    mtx_unlock(&dev->lock);
+    return ZX_OK;
+}
+
+// Applies the fault injection set up by IOCTL_RAMDISK_SLEEP_AFTER to |txn|.
+// Returns false if the ramdisk is asleep, so the txn must fail; otherwise
+// |*length| is how much of the txn to carry out, since a write which crosses
+// the point where the ramdisk falls asleep is cut short.
+static bool ramdisk_awake_locked(ramdisk_device_t* dev, iotxn_t* txn, zx_off_t* length) {
+    *length = txn->length;
+    if (dev->asleep) {
+        return false;
+    }
+    if (!dev->sleep_armed || txn->opcode != IOTXN_OP_WRITE) {
+        return true;
+    }
+    uint64_t blocks = txn->length / dev->blk_size;
+    if (blocks < dev->sleep_after) {
+        dev->sleep_after -= blocks;
+        return true;
+    }
+    *length = dev->sleep_after * dev->blk_size;
+    dev->sleep_armed = false;
+    dev->asleep = true;
+    return *length != 0;
+}
+
 // The worker thread processes messages from iotxns in the background
 static int worker_thread(void* arg) {
     ramdisk_device_t* dev = (ramdisk_device_t*)arg;
@@ -56,7 +171,14 @@ static int worker_thread(void* arg) {
             cnd_wait(&dev->work_cvar, &dev->lock);
         }
 
+        zx_off_t length;
+        bool awake = ramdisk_awake_locked(dev, txn, &length);
         mtx_unlock(&dev->lock);
+        if (!awake) {
+            iotxn_complete(txn, ZX_ERR_UNAVAILABLE, 0);
+            mtx_lock(&dev->lock);
+            continue;
+        }
         switch (txn->opcode) {
             case IOTXN_OP_READ: {
                 iotxn_copyto(txn, (void*) dev->mapped_addr + txn->offset, txn->length, 0);
@@ -64,8 +186,41 @@ static int worker_thread(void* arg) {
                 break;
             }
             case IOTXN_OP_WRITE: {
-                iotxn_copyfrom(txn, (void*) dev->mapped_addr + txn->offset, txn->length, 0);
-                iotxn_complete(txn, ZX_OK, txn->length);
+                if (dev->durable_vmo == ZX_HANDLE_INVALID) {
+                    iotxn_copyfrom(txn, (void*) dev->mapped_addr + txn->offset, length, 0);
+                } else {
+                    // Record the write under the lock, so a simulated crash
+                    // can't slip in between the copy and the bookkeeping.
+                    mtx_lock(&dev->lock);
+                    iotxn_copyfrom(txn, (void*) dev->mapped_addr + txn->offset, length, 0);
+                    ramdisk_mark_dirty_locked(dev, txn->offset, length);
+                    mtx_unlock(&dev->lock);
+                }
+                if (length != txn->length) {
+                    iotxn_complete(txn, ZX_ERR_UNAVAILABLE, length);
+                } else {
+                    iotxn_complete(txn, ZX_OK, txn->length);
+                }
+                break;
+            }
+            case IOTXN_OP_TRIM: {
+                // Like a write, a trim isn't durable until the next flush.
+                mtx_lock(&dev->lock);
+                ramdisk_trim(dev, txn->offset, txn->length);
+                if (dev->durable_vmo != ZX_HANDLE_INVALID) {
+                    ramdisk_mark_dirty_locked(dev, txn->offset, txn->length);
+                }
+                mtx_unlock(&dev->lock);
+                iotxn_complete(txn, ZX_OK, 0);
+                break;
+            }
+            case IOTXN_OP_FLUSH: {
+                // Txns are handled one at a time in the order they were
+                // queued, so everything ahead of the flush is already done.
+                mtx_lock(&dev->lock);
+                ramdisk_commit_locked(dev);
+                mtx_unlock(&dev->lock);
+                iotxn_complete(txn, ZX_OK, 0);
                 break;
             }
             default: {
@@ -108,7 +263,7 @@ static void ramdisk_get_info(void* ctx, block_info_t* info) {
     info->block_count = sizebytes(ramdev) / ramdev->blk_size;
     // Arbitrarily set, but matches the SATA driver for testing
     info->max_transfer_size = (1 << 25);
-    info->flags = ramdev->flags;
+    info->flags = ramdev->flags | BLOCK_FLAG_TRIM_SUPPORT;
 }
 
 // implement device protocol:
@@ -121,6 +276,12 @@ static void ramdisk_unbind(void* ctx) {
     device_remove(ramdev->zxdev);
 }
 
+static void ramdisk_iotxn_queue(void* ctx, iotxn_t* txn);
+
+static void ramdisk_sync_complete(iotxn_t* txn, void* cookie) {
+    completion_signal((completion_t*)cookie);
+}
+
 static zx_status_t ramdisk_ioctl(void* ctx, uint32_t op, const void* cmd, size_t cmd_len,
                                  void* reply, size_t max, size_t* out_actual) {
     ramdisk_device_t* ramdev = ctx;
@@ -160,10 +321,58 @@ static zx_status_t ramdisk_ioctl(void* ctx, uint32_t op, const void* cmd, size_t
     case IOCTL_BLOCK_RR_PART: {
         return device_rebind(ramdev->zxdev);
     }
-    case IOCTL_DEVICE_SYNC: {
-        // Wow, we sync so quickly!
+    case IOCTL_RAMDISK_SIMULATE_WRITE_CACHE: {
+        return ramdisk_simulate_write_cache(ramdev);
+    }
+    case IOCTL_RAMDISK_SIMULATE_CRASH: {
+        mtx_lock(&ramdev->lock);
+        if (!ramdev->durable_addr) {
+            mtx_unlock(&ramdev->lock);
+            return ZX_ERR_BAD_STATE;
+        }
+        ramdisk_revert_locked(ramdev);
+        mtx_unlock(&ramdev->lock);
         return ZX_OK;
     }
+    case IOCTL_RAMDISK_SLEEP_AFTER: {
+        if (cmd_len < sizeof(uint64_t)) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        mtx_lock(&ramdev->lock);
+        ramdev->sleep_after = *(const uint64_t*)cmd;
+        ramdev->sleep_armed = ramdev->sleep_after != 0;
+        ramdev->asleep = ramdev->sleep_after == 0;
+        mtx_unlock(&ramdev->lock);
+        return ZX_OK;
+    }
+    case IOCTL_RAMDISK_WAKE_UP: {
+        mtx_lock(&ramdev->lock);
+        ramdev->sleep_armed = false;
+        ramdev->asleep = false;
+        mtx_unlock(&ramdev->lock);
+        return ZX_OK;
+    }
+    case IOCTL_DEVICE_SYNC: {
+        // Go through the queue, so the flush is ordered after the writes
+        // already in it.
+        iotxn_t* txn;
+        zx_status_t status = iotxn_alloc(&txn, 0, 0);
+        if (status != ZX_OK) {
+            return status;
+        }
+        completion_t completion = COMPLETION_INIT;
+        txn->opcode = IOTXN_OP_FLUSH;
+        txn->flags = IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER;
+        txn->offset = 0;
+        txn->length = 0;
+        txn->complete_cb = ramdisk_sync_complete;
+        txn->cookie = &completion;
+        ramdisk_iotxn_queue(ramdev, txn);
+        completion_wait(&completion, ZX_TIME_INFINITE);
+        status = txn->status;
+        iotxn_release(txn);
+        return status;
+    }
     default:
         return ZX_ERR_NOT_SUPPORTED;
     }
@@ -175,10 +384,12 @@ static void ramdisk_iotxn_queue(void* ctx, iotxn_t* txn) {
         iotxn_complete(txn, ZX_ERR_BAD_STATE, 0);
         return;
     }
-    zx_status_t status = constrain_args(ramdev, &txn->offset, &txn->length);
-    if (status != ZX_OK) {
-        iotxn_complete(txn, status, 0);
-        return;
+    if (txn->opcode != IOTXN_OP_FLUSH) {
+        zx_status_t status = constrain_args(ramdev, &txn->offset, &txn->length);
+        if (status != ZX_OK) {
+            iotxn_complete(txn, status, 0);
+            return;
+        }
     }
 
     mtx_lock(&ramdev->lock);
@@ -206,6 +417,10 @@ static void ramdisk_release(void* ctx) {
         zx_vmar_unmap(zx_vmar_root_self(), ramdev->mapped_addr, sizebytes(ramdev));
         zx_handle_close(ramdev->vmo);
     }
+    if (ramdev->durable_vmo != ZX_HANDLE_INVALID) {
+        zx_vmar_unmap(zx_vmar_root_self(), ramdev->durable_addr, sizebytes(ramdev));
+        zx_handle_close(ramdev->durable_vmo);
+    }
     free(ramdev);
 }
 
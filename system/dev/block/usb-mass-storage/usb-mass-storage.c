@@ -242,6 +242,20 @@ static zx_status_t ums_mode_sense6(ums_t* ums, uint8_t lun, scsi_mode_sense_6_da
     return status;
 }
 
+static zx_status_t ums_synchronize_cache(ums_block_t* dev) {
+    // CBW Configuration
+    // zero lba and length cover the whole lun
+    scsi_command10_t command;
+    memset(&command, 0, sizeof(command));
+    command.opcode = UMS_SYNCHRONIZE_CACHE;
+
+    ums_t* ums = block_to_ums(dev);
+    ums_send_cbw(ums, dev->lun, 0, USB_DIR_IN, sizeof(command), &command);
+
+    // wait for CSW
+    return ums_read_csw(ums, NULL);
+}
+
 static zx_status_t ums_data_transfer(ums_t* ums, iotxn_t* txn, zx_off_t offset, size_t length,
                                      uint8_t ep_address) {
     usb_request_t* req = &ums->data_transfer_req;
@@ -604,6 +618,8 @@ static int ums_worker_thread(void* arg) {
             status = ums_read(dev, txn);
         }else if (txn->opcode == IOTXN_OP_WRITE) {
             status = ums_write(dev, txn);
+        } else if (txn->opcode == IOTXN_OP_FLUSH) {
+            status = ums_synchronize_cache(dev);
         } else {
             status = ZX_ERR_INVALID_ARGS;
         }
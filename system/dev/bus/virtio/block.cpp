@@ -33,15 +33,23 @@ void BlockDevice::virtio_block_iotxn_queue(void* ctx, iotxn_t* txn) {
     switch (txn->opcode) {
     case IOTXN_OP_READ: {
         LTRACEF("READ offset %#" PRIx64 " length %#" PRIx64 "\n", txn->offset, txn->length);
-        bd->QueueReadWriteTxn(txn);
+        bd->QueueTxn(txn);
         break;
     }
     case IOTXN_OP_WRITE:
         LTRACEF("WRITE offset %#" PRIx64 " length %#" PRIx64 "\n", txn->offset, txn->length);
-        bd->QueueReadWriteTxn(txn);
+        bd->QueueTxn(txn);
+        break;
+    case IOTXN_OP_FLUSH:
+        LTRACEF("FLUSH\n");
+        bd->QueueTxn(txn);
+        break;
+    case IOTXN_OP_TRIM:
+        LTRACEF("TRIM offset %#" PRIx64 " length %#" PRIx64 "\n", txn->offset, txn->length);
+        bd->QueueTxn(txn);
         break;
     default:
-        iotxn_complete(txn, -1, 0);
+        iotxn_complete(txn, ZX_ERR_NOT_SUPPORTED, 0);
         break;
     }
 }
@@ -61,6 +69,9 @@ void BlockDevice::GetInfo(block_info_t* info) {
     info->block_size = GetBlockSize();
     info->block_count = GetSize() / GetBlockSize();
     info->max_transfer_size = (uint32_t)(PAGE_SIZE * (ring_size - 2));
+    if (discard_supported_) {
+        info->flags |= BLOCK_FLAG_TRIM_SUPPORT;
+    }
 }
 
 zx_status_t BlockDevice::virtio_block_ioctl(void* ctx, uint32_t op, const void* in_buf, size_t in_len,
@@ -119,17 +130,47 @@ zx_status_t BlockDevice::Init() {
     // ack and set the driver status bit
     DriverStatusAck();
 
-    // XXX check features bits and ack/nak them
+    // a device with a write cache only offers a way to flush it
+    if (DeviceFeatureSupported(VIRTIO_BLK_F_FLUSH)) {
+        DriverFeatureAck(VIRTIO_BLK_F_FLUSH);
+        flush_supported_ = true;
+    }
+
+    // the discard limits in the config are only valid if the feature is offered
+    if (DeviceFeatureSupported(VIRTIO_BLK_F_DISCARD) && config_.max_discard_sectors > 0) {
+        DriverFeatureAck(VIRTIO_BLK_F_DISCARD);
+        discard_supported_ = true;
+        LTRACEF("max_discard_sectors %#x\n", config_.max_discard_sectors);
+    }
+
+    // a whole transfer takes up a single ring slot through an indirect table
+    if (DeviceFeatureSupported(1u << VIRTIO_F_RING_INDIRECT_DESC)) {
+        DriverFeatureAck(1u << VIRTIO_F_RING_INDIRECT_DESC);
+        indirect_supported_ = true;
+    }
+
+    // requests are spread over the queues; they all share the one interrupt
+    if (DeviceFeatureSupported(VIRTIO_BLK_F_MQ) && config_.num_queues > 1) {
+        DriverFeatureAck(VIRTIO_BLK_F_MQ);
+        uint16_t num_queues = config_.num_queues;
+        num_queues_ = fbl::min(num_queues, static_cast<uint16_t>(kMaxQueues));
+        LTRACEF("num_queues %u of %u\n", num_queues_, num_queues);
+    }
+
+    // XXX check the rest of the features bits and ack/nak them
 
-    // allocate the main vring
-    auto err = vring_.Init(0, ring_size);
-    if (err < 0) {
-        zxlogf(ERROR, "failed to allocate vring\n");
-        return err;
+    // allocate the vrings
+    for (uint16_t q = 0; q < num_queues_; q++) {
+        auto err = vrings_[q].Init(q, ring_size);
+        if (err < 0) {
+            zxlogf(ERROR, "failed to allocate vring %u\n", q);
+            return err;
+        }
     }
 
     // allocate a queue of block requests
-    size_t size = sizeof(virtio_blk_req_t) * blk_req_count + sizeof(uint8_t) * blk_req_count;
+    size_t size = sizeof(virtio_blk_req_t) * blk_req_count + sizeof(uint8_t) * blk_req_count +
+                  sizeof(virtio_blk_discard_t) * blk_req_count;
 
     zx_status_t r = map_contiguous_memory(size, (uintptr_t*)&blk_req_, &blk_req_pa_);
     if (r < 0) {
@@ -139,12 +180,24 @@ zx_status_t BlockDevice::Init() {
 
     LTRACEF("allocated blk request at %p, physical address %#" PRIxPTR "\n", blk_req_, blk_req_pa_);
 
-    // responses are 32 words at the end of the allocated block
+    // responses are a byte per request after the requests
     blk_res_pa_ = blk_req_pa_ + sizeof(virtio_blk_req_t) * blk_req_count;
     blk_res_ = (uint8_t*)((uintptr_t)blk_req_ + sizeof(virtio_blk_req_t) * blk_req_count);
 
     LTRACEF("allocated blk responses at %p, physical address %#" PRIxPTR "\n", blk_res_, blk_res_pa_);
 
+    // followed by the discard ranges
+    blk_discard_pa_ = blk_res_pa_ + sizeof(uint8_t) * blk_req_count;
+    blk_discard_ = (virtio_blk_discard_t*)(blk_res_ + sizeof(uint8_t) * blk_req_count);
+
+    // and the descriptor tables live in their own block
+    size = sizeof(vring_desc) * kIndirectCount * blk_req_count;
+    r = map_contiguous_memory(size, (uintptr_t*)&indirect_, &indirect_pa_);
+    if (r < 0) {
+        zxlogf(ERROR, "cannot alloc indirect descriptor tables %d\n", r);
+        return r;
+    }
+
     // start the interrupt thread
     StartIrqThread();
 
@@ -176,10 +229,13 @@ zx_status_t BlockDevice::Init() {
 void BlockDevice::IrqRingUpdate() {
     LTRACE_ENTRY;
 
+    list_node done = LIST_INITIAL_VALUE(done);
+
     // parse our descriptor chain, add back to the free queue
-    auto free_chain = [this](vring_used_elem* used_elem) {
+    Ring* ring = nullptr;
+    auto free_chain = [this, &ring, &done](vring_used_elem* used_elem) {
         uint32_t i = (uint16_t)used_elem->id;
-        struct vring_desc* desc = vring_.DescFromIndex((uint16_t)i);
+        struct vring_desc* desc = ring->DescFromIndex((uint16_t)i);
         auto head_desc = desc; // save the first element
         for (;;) {
             int next;
@@ -191,12 +247,12 @@ void BlockDevice::IrqRingUpdate() {
                 next = -1;
             }
 
-            vring_.FreeDesc((uint16_t)i);
+            ring->FreeDesc((uint16_t)i);
 
             if (next < 0)
                 break;
             i = next;
-            desc = vring_.DescFromIndex((uint16_t)i);
+            desc = ring->DescFromIndex((uint16_t)i);
         }
 
         // search our pending txn list to see if this completes it
@@ -204,16 +260,48 @@ void BlockDevice::IrqRingUpdate() {
         list_for_every_entry (&iotxn_list, txn, iotxn_t, node) {
             if (txn->context == head_desc) {
                 LTRACEF("completes txn %p\n", txn);
-                free_blk_req((unsigned int)txn->extra[1]);
+                size_t index = (size_t)txn->extra[1];
+                free_blk_req(index);
+                queue_depth_[req_queue_[index]]--;
                 list_delete(&txn->node);
-                iotxn_complete(txn, ZX_OK, txn->length);
+                switch (blk_res_[index]) {
+                case VIRTIO_BLK_S_OK:
+                    txn->status = ZX_OK;
+                    txn->actual = txn->length;
+                    break;
+                case VIRTIO_BLK_S_UNSUPP:
+                    txn->status = ZX_ERR_NOT_SUPPORTED;
+                    txn->actual = 0;
+                    break;
+                default:
+                    txn->status = ZX_ERR_IO;
+                    txn->actual = 0;
+                    break;
+                }
+                list_add_tail(&done, &txn->node);
                 break;
             }
         }
     };
 
-    // tell the ring to find free chains and hand it back to our lambda
-    vring_.IrqRingUpdate(free_chain);
+    {
+        fbl::AutoLock lock(&lock_);
+
+        // tell the rings to find free chains and hand them back to our lambda
+        for (uint16_t q = 0; q < num_queues_; q++) {
+            ring = &vrings_[q];
+            ring->IrqRingUpdate(free_chain);
+        }
+
+        // whatever was waiting on the transfers that just finished can go now
+        SubmitPendingLocked(&done);
+    }
+
+    // complete without the lock held, completions may queue more transfers
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&done, iotxn_t, node)) != nullptr) {
+        iotxn_complete(txn, txn->status, txn->actual);
+    }
 }
 
 void BlockDevice::IrqConfigChange() {
@@ -256,128 +344,262 @@ static void ScatterGatherHelper(const iotxn_t* txn, callback callback_new_run) {
         callback_new_run(run_start, run_len);
 }
 
-void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
+void BlockDevice::QueueTxn(iotxn_t* txn) {
     LTRACEF("txn %p, pflags %#x\n", txn, txn->pflags);
 
-    fbl::AutoLock lock(&lock_);
+    list_node done = LIST_INITIAL_VALUE(done);
+    {
+        fbl::AutoLock lock(&lock_);
 
-    bool write = (txn->opcode == IOTXN_OP_WRITE);
+        // anything behind a held back transfer waits too, to keep the order
+        if (!list_is_empty(&pending_list_) || BarrierLocked(txn) ||
+            !SubmitTxnLocked(txn, &done)) {
+            LTRACEF("txn %p waits\n", txn);
+            list_add_tail(&pending_list_, &txn->node);
+        }
+    }
 
-    // offset must be aligned to block size
-    if (txn->offset % config_.blk_size) {
-        LTRACEF("offset %#" PRIx64 " is not aligned to sector size %u!\n", txn->offset, config_.blk_size);
-        iotxn_complete(txn, ZX_ERR_INVALID_ARGS, 0);
-        return;
+    while ((txn = list_remove_head_type(&done, iotxn_t, node)) != nullptr) {
+        iotxn_complete(txn, txn->status, txn->actual);
     }
+}
 
-    // trim length to a multiple of the block size
-    if (txn->length % config_.blk_size) {
-        txn->length = ROUNDDOWN(txn->length, config_.blk_size);
+bool BlockDevice::BarrierLocked(const iotxn_t* txn) {
+    if (list_is_empty(&iotxn_list)) {
+        return false;
+    }
+    if (txn->flags & IOTXN_SYNC_BEFORE) {
+        return true;
     }
+    iotxn_t* active;
+    list_for_every_entry (&iotxn_list, active, iotxn_t, node) {
+        if (active->flags & IOTXN_SYNC_AFTER) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // constrain to device capacity
-    txn->length = fbl::min(txn->length, GetSize() - txn->offset);
-    if (txn->length == 0) {
-        iotxn_complete(txn, ZX_OK, 0);
-        return;
+void BlockDevice::SubmitPendingLocked(list_node* done) {
+    iotxn_t* txn;
+    while ((txn = list_peek_head_type(&pending_list_, iotxn_t, node)) != nullptr) {
+        if (BarrierLocked(txn)) {
+            break;
+        }
+        list_delete(&txn->node);
+        if (!SubmitTxnLocked(txn, done)) {
+            // out of request slots or descriptors until something completes
+            list_add_head(&pending_list_, &txn->node);
+            break;
+        }
+    }
+}
+
+bool BlockDevice::SubmitTxnLocked(iotxn_t* txn, list_node* done) {
+    auto finish = [txn, done](zx_status_t status, zx_off_t actual) {
+        txn->status = status;
+        txn->actual = actual;
+        list_add_tail(done, &txn->node);
+        return true;
+    };
+
+    uint32_t type;
+    switch (txn->opcode) {
+    case IOTXN_OP_FLUSH:
+        // without a write cache, everything which completed is already durable
+        if (!flush_supported_) {
+            return finish(ZX_OK, 0);
+        }
+        type = VIRTIO_BLK_T_FLUSH;
+        break;
+    case IOTXN_OP_TRIM:
+        if (!discard_supported_) {
+            return finish(ZX_ERR_NOT_SUPPORTED, 0);
+        }
+        if ((txn->offset % config_.blk_size) || (txn->length % config_.blk_size)) {
+            return finish(ZX_ERR_INVALID_ARGS, 0);
+        }
+        if (txn->offset >= GetSize() || txn->length > GetSize() - txn->offset) {
+            return finish(ZX_ERR_OUT_OF_RANGE, 0);
+        }
+        if (txn->length == 0) {
+            return finish(ZX_OK, 0);
+        }
+        type = VIRTIO_BLK_T_DISCARD;
+        break;
+    default:
+        // offset must be aligned to block size
+        if (txn->offset % config_.blk_size) {
+            LTRACEF("offset %#" PRIx64 " is not aligned to sector size %u!\n", txn->offset, config_.blk_size);
+            return finish(ZX_ERR_INVALID_ARGS, 0);
+        }
+
+        // trim length to a multiple of the block size
+        if (txn->length % config_.blk_size) {
+            txn->length = ROUNDDOWN(txn->length, config_.blk_size);
+        }
+
+        // constrain to device capacity
+        txn->length = fbl::min(txn->length, GetSize() - txn->offset);
+        if (txn->length == 0) {
+            return finish(ZX_OK, 0);
+        }
+        type = (txn->opcode == IOTXN_OP_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        break;
     }
 
     // allocate and start filling out a block request
     auto index = alloc_blk_req();
     if (index >= blk_req_count) {
-        TRACEF("too many block requests queued (%zu)!\n", index);
-        iotxn_complete(txn, ZX_ERR_NO_RESOURCES, 0);
-        return;
+        LTRACEF("all %zu block requests in use\n", blk_req_count);
+        return false;
     }
 
     auto req = &blk_req_[index];
-    req->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    req->type = type;
     req->ioprio = 0;
-    req->sector = txn->offset / 512;
+    req->sector = (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) ? txn->offset / 512 : 0;
     LTRACEF("blk_req type %u ioprio %u sector %" PRIu64 "\n",
             req->type, req->ioprio, req->sector);
 
     // save the req index into the txn->extra[1] slot so we can free it when we complete the transfer
     txn->extra[1] = index;
 
-    // get the physical map for the transfer
-    auto status = iotxn_physmap(txn);
-    LTRACEF("status %d, pflags %#x\n", status, txn->pflags);
+    // stage the chain in the request's descriptor table
+    vring_desc* table = indirect_ + index * kIndirectCount;
+    uint16_t count = 0;
+    table[count].addr = blk_req_pa_ + index * sizeof(virtio_blk_req_t);
+    table[count].len = sizeof(virtio_blk_req_t);
+    table[count].flags = 0;
+    count++;
+
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        // A discard is only a hint, so a range bigger than the device takes
+        // in one request is cut short rather than split.
+        auto range = &blk_discard_[index];
+        range->sector = txn->offset / 512;
+        range->num_sectors = static_cast<uint32_t>(
+            fbl::min<uint64_t>(txn->length / 512, config_.max_discard_sectors));
+        range->flags = 0;
+
+        table[count].addr = blk_discard_pa_ + index * sizeof(virtio_blk_discard_t);
+        table[count].len = sizeof(virtio_blk_discard_t);
+        table[count].flags = 0;
+        count++;
+    } else if (type != VIRTIO_BLK_T_FLUSH) {
+        // get the physical map for the transfer
+        auto status = iotxn_physmap(txn);
+        LTRACEF("status %d, pflags %#x\n", status, txn->pflags);
+        if (status != ZX_OK) {
+            free_blk_req(index);
+            return finish(status, 0);
+        }
 #if LOCAL_TRACE
-    LTRACEF("phys %p, phys_count %#lx\n", txn->phys, txn->phys_count);
-    for (uint64_t i = 0; i < txn->phys_count; i++) {
-        LTRACEF("phys %lu: %#lx\n", i, txn->phys[i]);
-    }
+        LTRACEF("phys %p, phys_count %#lx\n", txn->phys, txn->phys_count);
+        for (uint64_t i = 0; i < txn->phys_count; i++) {
+            LTRACEF("phys %lu: %#lx\n", i, txn->phys[i]);
+        }
 #endif
 
-    // count the number of physical runs we're going to need
-    size_t run_count = 0;
-
-    {
-        auto new_run_callback = [&run_count](uint64_t start, uint64_t len) {
+        // count the number of physical runs we're going to need
+        size_t run_count = 0;
+        ScatterGatherHelper(txn, [&run_count](uint64_t start, uint64_t len) {
             LTRACEF("start %#lx len %#lx\n", start, len);
             run_count++;
-        };
+        });
+        LTRACEF("run count %lu\n", run_count);
+        assert(run_count > 0);
+
+        if (2u + run_count > kIndirectCount ||
+            (!indirect_supported_ && 2u + run_count > ring_size)) {
+            TRACEF("transfer of %zu runs too fragmented for the ring\n", run_count);
+            free_blk_req(index);
+            return finish(ZX_ERR_OUT_OF_RANGE, 0);
+        }
 
-        ScatterGatherHelper(txn, new_run_callback);
+        /* mark buffers as write-only if it's a block read */
+        const uint16_t flags = (type == VIRTIO_BLK_T_IN) ? VRING_DESC_F_WRITE : 0;
+        ScatterGatherHelper(txn, [table, flags, &count](uint64_t start, uint64_t len) {
+            table[count].addr = start;
+            table[count].len = (uint32_t)len;
+            table[count].flags = flags;
+            count++;
+        });
     }
 
-    LTRACEF("run count %lu\n", run_count);
-    assert(run_count > 0);
-
-    /* put together a transfer */
-    uint16_t i;
-    auto desc = vring_.AllocDescChain((uint16_t)(2u + run_count), &i);
-    if (!desc) {
-        TRACEF("failed to allocate descriptor chain of length %zu\n", 2u + run_count);
-        // TODO: handle this scenario by requeing the transfer in smaller runs
-        iotxn_complete(txn, ZX_ERR_NO_RESOURCES, 0);
-        return;
+    /* the device writes the status last */
+    table[count].addr = blk_res_pa_ + index;
+    table[count].len = 1;
+    table[count].flags = VRING_DESC_F_WRITE;
+    count++;
+
+    if (!SubmitDescsLocked(txn, index, count)) {
+        free_blk_req(index);
+        return false;
     }
+    return true;
+}
 
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+bool BlockDevice::SubmitDescsLocked(iotxn_t* txn, size_t index, uint16_t count) {
+    // the queue with the fewest transfers in flight
+    uint16_t q = 0;
+    for (uint16_t i = 1; i < num_queues_; i++) {
+        if (queue_depth_[i] < queue_depth_[q]) {
+            q = i;
+        }
+    }
+    Ring* ring = &vrings_[q];
+
+    vring_desc* table = indirect_ + index * kIndirectCount;
+    uint16_t head;
+    vring_desc* desc;
+    if (indirect_supported_) {
+        desc = ring->AllocDescChain(1u, &head);
+        if (!desc) {
+            LTRACEF("ring %u full\n", q);
+            return false;
+        }
+        for (uint16_t i = 0; i + 1 < count; i++) {
+            table[i].flags |= VRING_DESC_F_NEXT;
+            table[i].next = static_cast<uint16_t>(i + 1);
+        }
+        desc->addr = indirect_pa_ + index * kIndirectCount * sizeof(vring_desc);
+        desc->len = static_cast<uint32_t>(count * sizeof(vring_desc));
+        desc->flags = VRING_DESC_F_INDIRECT;
+        LTRACE_DO(virtio_dump_desc(desc));
+    } else {
+        desc = ring->AllocDescChain(count, &head);
+        if (!desc) {
+            LTRACEF("ring %u has no chain of length %u\n", q, count);
+            return false;
+        }
+        vring_desc* d = desc;
+        for (uint16_t i = 0; i < count; i++) {
+            d->addr = table[i].addr;
+            d->len = table[i].len;
+            d->flags = table[i].flags;
+            if (i + 1 < count) {
+                d->flags |= VRING_DESC_F_NEXT;
+                d = ring->DescFromIndex(d->next);
+            }
+            LTRACE_DO(virtio_dump_desc(d));
+        }
+    }
 
     /* point the iotxn at this head descriptor */
     txn->context = desc;
-
-    /* set up the descriptor pointing to the head */
-    desc->addr = blk_req_pa_ + index * sizeof(virtio_blk_req_t);
-    desc->len = sizeof(virtio_blk_req_t);
-    desc->flags = VRING_DESC_F_NEXT;
-    LTRACE_DO(virtio_dump_desc(desc));
-    {
-        auto new_run_callback = [this, write, &desc](uint64_t start, uint64_t len) {
-            /* set up the descriptor pointing to the buffer */
-            desc = vring_.DescFromIndex(desc->next);
-
-            desc->addr = start;
-            desc->len = (uint32_t)len;
-            desc->flags = VRING_DESC_F_NEXT;
-            LTRACEF("pa %#lx, len %#x\n", desc->addr, desc->len);
-
-            if (!write)
-                desc->flags |= VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
-        };
-
-        ScatterGatherHelper(txn, new_run_callback);
-    }
-    LTRACE_DO(virtio_dump_desc(desc));
-
-    /* set up the descriptor pointing to the response */
-    desc = vring_.DescFromIndex(desc->next);
-    desc->addr = blk_res_pa_ + index;
-    desc->len = 1;
-    desc->flags = VRING_DESC_F_WRITE;
-    LTRACE_DO(virtio_dump_desc(desc));
+    req_queue_[index] = q;
+    queue_depth_[q]++;
 
     // save the iotxn in a list
     list_add_tail(&iotxn_list, &txn->node);
 
     /* submit the transfer */
-    vring_.SubmitChain(i);
+    ring->SubmitChain(head);
 
     /* kick it off */
-    vring_.Kick();
+    ring->Kick();
+    return true;
 }
 
 } // namespace virtio
@@ -41,42 +41,90 @@ private:
 
     void GetInfo(block_info_t* info);
 
-    void QueueReadWriteTxn(iotxn_t* txn);
+    void QueueTxn(iotxn_t* txn);
+
+    // Whether |txn| has to wait for the transfers in flight to finish first,
+    // because of its own or their IOTXN_SYNC_* flags.
+    bool BarrierLocked(const iotxn_t* txn) TA_REQ(lock_);
+
+    // Hands |txn| to the device.  Returns false if the request slots or ring
+    // descriptors it needs are all taken, in which case it can be retried
+    // as is once a transfer completes.  Transfers which finish without
+    // reaching the device are put on |done|, to be completed once lock_ is
+    // dropped.
+    bool SubmitTxnLocked(iotxn_t* txn, list_node* done) TA_REQ(lock_);
+    void SubmitPendingLocked(list_node* done) TA_REQ(lock_);
+
+    // Puts the |count| descriptors staged in the indirect table of request
+    // |index| on the least busy queue, either through a single indirect
+    // descriptor or by copying them into the ring.  Returns false if the
+    // ring has no room for them.
+    bool SubmitDescsLocked(iotxn_t* txn, size_t index, uint16_t count) TA_REQ(lock_);
 
-    // the main virtio ring
-    Ring vring_ = {this};
+    // a queue of block request/responses
+    static const size_t blk_req_count = 64;
+
+    // the request queues, only the first num_queues_ of which are in use
+    static const uint16_t kMaxQueues = 4;
+    Ring vrings_[kMaxQueues] = {{this}, {this}, {this}, {this}};
+    uint16_t num_queues_ = 1;
+    // transfers in flight on each queue, and the queue of each request
+    size_t queue_depth_[kMaxQueues] TA_GUARDED(lock_) = {};
+    uint16_t req_queue_[blk_req_count] TA_GUARDED(lock_) = {};
 
     static const uint16_t ring_size = 128; // 128 matches legacy pci
 
     // saved block device configuration out of the pci config BAR
     virtio_blk_config_t config_ = {};
 
-    // a queue of block request/responses
-    static const size_t blk_req_count = 32;
-
     zx_paddr_t blk_req_pa_ = 0;
     virtio_blk_req_t* blk_req_ = nullptr;
 
     zx_paddr_t blk_res_pa_ = 0;
     uint8_t* blk_res_ = nullptr;
 
-    uint32_t blk_req_bitmap_ = 0;
+    // the single range of each discard request, indexed like blk_req_
+    zx_paddr_t blk_discard_pa_ = 0;
+    virtio_blk_discard_t* blk_discard_ = nullptr;
+
+    // A table of descriptors for each request, which the ring points at
+    // when the device takes indirect descriptors.  Otherwise the chain is
+    // staged here and copied into the ring.  Big enough for the header, the
+    // status byte and the runs of a max_transfer_size transfer which doesn't
+    // start on a page boundary.
+    static const uint16_t kIndirectCount = ring_size + 2;
+    zx_paddr_t indirect_pa_ = 0;
+    vring_desc* indirect_ = nullptr;
+    bool indirect_supported_ = false;
+
+    uint64_t blk_req_bitmap_ = 0;
     static_assert(blk_req_count <= sizeof(blk_req_bitmap_) * CHAR_BIT, "");
 
     size_t alloc_blk_req() {
-        size_t i = 0;
-        if (blk_req_bitmap_ != 0)
-            i = sizeof(blk_req_bitmap_) * CHAR_BIT - __builtin_clz(blk_req_bitmap_);
-        blk_req_bitmap_ |= (1 << i);
+        if (blk_req_bitmap_ == ~0ull)
+            return blk_req_count;
+        size_t i = __builtin_ctzll(~blk_req_bitmap_);
+        if (i < blk_req_count)
+            blk_req_bitmap_ |= (1ull << i);
         return i;
     }
 
     void free_blk_req(size_t i) {
-        blk_req_bitmap_ &= ~(1 << i);
+        blk_req_bitmap_ &= ~(1ull << i);
     }
 
+    // set if the device has a volatile write cache which VIRTIO_BLK_T_FLUSH empties
+    bool flush_supported_ = false;
+
+    // set if the device takes VIRTIO_BLK_T_DISCARD requests
+    bool discard_supported_ = false;
+
     // pending iotxns
     list_node iotxn_list = LIST_INITIAL_VALUE(iotxn_list);
+
+    // iotxns held back by a barrier or waiting for a free request slot, in
+    // arrival order
+    list_node pending_list_ TA_GUARDED(lock_) = LIST_INITIAL_VALUE(pending_list_);
 };
 
 } // namespace virtio
@@ -506,21 +506,89 @@ static bool check_and_log_lz4_error(LZ4F_errorCode_t code, const char* msg) {
     return false;
 }
 
-ssize_t compress_setup(int fd, void** cookie, uint32_t* crc) {
+// Compression state, which also tracks where each block of the frame
+// starts so that an index of them can be written after the frame.
+typedef struct {
     LZ4F_compressionContext_t cctx;
-    LZ4F_errorCode_t errc = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+
+    // Offset from the start of the frame of the next byte written
+    size_t pos;
+    // Bytes of the current block (or its header) not yet written
+    size_t left;
+    uint8_t hdr[4];
+    size_t hdr_len;
+    bool done;
+
+    bootdata_lz4_block_t* index;
+    size_t count;
+    size_t max;
+} lz4_state_t;
+
+// The size of every block but the last, since we never flush the
+// compression context before the end of the frame.
+#define LZ4_BLOCK_SIZE 65536
+
+static int lz4_track_blocks(lz4_state_t* st, const uint8_t* buf, size_t len) {
+    while (len > 0 && !st->done) {
+        size_t n;
+        if (st->left > 0) {
+            n = (len < st->left) ? len : st->left;
+            st->left -= n;
+        } else {
+            n = sizeof(st->hdr) - st->hdr_len;
+            n = (len < n) ? len : n;
+            memcpy(st->hdr + st->hdr_len, buf, n);
+            st->hdr_len += n;
+            if (st->hdr_len == sizeof(st->hdr)) {
+                uint32_t size = st->hdr[0] | (st->hdr[1] << 8) | (st->hdr[2] << 16) |
+                                ((uint32_t)st->hdr[3] << 24);
+                st->hdr_len = 0;
+                if (size == 0) {
+                    // EndMark
+                    st->done = true;
+                } else {
+                    if (st->count == st->max) {
+                        st->max = st->max ? st->max * 2 : 256;
+                        st->index = realloc(st->index, st->max * sizeof(st->index[0]));
+                        if (st->index == NULL) {
+                            fprintf(stderr, "error: out of memory\n");
+                            return -1;
+                        }
+                    }
+                    st->index[st->count].src = st->pos + n - sizeof(st->hdr);
+                    st->index[st->count].dst = st->count * LZ4_BLOCK_SIZE;
+                    st->count++;
+                    st->left = size & 0x7fffffff;
+                }
+            }
+        }
+        st->pos += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+ssize_t compress_setup(int fd, void** cookie, uint32_t* crc) {
+    lz4_state_t* st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    LZ4F_errorCode_t errc = LZ4F_createCompressionContext(&st->cctx, LZ4F_VERSION);
     if (check_and_log_lz4_error(errc, "could not initialize compression context")) {
+        free(st);
         return -1;
     }
     uint8_t buf[128];
-    size_t r = LZ4F_compressBegin(cctx, buf, sizeof(buf), &lz4_prefs);
+    size_t r = LZ4F_compressBegin(st->cctx, buf, sizeof(buf), &lz4_prefs);
     if (check_and_log_lz4_error(r, "could not begin compression")) {
         return r;
     }
 
-    // Note: LZ4F_compressionContext_t is a typedef to a pointer, so this is
-    // "safe".
-    *cookie = (void*)cctx;
+    // The frame header is followed by the first block.
+    st->pos = r;
+    *cookie = st;
 
     if (crc && (r > 0)) {
         *crc = crc32(*crc, buf, r);
@@ -529,13 +597,17 @@ ssize_t compress_setup(int fd, void** cookie, uint32_t* crc) {
 }
 
 ssize_t compress_data(int fd, const void* src, size_t len, void* cookie, uint32_t* crc) {
+    lz4_state_t* st = cookie;
     // max will be, worst case, a bit larger than MAXBUFFER
     size_t max = LZ4F_compressBound(len, &lz4_prefs);
     uint8_t buf[max];
-    size_t r = LZ4F_compressUpdate((LZ4F_compressionContext_t)cookie, buf, max, src, len, NULL);
+    size_t r = LZ4F_compressUpdate(st->cctx, buf, max, src, len, NULL);
     if (check_and_log_lz4_error(r, "could not compress data")) {
         return -1;
     }
+    if (lz4_track_blocks(st, buf, r) < 0) {
+        return -1;
+    }
     if (crc) {
         *crc = crc32(*crc, buf, r);
     }
@@ -571,24 +643,56 @@ ssize_t compress_file(int fd, const char* fn, size_t len, void* cookie, uint32_t
     return (r < 0) ? -1 : total;
 }
 
+// Writes the index of the blocks in the frame as a skippable frame.
+static ssize_t compress_write_index(int fd, lz4_state_t* st, uint32_t* crc) {
+    size_t index_len = st->count * sizeof(st->index[0]);
+    uint32_t hdr[2] = {
+        BOOTDATA_LZ4_INDEX_FRAME,
+        index_len + 2 * sizeof(uint32_t),
+    };
+    uint32_t trailer[2] = {
+        st->count,
+        BOOTDATA_LZ4_INDEX_MAGIC,
+    };
+    if (crc) {
+        *crc = crc32(*crc, (void*)hdr, sizeof(hdr));
+        *crc = crc32(*crc, (void*)st->index, index_len);
+        *crc = crc32(*crc, (void*)trailer, sizeof(trailer));
+    }
+    if ((writex(fd, hdr, sizeof(hdr)) < 0) ||
+        (writex(fd, st->index, index_len) < 0) ||
+        (writex(fd, trailer, sizeof(trailer)) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
 ssize_t compress_finish(int fd, void* cookie, uint32_t* crc) {
+    lz4_state_t* st = cookie;
     // Max write is one block (64kB uncompressed) plus 8 bytes of footer.
     size_t max = LZ4F_compressBound(65536, &lz4_prefs) + 8;
     uint8_t buf[max];
-    size_t r = LZ4F_compressEnd((LZ4F_compressionContext_t)cookie, buf, max, NULL);
+    size_t r = LZ4F_compressEnd(st->cctx, buf, max, NULL);
     if (check_and_log_lz4_error(r, "could not finish compression")) {
         r = -1;
+    } else if (lz4_track_blocks(st, buf, r) < 0) {
+        r = -1;
     } else {
         if (crc) {
             *crc = crc32(*crc, buf, r);
         }
         r = writex(fd, buf, r);
+        if ((r >= 0) && (compress_write_index(fd, st, crc) < 0)) {
+            r = -1;
+        }
     }
 
-    LZ4F_errorCode_t errc = LZ4F_freeCompressionContext((LZ4F_compressionContext_t)cookie);
+    LZ4F_errorCode_t errc = LZ4F_freeCompressionContext(st->cctx);
     if (check_and_log_lz4_error(errc, "could not free compression context")) {
         r = -1;
     }
+    free(st->index);
+    free(st);
 
     return r;
 }
@@ -59,6 +59,18 @@
 // Flag indicating that the bootfs is compressed.
 #define BOOTDATA_BOOTFS_FLAG_COMPRESSED  (1 << 0)
 
+// Compressed payloads are a single LZ4 frame made of independent blocks,
+// which may be followed by an LZ4 skippable frame indexing those blocks,
+// so that they can be found and decompressed in any order:
+//   uint32_t             BOOTDATA_LZ4_INDEX_FRAME (skippable frame magic)
+//   uint32_t             size of the rest of the frame
+//   bootdata_lz4_block_t block[count]
+//   uint32_t             count
+//   uint32_t             BOOTDATA_LZ4_INDEX_MAGIC
+// The index ends the payload, so it is found from the end of the item.
+#define BOOTDATA_LZ4_INDEX_FRAME  (0x184d2a5b)
+#define BOOTDATA_LZ4_INDEX_MAGIC  (0x58444e49) // INDX
+
 
 // These items are for passing from bootloader to kernel
 
@@ -149,6 +161,14 @@ typedef struct {
     uint32_t crc32;
 } bootdata_t;
 
+// An entry in the index of a compressed payload.
+typedef struct {
+    // Offset of the block's header from the start of the LZ4 frame
+    uint32_t src;
+    // Offset of the block's contents in the decompressed payload
+    uint32_t dst;
+} bootdata_lz4_block_t;
+
 typedef struct {
     uint64_t base; // physical base addr
     uint32_t width;
@@ -83,6 +83,8 @@
 
 #define BLOCK_FLAG_READONLY 0x00000001
 #define BLOCK_FLAG_REMOVABLE 0x00000002
+// The device accepts BLOCKIO_TRIM
+#define BLOCK_FLAG_TRIM_SUPPORT 0x00000004
 
 typedef struct {
     uint64_t block_count;       // The number of blocks in this block device
@@ -226,7 +228,7 @@ IOCTL_WRAPPER_IN(ioctl_block_fvm_upgrade, IOCTL_BLOCK_FVM_UPGRADE, upgrade_req_t
 //    This response is sent once all operations either complete or a single operation fails.
 //    At this point, step (1) may begin again without reallocating the txn.
 //
-// For BLOCKIO_READ and BLOCKIO_WRITE, N may be greater than 1.
+// For BLOCKIO_READ, BLOCKIO_WRITE, BLOCKIO_SYNC and BLOCKIO_TRIM, N may be greater than 1.
 // Otherwise, N == 1 (skipping step (1) in the protocol above).
 //
 // Notes:
@@ -253,11 +255,25 @@ IOCTL_WRAPPER_IN(ioctl_block_fvm_upgrade, IOCTL_BLOCK_FVM_UPGRADE, upgrade_req_t
 // 'dev_offset', into the VMO associated with 'vmoid', starting at 'vmo_offset'.
 // If the transaction is out of range, for example if 'length' is too large or if
 // 'dev_offset' is beyond the end of the device, ZX_ERR_OUT_OF_RANGE is returned.
+//
+// BLOCKIO_SYNC ignores 'vmoid', 'length' and both offsets. It acts as a barrier: it does
+// not start until every request sent before it has completed, it makes the data they
+// wrote durable, and requests sent after it do not start until it has completed. It may
+// end a transaction of writes, so the response to that transaction means the writes are
+// on stable storage.
+//
+// BLOCKIO_TRIM ignores 'vmoid' and 'vmo_offset'. It tells the device that the 'length'
+// bytes at 'dev_offset' no longer hold anything of value, so an SSD or a thinly
+// provisioned disk can reclaim them; reading them afterwards returns unspecified data.
+// Like BLOCKIO_SYNC it is ordered against the requests around it, so a block may be
+// trimmed and then rewritten safely. Devices which set BLOCK_FLAG_TRIM_SUPPORT accept it;
+// others fail it with ZX_ERR_NOT_SUPPORTED.
 
 #define BLOCKIO_READ 0x0001      // Reads from the Block device into the VMO
 #define BLOCKIO_WRITE 0x0002     // Writes to the Block device from the VMO
-#define BLOCKIO_SYNC 0x0003      // Unimplemented
+#define BLOCKIO_SYNC 0x0003      // Flushes previous writes to stable storage
 #define BLOCKIO_CLOSE_VMO 0x0004 // Detaches the VMO from the block device; closes the handle to it.
+#define BLOCKIO_TRIM 0x0005      // Discards a range of the device
 #define BLOCKIO_OP_MASK 0x00FF
 
 #define BLOCKIO_TXN_END 0x0100 // Expects response after request (and all previous) have completed
@@ -16,6 +16,14 @@
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 2)
 #define IOCTL_RAMDISK_SET_FLAGS \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 3)
+#define IOCTL_RAMDISK_SIMULATE_WRITE_CACHE \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 5)
+#define IOCTL_RAMDISK_SIMULATE_CRASH \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 6)
+#define IOCTL_RAMDISK_SLEEP_AFTER \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 7)
+#define IOCTL_RAMDISK_WAKE_UP \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_RAMDISK, 8)
 
 typedef struct ramdisk_ioctl_config {
     uint64_t blk_size;
@@ -43,3 +51,24 @@ IOCTL_WRAPPER(ioctl_ramdisk_unlink, IOCTL_RAMDISK_UNLINK);
 // The flags to set match block_info_t.flags. This is intended to simulate the behavior
 // of other block devices, so it should be used only for tests.
 IOCTL_WRAPPER_IN(ioctl_ramdisk_set_flags, IOCTL_RAMDISK_SET_FLAGS, uint32_t);
+
+// ssize_t ioctl_ramdisk_simulate_write_cache(int fd);
+// Makes the ramdisk behave like a disk with a volatile write cache: from now on,
+// writes only become durable once a flush has completed. This keeps a second copy
+// of the ramdisk's contents, so it should be used only for tests.
+IOCTL_WRAPPER(ioctl_ramdisk_simulate_write_cache, IOCTL_RAMDISK_SIMULATE_WRITE_CACHE);
+
+// ssize_t ioctl_ramdisk_simulate_crash(int fd);
+// Throws away every write which has not been flushed, as if the power were cut.
+// Requires ioctl_ramdisk_simulate_write_cache().
+IOCTL_WRAPPER(ioctl_ramdisk_simulate_crash, IOCTL_RAMDISK_SIMULATE_CRASH);
+
+// ssize_t ioctl_ramdisk_sleep_after(int fd, const uint64_t* in);
+// Puts the ramdisk to sleep once |in| more blocks have been written: the write
+// which crosses that point only partly lands, and from then on all I/O fails
+// with ZX_ERR_UNAVAILABLE, as if the power were cut mid-write.
+IOCTL_WRAPPER_IN(ioctl_ramdisk_sleep_after, IOCTL_RAMDISK_SLEEP_AFTER, uint64_t);
+
+// ssize_t ioctl_ramdisk_wake_up(int fd);
+// Lets I/O through again after ioctl_ramdisk_sleep_after().
+IOCTL_WRAPPER(ioctl_ramdisk_wake_up, IOCTL_RAMDISK_WAKE_UP);
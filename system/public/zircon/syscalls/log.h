@@ -24,6 +24,11 @@ typedef struct zx_log_record {
 
 #define ZX_LOG_RECORD_MAX     256
 
+// The space a record takes up in the buffer filled by a batched read, which
+// is where the next record starts.
+#define ZX_LOG_RECORD_SIZE(rec) \
+    ((sizeof(zx_log_record_t) + (rec)->datalen + 7u) & ~7u)
+
 // Common Log Levels
 #define ZX_LOG_ERROR          (0x0001)
 #define ZX_LOG_INFO           (0x0002)
@@ -49,4 +54,10 @@ typedef struct zx_log_record {
 
 #define ZX_LOG_FLAG_READABLE  0x40000000
 
+// Read options
+
+// Fill the buffer with as many records as fit, oldest first, rather than
+// reading just one.  Each record starts on an 8 byte boundary.
+#define ZX_LOG_READ_BATCH     0x00000001
+
 __END_CDECLS
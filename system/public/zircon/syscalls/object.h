@@ -341,6 +341,17 @@ typedef struct zx_info_kmem_stats {
 
     // Non-free memory that isn't accounted for in any other field.
     uint64_t other_bytes;
+
+    // The total amount of VMO memory that has been found to be all zero and
+    // returned to the free pool since boot. Not a snapshot like the other
+    // fields; those pages are counted in |free_bytes| until reused.
+    uint64_t zero_reclaimed_bytes;
+
+    // The amount of VMO memory currently held compressed, before and after
+    // compression; their ratio is the compression ratio. The compressed data
+    // lives on the kernel heap and is counted in |total_heap_bytes|.
+    uint64_t compressed_original_bytes;
+    uint64_t compressed_bytes;
 } zx_info_kmem_stats_t;
 
 typedef struct zx_info_resource {
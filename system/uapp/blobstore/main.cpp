@@ -11,10 +11,6 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#ifndef __Fuchsia__
-#include <future>
-#include <vector>
-#endif
 
 #include <fbl/auto_call.h>
 #include <fbl/ref_ptr.h>
@@ -45,6 +41,8 @@ namespace {
 
 typedef struct {
     bool readonly = false;
+    bool compress = false;
+    unsigned threads = 0; // One per CPU
     uint64_t data_blocks = blobstore::kStartBlockMinimum; // Account for reserved blocks
     fbl::Vector<fbl::String> blob_list;
 } blob_options_t;
@@ -88,22 +86,6 @@ int do_blobstore_mount(fbl::unique_fd fd, const blob_options_t& options) {
 
 #else
 
-int do_blobstore_add_blob(blobstore::Blobstore* bs, const char* blob_name) {
-    fbl::unique_fd data_fd(open(blob_name, O_RDONLY, 0644));
-    if (!data_fd) {
-        fprintf(stderr, "error: cannot open '%s'\n", blob_name);
-        return -1;
-    }
-    int r;
-    if ((r = blobstore::blobstore_add_blob(bs, data_fd.get())) != 0) {
-        if (r != ZX_ERR_ALREADY_EXISTS) {
-            fprintf(stderr, "blobstore: Failed to add blob '%s': %d\n", blob_name, r);
-            return -1;
-        }
-    }
-    return 0;
-}
-
 int do_blobstore_add_blobs(fbl::unique_fd fd, const blob_options_t& options) {
     if (options.blob_list.is_empty()) {
         fprintf(stderr, "Adding a blob requires an additional file argument\n");
@@ -115,21 +97,10 @@ int do_blobstore_add_blobs(fbl::unique_fd fd, const blob_options_t& options) {
         return -1;
     }
 
-    std::vector<std::future<int>> futures;
-
-    for (unsigned i = 0; i < options.blob_list.size(); i++) {
-        const char *filename = options.blob_list[i].c_str();
-        futures.push_back(std::async(std::launch::async, [bs, filename] {
-            return do_blobstore_add_blob(bs.get(), filename);
-        }));
-    }
-
-    for (unsigned i = 0; i < options.blob_list.size(); i++) {
-        if (futures[i].get() < 0) {
-            return -1;
-        }
+    if (blobstore::blobstore_add_blobs(bs.get(), options.blob_list, options.compress,
+                                       options.threads) != ZX_OK) {
+        return -1;
     }
-
     return 0;
 }
 
@@ -281,7 +252,10 @@ int usage() {
             "This can make 'blobstore' commands hard to invoke from command line.\n"
             "Try using the [mkfs,fsck,mount,umount] commands instead\n"
 #else
-            "usage: blobstore <file-or-device>[@<size>] <command> [ <arg>* ]\n"
+            "usage: blobstore [ <options>* ] <file-or-device>[@<size>] <command> [ <arg>* ]\n"
+            "\n"
+            "options: --compress     Store blobs compressed where it saves space\n"
+            "         --threads <n>  Prepare blobs on <n> threads (default: one per CPU)\n"
 #endif
             "\n");
     for (unsigned n = 0; n < (sizeof(CMDS) / sizeof(CMDS[0])); n++) {
@@ -311,6 +285,14 @@ int process_args(int argc, char** argv, CommandFunction* func, blob_options_t* o
     while (argc > 1) {
         if (!strcmp(argv[0], "--readonly")) {
             options->readonly = true;
+#ifndef __Fuchsia__
+        } else if (!strcmp(argv[0], "--compress")) {
+            options->compress = true;
+        } else if (!strcmp(argv[0], "--threads") && argc > 2) {
+            options->threads = static_cast<unsigned>(strtoul(argv[1], nullptr, 10));
+            argc--;
+            argv++;
+#endif
         } else {
             break;
         }
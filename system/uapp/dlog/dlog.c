@@ -64,30 +64,34 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    char buf[ZX_LOG_RECORD_MAX];
-    zx_log_record_t* rec = (zx_log_record_t*)buf;
+    // Read records in batches, so a full log doesn't take a syscall apiece.
+    static char buf[ZX_LOG_RECORD_MAX * 64] __attribute__((aligned(8)));
     for (;;) {
         zx_status_t status;
-        if ((status = zx_log_read(h, ZX_LOG_RECORD_MAX, rec, 0)) < 0) {
+        if ((status = zx_log_read(h, sizeof(buf), buf, ZX_LOG_READ_BATCH)) < 0) {
             if ((status == ZX_ERR_SHOULD_WAIT) && tail) {
                 zx_object_wait_one(h, ZX_LOG_READABLE, ZX_TIME_INFINITE, NULL);
                 continue;
             }
             break;
         }
-        if (filter_pid && (pid != rec->pid)) {
-            continue;
-        }
-        if (!plain) {
-            char tmp[32];
-            size_t len = snprintf(tmp, sizeof(tmp), "[%05d.%03d] ",
-                                  (int)(rec->timestamp / 1000000000ULL),
-                                  (int)((rec->timestamp / 1000000ULL) % 1000ULL));
-            write(1, tmp, (len > sizeof(tmp) ? sizeof(tmp) : len));
-        }
-        write(1, rec->data, rec->datalen);
-        if ((rec->datalen == 0) || (rec->data[rec->datalen - 1] != '\n')) {
-            write(1, "\n", 1);
+        for (size_t off = 0; off < (size_t)status;) {
+            zx_log_record_t* rec = (zx_log_record_t*)(buf + off);
+            off += ZX_LOG_RECORD_SIZE(rec);
+            if (filter_pid && (pid != rec->pid)) {
+                continue;
+            }
+            if (!plain) {
+                char tmp[32];
+                size_t len = snprintf(tmp, sizeof(tmp), "[%05d.%03d] ",
+                                      (int)(rec->timestamp / 1000000000ULL),
+                                      (int)((rec->timestamp / 1000000ULL) % 1000ULL));
+                write(1, tmp, (len > sizeof(tmp) ? sizeof(tmp) : len));
+            }
+            write(1, rec->data, rec->datalen);
+            if ((rec->datalen == 0) || (rec->data[rec->datalen - 1] != '\n')) {
+                write(1, "\n", 1);
+            }
         }
     }
     return 0;
@@ -43,6 +43,16 @@ MinfsFormat::MinfsFormat(fbl::unique_fd fd, const char* type)
         exit(-1);
     }
 
+    // Only the info block of the journal is carried over, so anything
+    // committed to it has to be in place first.
+    if (minfs_journal_replay(bc_.get(), &info_) != ZX_OK) {
+        fprintf(stderr, "minfs: could not replay journal\n");
+        exit(-1);
+    } else if (bc_->Readblk(0, &blk_) != ZX_OK) {
+        fprintf(stderr, "minfs: could not read info block\n");
+        exit(-1);
+    }
+
     if (minfs_check_info(&info_, bc_.get()) != ZX_OK) {
         fprintf(stderr, "Check info failed\n");
         exit(-1);
@@ -89,6 +99,15 @@ zx_status_t MinfsFormat::MakeFvmReady(size_t slice_size, uint32_t vpart_index) {
     fvm_info_.dat_block = minfs::kFVMBlockDataStart;
     fvm_info_.flags |= minfs::kMinfsFlagFVM;
 
+    // The journal shares the first slice with the superblock.
+    fvm_info_.journal_block_count = fbl::min(info_.journal_block_count,
+                                             static_cast<uint32_t>(kBlocksPerSlice -
+                                                                   minfs::kMinfsJournalStart));
+    if (fvm_info_.journal_block_count < minfs::kMinfsMinJournalBlocks) {
+        fvm_info_.journal_block_count = 0;
+    }
+    fvm_info_.journal_block = fvm_info_.journal_block_count ? minfs::kMinfsJournalStart : 0;
+
     zx_status_t status;
     // Check if bitmaps are the wrong size, slice extents run on too long, etc.
     if ((status = minfs_check_info(&fvm_info_, bc_.get())) != ZX_OK) {
@@ -108,7 +127,8 @@ zx_status_t MinfsFormat::GetVsliceRange(unsigned extent_index, vslice_info_t* vs
         vslice_info->vslice_start = 0;
         vslice_info->slice_count = 1;
         vslice_info->block_offset = 0;
-        vslice_info->block_count = 1;
+        // The superblock, and the info block of the journal (if any).
+        vslice_info->block_count = fvm_info_.journal_block_count ? 2 : 1;
         return ZX_OK;
     }
     case 1: {
@@ -155,6 +175,10 @@ zx_status_t MinfsFormat::FillBlock(size_t block_offset) {
     CheckFvmReady();
     if (block_offset == 0) {
         memcpy(datablk, fvm_blk_, minfs::kMinfsBlockSize);
+    } else if (block_offset == minfs::kMinfsJournalStart && fvm_info_.journal_block_count) {
+        // The ring may have shrunk, so start an empty journal rather than
+        // carrying over the old position.
+        minfs::minfs_journal_init(datablk);
     } else if (bc_->Readblk(block_offset, datablk) != ZX_OK) {
         fprintf(stderr, "minfs: could not read block\n");
         exit(-1);
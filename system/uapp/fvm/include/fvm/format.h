@@ -16,6 +16,7 @@
 #include <minfs/bcache.h>
 #include <minfs/format.h>
 #include <minfs/fsck.h>
+#include <minfs/journal.h>
 #include <fbl/vector.h>
 
 #define TRACE 0
@@ -99,10 +99,13 @@ static zx_time_t iotime_block(int is_read, int fd, size_t total, size_t bufsz) {
     return iotime_posix(is_read, fd, total, bufsz);
 }
 
-static zx_time_t iotime_fifo(char* dev, int is_read, int fd, size_t total, size_t bufsz) {
+// Keeps up to |depth| requests of |bufsz| bytes outstanding, by sending them
+// to the block server as one transaction.
+static zx_time_t iotime_fifo(char* dev, int is_read, int fd, size_t total, size_t bufsz,
+                             size_t depth) {
     zx_status_t r;
     zx_handle_t vmo;
-    if ((r = zx_vmo_create(bufsz, 0, &vmo)) != ZX_OK) {
+    if ((r = zx_vmo_create(bufsz * depth, 0, &vmo)) != ZX_OK) {
         fprintf(stderr, "error: out of memory %d\n", r);
         return ZX_TIME_INFINITE;
     }
@@ -140,20 +143,25 @@ static zx_time_t iotime_fifo(char* dev, int is_read, int fd, size_t total, size_
     zx_time_t t0 = zx_time_get(ZX_CLOCK_MONOTONIC);
     size_t n = total;
     while (n > 0) {
-        size_t xfer = (n > bufsz) ? bufsz : n;
-        block_fifo_request_t request = {
-            .txnid = txnid,
-            .vmoid = vmoid,
-            .opcode = is_read ? BLOCKIO_READ : BLOCKIO_WRITE,
-            .length = xfer,
-            .vmo_offset = 0,
-            .dev_offset = total - n,
-        };
-        if ((r = block_fifo_txn(client, &request, 1)) != ZX_OK) {
+        block_fifo_request_t requests[MAX_TXN_MESSAGES];
+        size_t count = 0;
+        while (n > 0 && count < depth) {
+            size_t xfer = (n > bufsz) ? bufsz : n;
+            requests[count] = (block_fifo_request_t) {
+                .txnid = txnid,
+                .vmoid = vmoid,
+                .opcode = is_read ? BLOCKIO_READ : BLOCKIO_WRITE,
+                .length = xfer,
+                .vmo_offset = count * bufsz,
+                .dev_offset = total - n,
+            };
+            count++;
+            n -= xfer;
+        }
+        if ((r = block_fifo_txn(client, requests, count)) != ZX_OK) {
             fprintf(stderr, "error: block_fifo_txn error %d\n", r);
             return ZX_TIME_INFINITE;
         }
-        n -= xfer;
     }
     zx_time_t t1 = zx_time_get(ZX_CLOCK_MONOTONIC);
     return t1 - t0;
@@ -161,21 +169,28 @@ static zx_time_t iotime_fifo(char* dev, int is_read, int fd, size_t total, size_
 
 static int usage(void) {
     fprintf(stderr,
-            "usage: iotime <read|write> <posix|block|fifo> <device|--ramdisk> <bytes> <bufsize>\n\n"
+            "usage: iotime <read|write> <posix|block|fifo> <device|--ramdisk> <bytes> <bufsize> "
+            "[<depth>]\n\n"
             "        <bytes> and <bufsize> must be a multiple of 4k for block mode\n"
-            "        --ramdisk only supported for block mode\n");
+            "        --ramdisk only supported for block mode\n"
+            "        <depth> is the number of requests kept in flight in fifo mode (max %d)\n",
+            MAX_TXN_MESSAGES);
     return -1;
 }
 
 
 int main(int argc, char** argv) {
-    if (argc != 6) {
+    if (argc != 6 && argc != 7) {
         return usage();
     }
 
     int is_read = !strcmp(argv[1], "read");
     size_t total = number(argv[4]);
     size_t bufsz = number(argv[5]);
+    size_t depth = (argc == 7) ? number(argv[6]) : 1;
+    if (bufsz == 0 || depth == 0 || depth > MAX_TXN_MESSAGES) {
+        return usage();
+    }
 
     int fd;
     if (!strcmp(argv[3], "--ramdisk")) {
@@ -200,7 +215,7 @@ int main(int argc, char** argv) {
     } else if (!strcmp(argv[2], "block")) {
         res = iotime_block(is_read, fd, total, bufsz);
     } else if (!strcmp(argv[2], "fifo")) {
-        res = iotime_fifo(argv[3], is_read, fd, total, bufsz);
+        res = iotime_fifo(argv[3], is_read, fd, total, bufsz, depth);
     } else {
         fprintf(stderr, "error: unknown mode '%s'\n", argv[2]);
         return -1;
@@ -209,6 +224,9 @@ int main(int argc, char** argv) {
     if (res != ZX_TIME_INFINITE) {
         fprintf(stderr, "%s %zu bytes in %zu ns: ", is_read ? "read" : "write", total, res);
         bytes_per_second(total, res);
+        size_t ops = (total + bufsz - 1) / bufsz;
+        fprintf(stderr, "%zu ops at depth %zu: %g IOPS\n", ops, depth,
+                ((double)ops) * 1000000000 / ((double)res));
         return 0;
     } else {
         return -1;
@@ -333,8 +333,10 @@ struct {
 } CMDS[] = {
     {"create", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
     {"mkfs", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
-    {"check", do_minfs_check, O_RDONLY, "check filesystem integrity"},
-    {"fsck", do_minfs_check, O_RDONLY, "check filesystem integrity"},
+    {"check", do_minfs_check, O_RDWR, "check filesystem integrity "
+                                     "(replays the journal first)"},
+    {"fsck", do_minfs_check, O_RDWR, "check filesystem integrity "
+                                     "(replays the journal first)"},
 #ifndef __Fuchsia__
     {"cp", do_cp, O_RDWR, "copy to/from fs. Prefix fs paths with '::'"},
     {"mkdir", do_mkdir, O_RDWR, "create directory. Prefix paths with '::'"},
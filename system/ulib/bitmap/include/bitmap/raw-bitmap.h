@@ -14,6 +14,7 @@
 #include <zircon/assert.h>
 #include <zircon/types.h>
 #include <fbl/algorithm.h>
+#include <fbl/array.h>
 #include <fbl/macros.h>
 #include <fbl/type_support.h>
 
@@ -72,11 +73,57 @@ public:
     // Clear all bits in the bitmap.
     void ClearAll() override;
 
+    // Recomputes the summary which speeds up Scan and Find from the contents
+    // of the bitmap.  Must be called after modifying bits through the
+    // underlying storage (for example, after reading the bitmap from disk).
+    void RecomputeSummary();
+
 protected:
+    // Sizes the summary for the words of the bitmap, and computes it.
+    // Summaries are only kept for bitmaps larger than kSummaryMinBits; if
+    // allocating one fails, the bitmap is searched without one.
+    void ResetSummary();
+
     // The size of this bitmap, in bits.
     size_t size_ = 0;
     // Owned by bits_, cached
     size_t* data_ = nullptr;
+
+private:
+    // Large bitmaps keep two summaries: one of the words which have a clear
+    // bit, and one of the words which have a set bit.  Bit i of level 0 of a
+    // summary describes word i of the bitmap, and bit i of level n + 1 is set
+    // if word i of level n is nonzero, up to a level of a single word.  Scan
+    // uses them to skip the words which can't hold the bit it looks for.
+    enum SummaryKind : size_t {
+        kHasClear = 0,
+        kHasSet = 1,
+    };
+    static constexpr size_t kSummaryMinBits = kBits * kBits;
+    static constexpr size_t kMaxSummaryLevels = 10;
+
+    size_t* SummaryLevel(size_t kind, size_t level) const {
+        return summary_.get() + kind * summary_words_ + summary_offset_[level];
+    }
+
+    // Updates the summaries for words [first_idx, last_idx] of the bitmap.
+    void UpdateSummary(size_t first_idx, size_t last_idx);
+
+    // Returns the index of the first word at or after |idx| which the
+    // summary of |kind| marks, or SIZE_MAX if there is none.
+    size_t NextSummaryWord(size_t kind, size_t idx) const;
+
+    // Number of levels in each summary; zero if there is no summary.
+    size_t summary_levels_ = 0;
+    // Number of words in each level, and their offsets within a summary.
+    size_t summary_level_words_[kMaxSummaryLevels] = {};
+    size_t summary_offset_[kMaxSummaryLevels] = {};
+    // Number of words of the bitmap covered by the summaries, and number of
+    // words in each summary.
+    size_t summary_data_words_ = 0;
+    size_t summary_words_ = 0;
+    // Both summaries, one after the other.
+    fbl::Array<size_t> summary_;
 };
 
 // A simple bitmap backed by generic storage.
@@ -125,6 +172,7 @@ public:
 
         // Clear the partial bits not included in the new "size_t"s.
         Clear(old_size, fbl::min(old_len * kBits, size_));
+        ResetSummary();
         return ZX_OK;
     }
 
@@ -140,6 +188,7 @@ public:
         size_ = size;
         if (size_ == 0) {
             data_ = nullptr;
+            ResetSummary();
             return ZX_OK;
         }
         size_t last_idx = LastIdx(size);
@@ -149,12 +198,14 @@ public:
         }
         data_ = static_cast<size_t*>(bits_.GetData());
         ClearAll();
+        ResetSummary();
         return ZX_OK;
     }
 
     // This function allows access to underlying data, but is dangerous: It
     // leaks the pointer to bits_. Reset and the bitmap destructor should not
     // be called on the bitmap while the pointer returned from data() is alive.
+    // Bits modified through it must be followed by RecomputeSummary().
     const Storage* StorageUnsafe() const { return &bits_; }
 
 private:
@@ -10,23 +10,38 @@
 
 #include <zircon/types.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/intrusive_wavl_tree.h>
 #include <fbl/macros.h>
 #include <fbl/unique_ptr.h>
 
 namespace bitmap {
 
-struct RleBitmapElement;
+// Elements of the bitmap.  While an element is part of a bitmap it is held in
+// the bitmap's tree of ranges; otherwise it may be kept in a free list.
+struct RleBitmapElement : public fbl::DoublyLinkedListable<fbl::unique_ptr<RleBitmapElement>>,
+                          public fbl::WAVLTreeContainable<fbl::unique_ptr<RleBitmapElement>> {
+    size_t GetKey() const { return bitoff; }
+
+    // The start of this run of 1-bits.
+    size_t bitoff;
+    // The number of 1-bits in this run.
+    size_t bitlen;
+};
 
 // A run-length encoded bitmap.
+//
+// The runs are kept in a tree ordered by their first bit, so Get, Set and
+// Clear take logarithmic time in the number of runs (plus the number of runs
+// merged or removed).
 class RleBitmap final : public Bitmap {
 private:
     // Private forward-declaration to share the type between the iterator type
-    // and the internal list.
-    using ListType = fbl::DoublyLinkedList<fbl::unique_ptr<RleBitmapElement>>;
+    // and the internal tree.
+    using TreeType = fbl::WAVLTree<size_t, fbl::unique_ptr<RleBitmapElement>>;
 
 public:
-    using const_iterator = ListType::const_iterator;
-    using FreeList = ListType;
+    using const_iterator = TreeType::const_iterator;
+    using FreeList = fbl::DoublyLinkedList<fbl::unique_ptr<RleBitmapElement>>;
 
     constexpr RleBitmap()
         : num_elems_(0) {}
@@ -87,19 +102,12 @@ private:
     zx_status_t SetInternal(size_t bitoff, size_t bitmax, FreeList* free_list);
     zx_status_t ClearInternal(size_t bitoff, size_t bitmax, FreeList* free_list);
 
-    // The ranges of the bitmap.
-    ListType elems_;
+    // The ranges of the bitmap, keyed by their first bit.  Ranges never
+    // overlap or touch; adjacent ranges are merged.
+    TreeType elems_;
 
     // The number of ranges in elems_.
     size_t num_elems_;
 };
 
-// Elements of the bitmap list
-struct RleBitmapElement : public fbl::DoublyLinkedListable<fbl::unique_ptr<RleBitmapElement>> {
-    // The start of this run of 1-bits.
-    size_t bitoff;
-    // The number of 1-bits in this run.
-    size_t bitlen;
-};
-
 } // namespace bitmap
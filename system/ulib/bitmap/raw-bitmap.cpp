@@ -10,6 +10,7 @@
 
 #include <zircon/types.h>
 #include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
 #include <fbl/macros.h>
 
 namespace {
@@ -57,6 +58,8 @@ size_t CountZeros(size_t idx, size_t value) {
 }
 #undef CTZ
 
+constexpr size_t kNoWord = SIZE_MAX;
+
 } // namespace
 
 namespace bitmap {
@@ -78,7 +81,7 @@ size_t RawBitmapBase::Scan(size_t bitoff, size_t bitmax, bool is_set) const {
     size_t last_idx = LastIdx(bitmax);
     size_t i = first_idx;
     size_t value = 0;
-    for (i = first_idx; i <= last_idx; ++i) {
+    while (i <= last_idx) {
         value = GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
         if (is_set) {
             // If is_set=true, invert the mask, OR it with the value, and invert
@@ -92,6 +95,14 @@ size_t RawBitmapBase::Scan(size_t bitoff, size_t bitmax, bool is_set) const {
         if (value != 0) {
             break;
         }
+        // Skip ahead to the next word which can end the run.
+        ++i;
+        if (summary_levels_ > 0 && i <= last_idx) {
+            i = NextSummaryWord(is_set ? kHasClear : kHasSet, i);
+        }
+    }
+    if (i > last_idx) {
+        return bitmax;
     }
     return fbl::min(bitmax, CountZeros(i, value));
 }
@@ -136,6 +147,7 @@ zx_status_t RawBitmapBase::Set(size_t bitoff, size_t bitmax) {
         data_[i] |=
                 GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
     }
+    UpdateSummary(first_idx, last_idx);
     return ZX_OK;
 }
 
@@ -152,6 +164,7 @@ zx_status_t RawBitmapBase::Clear(size_t bitoff, size_t bitmax) {
         data_[i] &=
                 ~(GetMask(i == first_idx, i == last_idx, bitoff, bitmax));
     }
+    UpdateSummary(first_idx, last_idx);
     return ZX_OK;
 }
 
@@ -163,6 +176,103 @@ void RawBitmapBase::ClearAll() {
     for (size_t i = 0; i <= last_idx; ++i) {
         data_[i] = 0;
     }
+    UpdateSummary(0, last_idx);
+}
+
+void RawBitmapBase::RecomputeSummary() {
+    if (summary_levels_ > 0) {
+        UpdateSummary(0, summary_data_words_ - 1);
+    }
+}
+
+void RawBitmapBase::ResetSummary() {
+    summary_levels_ = 0;
+    summary_data_words_ = 0;
+    summary_words_ = 0;
+    summary_.reset();
+    if (size_ <= kSummaryMinBits) {
+        return;
+    }
+
+    size_t levels = 0;
+    size_t words = 0;
+    size_t below = LastIdx(size_) + 1;
+    do {
+        ZX_DEBUG_ASSERT(levels < kMaxSummaryLevels);
+        summary_offset_[levels] = words;
+        summary_level_words_[levels] = (below + kBits - 1) / kBits;
+        below = summary_level_words_[levels];
+        words += below;
+        levels++;
+    } while (below > 1);
+
+    fbl::AllocChecker ac;
+    size_t* summary = new (&ac) size_t[2 * words]();
+    if (!ac.check()) {
+        return;
+    }
+    summary_.reset(summary, 2 * words);
+    summary_levels_ = levels;
+    summary_data_words_ = LastIdx(size_) + 1;
+    summary_words_ = words;
+    RecomputeSummary();
+}
+
+void RawBitmapBase::UpdateSummary(size_t first_idx, size_t last_idx) {
+    if (summary_levels_ == 0 || first_idx >= summary_data_words_) {
+        return;
+    }
+    last_idx = fbl::min(last_idx, summary_data_words_ - 1);
+    for (size_t kind = kHasClear; kind <= kHasSet; kind++) {
+        const size_t* below = data_;
+        size_t lo = first_idx;
+        size_t hi = last_idx;
+        for (size_t level = 0; level < summary_levels_; level++) {
+            size_t* summary = SummaryLevel(kind, level);
+            bool changed = false;
+            for (size_t i = lo; i <= hi; i++) {
+                // Only the bitmap itself is summarized for clear bits; every
+                // level above summarizes the nonzero words of the one below.
+                bool marked = (level == 0 && kind == kHasClear) ? ~below[i] != 0 : below[i] != 0;
+                size_t bit = static_cast<size_t>(1) << (i % kBits);
+                size_t old = summary[i / kBits];
+                summary[i / kBits] = marked ? (old | bit) : (old & ~bit);
+                changed |= summary[i / kBits] != old;
+            }
+            if (!changed) {
+                break;
+            }
+            below = summary;
+            lo /= kBits;
+            hi /= kBits;
+        }
+    }
+}
+
+size_t RawBitmapBase::NextSummaryWord(size_t kind, size_t idx) const {
+    // Climb until some level has a marked bit at or after |idx|...
+    size_t level = 0;
+    for (;;) {
+        if (level == summary_levels_) {
+            return kNoWord;
+        }
+        size_t word = idx / kBits;
+        if (word >= summary_level_words_[level]) {
+            return kNoWord;
+        }
+        size_t value = SummaryLevel(kind, level)[word] & (~static_cast<size_t>(0) << (idx % kBits));
+        if (value != 0) {
+            idx = CountZeros(word, value);
+            break;
+        }
+        idx = word + 1;
+        level++;
+    }
+    // ... and descend along the first marked bits to the bitmap.
+    while (level-- > 0) {
+        idx = CountZeros(idx, SummaryLevel(kind, level)[idx]);
+    }
+    return idx;
 }
 
 } // namespace bitmap
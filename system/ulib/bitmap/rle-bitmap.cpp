@@ -41,14 +41,11 @@ void ReleaseElement(RleBitmap::FreeList* free_list, fbl::unique_ptr<RleBitmapEle
 } // namespace
 
 bool RleBitmap::Get(size_t bitoff, size_t bitmax, size_t* first_unset) const {
-    for (auto& elem : elems_) {
-        if (bitoff < elem.bitoff) {
-            break;
-        }
-        if (bitoff < elem.bitoff + elem.bitlen) {
-            bitoff = elem.bitoff + elem.bitlen;
-            break;
-        }
+    // The only range which can contain 'bitoff' is the last one starting at
+    // or before it.
+    auto itr = --elems_.upper_bound(bitoff);
+    if (itr.IsValid() && bitoff < itr->bitoff + itr->bitlen) {
+        bitoff = itr->bitoff + itr->bitlen;
     }
     if (bitoff > bitmax) {
         bitoff = bitmax;
@@ -93,8 +90,7 @@ zx_status_t RleBitmap::SetInternal(size_t bitoff, size_t bitmax, FreeList* free_
         return ZX_ERR_INVALID_ARGS;
     }
 
-    const size_t bitlen = bitmax - bitoff;
-    if (bitlen == 0) {
+    if (bitmax - bitoff == 0) {
         return ZX_OK;
     }
 
@@ -102,50 +98,29 @@ zx_status_t RleBitmap::SetInternal(size_t bitoff, size_t bitmax, FreeList* free_
     if (!new_elem) {
         return ZX_ERR_NO_MEMORY;
     }
-    ++num_elems_;
-    new_elem->bitoff = bitoff;
-    new_elem->bitlen = bitlen;
-
-    auto ends_after = elems_.find_if([bitoff](const RleBitmapElement& elem) -> bool {
-        return elem.bitoff + elem.bitlen >= bitoff;
-    });
-
-    // Insert the new element before the first node that ends at a point >=
-    // when we begin.
-    elems_.insert(ends_after, fbl::move(new_elem));
-
-    // If ends_after was the end of the list, there is no merging to do.
-    if (ends_after == elems_.end()) {
-        return ZX_OK;
-    }
-
-    auto itr = ends_after;
-    RleBitmapElement& elem = *--ends_after;
 
-    if (elem.bitlen + elem.bitoff >= itr->bitoff) {
-        // Our range either starts before or in the middle/end of *elem*.
-        // Adjust it so it starts at the same place as *elem*, to allow
-        // the merge logic to not consider this overlap case.
-        elem.bitlen += elem.bitoff - itr->bitoff;
-        elem.bitoff = itr->bitoff;
+    // Start merging at the range before 'bitoff' if it reaches 'bitoff',
+    // otherwise at the first range after it.
+    auto itr = --elems_.upper_bound(bitoff);
+    if (itr.IsValid() && itr->bitoff + itr->bitlen >= bitoff) {
+        bitoff = itr->bitoff;
+    } else {
+        itr = elems_.upper_bound(bitoff);
     }
 
-    // Walk forwards and remove/merge any overlaps
-    size_t max = elem.bitoff + elem.bitlen;
-    while (itr != elems_.end()) {
-        if (itr->bitoff > max) {
-            break;
-        }
-
-        max = fbl::max(max, itr->bitoff + itr->bitlen);
-        elem.bitlen = max - elem.bitoff;
-
-        auto to_erase = itr;
-        ++itr;
+    // Walk forwards and absorb any range which overlaps or touches
+    // [bitoff, bitmax).
+    while (itr.IsValid() && itr->bitoff <= bitmax) {
+        bitmax = fbl::max(bitmax, itr->bitoff + itr->bitlen);
+        auto to_erase = itr++;
         ReleaseElement(free_list, elems_.erase(to_erase));
         --num_elems_;
     }
 
+    new_elem->bitoff = bitoff;
+    new_elem->bitlen = bitmax - bitoff;
+    elems_.insert(fbl::move(new_elem));
+    ++num_elems_;
     return ZX_OK;
 }
 
@@ -158,48 +133,42 @@ zx_status_t RleBitmap::ClearInternal(size_t bitoff, size_t bitmax, FreeList* fre
         return ZX_OK;
     }
 
-    auto itr = elems_.begin();
-    while (itr != elems_.end()) {
-        if (itr->bitoff + itr->bitlen < bitoff) {
-            ++itr;
-            continue;
+    // Only the last range starting before 'bitoff' can contain it.
+    auto itr = --elems_.lower_bound(bitoff);
+    if (itr.IsValid() && itr->bitoff + itr->bitlen > bitoff) {
+        const size_t end = itr->bitoff + itr->bitlen;
+        if (end > bitmax) {
+            // '*itr' contains [bitoff, bitmax), and we need to split it.
+            fbl::unique_ptr<RleBitmapElement> new_elem = AllocateElement(free_list);
+            if (!new_elem) {
+                return ZX_ERR_NO_MEMORY;
+            }
+            new_elem->bitoff = bitmax;
+            new_elem->bitlen = end - bitmax;
+            itr->bitlen = bitoff - itr->bitoff;
+            elems_.insert(fbl::move(new_elem));
+            ++num_elems_;
+            return ZX_OK;
         }
-        if (bitmax < itr->bitoff) {
+        // '*itr' contains 'bitoff'.
+        itr->bitlen = bitoff - itr->bitoff;
+    }
+
+    itr = elems_.lower_bound(bitoff);
+    while (itr.IsValid() && itr->bitoff < bitmax) {
+        auto to_erase = itr++;
+        fbl::unique_ptr<RleBitmapElement> elem = elems_.erase(to_erase);
+        if (bitmax < elem->bitoff + elem->bitlen) {
+            // 'elem' contains 'bitmax'.  Its key changes, so it has to be
+            // reinserted.
+            elem->bitlen = elem->bitoff + elem->bitlen - bitmax;
+            elem->bitoff = bitmax;
+            elems_.insert(fbl::move(elem));
             break;
         }
-        if (itr->bitoff < bitoff) {
-            if (itr->bitoff + itr->bitlen <= bitmax) {
-                // '*itr' contains 'bitoff'.
-                itr->bitlen = bitoff - itr->bitoff;
-                ++itr;
-                continue;
-            } else {
-                // '*itr' contains [bitoff, bitmax), and we need to split it.
-                fbl::unique_ptr<RleBitmapElement> new_elem = AllocateElement(free_list);
-                if (!new_elem) {
-                    return ZX_ERR_NO_MEMORY;
-                }
-                ++num_elems_;
-                new_elem->bitoff = bitmax;
-                new_elem->bitlen = itr->bitoff + itr->bitlen - bitmax;
-
-                elems_.insert_after(itr, fbl::move(new_elem));
-                itr->bitlen = bitoff - itr->bitoff;
-                break;
-            }
-        } else {
-            if (bitmax < itr->bitoff + itr->bitlen) {
-                // 'elem' contains 'bitmax'
-                itr->bitlen = itr->bitoff + itr->bitlen - bitmax;
-                itr->bitoff = bitmax;
-                break;
-            } else {
-                // [bitoff, bitmax) fully contains '*itr'.
-                auto to_erase = itr++;
-                ReleaseElement(free_list, elems_.erase(to_erase));
-                --num_elems_;
-            }
-        }
+        // [bitoff, bitmax) fully contains 'elem'.
+        ReleaseElement(free_list, fbl::move(elem));
+        --num_elems_;
     }
     return ZX_OK;
 }
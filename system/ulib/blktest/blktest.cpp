@@ -232,6 +232,144 @@ bool blkdev_test_fifo_basic(void) {
     END_TEST;
 }
 
+// Writes a vmo one block at a time with the requests in reverse order, so the
+// server has adjacent requests it may sort and coalesce, and checks that every
+// block lands where it was sent.
+bool blkdev_test_fifo_adjacent_requests(void) {
+    BEGIN_TEST;
+    uint64_t blk_size, blk_count;
+    int fd = get_testdev(&blk_size, &blk_count);
+    zx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), ZX_OK, "");
+
+    const size_t kBlocks = MAX_TXN_MESSAGES;
+    uint64_t vmo_size = blk_size * kBlocks;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(vmo_size, 0, &vmo), ZX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(buf.get(), vmo_size);
+    size_t actual;
+    ASSERT_EQ(zx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), ZX_OK, "");
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    zx_handle_t xfer_vmo;
+    ASSERT_EQ(zx_handle_duplicate(vmo, ZX_RIGHT_SAME_RIGHTS, &xfer_vmo), ZX_OK, "");
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    block_fifo_request_t requests[kBlocks];
+    for (size_t i = 0; i < kBlocks; i++) {
+        size_t b = kBlocks - 1 - i;
+        requests[i].txnid      = txnid;
+        requests[i].vmoid      = vmoid;
+        requests[i].opcode     = BLOCKIO_WRITE;
+        requests[i].length     = static_cast<uint32_t>(blk_size);
+        requests[i].vmo_offset = b * blk_size;
+        requests[i].dev_offset = b * blk_size;
+    }
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], kBlocks), ZX_OK, "");
+
+    // Read it back with a single request
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(zx_vmo_write(vmo, out.get(), 0, vmo_size, &actual), ZX_OK, "");
+    requests[0].opcode     = BLOCKIO_READ;
+    requests[0].length     = static_cast<uint32_t>(vmo_size);
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK, "");
+    ASSERT_EQ(zx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), ZX_OK, "");
+    ASSERT_EQ(memcmp(buf.get(), out.get(), vmo_size), 0, "Read data not equal to written data");
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK, "");
+    ASSERT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    block_fifo_release_client(client);
+    ASSERT_EQ(ioctl_block_fifo_close(fd), ZX_OK, "Failed to close fifo");
+    close(fd);
+    END_TEST;
+}
+
+// Sends a flush followed by a write larger than the device's max transfer
+// size in a single batch, so that the server sees the barrier before the
+// split request has been handed to the device.
+bool blkdev_test_fifo_sync_then_split(void) {
+    BEGIN_TEST;
+    uint64_t blk_size, blk_count;
+    int fd = get_testdev(&blk_size, &blk_count);
+    block_info_t info;
+    ASSERT_GE(ioctl_block_get_info(fd, &info), 0, "Could not get block info");
+    zx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), ZX_OK, "");
+
+    uint64_t vmo_size = info.max_transfer_size ? 2 * info.max_transfer_size : blk_size * 8;
+    vmo_size = fbl::min(vmo_size, blk_size * blk_count);
+    vmo_size = fbl::round_down(vmo_size, blk_size);
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(vmo_size, 0, &vmo), ZX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(buf.get(), vmo_size);
+    size_t actual;
+    ASSERT_EQ(zx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), ZX_OK, "");
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    zx_handle_t xfer_vmo;
+    ASSERT_EQ(zx_handle_duplicate(vmo, ZX_RIGHT_SAME_RIGHTS, &xfer_vmo), ZX_OK, "");
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    block_fifo_request_t requests[2];
+    requests[0].txnid      = txnid;
+    requests[0].vmoid      = vmoid;
+    requests[0].opcode     = BLOCKIO_SYNC;
+    requests[0].length     = 0;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    requests[1].txnid      = txnid;
+    requests[1].vmoid      = vmoid;
+    requests[1].opcode     = BLOCKIO_WRITE;
+    requests[1].length     = static_cast<uint32_t>(vmo_size);
+    requests[1].vmo_offset = 0;
+    requests[1].dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], fbl::count_of(requests)), ZX_OK, "");
+
+    // Read it back
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(zx_vmo_write(vmo, out.get(), 0, vmo_size, &actual), ZX_OK, "");
+    requests[0].opcode     = BLOCKIO_READ;
+    requests[0].length     = static_cast<uint32_t>(vmo_size);
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK, "");
+    ASSERT_EQ(zx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), ZX_OK, "");
+    ASSERT_EQ(memcmp(buf.get(), out.get(), vmo_size), 0, "Read data not equal to written data");
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK, "");
+    ASSERT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    block_fifo_release_client(client);
+    ASSERT_EQ(ioctl_block_fifo_close(fd), ZX_OK, "Failed to close fifo");
+    close(fd);
+    END_TEST;
+}
+
 bool blkdev_test_fifo_whole_disk(void) {
     BEGIN_TEST;
     uint64_t blk_size, blk_count;
@@ -902,6 +1040,8 @@ RUN_TEST(blkdev_test_multiple)
 #endif
 RUN_TEST(blkdev_test_fifo_no_op)
 RUN_TEST(blkdev_test_fifo_basic)
+RUN_TEST(blkdev_test_fifo_adjacent_requests)
+RUN_TEST(blkdev_test_fifo_sync_then_split)
 //RUN_TEST(blkdev_test_fifo_whole_disk)
 RUN_TEST(blkdev_test_fifo_multiple_vmo)
 RUN_TEST(blkdev_test_fifo_multiple_vmo_multithreaded)
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -117,10 +118,6 @@ zx_status_t VnodeBlob::Verify() const {
     ZX_DEBUG_ASSERT(blob_ != nullptr);
 
     const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
-    // TODO(smklein): We could lazily verify more of the VMO if
-    // we could fault in pages on-demand.
-    //
-    // For now, we aggressively verify the entire VMO up front.
     Digest d;
     d = reinterpret_cast<const uint8_t*>(&digest_[0]);
     return MerkleTree::Verify(GetData(), inode->blob_size, GetMerkle(),
@@ -138,7 +135,12 @@ zx_status_t VnodeBlob::InitVmos() {
     zx_status_t status;
     const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
 
-    uint64_t num_blocks = BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    uint64_t num_blocks = data_blocks + merkle_blocks;
+    if (inode->flags & kBlobstoreInodeFlagLZ4) {
+        num_blocks += inode->num_blocks - merkle_blocks;
+    }
     if ((status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
         FS_TRACE_ERROR("Failed to initialize vmo; error: %d\n", status);
         BlobCloseHandles();
@@ -149,15 +151,145 @@ zx_status_t VnodeBlob::InitVmos() {
         BlobCloseHandles();
         return status;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != ZX_OK) {
+        BlobCloseHandles();
+        return status;
+    }
+
+    // Only the Merkle tree (and the chunk table, for compressed blobs) is
+    // read up front. Data blocks are read and verified by LoadAndVerify as
+    // they are accessed.
+    ReadTxn txn(blobstore_.get());
+    const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_);
+    txn.Enqueue(vmoid_, 0, dev_start, merkle_blocks);
+    if (inode->flags & kBlobstoreInodeFlagLZ4) {
+        uint64_t table_blocks = fbl::round_up(BlobChunkTableSize(*inode), kBlobstoreBlockSize) /
+                                kBlobstoreBlockSize;
+        txn.Enqueue(vmoid_, merkle_blocks + data_blocks, dev_start + merkle_blocks, table_blocks);
+    }
+    return txn.Flush();
+}
+
+zx_status_t VnodeBlob::LoadAndVerify(uint64_t off, uint64_t len) {
+    TRACE_DURATION("blobstore", "Blobstore::LoadAndVerify", "off", off, "len", len);
+    ZX_DEBUG_ASSERT(blob_ != nullptr);
+
+    const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    uint64_t bno_start = off / kBlobstoreBlockSize;
+    uint64_t bno_end = fbl::min(fbl::round_up(off + len, kBlobstoreBlockSize) / kBlobstoreBlockSize,
+                                data_blocks);
+    if (bno_start >= bno_end || verified_.Get(bno_start, bno_end)) {
+        return ZX_OK;
+    }
+
+    // Something in the requested range is missing; pull in the readahead
+    // window along with it.
+    bno_end = fbl::min(bno_end + kReadAheadBlocks, data_blocks);
+
+    zx_status_t status;
+    if (inode->flags & kBlobstoreInodeFlagLZ4) {
+        // Compressed chunks can only be decompressed whole.
+        const uint64_t chunk_blocks = kBlobstoreCompressChunkSize / kBlobstoreBlockSize;
+        bno_start = fbl::round_down(bno_start, chunk_blocks);
+        bno_end = fbl::min(fbl::round_up(bno_end, chunk_blocks), data_blocks);
+        if ((status = LoadCompressed(bno_start, bno_end)) != ZX_OK) {
+            return status;
+        }
+    } else {
+        ReadTxn txn(blobstore_.get());
+        const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_);
+        for (uint64_t bno = verified_.Scan(bno_start, bno_end, true); bno < bno_end;) {
+            uint64_t run_end = verified_.Scan(bno, bno_end, false);
+            txn.Enqueue(vmoid_, merkle_blocks + bno, dev_start + merkle_blocks + bno,
+                        run_end - bno);
+            bno = verified_.Scan(run_end, bno_end, true);
+        }
+        if ((status = txn.Flush()) != ZX_OK) {
+            return status;
+        }
+    }
+
+    Digest d;
+    d = reinterpret_cast<const uint8_t*>(&digest_[0]);
+    const size_t tree_len = MerkleTree::GetTreeLength(inode->blob_size);
+    for (uint64_t bno = verified_.Scan(bno_start, bno_end, true); bno < bno_end;) {
+        uint64_t run_end = verified_.Scan(bno, bno_end, false);
+        uint64_t run_off = bno * kBlobstoreBlockSize;
+        uint64_t run_len = fbl::min(run_end * kBlobstoreBlockSize, inode->blob_size) - run_off;
+        if ((status = MerkleTree::Verify(GetData(), inode->blob_size, GetMerkle(), tree_len,
+                                         run_off, run_len, d)) != ZX_OK) {
+            FS_TRACE_ERROR("blobstore: Blob failed verification at block %" PRIu64 "\n", bno);
+            return status;
+        }
+        verified_.Set(bno, run_end);
+        bno = verified_.Scan(run_end, bno_end, true);
+    }
+    return ZX_OK;
+}
+
+zx_status_t VnodeBlob::LoadCompressed(uint64_t bno_start, uint64_t bno_end) {
+    TRACE_DURATION("blobstore", "Blobstore::LoadCompressed", "bno_start", bno_start,
+                   "bno_end", bno_end);
 
+    const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t compressed_blocks = inode->num_blocks - merkle_blocks;
+    const size_t compressed_len = compressed_blocks * kBlobstoreBlockSize;
+    const size_t table_size = BlobChunkTableSize(*inode);
+    const uint64_t table_blocks = fbl::round_up(table_size, kBlobstoreBlockSize) /
+                                  kBlobstoreBlockSize;
+    const uint64_t chunk_blocks = kBlobstoreCompressChunkSize / kBlobstoreBlockSize;
+    const uint64_t chunk_start = bno_start / chunk_blocks;
+    const uint64_t chunk_end = fbl::round_up(bno_end, chunk_blocks) / chunk_blocks;
+    const uint64_t* table = static_cast<const uint64_t*>(GetCompressed());
+
+    // The compressed data is staged in the VMO at the same offsets it has on
+    // disk, following the uncompressed blob.
     ReadTxn txn(blobstore_.get());
-    txn.Enqueue(vmoid_, 0, inode->start_block + DataStartBlock(blobstore_->info_),
-                BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode));
+    const uint64_t vmo_start = merkle_blocks + data_blocks;
+    const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_) +
+                               merkle_blocks;
+    for (uint64_t n = chunk_start; n < chunk_end; n++) {
+        if (verified_.Get(n * chunk_blocks, fbl::min((n + 1) * chunk_blocks, data_blocks))) {
+            continue;
+        }
+        const uint64_t start = table_size + ((n == 0) ? 0 : table[n - 1]);
+        const uint64_t end = table_size + table[n];
+        if (start >= end || end > compressed_len) {
+            FS_TRACE_ERROR("blobstore: Corrupt chunk table entry %" PRIu64 "\n", n);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        const uint64_t blk = start / kBlobstoreBlockSize;
+        const uint64_t blk_end = fbl::round_up(end, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+        txn.Enqueue(vmoid_, vmo_start + blk, dev_start + blk, blk_end - blk);
+    }
+    zx_status_t status;
     if ((status = txn.Flush()) != ZX_OK) {
         return status;
     }
 
-    return Verify();
+    for (uint64_t n = chunk_start; n < chunk_end; n++) {
+        if (verified_.Get(n * chunk_blocks, fbl::min((n + 1) * chunk_blocks, data_blocks))) {
+            continue;
+        }
+        if ((status = BlobDecompressChunk(*inode, GetCompressed(), compressed_len, n,
+                                          GetData())) != ZX_OK) {
+            return status;
+        }
+    }
+
+    // Only the chunk table needs to stay resident; everything else is
+    // re-read from disk if it is ever needed again.
+    if (compressed_blocks > table_blocks) {
+        status = zx_vmo_op_range(blob_->GetVmo(), ZX_VMO_OP_DECOMMIT,
+                                 (vmo_start + table_blocks) * kBlobstoreBlockSize,
+                                 (compressed_blocks - table_blocks) * kBlobstoreBlockSize,
+                                 nullptr, 0);
+    }
+    return status;
 }
 
 uint64_t VnodeBlob::SizeData() const {
@@ -195,6 +327,7 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
 
     // Find a free node, mark it as reserved.
     zx_status_t status;
+    uint64_t vmo_blocks;
     if ((status = blobstore_->AllocateNode(&map_index_)) != ZX_OK) {
         return status;
     }
@@ -205,8 +338,18 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     inode->blob_size = size_data;
     inode->num_blocks = MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode);
 
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != ZX_OK) {
+        blobstore_->FreeNode(map_index_);
+        return status;
+    }
+
     // Open VMOs, so we can begin writing after allocate succeeds.
-    if ((status = MappedVmo::Create(inode->num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
+    // Blobs which may be compressed need room to compress into.
+    vmo_blocks = inode->num_blocks;
+    if (MayCompress()) {
+        vmo_blocks += BlobDataBlocks(*inode);
+    }
+    if ((status = MappedVmo::Create(vmo_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
         goto fail;
     }
     if ((status = blobstore_->AttachVmo(blob_->GetVmo(), &vmoid_)) != ZX_OK) {
@@ -250,6 +393,56 @@ void* VnodeBlob::GetMerkle() const {
     return blob_->GetData();
 }
 
+void* VnodeBlob::GetCompressed() const {
+    auto inode = blobstore_->GetNode(map_index_);
+    return fs::GetBlock<kBlobstoreBlockSize>(blob_->GetData(),
+                                             MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode));
+}
+
+bool VnodeBlob::MayCompress() const {
+    return CompressionSupported(blobstore_->info_) &&
+           blobstore_->GetNode(map_index_)->blob_size >= kCompressionMinBytes;
+}
+
+zx_status_t VnodeBlob::CompressAndWrite(WriteTxn* txn) {
+    TRACE_DURATION("blobstore", "Blobstore::CompressAndWrite", "txn", txn);
+
+    blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+
+    // The compressed blob is only kept if it saves at least one block.
+    size_t compressed_len;
+    zx_status_t status = BlobCompress(GetData(), inode->blob_size, GetCompressed(),
+                                      (data_blocks - 1) * kBlobstoreBlockSize, &compressed_len);
+    if (status == ZX_ERR_BUFFER_TOO_SMALL) {
+        return WriteShared(txn, merkle_blocks * kBlobstoreBlockSize, inode->blob_size,
+                           inode->start_block);
+    } else if (status != ZX_OK) {
+        return status;
+    }
+
+    const uint64_t compressed_blocks = fbl::round_up(compressed_len, kBlobstoreBlockSize) /
+                                       kBlobstoreBlockSize;
+    blobstore_->FreeBlocks(data_blocks - compressed_blocks,
+                           inode->start_block + merkle_blocks + compressed_blocks);
+    inode->num_blocks = merkle_blocks + compressed_blocks;
+    inode->flags |= kBlobstoreInodeFlagLZ4;
+
+    txn->Enqueue(vmoid_, merkle_blocks + data_blocks,
+                 inode->start_block + DataStartBlock(blobstore_->info_) + merkle_blocks,
+                 compressed_blocks);
+    if ((status = txn->Flush()) != ZX_OK) {
+        return status;
+    }
+
+    // Reads are served from the uncompressed copy, which has already been
+    // verified, so the staging area can be released.
+    return zx_vmo_op_range(blob_->GetVmo(), ZX_VMO_OP_DECOMMIT,
+                           (merkle_blocks + data_blocks) * kBlobstoreBlockSize,
+                           data_blocks * kBlobstoreBlockSize, nullptr, 0);
+}
+
 zx_status_t VnodeBlob::WriteMetadata() {
     TRACE_DURATION("blobstore", "Blobstore::WriteMetadata");
 
@@ -281,12 +474,19 @@ zx_status_t VnodeBlob::WriteMetadata() {
         return ZX_ERR_IO;
     }
 
-    // Flush the block allocation bitmap to disk
-    fsync(blobstore_->Fd());
+    // The bitmap must be on disk before the node which references the blocks.
+    if (txn.Sync() != ZX_OK) {
+        return ZX_ERR_IO;
+    }
 
     // Update the on-disk hash
     memcpy(inode->merkle_root_hash, &digest_[0], Digest::kLength);
 
+    zx_status_t status;
+    if ((status = blobstore_->IndexBlob(&digest_[0], map_index_)) != ZX_OK) {
+        return status;
+    }
+
     // Write back the blob node
     if (blobstore_->WriteNode(&txn, map_index_)) {
         return ZX_ERR_IO;
@@ -316,10 +516,14 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
-        status = WriteShared(&txn, offset, len, inode->start_block);
-        if (status != ZX_OK) {
-            SetState(kBlobStateError);
-            return status;
+        // Blobs which may be compressed are not written to disk until all
+        // of their data is present.
+        if (!MayCompress()) {
+            status = WriteShared(&txn, offset, len, inode->start_block);
+            if (status != ZX_OK) {
+                SetState(kBlobStateError);
+                return status;
+            }
         }
 
         *actual = to_write;
@@ -361,6 +565,14 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
+        // The entire blob is now in memory and matches its digest.
+        verified_.Set(0, BlobDataBlocks(*inode));
+
+        if (MayCompress() && (status = CompressAndWrite(&txn)) != ZX_OK) {
+            SetState(kBlobStateError);
+            return status;
+        }
+
         // No more data to write. Flush to disk.
         if ((status = WriteMetadata()) != ZX_OK) {
             SetState(kBlobStateError);
@@ -402,8 +614,12 @@ zx_status_t VnodeBlob::CopyVmo(zx_rights_t rights, zx_handle_t* out) {
     }
 
     auto inode = blobstore_->GetNode(map_index_);
-    // TODO(smklein): Only clone / verify the part of the vmo that
-    // was requested.
+    // TODO(ZX-1481): Clones cannot fault in data on demand yet, so the
+    // entire blob must be read and verified before it can be shared.
+    if ((status = LoadAndVerify(0, inode->blob_size)) != ZX_OK) {
+        return status;
+    }
+
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     zx_handle_t clone;
     if ((status = zx_vmo_clone(blob_->GetVmo(), ZX_VMO_CLONE_COPY_ON_WRITE,
@@ -440,6 +656,9 @@ zx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
     if (len > (inode->blob_size - off)) {
         len = inode->blob_size - off;
     }
+    if ((status = LoadAndVerify(off, len)) != ZX_OK) {
+        return status;
+    }
 
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     return zx_vmo_read(blob_->GetVmo(), data, data_start + off, len, actual);
@@ -481,42 +700,56 @@ void Blobstore::FreeBlocks(size_t nblocks, size_t blkno) {
 // Allocates a node IN MEMORY
 zx_status_t Blobstore::AllocateNode(size_t* node_index_out) {
     TRACE_DURATION("blobstore", "Blobstore::AllocateNode");
-    for (size_t i = 0; i < info_.inode_count; ++i) {
-        if (GetNode(i)->start_block == kStartBlockFree) {
-            // Found a free node. Mark it as reserved so no one else can allocate it.
-            GetNode(i)->start_block = kStartBlockReserved;
-            info_.alloc_inode_count++;
-            *node_index_out = i;
-            return ZX_OK;
-        }
-    }
-
-    // If we didn't find any free inodes, try adding more via FVM.
-    size_t old_inode_count = info_.inode_count;
-    if (AddInodes() != ZX_OK) {
-        return ZX_ERR_NO_SPACE;
-    }
-
-    for (size_t i = old_inode_count; i < info_.inode_count; ++i) {
-        if (GetNode(i)->start_block == kStartBlockFree) {
-            // Found a free node. Mark it as reserved so no one else can allocate it.
-            GetNode(i)->start_block = kStartBlockReserved;
-            info_.alloc_inode_count++;
-            *node_index_out = i;
-            return ZX_OK;
+    size_t i;
+    if (node_bitmap_.Find(false, 0, info_.inode_count, 1, &i) != ZX_OK) {
+        // If we didn't find any free inodes, try adding more via FVM.
+        size_t old_inode_count = info_.inode_count;
+        if (AddInodes() != ZX_OK) {
+            return ZX_ERR_NO_SPACE;
+        } else if (node_bitmap_.Find(false, old_inode_count, info_.inode_count, 1, &i) != ZX_OK) {
+            return ZX_ERR_NO_SPACE;
         }
     }
 
-    return ZX_ERR_NO_SPACE;
+    // Found a free node. Mark it as reserved so no one else can allocate it.
+    ZX_DEBUG_ASSERT(GetNode(i)->start_block == kStartBlockFree);
+    node_bitmap_.Set(i, i + 1);
+    GetNode(i)->start_block = kStartBlockReserved;
+    info_.alloc_inode_count++;
+    *node_index_out = i;
+    return ZX_OK;
 }
 
 // Frees a node IN MEMORY
 void Blobstore::FreeNode(size_t node_index) {
     TRACE_DURATION("blobstore", "Blobstore::FreeNode", "node_index", node_index);
     memset(GetNode(node_index), 0, sizeof(blobstore_inode_t));
+    node_bitmap_.Clear(node_index, node_index + 1);
     info_.alloc_inode_count--;
 }
 
+zx_status_t Blobstore::IndexBlob(const uint8_t* digest, size_t map_index) {
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<BlobIndexEntry> entry(new (&ac) BlobIndexEntry);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    memcpy(entry->digest, digest, Digest::kLength);
+    entry->map_index = map_index;
+    if (!index_.insert_or_find(fbl::move(entry))) {
+        FS_TRACE_ERROR("blobstore: Duplicate blob in node %zu\n", map_index);
+        return ZX_ERR_ALREADY_EXISTS;
+    }
+    return ZX_OK;
+}
+
+void Blobstore::UnindexBlob(const uint8_t* digest, size_t map_index) {
+    auto entry = index_.find(digest);
+    if (entry.IsValid() && entry->map_index == map_index) {
+        index_.erase(entry);
+    }
+}
+
 zx_status_t Blobstore::Unmount() {
     TRACE_DURATION("blobstore", "Blobstore::Unmount");
     // Explicitly delete this (rather than just letting the memory release when
@@ -595,6 +828,7 @@ zx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     case kBlobStateError: {
         vn->SetState(kBlobStateReleasing);
         size_t node_index = vn->GetMapIndex();
+        UnindexBlob(vn->GetKey(), node_index);
         uint64_t start_block = GetNode(node_index)->start_block;
         uint64_t nblocks = GetNode(node_index)->num_blocks;
         FreeNode(node_index);
@@ -603,6 +837,11 @@ zx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
         WriteNode(&txn, node_index);
         WriteBitmap(&txn, nblocks, start_block);
         CountUpdate(&txn);
+        if (trim_supported_ && txn.Sync() == ZX_OK) {
+            // Sent behind the barrier, so the blocks are only discarded once
+            // the bitmap which frees them is on stable storage.
+            txn.Trim(DataStartBlock(info_) + start_block, nblocks);
+        }
         hash_.erase(*vn);
         return ZX_OK;
     }
@@ -667,29 +906,27 @@ zx_status_t Blobstore::LookupBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>*
         return ZX_OK;
     }
 
-    // Look up blob in the slow map
-    for (size_t i = 0; i < info_.inode_count; ++i) {
-        if (GetNode(i)->start_block >= kStartBlockMinimum) {
-            if (digest == GetNode(i)->merkle_root_hash) {
-                if (out != nullptr) {
-                    // Found it. Attempt to wrap the blob in a vnode.
-                    fbl::AllocChecker ac;
-                    fbl::RefPtr<VnodeBlob> vn =
-                        fbl::AdoptRef(new (&ac) VnodeBlob(fbl::RefPtr<Blobstore>(this), digest));
-                    if (!ac.check()) {
-                        return ZX_ERR_NO_MEMORY;
-                    }
-                    vn->SetState(kBlobStateReadable);
-                    vn->SetMapIndex(i);
-                    // Delay reading any data from disk until read.
-                    hash_.insert(vn.get());
-                    *out = fbl::move(vn);
-                }
-                return ZX_OK;
-            }
+    // Look up blob in the index of blobs on disk
+    auto entry = index_.find(digest.AcquireBytes());
+    digest.ReleaseBytes();
+    if (!entry.IsValid()) {
+        return ZX_ERR_NOT_FOUND;
+    }
+    if (out != nullptr) {
+        // Found it. Attempt to wrap the blob in a vnode.
+        fbl::AllocChecker ac;
+        fbl::RefPtr<VnodeBlob> vn =
+            fbl::AdoptRef(new (&ac) VnodeBlob(fbl::RefPtr<Blobstore>(this), digest));
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
         }
+        vn->SetState(kBlobStateReadable);
+        vn->SetMapIndex(entry->map_index);
+        // Delay reading any data from disk until read.
+        hash_.insert(vn.get());
+        *out = fbl::move(vn);
     }
-    return ZX_ERR_NOT_FOUND;
+    return ZX_OK;
 }
 
 zx_status_t Blobstore::AttachVmo(zx_handle_t vmo, vmoid_t* out) {
@@ -735,6 +972,8 @@ zx_status_t Blobstore::AddInodes() {
 
     if (node_map_->Grow(inoblks * kBlobstoreBlockSize) != ZX_OK) {
         return ZX_ERR_NO_SPACE;
+    } else if (node_bitmap_.Grow(inodes) != ZX_OK) {
+        return ZX_ERR_NO_SPACE;
     }
 
     info_.vslice_count += request.length;
@@ -838,6 +1077,12 @@ zx_status_t Blobstore::Create(fbl::unique_fd fd, const blobstore_info_t* info,
 
     zx_handle_t fifo;
     ssize_t r;
+    block_info_t block_info;
+    if ((r = ioctl_block_get_info(fs->Fd(), &block_info)) < 0) {
+        return static_cast<zx_status_t>(r);
+    }
+    fs->trim_supported_ = block_info.flags & BLOCK_FLAG_TRIM_SUPPORT;
+
     if ((r = ioctl_block_get_fifos(fs->Fd(), &fifo)) < 0) {
         return static_cast<zx_status_t>(r);
     } else if ((r = ioctl_block_alloc_txn(fs->Fd(), &fs->txnid_)) < 0) {
@@ -872,6 +1117,9 @@ zx_status_t Blobstore::Create(fbl::unique_fd fd, const blobstore_info_t* info,
     } else if ((status = fs->LoadBitmaps()) < 0) {
         fprintf(stderr, "blobstore: Failed to load bitmaps: %d\n", status);
         return status;
+    } else if ((status = fs->LoadNodeIndex()) != ZX_OK) {
+        fprintf(stderr, "blobstore: Failed to index nodes: %d\n", status);
+        return status;
     } else if ((status = MappedVmo::Create(kBlobstoreBlockSize, "blobstore-superblock",
                                            &fs->info_vmo_)) != ZX_OK) {
         fprintf(stderr, "blobstore: Failed to create info vmo: %d\n", status);
@@ -905,7 +1153,33 @@ zx_status_t Blobstore::LoadBitmaps() {
     ReadTxn txn(this);
     txn.Enqueue(block_map_vmoid_, 0, BlockMapStartBlock(info_), BlockMapBlocks(info_));
     txn.Enqueue(node_map_vmoid_, 0, NodeMapStartBlock(info_), NodeMapBlocks(info_));
-    return txn.Flush();
+    zx_status_t status = txn.Flush();
+    if (status != ZX_OK) {
+        return status;
+    }
+    block_map_.RecomputeSummary();
+    return ZX_OK;
+}
+
+zx_status_t Blobstore::LoadNodeIndex() {
+    TRACE_DURATION("blobstore", "Blobstore::LoadNodeIndex");
+    zx_status_t status;
+    if ((status = node_bitmap_.Reset(info_.inode_count)) != ZX_OK) {
+        return status;
+    }
+
+    for (size_t i = 0; i < info_.inode_count; ++i) {
+        const blobstore_inode_t* inode = GetNode(i);
+        if (inode->start_block == kStartBlockFree) {
+            continue;
+        }
+        node_bitmap_.Set(i, i + 1);
+        if (inode->start_block >= kStartBlockMinimum &&
+            (status = IndexBlob(inode->merkle_root_hash, i)) != ZX_OK) {
+            return status;
+        }
+    }
+    return ZX_OK;
 }
 
 zx_status_t blobstore_create(fbl::RefPtr<Blobstore>* out, fbl::unique_fd blockfd) {
@@ -19,6 +19,7 @@
 #include <fbl/limits.h>
 #include <fs/block-txn.h>
 #include <fs/trace.h>
+#include <lz4/lz4.h>
 
 #ifdef __Fuchsia__
 #include <fs/fvm.h>
@@ -39,6 +40,66 @@ uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode) {
     return fbl::round_up(size_merkle, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+zx_status_t BlobCompress(const void* data, uint64_t blob_size, void* out, size_t out_size,
+                         size_t* out_len) {
+    blobstore_inode_t node;
+    node.blob_size = blob_size;
+    const uint64_t chunks = BlobChunkCount(node);
+    const size_t table_size = BlobChunkTableSize(node);
+    if (table_size >= out_size) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    auto table = static_cast<uint64_t*>(out);
+    auto dst = static_cast<char*>(out) + table_size;
+    const size_t dst_size = out_size - table_size;
+    auto src = static_cast<const char*>(data);
+    size_t end = 0;
+    for (uint64_t n = 0; n < chunks; n++) {
+        const uint64_t off = n * kBlobstoreCompressChunkSize;
+        const int len = static_cast<int>(fbl::min(kBlobstoreCompressChunkSize, blob_size - off));
+        const int max = static_cast<int>(fbl::min(dst_size - end, static_cast<size_t>(INT_MAX)));
+        // LZ4 reports failure (returns zero) when the output does not fit.
+        int r = LZ4_compress_default(src + off, dst + end, len, max);
+        if (r <= 0) {
+            return ZX_ERR_BUFFER_TOO_SMALL;
+        }
+        end += r;
+        table[n] = end;
+    }
+
+    *out_len = table_size + end;
+    return ZX_OK;
+}
+
+zx_status_t BlobDecompressChunk(const blobstore_inode_t& blobNode, const void* compressed,
+                                size_t compressed_len, uint64_t chunk, void* data) {
+    const size_t table_size = BlobChunkTableSize(blobNode);
+    if (chunk >= BlobChunkCount(blobNode) || compressed_len < table_size) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+
+    auto table = static_cast<const uint64_t*>(compressed);
+    const uint64_t start = (chunk == 0) ? 0 : table[chunk - 1];
+    const uint64_t end = table[chunk];
+    if (start >= end || end > compressed_len - table_size) {
+        FS_TRACE_ERROR("blobstore: Corrupt chunk table entry %" PRIu64 "\n", chunk);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+
+    const uint64_t off = chunk * kBlobstoreCompressChunkSize;
+    const int len = static_cast<int>(fbl::min(kBlobstoreCompressChunkSize,
+                                              blobNode.blob_size - off));
+    auto src = static_cast<const char*>(compressed) + table_size + start;
+    int r = LZ4_decompress_safe(src, static_cast<char*>(data) + off,
+                                static_cast<int>(end - start), len);
+    if (r != len) {
+        FS_TRACE_ERROR("blobstore: Failed to decompress chunk %" PRIu64 "\n", chunk);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    return ZX_OK;
+}
+
 // Sanity check the metadata for the blobstore, given a maximum number of
 // available blocks.
 zx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
@@ -47,7 +108,7 @@ zx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
         fprintf(stderr, "blobstore: bad magic\n");
         return ZX_ERR_INVALID_ARGS;
     }
-    if (info->version != kBlobstoreVersion) {
+    if (info->version != kBlobstoreVersion && info->version != kBlobstoreVersionNoCompression) {
         fprintf(stderr, "blobstore: FS Version: %08x. Driver version: %08x\n", info->version,
                 kBlobstoreVersion);
         return ZX_ERR_INVALID_ARGS;
@@ -12,12 +12,19 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <digest/digest.h>
 #include <digest/merkle-tree.h>
 #include <fs/block-txn.h>
 #include <fbl/algorithm.h>
-#include <fbl/auto_call.h>
 #include <fbl/new.h>
+#include <fbl/unique_fd.h>
 #include <fbl/unique_ptr.h>
 #include <fdio/debug.h>
 
@@ -147,38 +154,105 @@ zx_status_t blobstore_create_sparse(fbl::RefPtr<Blobstore>* out, fbl::unique_fd
     return ZX_OK;
 }
 
-std::mutex add_blob_mutex_;
+namespace {
 
-zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
-    // Mmap user-provided file, create the corresponding merkle tree
+// Blobs with more than this much data have their leaves hashed in pieces of
+// this size, so that several workers can share one large blob.
+constexpr size_t kHashChunkSize = 512 * MerkleTree::kNodeSize;
+
+// A blob read from the host, along with its Merkle tree and, if that saves
+// space, its compressed contents; everything needed to write it into an image.
+struct BlobInfo {
+    BlobInfo() = default;
+    ~BlobInfo() { Reset(); }
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlobInfo);
+
+    void Reset() {
+        if (data != nullptr) {
+            munmap(data, data_len);
+            data = nullptr;
+        }
+        merkle_tree.reset();
+        compressed.reset();
+    }
+
+    void* data = nullptr;
+    size_t data_len = 0;
+    fbl::unique_ptr<uint8_t[]> merkle_tree;
+    size_t merkle_size = 0;
+    Digest digest;
+    fbl::unique_ptr<uint8_t[]> compressed;
+    size_t compressed_len = 0;
+
+    // Used by BlobPreparer.
+    zx_status_t status = ZX_OK;
+    bool ready = false;
+    std::atomic<size_t> pending_chunks{0};
+};
+
+// Maps the file at |data_fd| and allocates room for its Merkle tree.
+zx_status_t MapBlob(int data_fd, BlobInfo* info) {
     struct stat s;
     if (fstat(data_fd, &s) < 0) {
         return ZX_ERR_BAD_STATE;
     }
-    void* blob_data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
-    if (blob_data == nullptr) {
-        return ZX_ERR_BAD_STATE;
+    info->data_len = static_cast<size_t>(s.st_size);
+    if (info->data_len != 0) {
+        void* data = mmap(nullptr, info->data_len, PROT_READ, MAP_PRIVATE, data_fd, 0);
+        if (data == MAP_FAILED) {
+            return ZX_ERR_BAD_STATE;
+        }
+        info->data = data;
     }
+    fbl::AllocChecker ac;
+    info->merkle_size = MerkleTree::GetTreeLength(info->data_len);
+    info->merkle_tree.reset(new (&ac) uint8_t[info->merkle_size]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    return ZX_OK;
+}
 
-    auto auto_unmap = fbl::MakeAutoCall([blob_data, s]() {
-        munmap(blob_data, s.st_size);
-    });
-
-    zx_status_t status;
-    digest::Digest digest;
+// Compresses the blob if asked to. The compressed blob is only kept if it
+// saves at least one block.
+zx_status_t CompressBlob(BlobInfo* info, bool compress) {
+    const size_t data_size = fbl::round_up(info->data_len, kBlobstoreBlockSize);
+    if (!compress || data_size <= kBlobstoreBlockSize) {
+        return ZX_OK;
+    }
     fbl::AllocChecker ac;
-    size_t merkle_size = MerkleTree::GetTreeLength(s.st_size);
-    auto merkle_tree = fbl::unique_ptr<uint8_t[]>(new (&ac) uint8_t[merkle_size]);
+    const size_t max_len = data_size - kBlobstoreBlockSize;
+    info->compressed.reset(new (&ac) uint8_t[max_len]);
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
-    } else if ((status = MerkleTree::Create(blob_data, s.st_size, merkle_tree.get(),
-                                  merkle_size, &digest)) != ZX_OK) {
+    }
+    zx_status_t status = BlobCompress(info->data, info->data_len, info->compressed.get(),
+                                      max_len, &info->compressed_len);
+    if (status == ZX_ERR_BUFFER_TOO_SMALL) {
+        info->compressed.reset();
+    } else if (status != ZX_OK) {
         return status;
     }
+    return ZX_OK;
+}
 
-    std::lock_guard<std::mutex> lock(add_blob_mutex_);
+// Hashes and compresses a blob that has been mapped by MapBlob.
+zx_status_t PrepareBlob(BlobInfo* info, bool compress) {
+    zx_status_t status;
+    if ((status = MerkleTree::Create(info->data, info->data_len, info->merkle_tree.get(),
+                                     info->merkle_size, &info->digest)) != ZX_OK) {
+        return status;
+    }
+    return CompressBlob(info, compress);
+}
+
+// Allocates a node and blocks for a prepared blob and writes it out. This is
+// the only part of adding a blob that touches the image, so it must not be run
+// concurrently with itself.
+zx_status_t CommitBlob(Blobstore* bs, const BlobInfo& info) {
+    zx_status_t status;
     fbl::unique_ptr<InodeBlock> inode_block;
-    if ((status = bs->NewBlob(digest, &inode_block)) < 0) {
+    if ((status = bs->NewBlob(info.digest, &inode_block)) < 0) {
         return status;
     }
     if (inode_block == nullptr) {
@@ -186,14 +260,24 @@ zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
         return ZX_ERR_NO_RESOURCES;
     }
 
-    inode_block->SetSize(s.st_size);
+    inode_block->SetSize(info.data_len);
     blobstore_inode_t* inode = inode_block->GetInode();
+    const void* data = info.data;
+    size_t data_len = info.data_len;
+    if (info.compressed != nullptr) {
+        inode->flags |= kBlobstoreInodeFlagLZ4;
+        inode->num_blocks = MerkleTreeBlocks(*inode) +
+                            fbl::round_up(info.compressed_len, kBlobstoreBlockSize) /
+                            kBlobstoreBlockSize;
+        data = info.compressed.get();
+        data_len = info.compressed_len;
+    }
 
     if ((status = bs->AllocateBlocks(inode->num_blocks,
                                      reinterpret_cast<size_t*>(&inode->start_block))) != ZX_OK) {
         fprintf(stderr, "error: No blocks available\n");
         return status;
-    } else if ((status = bs->WriteData(inode, merkle_tree.get(), blob_data)) != ZX_OK) {
+    } else if ((status = bs->WriteData(inode, info.merkle_tree.get(), data, data_len)) != ZX_OK) {
         return status;
     } else if ((status = bs->WriteBitmap(inode->num_blocks, inode->start_block)) != ZX_OK) {
         return status;
@@ -206,6 +290,230 @@ zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
     return ZX_OK;
 }
 
+// Prepares a list of blobs on a pool of worker threads, while the caller
+// commits them one at a time in list order.  Each blob is normally a single
+// job.  The leaves of large blobs are instead split into several jobs, and
+// whichever worker finishes the last of them builds the rest of the tree and
+// compresses the blob.  Workers only run a bounded distance ahead of the
+// caller, which keeps the number of blobs held in memory in check.
+class BlobPreparer {
+public:
+    BlobPreparer(const fbl::Vector<fbl::String>& paths, bool compress)
+        : paths_(paths), compress_(compress) {}
+    ~BlobPreparer() { Stop(); }
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlobPreparer);
+
+    // Starts |threads| workers.
+    zx_status_t Start(unsigned threads) {
+        fbl::AllocChecker ac;
+        blobs_.reset(new (&ac) BlobInfo[paths_.size()]);
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        window_ = 4 * threads;
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { Work(); });
+        }
+        return ZX_OK;
+    }
+
+    // Blocks until blob |i| has been prepared, and returns it.
+    BlobInfo* Wait(size_t i) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this, i] { return blobs_[i].ready; });
+        return &blobs_[i];
+    }
+
+    // Frees blob |i| once the caller is done with it, letting the workers
+    // move on to later blobs.
+    void Release(size_t i) {
+        blobs_[i].Reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        released_ = i + 1;
+        work_.notify_all();
+    }
+
+    // Stops and joins the workers.  Blobs that were in progress are abandoned.
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            work_.notify_all();
+        }
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+    }
+
+private:
+    struct Chunk {
+        size_t blob;
+        size_t offset;
+        size_t length;
+    };
+
+    bool CanOpenLocked() const {
+        return next_blob_ < paths_.size() && next_blob_ < released_ + window_;
+    }
+
+    void Work() {
+        while (true) {
+            Chunk chunk;
+            bool open = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_.wait(lock, [this] {
+                    return stopping_ || !chunks_.empty() || CanOpenLocked();
+                });
+                if (stopping_) {
+                    return;
+                }
+                if (!chunks_.empty()) {
+                    chunk = chunks_.front();
+                    chunks_.pop_front();
+                } else {
+                    chunk.blob = next_blob_++;
+                    open = true;
+                }
+            }
+            if (open) {
+                Open(chunk.blob);
+            } else {
+                HashChunk(chunk);
+            }
+        }
+    }
+
+    void Open(size_t i) {
+        BlobInfo* info = &blobs_[i];
+        fbl::unique_fd data_fd(open(paths_[i].c_str(), O_RDONLY));
+        if (!data_fd) {
+            fprintf(stderr, "error: cannot open '%s'\n", paths_[i].c_str());
+            Finish(i, ZX_ERR_IO);
+            return;
+        }
+        zx_status_t status;
+        if ((status = MapBlob(data_fd.get(), info)) != ZX_OK) {
+            Finish(i, status);
+            return;
+        }
+        if (info->data_len <= 2 * kHashChunkSize) {
+            Finish(i, PrepareBlob(info, compress_));
+            return;
+        }
+        // Queue up all but the first chunk for other workers, and hash the
+        // first one here.
+        size_t chunks = fbl::round_up(info->data_len, kHashChunkSize) / kHashChunkSize;
+        info->pending_chunks.store(chunks);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t off = kHashChunkSize; off < info->data_len; off += kHashChunkSize) {
+                chunks_.push_back({i, off, fbl::min(kHashChunkSize, info->data_len - off)});
+            }
+            work_.notify_all();
+        }
+        HashChunk({i, 0, kHashChunkSize});
+    }
+
+    void HashChunk(const Chunk& chunk) {
+        BlobInfo* info = &blobs_[chunk.blob];
+        zx_status_t status = MerkleTree::CreateLeafDigests(info->data, info->data_len,
+                                                           chunk.offset, chunk.length,
+                                                           info->merkle_tree.get(),
+                                                           info->merkle_size);
+        if (status != ZX_OK) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            info->status = status;
+        }
+        if (info->pending_chunks.fetch_sub(1) != 1) {
+            return;
+        }
+        // This was the last chunk, so the other workers are done with the blob.
+        if (info->status != ZX_OK) {
+            Finish(chunk.blob, info->status);
+            return;
+        }
+        if ((status = MerkleTree::CreateFromLeafDigests(info->data_len, info->merkle_tree.get(),
+                                                        info->merkle_size,
+                                                        &info->digest)) != ZX_OK) {
+            Finish(chunk.blob, status);
+            return;
+        }
+        Finish(chunk.blob, CompressBlob(info, compress_));
+    }
+
+    void Finish(size_t i, zx_status_t status) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (blobs_[i].status == ZX_OK) {
+            blobs_[i].status = status;
+        }
+        blobs_[i].ready = true;
+        ready_.notify_all();
+    }
+
+    const fbl::Vector<fbl::String>& paths_;
+    const bool compress_;
+    fbl::unique_ptr<BlobInfo[]> blobs_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    // Signalled when there may be work for the workers.
+    std::condition_variable work_;
+    // Signalled when a blob becomes ready.
+    std::condition_variable ready_;
+    std::deque<Chunk> chunks_;
+    size_t next_blob_ = 0;
+    size_t released_ = 0;
+    size_t window_ = 0;
+    bool stopping_ = false;
+};
+
+} // namespace
+
+std::mutex add_blob_mutex_;
+
+zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd, bool compress) {
+    // Mmap user-provided file, create the corresponding merkle tree
+    BlobInfo info;
+    zx_status_t status;
+    compress = compress && bs->CompressionSupported();
+    if ((status = MapBlob(data_fd, &info)) != ZX_OK ||
+        (status = PrepareBlob(&info, compress)) != ZX_OK) {
+        return status;
+    }
+
+    std::lock_guard<std::mutex> lock(add_blob_mutex_);
+    return CommitBlob(bs, info);
+}
+
+zx_status_t blobstore_add_blobs(Blobstore* bs, const fbl::Vector<fbl::String>& paths,
+                                bool compress, unsigned threads) {
+    if (threads == 0) {
+        threads = fbl::max(std::thread::hardware_concurrency(), 1u);
+    }
+    BlobPreparer preparer(paths, compress && bs->CompressionSupported());
+    zx_status_t status;
+    if ((status = preparer.Start(threads)) != ZX_OK) {
+        return status;
+    }
+    std::lock_guard<std::mutex> lock(add_blob_mutex_);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const BlobInfo* info = preparer.Wait(i);
+        if ((status = info->status) == ZX_OK) {
+            status = CommitBlob(bs, *info);
+        }
+        // Identical files are only stored once.
+        if (status != ZX_OK && status != ZX_ERR_ALREADY_EXISTS) {
+            fprintf(stderr, "blobstore: Failed to add blob '%s': %d\n", paths[i].c_str(),
+                    status);
+            return status;
+        }
+        preparer.Release(i);
+    }
+    return ZX_OK;
+}
+
 zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
                    const fbl::Vector<size_t>& extent_lengths) {
     fbl::RefPtr<Blobstore> blob;
@@ -221,6 +529,7 @@ zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
 
 void InodeBlock::SetSize(size_t size) {
     inode_->blob_size = size;
+    inode_->flags = 0;
     inode_->num_blocks = MerkleTreeBlocks(*inode_) + BlobDataBlocks(*inode_);
 }
 
@@ -292,6 +601,7 @@ zx_status_t Blobstore::LoadBitmap() {
             memcpy(bmdata, cache_.blk, kBlobstoreBlockSize);
         }
     }
+    block_map_.RecomputeSummary();
     return ZX_OK;
 }
 
@@ -384,8 +694,10 @@ zx_status_t Blobstore::WriteNode(fbl::unique_ptr<InodeBlock> ino_block) {
     return WriteBlock(cache_.bno, cache_.blk);
 }
 
-zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data) {
-    for (size_t n = 0; n < MerkleTreeBlocks(*inode); n++) {
+zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, const void* merkle_data,
+                                 const void* data, size_t data_len) {
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    for (size_t n = 0; n < merkle_blocks; n++) {
         const void* data = fs::GetBlock<kBlobstoreBlockSize>(merkle_data, n);
         uint64_t bno = data_start_block_ + inode->start_block + n;
         zx_status_t status;
@@ -394,23 +706,23 @@ zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, vo
         }
     }
 
-    for (size_t n = 0; n < BlobDataBlocks(*inode); n++) {
-        const void* data = fs::GetBlock<kBlobstoreBlockSize>(blob_data, n);
+    for (size_t n = 0; n < inode->num_blocks - merkle_blocks; n++) {
+        const void* block = fs::GetBlock<kBlobstoreBlockSize>(data, n);
 
         // If we try to write a block, will it be reaching beyond the end of the
-        // mapped file?
+        // data?
         size_t off = n * kBlobstoreBlockSize;
         uint8_t last_data[kBlobstoreBlockSize];
-        if (inode->blob_size < off + kBlobstoreBlockSize) {
+        if (data_len < off + kBlobstoreBlockSize) {
             // Read the partial block from a block-sized buffer which zero-pads the data.
             memset(last_data, 0, kBlobstoreBlockSize);
-            memcpy(last_data, data, inode->blob_size - off);
-            data = last_data;
+            memcpy(last_data, block, data_len - off);
+            block = last_data;
         }
 
-        uint64_t bno = data_start_block_ + inode->start_block + MerkleTreeBlocks(*inode) + n;
+        uint64_t bno = data_start_block_ + inode->start_block + merkle_blocks + n;
         zx_status_t status;
-        if ((status = WriteBlock(bno, data)) != ZX_OK) {
+        if ((status = WriteBlock(bno, block)) != ZX_OK) {
             return status;
         }
     }
@@ -12,6 +12,7 @@
 #endif
 
 #include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
 #include <digest/digest.h>
 #include <fbl/algorithm.h>
 #include <fbl/intrusive_double_list.h>
@@ -47,6 +48,14 @@ using digest::Digest;
 
 typedef uint32_t BlobFlags;
 
+// Number of data blocks read past the end of a read request which misses
+// unverified blocks.
+constexpr uint64_t kReadAheadBlocks = 16;
+
+// Blobs at least this large are compressed when written, if doing so
+// saves space on disk.
+constexpr uint64_t kCompressionMinBytes = 2 * kBlobstoreBlockSize;
+
 // clang-format off
 
 // After Open;
@@ -163,26 +172,45 @@ private:
     zx_status_t Mmap(int flags, size_t len, size_t* off, zx_handle_t* out) final;
     zx_status_t Sync() final;
 
-    // Read both VMOs into memory, if we haven't already.
-    //
-    // TODO(ZX-1481): When we have can register the Blob Store as a pager
-    // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // Creates the blob VMO and reads the Merkle tree into it, if we
+    // haven't already. No blob data is read until it is accessed.
     zx_status_t InitVmos();
 
-    // Verify the integrity of the in-memory Blob.
+    // Reads any blocks of [off, off + len) which have not been verified yet,
+    // along with up to kReadAheadBlocks following them, and verifies them
+    // against the Merkle tree.
     // InitVmos() must have already been called for this blob.
+    //
+    // TODO(ZX-1481): When we can register the Blob Store as a pager service,
+    // this should be driven by page faults on the blob VMO instead.
+    zx_status_t LoadAndVerify(uint64_t off, uint64_t len);
+
+    // Reads and decompresses each chunk of a compressed blob which overlaps
+    // data blocks [bno_start, bno_end) and has not been verified yet.
+    // The caller is responsible for verifying the decompressed data.
+    zx_status_t LoadCompressed(uint64_t bno_start, uint64_t bno_end);
+
+    // Verify the integrity of the entire in-memory Blob.
+    // All of the blob's data must already be present in the VMO.
     zx_status_t Verify() const;
 
     zx_status_t WriteShared(WriteTxn* txn, size_t start, size_t len, uint64_t start_block);
+
+    // Whether the blob will be compressed once all of its data has been written.
+    bool MayCompress() const;
+
+    // Writes the blob's data to disk once it has been fully written to the
+    // VMO, compressing it first if that saves any blocks. Blocks which are
+    // no longer needed are released.
+    zx_status_t CompressAndWrite(WriteTxn* txn);
     // Called by Blob once the last write has completed, updating the
     // on-disk metadata.
     zx_status_t WriteMetadata();
 
-    // Acquire a pointer to the mapped data or merkle tree
+    // Acquire a pointer to the mapped data, merkle tree, or compressed data
     void* GetData() const;
     void* GetMerkle() const;
+    void* GetCompressed() const;
 
     WAVLTreeNodeState type_wavl_state_{};
 
@@ -192,8 +220,13 @@ private:
     // The blob_ here consists of:
     // 1) The Merkle Tree
     // 2) The Blob itself, aligned to the nearest kBlobstoreBlockSize
+    // 3) For blobs which are (or may become) compressed, space to stage the
+    //    compressed data on its way to or from disk
     fbl::unique_ptr<MappedVmo> blob_{};
     vmoid_t vmoid_{};
+    // One bit per data block of blob_, set once the block has been
+    // read from disk and verified.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_{};
 
     zx::event readable_event_{};
     uint64_t bytes_written_{};
@@ -206,7 +239,8 @@ private:
 // which is larger than a primitive type: the keys are 'Digest::kLength'
 // bytes long.
 struct MerkleRootTraits {
-    static const uint8_t* GetKey(const VnodeBlob& obj) { return obj.GetKey(); }
+    template <typename T>
+    static const uint8_t* GetKey(const T& obj) { return obj.GetKey(); }
     static bool LessThan(const uint8_t* k1, const uint8_t* k2) {
         return memcmp(k1, k2, Digest::kLength) < 0;
     }
@@ -215,6 +249,14 @@ struct MerkleRootTraits {
     }
 };
 
+// An entry in the index of blobs which have been fully written to disk.
+struct BlobIndexEntry : public fbl::WAVLTreeContainable<fbl::unique_ptr<BlobIndexEntry>> {
+    const uint8_t* GetKey() const { return &digest[0]; }
+
+    uint8_t digest[Digest::kLength];
+    size_t map_index;
+};
+
 class Blobstore : public fbl::RefCounted<Blobstore> {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Blobstore);
@@ -277,6 +319,13 @@ private:
     Blobstore(fbl::unique_fd fd, const blobstore_info_t* info);
     zx_status_t LoadBitmaps();
 
+    // Builds the in-memory node bitmap and blob index from the node map.
+    zx_status_t LoadNodeIndex();
+
+    // Adds or removes a blob from the index of blobs on disk.
+    zx_status_t IndexBlob(const uint8_t* digest, size_t map_index);
+    void UnindexBlob(const uint8_t* digest, size_t map_index);
+
     // Finds space for a block in memory. Does not update disk.
     zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
     void FreeBlocks(size_t nblocks, size_t blkno);
@@ -306,13 +355,23 @@ private:
                                             VnodeBlob::TypeWavlTraits>;
     WAVLTreeByMerkle hash_{}; // Map of all 'in use' blobs
 
+    // Blobs on disk, whether or not they are in use, so that blobs which are
+    // not open can be found without scanning the node map.
+    using BlobIndex = fbl::WAVLTree<const uint8_t*,
+                                    fbl::unique_ptr<BlobIndexEntry>,
+                                    MerkleRootTraits>;
+    BlobIndex index_{};
+
     fbl::unique_fd blockfd_;
     fifo_client_t* fifo_client_{};
     txnid_t txnid_{};
+    // Set if the device can be told which blocks no longer hold blobs.
+    bool trim_supported_{};
     RawBitmap block_map_{};
     vmoid_t block_map_vmoid_{};
     fbl::unique_ptr<MappedVmo> node_map_{};
     vmoid_t node_map_vmoid_{};
+    RawBitmap node_bitmap_{}; // In-memory only; set for each allocated node
     fbl::unique_ptr<MappedVmo> info_vmo_{};
     vmoid_t info_vmoid_{};
 };
@@ -40,6 +40,21 @@ int blobstore_mkfs(int fd, uint64_t block_count);
 
 uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode);
 
+// Compresses the |blob_size| bytes of |data| into |out|, using the chunked
+// layout described in format.h. On success, the number of bytes of |out|
+// used is returned in |out_len|.
+// Returns ZX_ERR_BUFFER_TOO_SMALL if the compressed blob would not fit in
+// |out_size| bytes, in which case the blob should be stored uncompressed.
+zx_status_t BlobCompress(const void* data, uint64_t blob_size, void* out, size_t out_size,
+                         size_t* out_len);
+
+// Decompresses the |chunk|th chunk of a compressed blob into its place
+// within |data|, which holds the uncompressed blob.
+// |compressed| holds the first |compressed_len| bytes of the blob's
+// compressed data, which must cover both the chunk table and the chunk.
+zx_status_t BlobDecompressChunk(const blobstore_inode_t& blobNode, const void* compressed,
+                                size_t compressed_len, uint64_t chunk, void* data);
+
 // Get a pointer to the nth block of the bitmap.
 inline void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n) {
     assert(n * kBlobstoreBlockSize < bm.size());                  // Accessing beyond end of bitmap
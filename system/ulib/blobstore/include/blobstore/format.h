@@ -23,7 +23,11 @@ namespace blobstore {
 
 constexpr uint64_t kBlobstoreMagic0  = (0xac2153479e694d21ULL);
 constexpr uint64_t kBlobstoreMagic1  = (0x985000d4d4d3d314ULL);
-constexpr uint32_t kBlobstoreVersion = 0x00000004;
+constexpr uint32_t kBlobstoreVersion = 0x00000005;
+// The last version without compressed blobs.  Its inodes never set any flags,
+// so it is still mounted; new blobs are left uncompressed, so older drivers
+// can still read it.
+constexpr uint32_t kBlobstoreVersionNoCompression = 0x00000004;
 
 constexpr uint32_t kBlobstoreFlagClean      = 1;
 constexpr uint32_t kBlobstoreFlagDirty      = 2;
@@ -103,6 +107,11 @@ constexpr uint64_t TotalBlocks(const blobstore_info_t& info) {
     return BlockMapStartBlock(info) + BlockMapBlocks(info) + NodeMapBlocks(info) + DataBlocks(info);
 }
 
+// Whether new blobs may be stored compressed
+constexpr bool CompressionSupported(const blobstore_info_t& info) {
+    return info.version == kBlobstoreVersion;
+}
+
 // States of 'Blob' identified via start block.
 constexpr uint64_t kStartBlockFree     = 0;
 constexpr uint64_t kStartBlockReserved = 1;
@@ -114,9 +123,12 @@ typedef struct {
     uint64_t start_block;
     uint64_t num_blocks;
     uint64_t blob_size;
-    uint64_t reserved;
+    uint64_t flags;
 } blobstore_inode_t;
 
+// Inode flags
+constexpr uint64_t kBlobstoreInodeFlagLZ4 = 1; // Blob data is stored LZ4 compressed
+
 static_assert(sizeof(blobstore_inode_t) == kBlobstoreInodeSize,
               "Blobstore Inode size is wrong");
 static_assert(kBlobstoreBlockSize % kBlobstoreInodeSize == 0,
@@ -127,4 +139,28 @@ constexpr uint64_t BlobDataBlocks(const blobstore_inode_t& blobNode) {
     return fbl::round_up(blobNode.blob_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+// Compressed blobs store their data as a table of chunk end offsets, followed
+// by the chunks themselves. Each chunk holds kBlobstoreCompressChunkSize bytes
+// of the blob (less for the final chunk), compressed independently of the
+// others so that any Merkle-aligned range of the blob can be decompressed
+// and verified without touching the rest of it.
+//
+// Entry n of the table is the end of chunk n, in bytes, relative to the end
+// of the table. The Merkle tree always covers the uncompressed data.
+constexpr uint64_t kBlobstoreCompressChunkSize = 16 * kBlobstoreBlockSize;
+
+static_assert(kBlobstoreCompressChunkSize % digest::MerkleTree::kNodeSize == 0,
+              "Compressed chunks must be aligned to Merkle tree nodes");
+
+// Number of compressed chunks making up the blob
+constexpr uint64_t BlobChunkCount(const blobstore_inode_t& blobNode) {
+    return fbl::round_up(blobNode.blob_size, kBlobstoreCompressChunkSize) /
+           kBlobstoreCompressChunkSize;
+}
+
+// Size of the chunk table at the start of a compressed blob's data
+constexpr uint64_t BlobChunkTableSize(const blobstore_inode_t& blobNode) {
+    return BlobChunkCount(blobNode) * sizeof(uint64_t);
+}
+
 } // namespace blobstore
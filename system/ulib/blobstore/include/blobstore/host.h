@@ -17,6 +17,7 @@
 #include <fbl/macros.h>
 #include <fbl/ref_counted.h>
 #include <fbl/ref_ptr.h>
+#include <fbl/string.h>
 #include <fbl/unique_fd.h>
 #include <fbl/unique_free_ptr.h>
 #include <fbl/vector.h>
@@ -80,11 +81,17 @@ public:
     // Allocate |nblocks| starting at |*blkno_out| in memory
     zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
 
-    zx_status_t WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data);
+    // Writes the Merkle tree followed by the |data_len| bytes of |data|, which is
+    // either the blob itself or its compressed form, depending on the inode's flags.
+    zx_status_t WriteData(blobstore_inode_t* inode, const void* merkle_data, const void* data,
+                          size_t data_len);
     zx_status_t WriteBitmap(size_t nblocks, size_t start_block);
     zx_status_t WriteNode(fbl::unique_ptr<InodeBlock> ino_block);
     zx_status_t WriteInfo();
 
+    // Whether new blobs may be stored compressed in this image
+    bool CompressionSupported() const { return blobstore::CompressionSupported(info_); }
+
 private:
     typedef struct {
         size_t bno;
@@ -136,8 +143,18 @@ private:
 zx_status_t blobstore_create(fbl::RefPtr<Blobstore>* out, fbl::unique_fd blockfd);
 
 // blobstore_add_blob may be called by multiple threads to gain concurrent
-// merkle tree generation. No other methods are thread safe.
-zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd);
+// merkle tree generation and compression. No other methods are thread safe.
+// If |compress| is set, the blob is stored compressed when that saves space
+// and the image's version allows it.
+zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd, bool compress);
+
+// Adds the files named by |paths| to |bs|.  The files are read, hashed, and
+// compressed (if |compress| is set) on |threads| worker threads, or one per CPU
+// if |threads| is 0.  Nodes and blocks are still allocated one blob at a time
+// in the order of |paths|, so the same inputs always produce the same image.
+// Files whose contents are already in |bs| are skipped.
+zx_status_t blobstore_add_blobs(Blobstore* bs, const fbl::Vector<fbl::String>& paths,
+                                bool compress, unsigned threads);
 zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
                            const fbl::Vector<size_t>& extent_lengths);
 
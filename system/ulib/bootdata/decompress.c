@@ -5,6 +5,8 @@
 #include <bootdata/decompress.h>
 
 #include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <zircon/boot/bootdata.h>
@@ -85,42 +87,96 @@ static zx_status_t check_lz4_frame(const lz4_frame_desc* fd,
     return ZX_OK;
 }
 
-static zx_status_t decompress_bootfs_vmo(zx_handle_t vmar, const uint8_t* data,
-                                         size_t _outsize, zx_handle_t* out,
-                                         const char** err) {
-    if (*(const uint32_t*)data != ZX_LZ4_MAGIC) {
-        *err = "bad magic number for compressed bootfs";
-        return ZX_ERR_INVALID_ARGS;
+// Finds the block index which mkbootfs appends to the LZ4 frame, if any.
+// On success, |frame_len| is updated to exclude the index.
+static bool find_lz4_index(const uint8_t* frame, size_t* frame_len,
+                           const bootdata_lz4_block_t** index, size_t* count) {
+    const size_t len = *frame_len;
+    if (len < 4 * sizeof(uint32_t)) {
+        return false;
     }
-    data += sizeof(uint32_t);
+    const uint32_t* trailer = (const uint32_t*)(frame + len - 2 * sizeof(uint32_t));
+    if (trailer[1] != BOOTDATA_LZ4_INDEX_MAGIC || trailer[0] == 0) {
+        return false;
+    }
+    size_t index_len = trailer[0] * sizeof(bootdata_lz4_block_t);
+    if (index_len > len - 4 * sizeof(uint32_t)) {
+        return false;
+    }
+    const uint32_t* hdr = (const uint32_t*)((const uint8_t*)trailer - index_len -
+                                            2 * sizeof(uint32_t));
+    if (hdr[0] != BOOTDATA_LZ4_INDEX_FRAME || hdr[1] != index_len + 2 * sizeof(uint32_t)) {
+        return false;
+    }
+    *index = (const bootdata_lz4_block_t*)(hdr + 2);
+    *count = trailer[0];
+    *frame_len = (const uint8_t*)hdr - frame;
+    return true;
+}
 
-    check_lz4_frame((const lz4_frame_desc*)data, _outsize, err);
-    data += sizeof(lz4_frame_desc);
+typedef struct {
+    const uint8_t* frame;
+    size_t frame_len;
+    const bootdata_lz4_block_t* index;
+    size_t count;
+    uint8_t* dst;
+    size_t outsize;
 
-    size_t outsize = (_outsize + 4095) & ~4095;
-    if (outsize < _outsize) {
-        // newsize wrapped, which means the outsize was too large
-        *err = "lz4 output size too large";
-        return ZX_ERR_NO_MEMORY;
+    atomic_bool failed;
+    const char* err;
+} lz4_job_t;
+
+// Decompresses the |n|th block of the frame described by |arg|.
+static void decompress_lz4_block(void* arg, size_t n) {
+    lz4_job_t* job = arg;
+    const bootdata_lz4_block_t* block = &job->index[n];
+    const size_t end = (n + 1 < job->count) ? job->index[n + 1].dst : job->outsize;
+    const char* err = NULL;
+
+    if ((block->dst >= end) || (end > job->outsize) ||
+        (block->src > job->frame_len - sizeof(uint32_t))) {
+        err = "bad lz4 block index for bootfs";
+    } else {
+        const uint8_t* src = job->frame + block->src;
+        uint32_t blocksize = *(const uint32_t*)src;
+        uint32_t actual = blocksize & 0x7fffffff;
+        size_t expected = end - block->dst;
+        src += sizeof(uint32_t);
+        if (actual > job->frame_len - block->src - sizeof(uint32_t)) {
+            err = "lz4 block extends past end of bootfs";
+        } else if (blocksize >> 31) {
+            // If the data is uncompressed, the high bit is 1.
+            if (actual != expected) {
+                err = "bootdata outsize does not match lz4 block index";
+            } else {
+                memcpy(job->dst + block->dst, src, actual);
+            }
+        } else {
+            int dcmp = LZ4_decompress_safe((const char*)src, (char*)job->dst + block->dst,
+                                           actual, expected);
+            if (dcmp < 0 || (size_t)dcmp != expected) {
+                err = "lz4 decompression failed";
+            }
+        }
     }
-    zx_handle_t dst_vmo;
-    zx_status_t status = zx_vmo_create((uint64_t)outsize, 0, &dst_vmo);
-    if (status < 0) {
-        *err = "zx_vmo_create failed for decompressing bootfs";
-        return status;
+
+    // Only the first error is reported.
+    if (err != NULL && !atomic_exchange(&job->failed, true)) {
+        job->err = err;
     }
-    zx_object_set_property(dst_vmo, ZX_PROP_NAME, "bootfs", 6);
+}
 
-    uintptr_t dst_addr = 0;
-    status = zx_vmar_map(vmar, 0, dst_vmo, 0, outsize,
-            ZX_VM_FLAG_PERM_READ|ZX_VM_FLAG_PERM_WRITE, &dst_addr);
-    if (status < 0) {
-        *err = "zx_vmar_map failed on bootfs vmo during decompression";
-        return status;
+static void for_each_serial(void (*fn)(void* arg, size_t n), void* arg, size_t count) {
+    for (size_t n = 0; n < count; n++) {
+        fn(arg, n);
     }
+}
 
+// Decompresses each block of the frame in turn, starting with the block
+// at |data|.
+static zx_status_t decompress_lz4_stream(const uint8_t* data, uint8_t* dst, size_t outsize,
+                                         const char** err) {
     size_t remaining = outsize;
-    uint8_t* dst = (uint8_t*)dst_addr;
 
     // Read each LZ4 block and decompress it. Block sizes are 32 bits.
     uint32_t blocksize = *(const uint32_t*)data;
@@ -166,18 +222,104 @@ static zx_status_t decompress_bootfs_vmo(zx_handle_t vmar, const uint8_t* data,
         return ZX_ERR_INVALID_ARGS;
     }
 
+    return ZX_OK;
+}
+
+static zx_status_t decompress_bootfs_vmo(zx_handle_t vmar, const uint8_t* data,
+                                         size_t length, size_t _outsize,
+                                         bootdata_for_each_t for_each,
+                                         zx_handle_t* out, const char** err) {
+    if (length < sizeof(uint32_t) + sizeof(lz4_frame_desc)) {
+        *err = "compressed bootfs too small";
+        return ZX_ERR_INVALID_ARGS;
+    }
+    const uint8_t* frame = data;
+    if (*(const uint32_t*)data != ZX_LZ4_MAGIC) {
+        *err = "bad magic number for compressed bootfs";
+        return ZX_ERR_INVALID_ARGS;
+    }
+    data += sizeof(uint32_t);
+
+    zx_status_t status = check_lz4_frame((const lz4_frame_desc*)data, _outsize, err);
+    if (status != ZX_OK) {
+        return status;
+    }
+    data += sizeof(lz4_frame_desc);
+
+    size_t outsize = (_outsize + 4095) & ~4095;
+    if (outsize < _outsize) {
+        // newsize wrapped, which means the outsize was too large
+        *err = "lz4 output size too large";
+        return ZX_ERR_NO_MEMORY;
+    }
+    zx_handle_t dst_vmo;
+    status = zx_vmo_create((uint64_t)outsize, 0, &dst_vmo);
+    if (status < 0) {
+        *err = "zx_vmo_create failed for decompressing bootfs";
+        return status;
+    }
+    zx_object_set_property(dst_vmo, ZX_PROP_NAME, "bootfs", 6);
+
+    uintptr_t dst_addr = 0;
+    status = zx_vmar_map(vmar, 0, dst_vmo, 0, outsize,
+            ZX_VM_FLAG_PERM_READ|ZX_VM_FLAG_PERM_WRITE, &dst_addr);
+    if (status < 0) {
+        *err = "zx_vmar_map failed on bootfs vmo during decompression";
+        zx_handle_close(dst_vmo);
+        return status;
+    }
+
+    // With an index, the blocks can be decompressed in any order.
+    lz4_job_t job = {
+        .frame = frame,
+        .frame_len = length,
+        .dst = (uint8_t*)dst_addr,
+        .outsize = _outsize,
+        .failed = ATOMIC_VAR_INIT(false),
+    };
+    if (find_lz4_index(frame, &job.frame_len, &job.index, &job.count)) {
+        if (job.index[0].dst != 0) {
+            *err = "bad lz4 block index for bootfs";
+            status = ZX_ERR_INVALID_ARGS;
+            goto fail;
+        }
+        (for_each ? for_each : for_each_serial)(decompress_lz4_block, &job, job.count);
+        if (atomic_load(&job.failed)) {
+            *err = job.err;
+            status = ZX_ERR_BAD_STATE;
+            goto fail;
+        }
+    } else if ((status = decompress_lz4_stream(data, (uint8_t*)dst_addr, outsize,
+                                               err)) != ZX_OK) {
+        goto fail;
+    }
+
     status = zx_vmar_unmap(vmar, dst_addr, outsize);
     if (status < 0) {
         *err = "zx_vmar_unmap after decompress failed";
+        zx_handle_close(dst_vmo);
         return status;
     }
     *out = dst_vmo;
     return ZX_OK;
+
+fail:
+    // Don't leave the half-written image behind, mapped or otherwise.
+    zx_vmar_unmap(vmar, dst_addr, outsize);
+    zx_handle_close(dst_vmo);
+    return status;
 }
 
 zx_status_t decompress_bootdata(zx_handle_t vmar, zx_handle_t vmo,
                                 size_t offset, size_t length,
                                 zx_handle_t* out, const char** err) {
+    return decompress_bootdata_parallel(vmar, vmo, offset, length, NULL, out, err);
+}
+
+zx_status_t decompress_bootdata_parallel(zx_handle_t vmar, zx_handle_t vmo,
+                                         size_t offset, size_t length,
+                                         bootdata_for_each_t for_each,
+                                         zx_handle_t* out, const char** err) {
     *err = "none";
 
     if (length > SIZE_MAX) {
@@ -198,13 +340,16 @@ zx_status_t decompress_bootdata(zx_handle_t vmar, zx_handle_t vmo,
 
     const bootdata_t* hdr = (bootdata_t*)bootdata_addr;
     bootdata_addr += sizeof(bootdata_t);
+    bool decompressed = false;
 
     switch (hdr->type) {
     case BOOTDATA_BOOTFS_BOOT:
     case BOOTDATA_BOOTFS_SYSTEM:
     case BOOTDATA_RAMDISK:
         if (hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED) {
-            status = decompress_bootfs_vmo(vmar, (const uint8_t*)bootdata_addr, hdr->extra, out, err);
+            status = decompress_bootfs_vmo(vmar, (const uint8_t*)bootdata_addr, hdr->length,
+                                           hdr->extra, for_each, out, err);
+            decompressed = (status == ZX_OK);
         }
         break;
     default:
@@ -216,6 +361,9 @@ zx_status_t decompress_bootdata(zx_handle_t vmar, zx_handle_t vmo,
     zx_status_t s = zx_vmar_unmap(vmar, addr, length);
     if (s < 0) {
         *err = "zx_vmar_unmap failed on bootfs vmo";
+        if (decompressed) {
+            zx_handle_close(*out);
+        }
         return s;
     }
 
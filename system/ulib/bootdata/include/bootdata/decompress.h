@@ -16,4 +16,17 @@ zx_status_t decompress_bootdata(zx_handle_t vmar, zx_handle_t vmo,
                                 size_t offset, size_t length,
                                 zx_handle_t* out, const char** errmsg);
 
+// Calls fn(arg, n) once for each n in [0, count), in any order and possibly
+// concurrently, returning once all of the calls have completed.
+typedef void (*bootdata_for_each_t)(void (*fn)(void* arg, size_t n), void* arg,
+                                    size_t count);
+
+// Like decompress_bootdata, but if the compressed bootdata carries an index
+// of its blocks, they are decompressed using for_each, which may spread
+// the work across threads.
+zx_status_t decompress_bootdata_parallel(zx_handle_t vmar, zx_handle_t vmo,
+                                         size_t offset, size_t length,
+                                         bootdata_for_each_t for_each,
+                                         zx_handle_t* out, const char** errmsg);
+
 #pragma GCC visibility pop
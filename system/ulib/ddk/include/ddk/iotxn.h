@@ -38,6 +38,14 @@ typedef struct iotxn iotxn_t;
 // opcodes
 #define IOTXN_OP_READ      1
 #define IOTXN_OP_WRITE     2
+// Makes every write that completed before this txn started durable.
+// offset and length are ignored.  Usually queued with IOTXN_SYNC_BEFORE so
+// that it covers everything queued ahead of it.
+#define IOTXN_OP_FLUSH     3
+// Tells the device that the data in [offset, offset + length) is no longer
+// needed.  Reads from the range afterwards may return anything.  The txn has
+// no data buffer: length describes the device range only.
+#define IOTXN_OP_TRIM      4
 
 // cache maintenance ops
 #define IOTXN_CACHE_INVALIDATE        ZX_VMO_OP_CACHE_INVALIDATE
@@ -67,6 +67,21 @@ public:
                               const void* tree, size_t tree_len, size_t offset,
                               size_t length, const Digest& digest);
 
+    // Together, these two methods split |Create| so that the bottom level of
+    // the tree, which is nearly all of the work, can be spread across several
+    // threads.  |CreateLeafDigests| writes the digests of the data nodes
+    // between |offset| and |offset + length| into |tree|.  |offset| must be
+    // node-aligned, and |offset + length| must be node-aligned or equal to
+    // |data_len|.  Once every data node's digest has been written, calling
+    // |CreateFromLeafDigests| fills in the rest of the tree and saves its root
+    // digest.  The result is identical to calling |Create|.  Both require
+    // |data_len| to be more than |kNodeSize|; smaller data has no tree.
+    static zx_status_t CreateLeafDigests(const void* data, size_t data_len,
+                                         size_t offset, size_t length,
+                                         void* tree, size_t tree_len);
+    static zx_status_t CreateFromLeafDigests(size_t data_len, void* tree,
+                                             size_t tree_len, Digest* digest);
+
     // The stateful instance methods below are only needed when creating a
     // Merkle tree using the Init/Update/Final methods.
     MerkleTree();
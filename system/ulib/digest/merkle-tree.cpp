@@ -14,6 +14,8 @@
 #include <zircon/assert.h>
 #include <zircon/errors.h>
 
+#include "sha256-mb.h"
+
 namespace digest {
 
 // Size of a node in bytes.  Defined in tree.h.
@@ -75,6 +77,42 @@ void DigestFinal(Digest* digest, size_t offset) {
     digest->Final();
 }
 
+// The bytes hashed ahead of a node's data: its locality and its length.
+constexpr size_t kNodePrefixLen = sizeof(uint64_t) + sizeof(uint32_t);
+
+// Returns how many whole nodes starting at |offset| should be hashed together
+// with |DigestNodes|, or 0 if they should be hashed one at a time.  |length|
+// is the amount of data available from |offset|.
+size_t NodesToBatch(size_t offset, size_t length) {
+    size_t lanes = internal::HashLanes();
+    if (offset % MerkleTree::kNodeSize != 0 || lanes < 2) {
+        return 0;
+    }
+    size_t nodes = fbl::min(length / MerkleTree::kNodeSize, lanes);
+    return (nodes < 2 ? 0 : nodes);
+}
+
+// Hashes |count| whole nodes from |in|, the first of which is at |offset| in
+// |level|, and writes their digests consecutively to |out|.  This produces the
+// same digests as DigestInit, DigestUpdate, and DigestFinal would, but uses
+// multi-buffer SHA-256 to hash the nodes side by side.
+void DigestNodes(const uint8_t* in, size_t count, size_t offset, uint64_t level, uint8_t* out) {
+    ZX_DEBUG_ASSERT(count <= internal::kMaxHashLanes);
+    uint8_t prefixes[internal::kMaxHashLanes][kNodePrefixLen];
+    internal::HashInput nodes[internal::kMaxHashLanes];
+    uint32_t len32 = static_cast<uint32_t>(MerkleTree::kNodeSize);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t locality = (offset + i * MerkleTree::kNodeSize) | level;
+        memcpy(prefixes[i], &locality, sizeof(locality));
+        memcpy(prefixes[i] + sizeof(locality), &len32, sizeof(len32));
+        nodes[i].head = prefixes[i];
+        nodes[i].head_len = kNodePrefixLen;
+        nodes[i].body = in + i * MerkleTree::kNodeSize;
+        nodes[i].body_len = MerkleTree::kNodeSize;
+    }
+    internal::MultiHash(nodes, count, out);
+}
+
 ////////
 // Helper functions for working between levels of the tree.
 
@@ -170,6 +208,23 @@ zx_status_t MerkleTree::CreateUpdate(const void* data, size_t length, void* tree
     // Consume the data.
     zx_status_t rc = ZX_OK;
     while (length > 0 && rc == ZX_OK) {
+        // Hash runs of whole nodes several at a time if the CPU allows it.
+        size_t nodes = NodesToBatch(offset_, length);
+        if (nodes != 0) {
+            for (size_t i = 0; i < nodes; ++i) {
+                if ((tree_off + i * Digest::kLength) % kNodeSize == 0) {
+                    memset(out + i * Digest::kLength, 0, kNodeSize);
+                }
+            }
+            DigestNodes(in, nodes, offset_, level_, out);
+            rc = next_->CreateUpdate(out, nodes * Digest::kLength, next);
+            in += nodes * kNodeSize;
+            offset_ += nodes * kNodeSize;
+            length -= nodes * kNodeSize;
+            out += nodes * Digest::kLength;
+            tree_off += nodes * Digest::kLength;
+            continue;
+        }
         // Check if this is the start of a node.
         if (offset_ % kNodeSize == 0 &&
             (rc = DigestInit(&digest_, offset_ | level_, length_ - offset_)) != ZX_OK) {
@@ -241,6 +296,81 @@ zx_status_t MerkleTree::CreateFinalInternal(const void* data, void* tree, Digest
     return next_->CreateFinalInternal(tree, next, root);
 }
 
+zx_status_t MerkleTree::CreateLeafDigests(const void* data, size_t data_len, size_t offset,
+                                          size_t length, void* tree, size_t tree_len) {
+    zx_status_t rc;
+    ZX_DEBUG_ASSERT(offset + length >= offset);
+    // Must have more than one node of data and somewhere to put the digests.
+    if (!data || data_len <= kNodeSize || !tree) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    if (tree_len < NextAligned(data_len)) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    // Must not overrun expected length.
+    if (offset + length > data_len) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    // Must cover whole nodes.
+    if (offset % kNodeSize != 0 || ((offset + length) % kNodeSize != 0 &&
+                                    offset + length != data_len)) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    const uint8_t* in = static_cast<const uint8_t*>(data) + offset;
+    uint8_t* out = static_cast<uint8_t*>(tree) + (offset / kDigestsPerNode);
+    Digest digest;
+    while (length > 0) {
+        size_t nodes = NodesToBatch(offset, length);
+        if (nodes != 0) {
+            DigestNodes(in, nodes, offset, 0, out);
+            in += nodes * kNodeSize;
+            offset += nodes * kNodeSize;
+            length -= nodes * kNodeSize;
+            out += nodes * Digest::kLength;
+            continue;
+        }
+        if ((rc = DigestInit(&digest, offset, data_len - offset)) != ZX_OK) {
+            return rc;
+        }
+        size_t chunk = DigestUpdate(&digest, in, offset, length);
+        in += chunk;
+        offset += chunk;
+        length -= chunk;
+        DigestFinal(&digest, offset);
+        if ((rc = digest.CopyTo(out, Digest::kLength)) != ZX_OK) {
+            return rc;
+        }
+        out += Digest::kLength;
+    }
+    return ZX_OK;
+}
+
+zx_status_t MerkleTree::CreateFromLeafDigests(size_t data_len, void* tree, size_t tree_len,
+                                              Digest* root) {
+    zx_status_t rc;
+    if (data_len <= kNodeSize || !tree || !root) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    size_t next_len = NextAligned(data_len);
+    if (tree_len < next_len) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    // The leaf digests are the data of the next level up, which is padded
+    // with zeros to a whole node.
+    uint8_t* digests = static_cast<uint8_t*>(tree);
+    size_t digests_len = NextLength(data_len);
+    memset(digests + digests_len, 0, next_len - digests_len);
+    uint8_t* next = digests + next_len;
+    MerkleTree mt;
+    mt.level_ = 1;
+    if ((rc = mt.CreateInit(next_len, tree_len - next_len)) != ZX_OK ||
+        (rc = mt.CreateUpdate(digests, next_len, next)) != ZX_OK ||
+        (rc = mt.CreateFinal(next, root)) != ZX_OK) {
+        return rc;
+    }
+    return ZX_OK;
+}
+
 ////////
 // Verification methods
 
@@ -263,8 +393,12 @@ zx_status_t MerkleTree::Verify(const void* data, size_t data_len, const void* tr
             return ZX_ERR_BUFFER_TOO_SMALL;
         }
         tree_len -= data_len;
+        // Widen the range to whole nodes before scaling it, so the digests
+        // covering a partial range are checked at every level.
+        size_t finish = fbl::round_up(offset + length, kNodeSize);
+        offset -= offset % kNodeSize;
+        length = (finish - offset) / kDigestsPerNode;
         offset /= kDigestsPerNode;
-        length /= kDigestsPerNode;
         ++level;
     }
     return VerifyRoot(data, root_len, level, root);
@@ -310,6 +444,19 @@ zx_status_t MerkleTree::VerifyLevel(const void* data, size_t data_len, const voi
     const uint8_t* expected = static_cast<const uint8_t*>(tree) + (offset / kDigestsPerNode);
     // Check the data of this level against the digests.
     while (length > 0) {
+        size_t nodes = NodesToBatch(offset, length);
+        if (nodes != 0) {
+            uint8_t actuals[internal::kMaxHashLanes * Digest::kLength];
+            DigestNodes(in, nodes, offset, level, actuals);
+            if (memcmp(actuals, expected, nodes * Digest::kLength) != 0) {
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            in += nodes * kNodeSize;
+            offset += nodes * kNodeSize;
+            length -= nodes * kNodeSize;
+            expected += nodes * Digest::kLength;
+            continue;
+        }
         if ((rc = DigestInit(&actual, offset | level, data_len - offset)) != ZX_OK) {
             return rc;
         }
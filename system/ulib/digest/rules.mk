@@ -10,7 +10,8 @@ MODULE_TYPE := userlib
 
 MODULE_SRCS += \
     $(LOCAL_DIR)/digest.cpp \
-    $(LOCAL_DIR)/merkle-tree.cpp
+    $(LOCAL_DIR)/merkle-tree.cpp \
+    $(LOCAL_DIR)/sha256-mb.cpp
 
 MODULE_SO_NAME := digest
 MODULE_LIBS := system/ulib/c
@@ -33,7 +34,8 @@ MODULE_COMPILEFLAGS := \
 
 MODULE_SRCS += \
     $(LOCAL_DIR)/digest.cpp \
-    $(LOCAL_DIR)/merkle-tree.cpp
+    $(LOCAL_DIR)/merkle-tree.cpp \
+    $(LOCAL_DIR)/sha256-mb.cpp
 
 MODULE_HOST_LIBS := \
     third_party/ulib/uboringssl.hostlib \
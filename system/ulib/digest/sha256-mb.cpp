@@ -0,0 +1,256 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sha256-mb.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include <fbl/algorithm.h>
+#include <zircon/assert.h>
+
+// The vector code below is written with the compiler's generic vector
+// extensions, which turn into AVX2 on x86-64 and NEON on arm64.  The
+// helpers are macros rather than functions so that no vector type is ever
+// passed by value across a function boundary; doing that with a 256 bit vector
+// outside of an AVX2 function changes the calling convention.
+
+namespace digest {
+namespace internal {
+namespace {
+
+typedef uint32_t Vec4 __attribute__((vector_size(16)));
+typedef uint32_t Vec8 __attribute__((vector_size(32)));
+
+constexpr size_t kBlockSize = 64;
+constexpr size_t kDigestLen = 32;
+
+const uint32_t kInitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define BSIG0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SPLAT(v, val)                                                          \
+    for (size_t lane_ = 0; lane_ < sizeof(v) / sizeof(uint32_t); ++lane_) {    \
+        (v)[lane_] = (val);                                                    \
+    }
+
+uint32_t LoadBE32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+void StoreBE32(uint8_t* p, uint32_t val) {
+    p[0] = static_cast<uint8_t>(val >> 24);
+    p[1] = static_cast<uint8_t>(val >> 16);
+    p[2] = static_cast<uint8_t>(val >> 8);
+    p[3] = static_cast<uint8_t>(val);
+}
+
+// Returns the block of |in| that starts at |off| once the message has been
+// padded out to |padded_len| bytes.  Blocks wholly within the body are
+// returned in place; anything else is assembled in |scratch|.
+const uint8_t* GetBlock(const HashInput& in, size_t off, size_t padded_len,
+                        uint8_t* scratch) {
+    size_t len = in.head_len + in.body_len;
+    if (off >= in.head_len && off + kBlockSize <= len) {
+        return static_cast<const uint8_t*>(in.body) + (off - in.head_len);
+    }
+    const uint8_t* head = static_cast<const uint8_t*>(in.head);
+    const uint8_t* body = static_cast<const uint8_t*>(in.body);
+    uint64_t bits = static_cast<uint64_t>(len) * 8;
+    for (size_t i = 0; i < kBlockSize; ++i) {
+        size_t pos = off + i;
+        if (pos < in.head_len) {
+            scratch[i] = head[pos];
+        } else if (pos < len) {
+            scratch[i] = body[pos - in.head_len];
+        } else if (pos == len) {
+            scratch[i] = 0x80;
+        } else if (pos >= padded_len - sizeof(bits)) {
+            scratch[i] = static_cast<uint8_t>(bits >> (8 * (padded_len - 1 - pos)));
+        } else {
+            scratch[i] = 0;
+        }
+    }
+    return scratch;
+}
+
+// Hashes |count| messages with one lane of |V| each.  Unused lanes repeat the
+// first message and their results are dropped.
+template <typename V>
+__attribute__((always_inline)) inline void HashLanesOf(const HashInput* in, size_t count,
+                                                       uint8_t* out) {
+    constexpr size_t kLanes = sizeof(V) / sizeof(uint32_t);
+    ZX_DEBUG_ASSERT(count > 0 && count <= kLanes);
+    size_t len = in[0].head_len + in[0].body_len;
+    size_t padded_len = fbl::round_up(len + 1 + sizeof(uint64_t), kBlockSize);
+
+    V state[8];
+    for (size_t i = 0; i < 8; ++i) {
+        SPLAT(state[i], kInitialState[i]);
+    }
+    uint8_t scratch[kLanes][kBlockSize];
+    for (size_t off = 0; off < padded_len; off += kBlockSize) {
+        // Transpose the block so that each vector holds the same word from
+        // every message.
+        V w[16];
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            const HashInput& msg = in[lane < count ? lane : 0];
+            ZX_DEBUG_ASSERT(msg.head_len + msg.body_len == len);
+            const uint8_t* block = GetBlock(msg, off, padded_len, scratch[lane]);
+            for (size_t t = 0; t < 16; ++t) {
+                w[t][lane] = LoadBE32(block + 4 * t);
+            }
+        }
+        V a = state[0], b = state[1], c = state[2], d = state[3];
+        V e = state[4], f = state[5], g = state[6], h = state[7];
+        for (size_t t = 0; t < 64; ++t) {
+            if (t >= 16) {
+                w[t & 15] += SSIG1(w[(t - 2) & 15]) + w[(t - 7) & 15] + SSIG0(w[(t - 15) & 15]);
+            }
+            V k;
+            SPLAT(k, kRoundConstants[t]);
+            V t1 = h + BSIG1(e) + CH(e, f, g) + k + w[t & 15];
+            V t2 = BSIG0(a) + MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+    for (size_t lane = 0; lane < count; ++lane) {
+        for (size_t i = 0; i < 8; ++i) {
+            StoreBE32(out + lane * kDigestLen + i * sizeof(uint32_t), state[i][lane]);
+        }
+    }
+}
+
+void MultiHash4(const HashInput* in, size_t count, uint8_t* out) {
+    HashLanesOf<Vec4>(in, count, out);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) void MultiHash8(const HashInput* in, size_t count,
+                                                 uint8_t* out) {
+    HashLanesOf<Vec8>(in, count, out);
+}
+
+// AVX2 needs both the CPU's support and the kernel's, which shows up as the
+// AVX state being enabled in XCR0.
+bool HasAvx2() {
+    uint32_t a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return false;
+    }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & bit_AVX2) != 0;
+}
+
+// The SHA extensions (CPUID.7.0:EBX bit 29) hash a single stream in hardware.
+bool HasShaNi() {
+    uint32_t a, b, c, d;
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1u << 29)) != 0;
+}
+
+#endif // __x86_64__
+
+typedef void (*MultiHashFn)(const HashInput* in, size_t count, uint8_t* out);
+
+struct Backend {
+    size_t lanes;
+    MultiHashFn fn;
+};
+
+Backend SelectBackend() {
+#if defined(__x86_64__)
+    // Eight lanes of AVX2 only win against a scalar SHA-256; BoringSSL's
+    // assembly is expected to beat them on CPUs with the SHA extensions,
+    // once it is built to use them.
+    if (HasAvx2() && !HasShaNi()) {
+        return {8, MultiHash8};
+    }
+    // SSE2 has no vector rotate, and four lanes of it end up no faster than
+    // BoringSSL's single stream assembly.
+    return {1, MultiHash4};
+#elif defined(__aarch64__)
+    return {4, MultiHash4};
+#else
+    // Without a vector unit the lanes are computed one after another, which
+    // is no faster than hashing the messages separately.
+    return {1, MultiHash4};
+#endif
+}
+
+// Chosen once, when the library is loaded.
+const Backend gBackend = SelectBackend();
+
+} // namespace
+
+size_t HashLanes() {
+    return gBackend.lanes;
+}
+
+void MultiHash(const HashInput* in, size_t count, uint8_t* out) {
+    ZX_DEBUG_ASSERT(count <= kMaxHashLanes);
+    // A single lane backend still hashes four messages per call.
+    size_t lanes = fbl::max(gBackend.lanes, static_cast<size_t>(4));
+    while (count > 0) {
+        size_t n = fbl::min(count, lanes);
+        gBackend.fn(in, n, out);
+        in += n;
+        out += n * kDigestLen;
+        count -= n;
+    }
+}
+
+} // namespace internal
+} // namespace digest
@@ -0,0 +1,42 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace digest {
+namespace internal {
+
+// Multi-buffer SHA-256.  A single SHA-256 stream is a long chain of dependent
+// rounds, so it can't make use of vector units.  Independent messages of the
+// same length can, however, be hashed side by side with one message per SIMD
+// lane.  The Merkle tree has lots of those: every full node in a level is
+// hashed as a 12 byte prefix followed by |kNodeSize| bytes of data.
+
+// The most messages that |MultiHash| will hash at once.
+constexpr size_t kMaxHashLanes = 8;
+
+// A message to be hashed, made up of a |head| followed by a |body|.
+struct HashInput {
+    const void* head;
+    size_t head_len;
+    const void* body;
+    size_t body_len;
+};
+
+// Returns the number of lanes the best implementation for this CPU hashes at
+// once.  A value of 1 means there is no benefit to batching messages, and
+// callers should just use Digest.
+size_t HashLanes();
+
+// Computes the SHA-256 digests of |count| messages from |in|, and writes them
+// consecutively to |out|, which must have room for |count * 32| bytes.
+// |count| must be no more than |kMaxHashLanes|, and all of the messages must
+// have the same total length.
+void MultiHash(const HashInput* in, size_t count, uint8_t* out);
+
+} // namespace internal
+} // namespace digest
@@ -0,0 +1,704 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <zircon/assert.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/intrusive_container_utils.h>
+#include <fbl/intrusive_pointer_traits.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/macros.h>
+#include <fbl/type_support.h>
+
+namespace fbl {
+
+// Fwd decl of sanity checker class used by tests.
+namespace tests {
+namespace intrusive_containers {
+class ResizingHashTableChecker;
+}  // namespace tests
+}  // namespace intrusive_containers
+
+// DefaultResizingHashTraits defines a default implementation of the traits
+// used to define the hash function for a ResizingHashTable.
+//
+// Unlike the hash traits of a HashTable, the GetHash method of a
+// ResizingHashTable's hash traits returns the full hashed value of the key
+// rather than a bucket index, since the number of buckets changes as the
+// table grows.  The table mixes the hash before using it, so cheap hash
+// functions such as returning an aligned address or a small integer key as
+// is work fine.
+//
+// DefaultResizingHashTraits simply calls a static method of ObjType named
+// GetHash which takes a const reference to a KeyType and returns a HashType.
+template <typename KeyType,
+          typename ObjType,
+          typename HashType>
+struct DefaultResizingHashTraits {
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+    static HashType GetHash(const KeyType& key) {
+        return static_cast<HashType>(ObjType::GetHash(key));
+    }
+};
+
+// ResizingHashTable
+//
+// An intrusive hash table with the same API as HashTable, but which grows its
+// bucket array as elements are added so that chains stay short no matter how
+// many elements it holds.
+//
+// The first kMinBuckets buckets are stored inline, so a ResizingHashTable
+// never needs to allocate memory to insert an element.  Once the table holds
+// as many elements as it has buckets, it tries to allocate a bucket array
+// twice the size.  If that fails, the table keeps working with the buckets it
+// has and tries again once it holds twice as many elements.
+//
+// Growing does not move every element at once.  Each insert operation moves
+// the contents of a couple of the old buckets to the new array, which finishes
+// well before the table needs to grow again, so no single insert pays for
+// rehashing the whole table.  Lookups and erases check whichever array holds
+// the key's bucket, and never move elements.
+//
+// Like any other container, a ResizingHashTable's iterators may be used to
+// erase elements while iterating, but inserting elements invalidates all of
+// its iterators.  clear() shrinks the table back to its inline buckets.
+template <typename  _KeyType,
+          typename  _PtrType,
+          typename  _BucketType = SinglyLinkedList<_PtrType>,
+          typename  _HashType   = size_t,
+          typename  _KeyTraits  = DefaultKeyedObjectTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType>,
+          typename  _HashTraits = DefaultResizingHashTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType,
+                                    _HashType>>
+class ResizingHashTable {
+private:
+    // Private fwd decls of the iterator implementation.
+    template <typename IterTraits> class iterator_impl;
+    struct iterator_traits;
+    struct const_iterator_traits;
+
+public:
+    // Pointer types/traits
+    using PtrType      = _PtrType;
+    using PtrTraits    = internal::ContainerPtrTraits<PtrType>;
+    using ValueType    = typename PtrTraits::ValueType;
+
+    // Key types/traits
+    using KeyType      = _KeyType;
+    using KeyTraits    = _KeyTraits;
+
+    // Hash types/traits
+    using HashType     = _HashType;
+    using HashTraits   = _HashTraits;
+
+    // Bucket types/traits
+    using BucketType   = _BucketType;
+    using NodeTraits   = typename BucketType::NodeTraits;
+
+    // Declarations of the standard iterator types.
+    using iterator       = iterator_impl<iterator_traits>;
+    using const_iterator = iterator_impl<const_iterator_traits>;
+
+    // An alias for the type of this specific ResizingHashTable<...> and its
+    // test sanity checker.
+    using ContainerType = ResizingHashTable<_KeyType, _PtrType, _BucketType, _HashType,
+                                            _KeyTraits, _HashTraits>;
+    using CheckerType   = ::fbl::tests::intrusive_containers::ResizingHashTableChecker;
+
+    // The number of buckets stored inline, and the smallest the table gets.
+    static constexpr size_t kMinBuckets = 16;
+
+    // Hash tables only support constant order erase if their underlying bucket
+    // type does.
+    static constexpr bool SupportsConstantOrderErase = BucketType::SupportsConstantOrderErase;
+    static constexpr bool SupportsConstantOrderSize = true;
+    static constexpr bool IsAssociative = true;
+    static constexpr bool IsSequenced = false;
+
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+
+    ResizingHashTable() {}
+    ~ResizingHashTable() {
+        ZX_DEBUG_ASSERT(PtrTraits::IsManaged || is_empty());
+        clear();
+    }
+
+    // Standard begin/end, cbegin/cend iterator accessors.
+    iterator begin()              { return       iterator(this,       iterator::BEGIN); }
+    const_iterator begin()  const { return const_iterator(this, const_iterator::BEGIN); }
+    const_iterator cbegin() const { return const_iterator(this, const_iterator::BEGIN); }
+
+    iterator end()              { return       iterator(this,       iterator::END); }
+    const_iterator end()  const { return const_iterator(this, const_iterator::END); }
+    const_iterator cend() const { return const_iterator(this, const_iterator::END); }
+
+    // make_iterator : construct an iterator out of a reference to an object.
+    iterator make_iterator(ValueType& obj) {
+        size_t ndx = Locate(KeyTraits::GetKey(obj));
+        return iterator(this, ndx, GetBucket(ndx).make_iterator(obj));
+    }
+
+    void insert(const PtrType& ptr) { insert(PtrType(ptr)); }
+    void insert(PtrType&& ptr) {
+        ZX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key = KeyTraits::GetKey(*ptr);
+        BucketType& bucket = GetBucket(Locate(key));
+
+        // Duplicate keys are disallowed.  Debug assert if someone tries to to
+        // insert an element with a duplicate key.  If the user thought that
+        // there might be a duplicate key in the ResizingHashTable already,
+        // he/she should have used insert_or_find() instead.
+        ZX_DEBUG_ASSERT(FindInBucket(bucket, key).IsValid() == false);
+
+        bucket.push_front(fbl::move(ptr));
+        ++count_;
+    }
+
+    // insert_or_find
+    //
+    // Insert the element pointed to by ptr if it is not already in the
+    // ResizingHashTable, or find the element that the ptr collided with
+    // instead.
+    //
+    // 'iter' is an optional out parameter pointer to an iterator which
+    // will reference either the newly inserted item, or the item whose key
+    // collided with ptr.
+    //
+    // insert_or_find returns true if there was no collision and the item was
+    // successfully inserted, otherwise it returns false.
+    //
+    bool insert_or_find(const PtrType& ptr, iterator* iter = nullptr) {
+        return insert_or_find(PtrType(ptr), iter);
+    }
+
+    bool insert_or_find(PtrType&& ptr, iterator* iter = nullptr) {
+        ZX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key         = KeyTraits::GetKey(*ptr);
+        size_t  ndx         = Locate(key);
+        auto&   bucket      = GetBucket(ndx);
+        auto    bucket_iter = FindInBucket(bucket, key);
+
+        if (bucket_iter.IsValid()) {
+            if (iter) *iter = iterator(this, ndx, bucket_iter);
+            return false;
+        }
+
+        bucket.push_front(fbl::move(ptr));
+        ++count_;
+        if (iter) *iter = iterator(this, ndx, bucket.begin());
+        return true;
+    }
+
+    // insert_or_replace
+    //
+    // Find the element in the hashtable with the same key as *ptr and replace
+    // it with ptr, then return the pointer to the element which was replaced.
+    // If no element in the hashtable shares a key with *ptr, simply add ptr to
+    // the hashtable and return nullptr.
+    //
+    PtrType insert_or_replace(const PtrType& ptr) {
+        return insert_or_replace(PtrType(ptr));
+    }
+
+    PtrType insert_or_replace(PtrType&& ptr) {
+        ZX_DEBUG_ASSERT(ptr != nullptr);
+        PrepareForInsert();
+
+        KeyType key    = KeyTraits::GetKey(*ptr);
+        auto&   bucket = GetBucket(Locate(key));
+        auto    orig   = PtrTraits::GetRaw(ptr);
+
+        PtrType replaced = bucket.replace_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            },
+            fbl::move(ptr));
+
+        if (orig == PtrTraits::GetRaw(replaced)) {
+            bucket.push_front(PtrTraits::Take(replaced));
+            count_++;
+        }
+
+        return fbl::move(replaced);
+    }
+
+    iterator find(const KeyType& key) {
+        size_t ndx         = Locate(key);
+        auto   bucket_iter = FindInBucket(GetBucket(ndx), key);
+
+        return bucket_iter.IsValid() ? iterator(this, ndx, bucket_iter)
+                                     : iterator(this, iterator::END);
+    }
+
+    const_iterator find(const KeyType& key) const {
+        size_t      ndx         = Locate(key);
+        const auto& bucket      = GetBucket(ndx);
+        auto        bucket_iter = FindInBucket(bucket, key);
+
+        return bucket_iter.IsValid() ? const_iterator(this, ndx, bucket_iter)
+                                     : const_iterator(this, const_iterator::END);
+    }
+
+    PtrType erase(const KeyType& key) {
+        BucketType& bucket = GetBucket(Locate(key));
+
+        PtrType ret = internal::KeyEraseUtils<BucketType, KeyTraits>::erase(bucket, key);
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    PtrType erase(const iterator& iter) {
+        if (!iter.IsValid())
+            return PtrType(nullptr);
+
+        return direct_erase(GetBucket(iter.bucket_ndx_), *iter);
+    }
+
+    PtrType erase(ValueType& obj) {
+        return direct_erase(GetBucket(Locate(KeyTraits::GetKey(obj))), obj);
+    }
+
+    // clear
+    //
+    // Clear out the all of the hashtable buckets and shrink back down to the
+    // inline buckets.  For managed pointer types, this will release all
+    // references held by the hashtable to the objects which were in it.
+    void clear() {
+        for (size_t i = 0; i < total_buckets(); ++i)
+            GetBucket(i).clear();
+        ResetBuckets();
+    }
+
+    // clear_unsafe
+    //
+    // Perform a clear_unsafe on all buckets and reset the internal count to
+    // zero.  See comments in fbl/intrusive_single_list.h
+    // Think carefully before calling this!
+    void clear_unsafe() {
+        static_assert(PtrTraits::IsManaged == false,
+                     "clear_unsafe is not allowed for containers of managed pointers");
+
+        for (size_t i = 0; i < total_buckets(); ++i)
+            GetBucket(i).clear_unsafe();
+        ResetBuckets();
+    }
+
+    size_t size()      const { return count_; }
+    bool   is_empty()  const { return count_ == 0; }
+
+    // The number of buckets elements are being hashed into.  While the table is
+    // growing, this is the size of the new bucket array.
+    size_t bucket_count() const { return static_cast<size_t>(1) << bucket_shift_; }
+
+    // erase_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and erase it from the list, returning a referenced pointer
+    // to the removed element.  Return nullptr if no member satisfies the
+    // predicate.
+    template <typename UnaryFn>
+    PtrType erase_if(UnaryFn fn) {
+        if (is_empty())
+            return PtrType(nullptr);
+
+        for (size_t i = 0; i < total_buckets(); ++i) {
+            auto& bucket = GetBucket(i);
+            if (!bucket.is_empty()) {
+                PtrType ret = bucket.erase_if(fn);
+                if (ret != nullptr) {
+                    --count_;
+                    return ret;
+                }
+            }
+        }
+
+        return PtrType(nullptr);
+    }
+
+    // find_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and return an iterator to it.  Return end() if no member
+    // satisfies the predicate.
+    template <typename UnaryFn>
+    const_iterator find_if(UnaryFn fn) const {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+    template <typename UnaryFn>
+    iterator find_if(UnaryFn fn) {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+private:
+    // The traits of a non-const iterator
+    struct iterator_traits {
+        using RefType    = typename PtrTraits::RefType;
+        using RawPtrType = typename PtrTraits::RawPtrType;
+        using IterType   = typename BucketType::iterator;
+
+        static IterType BucketBegin(BucketType& bucket) { return bucket.begin(); }
+        static IterType BucketEnd  (BucketType& bucket) { return bucket.end(); }
+    };
+
+    // The traits of a const iterator
+    struct const_iterator_traits {
+        using RefType    = typename PtrTraits::ConstRefType;
+        using RawPtrType = typename PtrTraits::ConstRawPtrType;
+        using IterType   = typename BucketType::const_iterator;
+
+        static IterType BucketBegin(const BucketType& bucket) { return bucket.cbegin(); }
+        static IterType BucketEnd  (const BucketType& bucket) { return bucket.cend(); }
+    };
+
+    // The shared implementation of the iterator.  While the table is growing,
+    // iterators visit the buckets of the old array before those of the new
+    // one; see GetBucket().
+    template <class IterTraits>
+    class iterator_impl {
+    public:
+        iterator_impl() { }
+        iterator_impl(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+        }
+
+        iterator_impl& operator=(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+            return *this;
+        }
+
+        bool IsValid() const { return iter_.IsValid(); }
+        bool operator==(const iterator_impl& other) const { return iter_ == other.iter_; }
+        bool operator!=(const iterator_impl& other) const { return iter_ != other.iter_; }
+
+        // Prefix
+        iterator_impl& operator++() {
+            if (!IsValid()) return *this;
+            ZX_DEBUG_ASSERT(hash_table_);
+
+            // Bump the bucket iterator and go looking for a new bucket if the
+            // iterator has become invalid.
+            ++iter_;
+            advance_if_invalid_iter();
+
+            return *this;
+        }
+
+        iterator_impl& operator--() {
+            // If we have never been bound to a ResizingHashTable instance, the
+            // we had better be invalid.
+            if (!hash_table_) {
+                ZX_DEBUG_ASSERT(!IsValid());
+                return *this;
+            }
+
+            // Back up the bucket iterator.  If it is still valid, then we are done.
+            --iter_;
+            if (iter_.IsValid())
+                return *this;
+
+            // If the iterator is invalid after backing up, check previous
+            // buckets to see if they contain any nodes.
+            while (bucket_ndx_) {
+                --bucket_ndx_;
+                auto& bucket = GetBucket(bucket_ndx_);
+                if (!bucket.is_empty()) {
+                    iter_ = --IterTraits::BucketEnd(bucket);
+                    ZX_DEBUG_ASSERT(iter_.IsValid());
+                    return *this;
+                }
+            }
+
+            // Looks like we have backed up past the beginning.  Update the
+            // bookkeeping to point at the end of the last bucket.
+            bucket_ndx_ = hash_table_->total_buckets() - 1;
+            iter_ = IterTraits::BucketEnd(GetBucket(bucket_ndx_));
+
+            return *this;
+        }
+
+        // Postfix
+        iterator_impl operator++(int) {
+            iterator_impl ret(*this);
+            ++(*this);
+            return ret;
+        }
+
+        iterator_impl operator--(int) {
+            iterator_impl ret(*this);
+            --(*this);
+            return ret;
+        }
+
+        typename PtrTraits::PtrType CopyPointer()          { return iter_.CopyPointer(); }
+        typename IterTraits::RefType operator*()     const { return iter_.operator*(); }
+        typename IterTraits::RawPtrType operator->() const { return iter_.operator->(); }
+
+    private:
+        friend ContainerType;
+        using IterType = typename IterTraits::IterType;
+
+        enum BeginTag { BEGIN };
+        enum EndTag { END };
+
+        iterator_impl(const ContainerType* hash_table, BeginTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(0),
+              iter_(IterTraits::BucketBegin(GetBucket(0))) {
+            advance_if_invalid_iter();
+        }
+
+        iterator_impl(const ContainerType* hash_table, EndTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(hash_table->total_buckets() - 1),
+              iter_(IterTraits::BucketEnd(GetBucket(bucket_ndx_))) { }
+
+        iterator_impl(const ContainerType* hash_table, size_t bucket_ndx, const IterType& iter)
+            : hash_table_(hash_table),
+              bucket_ndx_(bucket_ndx),
+              iter_(iter) { }
+
+        BucketType& GetBucket(size_t ndx) {
+            return hash_table_->GetBucket(ndx);
+        }
+
+        void advance_if_invalid_iter() {
+            // If the iterator has run off the end of it's current bucket, then
+            // check to see if there are nodes in any of the remaining buckets.
+            if (!iter_.IsValid()) {
+                const size_t last = hash_table_->total_buckets() - 1;
+                while (bucket_ndx_ < last) {
+                    ++bucket_ndx_;
+                    auto& bucket = GetBucket(bucket_ndx_);
+
+                    if (!bucket.is_empty()) {
+                        iter_ = IterTraits::BucketBegin(bucket);
+                        ZX_DEBUG_ASSERT(iter_.IsValid());
+                        break;
+                    } else if (bucket_ndx_ == last) {
+                        iter_ = IterTraits::BucketEnd(bucket);
+                    }
+                }
+            }
+        }
+
+        const ContainerType* hash_table_ = nullptr;
+        size_t bucket_ndx_ = 0;
+        IterType iter_;
+    };
+
+    // The number of old buckets moved to the new array by each insert while
+    // the table is growing.  The new array has twice as many buckets as the
+    // old one had elements when it was allocated, so at least that many more
+    // inserts happen before it fills up, by which time half as many steps
+    // have emptied the old array.
+    static constexpr size_t kMigrateBucketsPerInsert = 2;
+    static constexpr uint32_t kMinBucketShift = 4;
+    static constexpr uint32_t kMaxBucketShift = sizeof(size_t) * 8 - 2;
+    static_assert((static_cast<size_t>(1) << kMinBucketShift) == kMinBuckets,
+                  "kMinBucketShift must match kMinBuckets");
+
+    PtrType direct_erase(BucketType& bucket, ValueType& obj) {
+        PtrType ret = internal::DirectEraseUtils<BucketType>::erase(bucket, obj);
+
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    static typename BucketType::iterator FindInBucket(BucketType& bucket,
+                                                      const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    static typename BucketType::const_iterator FindInBucket(const BucketType& bucket,
+                                                            const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    // Reduce a hash to an index into an array of (1 << shift) buckets.
+    // Multiplying by 2^64 divided by the golden ratio and keeping the top bits
+    // spreads every bit of the hash across the index, so that keys like
+    // aligned addresses don't pile up in a few buckets.
+    static size_t BucketIndex(HashType hash, uint32_t shift) {
+        return static_cast<size_t>(
+            (static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ull) >> (64 - shift));
+    }
+
+    size_t old_bucket_count() const {
+        return old_buckets_ ? static_cast<size_t>(1) << old_bucket_shift_ : 0;
+    }
+
+    size_t total_buckets() const { return old_bucket_count() + bucket_count(); }
+
+    // Buckets are numbered with the old array's, if the table is growing,
+    // followed by the current array's.
+    BucketType& GetBucket(size_t ndx) const {
+        const size_t old_count = old_bucket_count();
+        ZX_DEBUG_ASSERT(ndx < old_count + bucket_count());
+        return (ndx < old_count) ? old_buckets_[ndx] : buckets_[ndx - old_count];
+    }
+
+    // Find the number of the bucket which holds, or would hold, |key|.  Old
+    // buckets before migrate_ndx_ have been emptied into the new array.
+    size_t Locate(const KeyType& key) const {
+        HashType hash = HashTraits::GetHash(key);
+        if (old_buckets_) {
+            size_t ndx = BucketIndex(hash, old_bucket_shift_);
+            if (ndx >= migrate_ndx_)
+                return ndx;
+        }
+        return old_bucket_count() + BucketIndex(hash, bucket_shift_);
+    }
+
+    void PrepareForInsert() {
+        if (old_buckets_)
+            MigrateBuckets(kMigrateBucketsPerInsert);
+        if (count_ >= grow_threshold_)
+            Grow();
+    }
+
+    void Grow() {
+        // Finish off any growth still in progress; this only happens if erases
+        // and failed allocations have thrown the schedule off.
+        if (old_buckets_)
+            MigrateBuckets(old_bucket_count());
+
+        const uint32_t shift = bucket_shift_ + 1;
+        if (shift > kMaxBucketShift) {
+            grow_threshold_ = SIZE_MAX;
+            return;
+        }
+
+        AllocChecker ac;
+        BucketType* buckets = new (&ac) BucketType[static_cast<size_t>(1) << shift];
+        if (!ac.check()) {
+            // Keep going with longer chains and try again later.
+            grow_threshold_ = (grow_threshold_ > SIZE_MAX / 2) ? SIZE_MAX : grow_threshold_ * 2;
+            return;
+        }
+
+        old_buckets_ = buckets_;
+        old_bucket_shift_ = bucket_shift_;
+        migrate_ndx_ = 0;
+        buckets_ = buckets;
+        bucket_shift_ = shift;
+        grow_threshold_ = bucket_count();
+    }
+
+    void MigrateBuckets(size_t count) {
+        ZX_DEBUG_ASSERT(old_buckets_);
+        const size_t old_count = old_bucket_count();
+
+        for (; count > 0 && migrate_ndx_ < old_count; --count) {
+            BucketType& bucket = old_buckets_[migrate_ndx_++];
+            while (!bucket.is_empty()) {
+                PtrType ptr = bucket.pop_front();
+                HashType hash = HashTraits::GetHash(KeyTraits::GetKey(*ptr));
+                buckets_[BucketIndex(hash, bucket_shift_)].push_front(fbl::move(ptr));
+            }
+        }
+
+        if (migrate_ndx_ == old_count) {
+            FreeBuckets(old_buckets_);
+            old_buckets_ = nullptr;
+            old_bucket_shift_ = 0;
+            migrate_ndx_ = 0;
+        }
+    }
+
+    // Return to the inline buckets.  Every bucket must be empty.
+    void ResetBuckets() {
+        if (old_buckets_)
+            FreeBuckets(old_buckets_);
+        FreeBuckets(buckets_);
+        old_buckets_ = nullptr;
+        old_bucket_shift_ = 0;
+        migrate_ndx_ = 0;
+        buckets_ = inline_buckets_;
+        bucket_shift_ = kMinBucketShift;
+        grow_threshold_ = kMinBuckets;
+        count_ = 0;
+    }
+
+    void FreeBuckets(BucketType* buckets) {
+        if (buckets != inline_buckets_)
+            delete[] buckets;
+    }
+
+    // The test framework's 'checker' class is our friend.
+    friend CheckerType;
+
+    // Iterators need to access our bucket arrays in order to iterate.
+    friend iterator;
+    friend const_iterator;
+
+    // Hash tables may not currently be copied, assigned or moved.
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ResizingHashTable);
+
+    size_t count_ = 0UL;
+    size_t grow_threshold_ = kMinBuckets;
+
+    // The array elements are hashed into, and its size as a power of two.
+    BucketType* buckets_ = inline_buckets_;
+    uint32_t bucket_shift_ = kMinBucketShift;
+
+    // While the table is growing, the array elements are being moved out of,
+    // and the number of the next of its buckets to be moved.
+    BucketType* old_buckets_ = nullptr;
+    uint32_t old_bucket_shift_ = 0;
+    size_t migrate_ndx_ = 0;
+
+    BucketType inline_buckets_[kMinBuckets];
+};
+
+// Explicit declaration of constexpr storage.
+#define RESIZING_HASH_TABLE_PROP(_type, _name) \
+template <typename KeyType, typename PtrType, typename BucketType, typename HashType, \
+          typename KeyTraits, typename HashTraits> \
+constexpr _type ResizingHashTable<KeyType, PtrType, BucketType, HashType, \
+                                  KeyTraits, HashTraits>::_name
+
+RESIZING_HASH_TABLE_PROP(size_t, kMinBuckets);
+RESIZING_HASH_TABLE_PROP(bool, SupportsConstantOrderErase);
+RESIZING_HASH_TABLE_PROP(bool, SupportsConstantOrderSize);
+RESIZING_HASH_TABLE_PROP(bool, IsAssociative);
+RESIZING_HASH_TABLE_PROP(bool, IsSequenced);
+RESIZING_HASH_TABLE_PROP(size_t, kMigrateBucketsPerInsert);
+RESIZING_HASH_TABLE_PROP(uint32_t, kMinBucketShift);
+RESIZING_HASH_TABLE_PROP(uint32_t, kMaxBucketShift);
+
+#undef RESIZING_HASH_TABLE_PROP
+
+}  // namespace fbl
@@ -53,7 +53,9 @@ __BEGIN_CDECLS
 #define ZXRIO_LINK        (0x0000001a | ZXRIO_ONE_HANDLE)
 #define ZXRIO_MMAP         0x0000001b
 #define ZXRIO_FCNTL        0x0000001c
-#define ZXRIO_NUM_OPS      29
+#define ZXRIO_READ_VMO    (0x0000001d | ZXRIO_ONE_HANDLE)
+#define ZXRIO_WRITE_VMO   (0x0000001e | ZXRIO_ONE_HANDLE)
+#define ZXRIO_NUM_OPS      31
 
 #define ZXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define ZXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -66,7 +68,8 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync", "link", "mmap", "fcntl" }
+    "setattr", "sync", "link", "mmap", "fcntl", "read_vmo", \
+    "write_vmo" }
 
 // dispatcher callback return code that there were no messages to read
 #define ERR_DISPATCHER_NO_WORK ZX_ERR_SHOULD_WAIT
@@ -173,6 +176,16 @@ typedef struct zxrio_mmap_data {
     int32_t flags;
 } zxrio_mmap_data_t;
 
+// READ_VMO and WRITE_VMO move the data through a VMO, sent along with the
+// request, rather than through the message itself.
+#define ZXRIO_VMO_XFER_AT (1u << 0) // At |offset|, rather than the seek offset.
+
+typedef struct zxrio_vmo_xfer {
+    int64_t offset;
+    uint64_t length;                   // From the start of the VMO.
+    uint32_t flags;
+} zxrio_vmo_xfer_t;
+
 static_assert(FDIO_CHUNK_SIZE >= PATH_MAX, "FDIO_CHUNK_SIZE must be large enough to contain paths");
 
 #define READDIR_CMD_NONE  0
@@ -191,6 +204,8 @@ static_assert(FDIO_CHUNK_SIZE >= PATH_MAX, "FDIO_CHUNK_SIZE must be large enough
 // READ_AT     maxread    offset   -                 0           <bytes>         -
 // WRITE       0          0        <bytes>           newoffset   -               -
 // WRITE_AT    0          offset   <bytes>           0           -               -
+// READ_VMO    0          0        <vmo_xfer>        newoffset   -               -
+// WRITE_VMO   0          0        <vmo_xfer>        newoffset   -               -
 // SEEK        whence     offset   -                 offset      -               -
 // STAT        maxreply   0        -                 0           <vnattr_t>      -
 // READDIR     maxreply   cmd      -                 0           <vndirent_t[]>  -
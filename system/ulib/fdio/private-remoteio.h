@@ -19,6 +19,14 @@ struct zxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic zx_txid_t txid;
+
+    // set once the server has turned down a READ_VMO or WRITE_VMO, so
+    // large transfers go back to being sent in messages
+    _Atomic bool vmo_xfer_unsupported;
+
+    // kept between large reads and writes, so they don't each create one;
+    // taken by whichever transfer is using it
+    _Atomic zx_handle_t xfer_vmo;
 };
 
 // These are for the benefit of namespace.c
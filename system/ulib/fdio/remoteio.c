@@ -36,6 +36,12 @@
 #define POLL_SHIFT  24
 #define POLL_MASK   0x1F
 
+// Reads and writes of at least VMO_XFER_MIN bytes hand the server a VMO
+// holding the data, moving up to VMO_XFER_MAX bytes per round trip, rather
+// than going FDIO_CHUNK_SIZE bytes at a time through messages.
+#define VMO_XFER_MIN (4 * FDIO_CHUNK_SIZE)
+#define VMO_XFER_MAX (4 * 1024 * 1024)
+
 static_assert(ZX_USER_SIGNAL_0 == (1 << POLL_SHIFT), "");
 static_assert((POLLIN << POLL_SHIFT) == DEVICE_SIGNAL_READABLE, "");
 static_assert((POLLPRI << POLL_SHIFT) == DEVICE_SIGNAL_OOB, "");
@@ -344,6 +350,92 @@ ssize_t zxrio_ioctl(fdio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
+// Takes the connection's transfer VMO, or makes one if another transfer has
+// it.
+static zx_status_t xfer_vmo_get(zxrio_t* rio, zx_handle_t* out) {
+    zx_handle_t vmo = atomic_exchange(&rio->xfer_vmo, ZX_HANDLE_INVALID);
+    if (vmo != ZX_HANDLE_INVALID) {
+        *out = vmo;
+        return ZX_OK;
+    }
+    return zx_vmo_create(VMO_XFER_MAX, 0, out);
+}
+
+// Gives the transfer VMO back to the connection.  Its pages are dropped, so
+// an idle connection holds no memory and the server never sees what an
+// earlier transfer left behind.
+static void xfer_vmo_put(zxrio_t* rio, zx_handle_t vmo, size_t used) {
+    if (zx_vmo_op_range(vmo, ZX_VMO_OP_DECOMMIT, 0, used, NULL, 0) == ZX_OK) {
+        zx_handle_t expected = ZX_HANDLE_INVALID;
+        if (atomic_compare_exchange_strong(&rio->xfer_vmo, &expected, vmo)) {
+            return;
+        }
+    }
+    zx_handle_close(vmo);
+}
+
+// Moves |len| bytes between |data| and the server through a VMO.
+// Returns ZX_ERR_NOT_SUPPORTED, having moved nothing, for servers which
+// don't support READ_VMO and WRITE_VMO.
+static ssize_t vmo_xfer_common(uint32_t op, zxrio_t* rio, uint8_t* data, size_t len,
+                               off_t offset, bool at) {
+    const size_t vmo_size = (len > VMO_XFER_MAX) ? VMO_XFER_MAX : len;
+    zx_handle_t vmo;
+    zx_status_t r;
+    if ((r = xfer_vmo_get(rio, &vmo)) != ZX_OK) {
+        return r;
+    }
+
+    ssize_t count = 0;
+    zxrio_msg_t msg;
+    while (len > 0) {
+        size_t xfer = (len > vmo_size) ? vmo_size : len;
+        size_t actual;
+        if ((op == ZXRIO_WRITE_VMO) &&
+            (r = zx_vmo_write(vmo, data, 0, xfer, &actual)) != ZX_OK) {
+            break;
+        }
+
+        memset(&msg, 0, ZXRIO_HDR_SZ);
+        msg.op = op;
+        msg.datalen = sizeof(zxrio_vmo_xfer_t);
+        zxrio_vmo_xfer_t* req = (zxrio_vmo_xfer_t*)msg.data;
+        req->offset = offset;
+        req->length = xfer;
+        req->flags = at ? ZXRIO_VMO_XFER_AT : 0;
+        if ((r = zx_handle_duplicate(vmo, ZX_RIGHT_SAME_RIGHTS, &msg.handle[0])) != ZX_OK) {
+            break;
+        }
+        msg.hcount = 1;
+
+        if ((r = zxrio_txn(rio, &msg)) < 0) {
+            break;
+        }
+        discard_handles(msg.handle, msg.hcount);
+
+        if ((size_t)r > xfer) {
+            r = ZX_ERR_IO;
+            break;
+        }
+        actual = r;
+        if ((op == ZXRIO_READ_VMO) &&
+            (r = zx_vmo_read(vmo, data, 0, actual, &actual)) != ZX_OK) {
+            break;
+        }
+        count += actual;
+        data += actual;
+        len -= actual;
+        if (at)
+            offset += actual;
+        // stop at short transfer
+        if (actual < xfer) {
+            break;
+        }
+    }
+    xfer_vmo_put(rio, vmo, vmo_size);
+    return count ? count : r;
+}
+
 static ssize_t write_common(uint32_t op, fdio_t* io, const void* _data, size_t len, off_t offset) {
     zxrio_t* rio = (zxrio_t*)io;
     const uint8_t* data = _data;
@@ -352,6 +444,16 @@ static ssize_t write_common(uint32_t op, fdio_t* io, const void* _data, size_t l
     zxrio_msg_t msg;
     ssize_t xfer;
 
+    if ((len >= VMO_XFER_MIN) && !atomic_load(&rio->vmo_xfer_unsupported)) {
+        count = vmo_xfer_common(ZXRIO_WRITE_VMO, rio, (uint8_t*)data, len, offset,
+                                op == ZXRIO_WRITE_AT);
+        if (count != ZX_ERR_NOT_SUPPORTED) {
+            return count;
+        }
+        atomic_store(&rio->vmo_xfer_unsupported, true);
+        count = 0;
+    }
+
     while (len > 0) {
         xfer = (len > FDIO_CHUNK_SIZE) ? FDIO_CHUNK_SIZE : len;
 
@@ -400,6 +502,15 @@ static ssize_t read_common(uint32_t op, fdio_t* io, void* _data, size_t len, off
     zxrio_msg_t msg;
     ssize_t xfer;
 
+    if ((len >= VMO_XFER_MIN) && !atomic_load(&rio->vmo_xfer_unsupported)) {
+        count = vmo_xfer_common(ZXRIO_READ_VMO, rio, data, len, offset, op == ZXRIO_READ_AT);
+        if (count != ZX_ERR_NOT_SUPPORTED) {
+            return count;
+        }
+        atomic_store(&rio->vmo_xfer_unsupported, true);
+        count = 0;
+    }
+
     while (len > 0) {
         xfer = (len > FDIO_CHUNK_SIZE) ? FDIO_CHUNK_SIZE : len;
 
@@ -479,6 +590,7 @@ zx_status_t zxrio_close(fdio_t* io) {
         rio->h2 = 0;
         zx_handle_close(h);
     }
+    zx_handle_close(atomic_exchange(&rio->xfer_vmo, ZX_HANDLE_INVALID));
 
     return r;
 }
@@ -924,6 +1036,7 @@ static zx_status_t zxrio_unwrap(fdio_t* io, zx_handle_t* handles, uint32_t* type
     } else {
         r = 1;
     }
+    zx_handle_close(atomic_load(&rio->xfer_vmo));
     free(io);
     return r;
 }
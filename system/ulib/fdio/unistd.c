@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 #include <zircon/process.h>
 #include <zircon/processargs.h>
 #include <zircon/syscalls.h>
+#include <zircon/syscalls/port.h>
 #include <zircon/thread_annotations.h>
 
 #include <fdio/debug.h>
@@ -1861,6 +1863,182 @@ void __fdio_release(fdio_t* io) {
 // TODO: getrlimit(RLIMIT_NOFILE, ...)
 #define MAX_POLL_NFDS 1024
 
+// Each thread that waits on more than ZX_WAIT_MANY_MAX_ITEMS handles keeps a
+// port, and slot i of its wait set tracks the wait armed on that port for
+// the i'th item of the last set waited on.  Callers of poll() and select()
+// usually pass the same handles in the same order each time, so most waits
+// are still armed from the previous call and only the slots which changed,
+// or whose wait fired, have to be armed again.
+typedef struct {
+    zx_handle_t handle;     // ZX_HANDLE_INVALID if nothing is armed
+    zx_signals_t waitfor;
+    uint64_t key;
+} fdio_wait_slot_t;
+
+typedef struct {
+    zx_handle_t port;
+    uint64_t generation;    // makes the key of each armed wait unique
+    size_t count;           // slots which may be armed
+    size_t capacity;
+    fdio_wait_slot_t slots[];
+} fdio_wait_set_t;
+
+// The low bits of a key are the slot, the rest the generation it was armed
+// in, so packets for waits which have since been replaced can be told apart.
+#define WAIT_SLOT_BITS 16
+#define WAIT_SLOT_MASK ((1ull << WAIT_SLOT_BITS) - 1)
+static_assert(MAX_POLL_NFDS <= WAIT_SLOT_MASK, "Too many poll items for a wait key");
+static_assert(FD_SETSIZE <= WAIT_SLOT_MASK, "Too many select items for a wait key");
+
+static pthread_key_t wait_set_key;
+static pthread_once_t wait_set_once = PTHREAD_ONCE_INIT;
+
+static void wait_set_cleanup(void* data) {
+    fdio_wait_set_t* ws = data;
+    // Waits that did not fire still hold a reference to the port.
+    for (size_t i = 0; i < ws->count; i++) {
+        if (ws->slots[i].handle != ZX_HANDLE_INVALID) {
+            zx_port_cancel(ws->port, ws->slots[i].handle, ws->slots[i].key);
+        }
+    }
+    zx_handle_close(ws->port);
+    free(ws);
+}
+
+static void wait_set_key_create(void) {
+    if (pthread_key_create(&wait_set_key, &wait_set_cleanup) != 0)
+        abort();
+}
+
+// Returns this thread's wait set, with room for at least |count| slots.
+static zx_status_t wait_set_get(size_t count, fdio_wait_set_t** out) {
+    pthread_once(&wait_set_once, wait_set_key_create);
+    fdio_wait_set_t* ws = pthread_getspecific(wait_set_key);
+    if (ws != NULL && ws->capacity >= count) {
+        *out = ws;
+        return ZX_OK;
+    }
+
+    fdio_wait_set_t* grown = realloc(ws, sizeof(*ws) + count * sizeof(fdio_wait_slot_t));
+    if (grown == NULL) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    if (ws == NULL) {
+        zx_status_t r = zx_port_create(0, &grown->port);
+        if (r != ZX_OK) {
+            free(grown);
+            return r;
+        }
+        grown->generation = 0;
+        grown->count = 0;
+    }
+    grown->capacity = count;
+    pthread_setspecific(wait_set_key, grown);
+    *out = grown;
+    return ZX_OK;
+}
+
+// Waits on |items| like zx_object_wait_many(), without its limit of
+// ZX_WAIT_MANY_MAX_ITEMS handles.  Larger sets are armed on this thread's
+// port, so the wakeup only delivers packets for the handles that became
+// ready.  Waits stay armed between calls, so a packet may be left over from
+// before this call; each handle's signals are read again before it is
+// reported ready.
+static zx_status_t fdio_wait_many(zx_wait_item_t* items, size_t count, zx_time_t deadline) {
+    if (count <= ZX_WAIT_MANY_MAX_ITEMS) {
+        return zx_object_wait_many(items, count, deadline);
+    }
+
+    fdio_wait_set_t* ws;
+    zx_status_t r = wait_set_get(count, &ws);
+    if (r != ZX_OK) {
+        return r;
+    }
+
+    // Waits beyond the end of this set are not wanted any more.
+    for (size_t i = count; i < ws->count; i++) {
+        fdio_wait_slot_t* slot = &ws->slots[i];
+        if (slot->handle != ZX_HANDLE_INVALID) {
+            zx_port_cancel(ws->port, slot->handle, slot->key);
+            slot->handle = ZX_HANDLE_INVALID;
+        }
+    }
+    for (size_t i = ws->count; i < count; i++) {
+        ws->slots[i].handle = ZX_HANDLE_INVALID;
+    }
+    ws->count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        items[i].pending = 0;
+        fdio_wait_slot_t* slot = &ws->slots[i];
+        if (slot->handle == items[i].handle && slot->waitfor == items[i].waitfor) {
+            // Still armed from an earlier call.  Handle values carry a
+            // generation count, so it is very unlikely that a handle closed
+            // since then is mistaken for a new one with the same value.
+            continue;
+        }
+        if (slot->handle != ZX_HANDLE_INVALID) {
+            // This also drops its packet, if one is queued.  If the handle
+            // has been closed since, its wait is already gone.
+            zx_port_cancel(ws->port, slot->handle, slot->key);
+            slot->handle = ZX_HANDLE_INVALID;
+        }
+        uint64_t key = (++ws->generation << WAIT_SLOT_BITS) | i;
+        r = zx_object_wait_async(items[i].handle, ws->port, key,
+                                 items[i].waitfor, ZX_WAIT_ASYNC_ONCE);
+        if (r != ZX_OK) {
+            return r;
+        }
+        slot->handle = items[i].handle;
+        slot->waitfor = items[i].waitfor;
+        slot->key = key;
+    }
+
+    // Block for the first ready handle, then collect whatever else is
+    // already queued without blocking again.  Packets for waits which have
+    // been replaced, or whose handle was closed, are dropped.
+    zx_port_packet_t packet;
+    bool ready = false;
+    while ((r = zx_port_wait(ws->port, ready ? 0 : deadline, &packet, 0)) == ZX_OK) {
+        if (!ZX_PKT_IS_SIGNAL_ONE(packet.type)) {
+            continue;
+        }
+        size_t i = packet.key & WAIT_SLOT_MASK;
+        if (i >= count) {
+            continue;
+        }
+        fdio_wait_slot_t* slot = &ws->slots[i];
+        if (slot->handle == ZX_HANDLE_INVALID || slot->key != packet.key) {
+            continue;
+        }
+        // The packet may have been queued before an earlier call returned,
+        // and the signals it observed may be gone by now, so only the
+        // current signals are reported.
+        zx_signals_t observed = 0;
+        zx_object_wait_one(slot->handle, 0, 0, &observed);
+        if ((observed & slot->waitfor) == 0) {
+            // Stale: arm the wait again and keep waiting.
+            uint64_t key = (++ws->generation << WAIT_SLOT_BITS) | i;
+            zx_status_t status = zx_object_wait_async(slot->handle, ws->port, key,
+                                                      slot->waitfor, ZX_WAIT_ASYNC_ONCE);
+            if (status != ZX_OK) {
+                slot->handle = ZX_HANDLE_INVALID;
+                return status;
+            }
+            slot->key = key;
+            continue;
+        }
+        // The wait fired, so it has to be armed again next time.
+        slot->handle = ZX_HANDLE_INVALID;
+        items[i].pending = observed;
+        ready = true;
+    }
+    if (r == ZX_ERR_TIMED_OUT && ready) {
+        r = ZX_OK;
+    }
+    return r;
+}
+
 int ppoll(struct pollfd* fds, nfds_t n,
           const struct timespec* timeout_ts, const sigset_t* sigmask) {
     if (sigmask) {
@@ -1922,7 +2100,7 @@ int ppoll(struct pollfd* fds, nfds_t n,
                 tmo = zx_deadline_after(duration);
             }
         }
-        r = zx_object_wait_many(items, nvalid, tmo);
+        r = fdio_wait_many(items, nvalid, tmo);
         // pending signals could be reported on ZX_ERR_TIMED_OUT case as well
         if (r == ZX_OK || r == ZX_ERR_TIMED_OUT) {
             nfds_t j = 0; // j counts up on a valid entry
@@ -2017,7 +2195,7 @@ int select(int n, fd_set* restrict rfds, fd_set* restrict wfds, fd_set* restrict
     if (r == ZX_OK && nvalid > 0) {
         zx_time_t tmo = (tv == NULL) ? ZX_TIME_INFINITE :
             zx_deadline_after(ZX_SEC(tv->tv_sec) + ZX_USEC(tv->tv_usec));
-        r = zx_object_wait_many(items, nvalid, tmo);
+        r = fdio_wait_many(items, nvalid, tmo);
         // pending signals could be reported on ZX_ERR_TIMED_OUT case as well
         if (r == ZX_OK || r == ZX_ERR_TIMED_OUT) {
             int j = 0; // j counts up on a valid entry
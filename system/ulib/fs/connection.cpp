@@ -11,6 +11,7 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include <fbl/algorithm.h>
 #include <fdio/debug.h>
 #include <fdio/io.h>
 #include <fdio/remoteio.h>
@@ -299,6 +300,16 @@ zx_status_t Connection::HandleMessage(zxrio_msg_t* msg) {
         }
         return status;
     }
+    case ZXRIO_READ_VMO: {
+        TRACE_DURATION("vfs", "ZXRIO_READ_VMO");
+        zx::vmo vmo(msg->handle[0]); // take ownership
+        return TransferVmo(msg, len, fbl::move(vmo), false);
+    }
+    case ZXRIO_WRITE_VMO: {
+        TRACE_DURATION("vfs", "ZXRIO_WRITE_VMO");
+        zx::vmo vmo(msg->handle[0]); // take ownership
+        return TransferVmo(msg, len, fbl::move(vmo), true);
+    }
     case ZXRIO_SEEK: {
         TRACE_DURATION("vfs", "ZXRIO_SEEK");
         if (IsPathOnly(flags_)) {
@@ -608,4 +619,96 @@ zx_status_t Connection::HandleMessage(zxrio_msg_t* msg) {
     }
 }
 
+zx_status_t Connection::TransferVmo(zxrio_msg_t* msg, uint32_t len, zx::vmo vmo,
+                                    bool write) {
+    if (write ? !IsWritable(flags_) : !IsReadable(flags_)) {
+        return ZX_ERR_BAD_HANDLE;
+    }
+    if (len != sizeof(zxrio_vmo_xfer_t)) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    zxrio_vmo_xfer_t xfer;
+    memcpy(&xfer, msg->data, sizeof(xfer));
+    const bool at = xfer.flags & ZXRIO_VMO_XFER_AT;
+    // The length of the transfer is returned in |msg->arg|.
+    if ((at && xfer.offset < 0) || (xfer.length > INT32_MAX)) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    // The client can resize or decommit its side of the VMO at any time, so
+    // it is never mapped here; the data is copied through the message buffer
+    // instead, which only the server can touch.
+    size_t offset = at ? xfer.offset : offset_;
+    size_t done = 0;
+    zx_status_t status = ZX_OK;
+    if (write) {
+        // Vnodes have only ever been handed writes from single messages, so
+        // pass the data on in pieces of that size.
+        const bool append = !at && (flags_ & ZX_FS_FLAG_APPEND);
+        while (done < xfer.length) {
+            size_t chunk = fbl::min(xfer.length - done, static_cast<uint64_t>(FDIO_CHUNK_SIZE));
+            size_t actual;
+            if ((status = vmo.read(msg->data, done, chunk, &actual)) != ZX_OK) {
+                break;
+            } else if (actual != chunk) {
+                status = ZX_ERR_INVALID_ARGS;
+                break;
+            }
+            if (append) {
+                size_t end;
+                if ((status = vnode_->Append(msg->data, chunk, &end, &actual)) == ZX_OK) {
+                    offset = end;
+                }
+            } else if ((status = vnode_->Write(msg->data, chunk, offset, &actual)) == ZX_OK) {
+                offset += actual;
+            }
+            if (status != ZX_OK) {
+                break;
+            }
+            ZX_DEBUG_ASSERT(actual <= chunk);
+            done += actual;
+            if (actual < chunk) {
+                break;
+            }
+        }
+    } else {
+        while (done < xfer.length) {
+            size_t chunk = fbl::min(xfer.length - done, static_cast<uint64_t>(FDIO_CHUNK_SIZE));
+            size_t actual;
+            if ((status = vnode_->Read(msg->data, chunk, offset, &actual)) != ZX_OK) {
+                break;
+            }
+            ZX_DEBUG_ASSERT(actual <= chunk);
+            if (actual == 0) {
+                break;
+            }
+            size_t copied;
+            if ((status = vmo.write(msg->data, done, actual, &copied)) != ZX_OK) {
+                break;
+            } else if (copied != actual) {
+                status = ZX_ERR_INVALID_ARGS;
+                break;
+            }
+            offset += actual;
+            done += actual;
+            if (actual < chunk) {
+                break;
+            }
+        }
+    }
+    if (done > 0) {
+        // Report what was moved, like a short read or write.
+        status = ZX_OK;
+    }
+
+    if (status != ZX_OK) {
+        return status;
+    }
+    if (!at) {
+        offset_ = offset;
+        msg->arg2.off = offset_;
+    }
+    return static_cast<zx_status_t>(done);
+}
+
 } // namespace fs
@@ -47,7 +47,8 @@ public:
     // as a later point in time.
     void Enqueue(vmoid_t id, uint64_t relative_block, uint64_t absolute_block, uint64_t nblocks) {
         for (size_t i = 0; i < count_; i++) {
-            if (requests_[i].vmoid != id) {
+            if (requests_[i].opcode != (Write ? BLOCKIO_WRITE : BLOCKIO_READ) ||
+                requests_[i].vmoid != id) {
                 continue;
             }
 
@@ -65,6 +66,7 @@ public:
         }
 
         requests_[count_].txnid = handler_->TxnId();
+        requests_[count_].opcode = Write ? BLOCKIO_WRITE : BLOCKIO_READ;
         requests_[count_].vmoid = id;
         // NOTE: It's easier to compare everything when dealing
         // with blocks (not offsets!) so the following are described in
@@ -82,9 +84,36 @@ public:
         }
     }
 
+    // Identify that a range of blocks no longer holds anything worth
+    // keeping.  The trim is ordered against the other requests of the
+    // transaction, so blocks enqueued for writing after it are not lost.
+    void Trim(uint64_t absolute_block, uint64_t nblocks) {
+        if (count_ > 0 && requests_[count_ - 1].opcode == BLOCKIO_TRIM &&
+            requests_[count_ - 1].dev_offset + requests_[count_ - 1].length == absolute_block) {
+            requests_[count_ - 1].length += nblocks;
+            return;
+        }
+
+        requests_[count_] = {};
+        requests_[count_].txnid = handler_->TxnId();
+        requests_[count_].opcode = BLOCKIO_TRIM;
+        requests_[count_].vmoid = VMOID_INVALID;
+        requests_[count_].dev_offset = absolute_block;
+        requests_[count_].length = nblocks;
+        count_++;
+
+        if (count_ == MAX_TXN_MESSAGES) {
+            Flush();
+        }
+    }
+
     // Activate the transaction
     zx_status_t Flush();
 
+    // Activate the transaction, followed by a barrier: everything written
+    // before the barrier is on stable storage before anything after it runs.
+    zx_status_t Sync();
+
 private:
     TxnHandler* handler_;
     size_t count_;
@@ -94,7 +123,6 @@ private:
 template <bool Write, size_t BlockSize, typename TxnHandler>
 inline zx_status_t BlockTxn<vmoid_t, Write, BlockSize, TxnHandler>::Flush() {
     for (size_t i = 0; i < count_; i++) {
-        requests_[i].opcode = Write ? BLOCKIO_WRITE : BLOCKIO_READ;
         requests_[i].vmo_offset *= BlockSize;
         requests_[i].dev_offset *= BlockSize;
         requests_[i].length *= BlockSize;
@@ -107,6 +135,17 @@ inline zx_status_t BlockTxn<vmoid_t, Write, BlockSize, TxnHandler>::Flush() {
     return status;
 }
 
+template <bool Write, size_t BlockSize, typename TxnHandler>
+inline zx_status_t BlockTxn<vmoid_t, Write, BlockSize, TxnHandler>::Sync() {
+    // Enqueue() flushes whenever the array fills, so there is always room
+    // for the barrier, and it goes out in the same fifo transaction.
+    requests_[count_] = {};
+    requests_[count_].txnid = handler_->TxnId();
+    requests_[count_].opcode = BLOCKIO_SYNC;
+    count_++;
+    return Flush();
+}
+
 template <size_t BlockSize, typename TxnHandler>
 using WriteTxn = BlockTxn<vmoid_t, true, BlockSize, TxnHandler>;
 template <size_t BlockSize, typename TxnHandler>
@@ -136,8 +175,12 @@ public:
         }
     }
 
+    // Trimming is only a hint, and host images have nothing to tell.
+    void Trim(uint64_t absolute_block, uint64_t nblocks) {}
+
     // Activate the transaction (do nothing)
     zx_status_t Flush() { return ZX_OK; }
+    zx_status_t Sync() { return ZX_OK; }
 
 private:
     TxnHandler* handler_;
@@ -17,6 +17,7 @@
 #include <fs/vfs.h>
 #include <fs/vnode.h>
 #include <zx/event.h>
+#include <zx/vmo.h>
 
 namespace fs {
 
@@ -60,6 +61,10 @@ private:
     static zx_status_t HandleMessageThunk(zxrio_msg_t* msg, void* cookie);
     zx_status_t HandleMessage(zxrio_msg_t* msg);
 
+    // Serves READ_VMO and WRITE_VMO, for the request in |msg|, whose data is
+    // in |vmo|.
+    zx_status_t TransferVmo(zxrio_msg_t* msg, uint32_t len, zx::vmo vmo, bool write);
+
     bool is_waiting() const { return wait_.object() != ZX_HANDLE_INVALID; }
 
     fs::Vfs* const vfs_;
@@ -69,6 +69,12 @@ zx_status_t Bcache::Create(fbl::unique_ptr<Bcache>* out, fbl::unique_fd fd, uint
     zx_handle_t fifo;
     ssize_t r;
 
+    block_info_t info;
+    if ((r = ioctl_block_get_info(bc->fd_.get(), &info)) < 0) {
+        return static_cast<zx_status_t>(r);
+    }
+    bc->trim_supported_ = info.flags & BLOCK_FLAG_TRIM_SUPPORT;
+
     if ((r = ioctl_block_get_fifos(bc->fd_.get(), &fifo)) < 0) {
         return static_cast<zx_status_t>(r);
     } else if (bc->TxnId() == TXNID_INVALID) {
@@ -0,0 +1,572 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file holds the extent map of VnodeMinfs, which maps the data of
+// inodes with kMinfsInodeFlagExtents.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+
+#include <minfs/minfs.h>
+
+namespace minfs {
+
+zx_status_t VnodeMinfs::ExtentsLoad() {
+    if (extents_loaded_) {
+        return ZX_OK;
+    }
+    // Start over, in case an earlier attempt failed halfway.
+    extents_.reset();
+    leaves_.reset();
+#ifdef __Fuchsia__
+    next_leaf_slot_ = 1;
+    free_leaf_slots_.reset();
+#endif
+
+    const uint32_t count = inode_.extent_count;
+    fbl::AllocChecker ac;
+    extents_.reserve(count, &ac);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    if (count <= kMinfsInlineExtents) {
+        for (uint32_t i = 0; i < count; i++) {
+            extents_.push_back(inode_.extents[i]);
+        }
+    } else {
+        const blk_t ibno = inode_.extent_index;
+        if (ibno == 0 || ibno >= fs_->info_.block_count) {
+            FS_TRACE_ERROR("minfs: ino#%u: bad extent index %u\n", ino_, ibno);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+
+        zx_status_t status;
+#ifdef __Fuchsia__
+        minfs_extent_leaf_t* index;
+        if ((status = ExtentsVmoBlock(0, reinterpret_cast<void**>(&index))) != ZX_OK) {
+            return status;
+        }
+        ReadTxn txn(fs_->bc_.get());
+        txn.Enqueue(vmoid_indirect_, 0, ibno + fs_->info_.dat_block, 1);
+        if ((status = txn.Flush()) != ZX_OK) {
+            return status;
+        }
+#else
+        minfs_extent_leaf_t index[kMinfsExtentLeaves];
+        if ((status = fs_->ReadDat(ibno, index)) != ZX_OK) {
+            return status;
+        }
+#endif
+
+        uint32_t found = 0;
+        for (uint32_t i = 0; found < count; i++) {
+            if (i == kMinfsExtentLeaves || index[i].bno == 0 ||
+                index[i].bno >= fs_->info_.block_count || index[i].count == 0 ||
+                index[i].count > kMinfsExtentsPerLeaf || index[i].count > count - found) {
+                FS_TRACE_ERROR("minfs: ino#%u: bad extent leaf %u\n", ino_, i);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            ExtentLeaf leaf = { index[i].bno, index[i].count, 0 };
+#ifdef __Fuchsia__
+            leaf.slot = next_leaf_slot_++;
+#endif
+            leaves_.push_back(leaf, &ac);
+            if (!ac.check()) {
+                return ZX_ERR_NO_MEMORY;
+            }
+            found += leaf.count;
+        }
+
+#ifdef __Fuchsia__
+        // |index| may move as the VMO grows, and isn't needed any more.
+        void* data;
+        if ((status = ExtentsVmoBlock(next_leaf_slot_ - 1, &data)) != ZX_OK) {
+            return status;
+        }
+        for (size_t i = 0; i < leaves_.size(); i++) {
+            txn.Enqueue(vmoid_indirect_, leaves_[i].slot,
+                        leaves_[i].bno + fs_->info_.dat_block, 1);
+        }
+        if ((status = txn.Flush()) != ZX_OK) {
+            return status;
+        }
+#endif
+        for (size_t i = 0; i < leaves_.size(); i++) {
+#ifdef __Fuchsia__
+            if ((status = ExtentsVmoBlock(leaves_[i].slot, &data)) != ZX_OK) {
+                return status;
+            }
+            const minfs_extent_t* leaf = static_cast<const minfs_extent_t*>(data);
+#else
+            minfs_extent_t leaf[kMinfsExtentsPerLeaf];
+            if ((status = fs_->ReadDat(leaves_[i].bno, leaf)) != ZX_OK) {
+                return status;
+            }
+#endif
+            for (uint32_t j = 0; j < leaves_[i].count; j++) {
+                extents_.push_back(leaf[j]);
+            }
+        }
+    }
+
+    // Check the map before anything relies on it.
+    uint64_t end = 0;
+    for (size_t i = 0; i < extents_.size(); i++) {
+        const minfs_extent_t& e = extents_[i];
+        if (e.count == 0 || e.start < end || e.start + e.count > kMinfsMaxFileBlock ||
+            e.bno == 0 || static_cast<uint64_t>(e.bno) + e.count > fs_->info_.block_count) {
+            FS_TRACE_ERROR("minfs: ino#%u: bad extent %zu: %u blocks at %u (@%u)\n",
+                           ino_, i, e.count, e.start, e.bno);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        end = static_cast<uint64_t>(e.start) + e.count;
+    }
+
+    extents_loaded_ = true;
+    return ZX_OK;
+}
+
+size_t VnodeMinfs::ExtentFind(blk_t n) const {
+    size_t lo = 0;
+    size_t hi = extents_.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (extents_[mid].start + extents_[mid].count <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+zx_status_t VnodeMinfs::GetBnoExtents(WriteTxn* txn, blk_t n, blk_t* bno) {
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
+    }
+
+    size_t i = ExtentFind(n);
+    if (i == extents_.size() || extents_[i].start > n) {
+        if (txn == nullptr) {
+            *bno = 0;
+            return ZX_OK;
+        }
+        blk_t mapped;
+        if ((status = ExtentsAllocate(txn, n, 1, Minfs::BlockReserve::kNone,
+                                      &mapped)) != ZX_OK) {
+            return status;
+        }
+        i = ExtentFind(n);
+    }
+    *bno = extents_[i].bno + (n - extents_[i].start);
+    fs_->ValidateBno(*bno);
+    return ZX_OK;
+}
+
+zx_status_t VnodeMinfs::ExtentsAllocate(WriteTxn* txn, blk_t n, blk_t count,
+                                        Minfs::BlockReserve reserve, blk_t* out_mapped) {
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
+    }
+    if (n >= kMinfsMaxFileBlock) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    count = static_cast<blk_t>(fbl::min<uint64_t>(count, kMinfsMaxFileBlock - n));
+
+    size_t i = ExtentFind(n);
+    if (i < extents_.size() && extents_[i].start <= n) {
+        *out_mapped = fbl::min(count, extents_[i].start + extents_[i].count - n);
+        return ZX_OK;
+    }
+    if (i < extents_.size()) {
+        count = fbl::min(count, extents_[i].start - n);
+    }
+
+    // Carry on from the extent before, so that a file written in order ends
+    // up in order on disk.
+    blk_t hint = 0;
+    if (i > 0) {
+        hint = extents_[i - 1].bno + (n - extents_[i - 1].start);
+    }
+    minfs_extent_t extent;
+    extent.start = n;
+    if ((status = fs_->BlocksNew(txn, hint, count, reserve, &extent.bno,
+                                 &extent.count)) != ZX_OK) {
+        return status;
+    }
+    inode_.block_count += extent.count;
+    if ((status = ExtentInsert(txn, i, extent)) != ZX_OK) {
+        inode_.block_count -= extent.count;
+        fs_->BlocksFree(txn, extent.bno, extent.count);
+        return status;
+    }
+    *out_mapped = extent.count;
+    return ZX_OK;
+}
+
+zx_status_t VnodeMinfs::ExtentInsert(WriteTxn* txn, size_t index, const minfs_extent_t& extent) {
+    const bool merge_prev = index > 0 &&
+                            extents_[index - 1].start + extents_[index - 1].count == extent.start &&
+                            extents_[index - 1].bno + extents_[index - 1].count == extent.bno;
+    const bool merge_next = index < extents_.size() &&
+                            extent.start + extent.count == extents_[index].start &&
+                            extent.bno + extent.count == extents_[index].bno;
+
+    zx_status_t status;
+    if (merge_prev && merge_next) {
+        minfs_extent_t next = extents_.erase(index);
+        extents_[index - 1].count += extent.count + next.count;
+        if ((status = ExtentsSync(txn, index - 1, 2, 1)) != ZX_OK) {
+            extents_[index - 1].count -= extent.count + next.count;
+            extents_.insert(index, next);
+        }
+    } else if (merge_prev) {
+        extents_[index - 1].count += extent.count;
+        if ((status = ExtentsSync(txn, index - 1, 1, 1)) != ZX_OK) {
+            extents_[index - 1].count -= extent.count;
+        }
+    } else if (merge_next) {
+        minfs_extent_t next = extents_[index];
+        extents_[index].start = extent.start;
+        extents_[index].bno = extent.bno;
+        extents_[index].count += extent.count;
+        if ((status = ExtentsSync(txn, index, 1, 1)) != ZX_OK) {
+            extents_[index] = next;
+        }
+    } else {
+        fbl::AllocChecker ac;
+        extents_.insert(index, extent, &ac);
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        if ((status = ExtentsSync(txn, index, 0, 1)) != ZX_OK) {
+            extents_.erase(index);
+        }
+    }
+    return status;
+}
+
+zx_status_t VnodeMinfs::ExtentsShrink(WriteTxn* txn, blk_t start) {
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
+    }
+
+    const size_t first = ExtentFind(start);
+    const size_t old_count = extents_.size() - first;
+    if (old_count == 0) {
+        return ZX_OK;
+    }
+
+    size_t new_count = 0;
+    size_t i = first;
+    minfs_extent_t& head = extents_[first];
+    if (head.start < start) {
+        // Keep the part of the extent before |start|.
+        blk_t keep = start - head.start;
+        fs_->BlocksFree(txn, head.bno + keep, head.count - keep);
+        inode_.block_count -= head.count - keep;
+        head.count = keep;
+        new_count = 1;
+        i++;
+    }
+    for (; i < extents_.size(); i++) {
+        fs_->BlocksFree(txn, extents_[i].bno, extents_[i].count);
+        inode_.block_count -= extents_[i].count;
+    }
+    while (extents_.size() > first + new_count) {
+        extents_.pop_back();
+    }
+
+    // Shrinking the map only ever frees leaves, so this can't fail.
+    status = ExtentsSync(txn, first, old_count, new_count);
+    ZX_DEBUG_ASSERT(status == ZX_OK);
+    return status;
+}
+
+zx_status_t VnodeMinfs::ExtentsFree(WriteTxn* txn) {
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
+    }
+    for (size_t i = 0; i < extents_.size(); i++) {
+        fs_->BlocksFree(txn, extents_[i].bno, extents_[i].count);
+        inode_.block_count -= extents_[i].count;
+    }
+    extents_.reset();
+    ExtentsFreeTree(txn);
+    inode_.extent_count = 0;
+    return ZX_OK;
+}
+
+void VnodeMinfs::ExtentsFreeTree(WriteTxn* txn) {
+    for (size_t i = 0; i < leaves_.size(); i++) {
+        fs_->BlocksFree(txn, leaves_[i].bno, 1);
+        inode_.block_count--;
+#ifdef __Fuchsia__
+        ExtentsReleaseSlot(leaves_[i].slot);
+#endif
+    }
+    leaves_.reset();
+    if (inode_.extent_index != 0) {
+        fs_->BlocksFree(txn, inode_.extent_index, 1);
+        inode_.block_count--;
+        inode_.extent_index = 0;
+    }
+}
+
+zx_status_t VnodeMinfs::ExtentsSync(WriteTxn* txn, size_t first, size_t old_count,
+                                    size_t new_count) {
+    const size_t size = extents_.size();
+    if (size <= kMinfsInlineExtents) {
+        if (!leaves_.is_empty()) {
+            // The map fits in the inode again.
+            ExtentsFreeTree(txn);
+            first = 0;
+        }
+        for (size_t i = first; i < size; i++) {
+            inode_.extents[i] = extents_[i];
+        }
+        memset(&inode_.extents[size], 0, (kMinfsInlineExtents - size) * sizeof(minfs_extent_t));
+        inode_.extent_count = static_cast<uint32_t>(size);
+        InodeSync(txn, kMxFsSyncDefault);
+        return ZX_OK;
+    }
+
+    // Find the leaves which held the extents which changed: [leaf, end).
+    // Between them, they hold the |total| extents from index |pos|.
+    size_t leaf = 0;
+    size_t end = 0;
+    size_t pos = 0;
+    size_t total = size;
+    const bool new_index = leaves_.is_empty();
+    if (!new_index) {
+        while (leaf + 1 < leaves_.size() && pos + leaves_[leaf].count <= first) {
+            pos += leaves_[leaf].count;
+            leaf++;
+        }
+        size_t old_end = pos;
+        end = leaf;
+        do {
+            old_end += leaves_[end].count;
+            end++;
+        } while (end < leaves_.size() && old_end < first + old_count);
+        total = old_end - pos - old_count + new_count;
+
+        // Rather than adding a leaf, spill over into the next one if it has
+        // room.
+        while (total > (end - leaf) * kMinfsExtentsPerLeaf && end < leaves_.size() &&
+               leaves_[end].count < kMinfsExtentsPerLeaf) {
+            total += leaves_[end].count;
+            end++;
+        }
+    }
+
+    const size_t needed = (total + kMinfsExtentsPerLeaf - 1) / kMinfsExtentsPerLeaf;
+    const size_t have = end - leaf;
+    ZX_DEBUG_ASSERT(needed <= have + 1);
+    if (needed > have && leaves_.size() == kMinfsExtentLeaves) {
+        FS_TRACE_ERROR("minfs: ino#%u: too many extents\n", ino_);
+        return ZX_ERR_NO_SPACE;
+    }
+
+    // Allocate the new blocks before changing anything.
+    fbl::AllocChecker ac;
+    blk_t index_bno = inode_.extent_index;
+    blk_t leaf_bno = 0;
+    blk_t got;
+    zx_status_t status;
+    if (new_index) {
+        if ((status = fs_->BlocksNew(txn, 0, 1, Minfs::BlockReserve::kSlack, &index_bno,
+                                     &got)) != ZX_OK) {
+            return status;
+        }
+    }
+    if (needed > have) {
+        blk_t hint = leaves_.is_empty() ? index_bno + 1 : leaves_[end - 1].bno + 1;
+#ifdef __Fuchsia__
+        size_t free_index;
+        const uint32_t slot = ExtentsPickSlot(txn, &free_index);
+#endif
+        if ((status = fs_->BlocksNew(txn, hint, 1, Minfs::BlockReserve::kSlack, &leaf_bno,
+                                     &got)) == ZX_OK) {
+            ExtentLeaf new_leaf = { leaf_bno, 0, 0 };
+#ifdef __Fuchsia__
+            new_leaf.slot = slot;
+#endif
+            leaves_.insert(end, fbl::move(new_leaf), &ac);
+            if (!ac.check()) {
+                fs_->BlocksFree(txn, leaf_bno, 1);
+                status = ZX_ERR_NO_MEMORY;
+            }
+        }
+        if (status != ZX_OK) {
+            if (new_index) {
+                fs_->BlocksFree(txn, index_bno, 1);
+            }
+            return status;
+        }
+#ifdef __Fuchsia__
+        if (free_index < free_leaf_slots_.size()) {
+            free_leaf_slots_.erase(free_index);
+        } else {
+            next_leaf_slot_++;
+        }
+#endif
+        inode_.block_count++;
+        end++;
+    }
+    if (new_index) {
+        inode_.extent_index = index_bno;
+        inode_.block_count++;
+        memset(inode_.extents, 0, sizeof(inode_.extents));
+    }
+
+    // Release the leaves which are no longer needed, and spread the extents
+    // over the rest.
+    while (end - leaf > needed) {
+        end--;
+        fs_->BlocksFree(txn, leaves_[end].bno, 1);
+        inode_.block_count--;
+#ifdef __Fuchsia__
+        ExtentsReleaseSlot(leaves_[end].slot);
+#endif
+        leaves_.erase(end);
+    }
+    for (size_t i = leaf; i < end; i++) {
+        leaves_[i].count = static_cast<uint32_t>(fbl::min<size_t>(total, kMinfsExtentsPerLeaf));
+        if ((status = ExtentsWriteLeaf(txn, i, pos)) != ZX_OK) {
+            return status;
+        }
+        pos += leaves_[i].count;
+        total -= leaves_[i].count;
+    }
+    if ((status = ExtentsWriteIndex(txn)) != ZX_OK) {
+        return status;
+    }
+
+    inode_.extent_count = static_cast<uint32_t>(size);
+    InodeSync(txn, kMxFsSyncDefault);
+    return ZX_OK;
+}
+
+zx_status_t VnodeMinfs::ExtentsWriteLeaf(WriteTxn* txn, size_t leaf, size_t first) {
+    const ExtentLeaf& l = leaves_[leaf];
+#ifdef __Fuchsia__
+    zx_status_t status;
+    void* data;
+    if ((status = ExtentsVmoBlock(l.slot, &data)) != ZX_OK) {
+        return status;
+    }
+#else
+    uint8_t data[kMinfsBlockSize];
+#endif
+    memset(data, 0, kMinfsBlockSize);
+    memcpy(data, &extents_[first], l.count * sizeof(minfs_extent_t));
+#ifdef __Fuchsia__
+    txn->Enqueue(vmo_indirect_->GetVmo(), l.slot, l.bno + fs_->info_.dat_block, 1);
+    return ZX_OK;
+#else
+    return fs_->bc_->Writeblk(l.bno + fs_->info_.dat_block, data);
+#endif
+}
+
+zx_status_t VnodeMinfs::ExtentsWriteIndex(WriteTxn* txn) {
+#ifdef __Fuchsia__
+    zx_status_t status;
+    void* data;
+    if ((status = ExtentsVmoBlock(0, &data)) != ZX_OK) {
+        return status;
+    }
+#else
+    uint8_t data[kMinfsBlockSize];
+#endif
+    memset(data, 0, kMinfsBlockSize);
+    minfs_extent_leaf_t* index = reinterpret_cast<minfs_extent_leaf_t*>(data);
+    for (size_t i = 0; i < leaves_.size(); i++) {
+        index[i].bno = leaves_[i].bno;
+        index[i].count = leaves_[i].count;
+    }
+#ifdef __Fuchsia__
+    txn->Enqueue(vmo_indirect_->GetVmo(), 0, inode_.extent_index + fs_->info_.dat_block, 1);
+    return ZX_OK;
+#else
+    return fs_->bc_->Writeblk(inode_.extent_index + fs_->info_.dat_block, data);
+#endif
+}
+
+#ifdef __Fuchsia__
+zx_status_t VnodeMinfs::ExtentsVmoBlock(uint32_t slot, void** out) {
+    zx_status_t status;
+    if (vmo_indirect_ == nullptr) {
+        if ((status = MappedVmo::Create(kMinfsBlockSize, "minfs-extents",
+                                        &vmo_indirect_)) != ZX_OK) {
+            return status;
+        }
+        if ((status = fs_->bc_->AttachVmo(vmo_indirect_->GetVmo(),
+                                          &vmoid_indirect_)) != ZX_OK) {
+            vmo_indirect_ = nullptr;
+            return status;
+        }
+    }
+    size_t size = (slot + 1) * kMinfsBlockSize;
+    if (vmo_indirect_->GetSize() < size) {
+        if ((status = vmo_indirect_->Grow(fbl::max(size, 2 * vmo_indirect_->GetSize()))) != ZX_OK) {
+            return status;
+        }
+    }
+    *out = static_cast<uint8_t*>(vmo_indirect_->GetData()) + slot * kMinfsBlockSize;
+    return ZX_OK;
+}
+
+uint32_t VnodeMinfs::ExtentsPickSlot(WriteTxn* txn, size_t* free_index) {
+    // Once a transaction is handed to the writeback buffer, its data has been
+    // copied out of the VMO, so only the one being built can be in the way.
+    const write_request_t* requests = txn->Requests();
+    for (size_t i = 0; i < free_leaf_slots_.size(); i++) {
+        const uint32_t slot = free_leaf_slots_[i];
+        bool in_use = false;
+        for (size_t r = 0; r < txn->Count(); r++) {
+            if (requests[r].vmo == vmo_indirect_->GetVmo() && requests[r].vmo_offset <= slot &&
+                slot < requests[r].vmo_offset + requests[r].length) {
+                in_use = true;
+                break;
+            }
+        }
+        if (!in_use) {
+            *free_index = i;
+            return slot;
+        }
+    }
+    *free_index = free_leaf_slots_.size();
+    return next_leaf_slot_;
+}
+
+void VnodeMinfs::ExtentsReleaseSlot(uint32_t slot) {
+    // Should there be no memory to remember the slot, it simply isn't used
+    // again.
+    fbl::AllocChecker ac;
+    free_leaf_slots_.push_back(slot, &ac);
+}
+
+void VnodeMinfs::EnqueueExtentReads(ReadTxn* txn) {
+    const blk_t vmo_blocks = fbl::round_up(inode_.size, kMinfsBlockSize) / kMinfsBlockSize;
+    for (size_t i = 0; i < extents_.size(); i++) {
+        const minfs_extent_t& e = extents_[i];
+        if (e.start >= vmo_blocks) {
+            break;
+        }
+        txn->Enqueue(vmoid_, e.start, e.bno + fs_->info_.dat_block,
+                     fbl::min(e.count, vmo_blocks - e.start));
+    }
+}
+#endif
+
+} // namespace minfs
@@ -9,6 +9,7 @@
 
 #include <minfs/format.h>
 #include <minfs/fsck.h>
+#include <minfs/journal.h>
 #include <minfs/minfs.h>
 
 // #define DEBUG_PRINTF
@@ -265,7 +266,71 @@ const char* MinfsChecker::CheckDataBlock(blk_t bno) {
     return nullptr;
 }
 
+zx_status_t MinfsChecker::CheckExtents(minfs_inode_t* inode, ino_t ino) {
+    zx_status_t status;
+    fbl::RefPtr<VnodeMinfs> vn;
+    if ((status = VnodeMinfs::AllocateHollow(fs_.get(), &vn)) != ZX_OK) {
+        return status;
+    }
+    memcpy(&vn->inode_, inode, kMinfsInodeSize);
+    vn->ino_ = ino;
+
+    // Loading the map checks that the extents are in order, and in range.
+    if ((status = vn->ExtentsLoad()) != ZX_OK) {
+        FS_TRACE_ERROR("check: ino#%u: bad extent map\n", ino);
+        return status;
+    }
+
+    uint32_t block_count = 0;
+    const char* msg;
+    if (inode->extent_index != 0) {
+        if ((msg = CheckDataBlock(inode->extent_index)) != nullptr) {
+            FS_TRACE_WARN("check: ino#%u: extent index (@%u): %s\n",
+                          ino, inode->extent_index, msg);
+            conforming_ = false;
+        }
+        block_count++;
+    }
+    for (size_t i = 0; i < vn->leaves_.size(); i++) {
+        if ((msg = CheckDataBlock(vn->leaves_[i].bno)) != nullptr) {
+            FS_TRACE_WARN("check: ino#%u: extent leaf %zu(@%u): %s\n",
+                          ino, i, vn->leaves_[i].bno, msg);
+            conforming_ = false;
+        }
+        block_count++;
+    }
+
+    blk_t next_blk = 0;
+    for (size_t i = 0; i < vn->extents_.size(); i++) {
+        const minfs_extent_t& e = vn->extents_[i];
+        for (blk_t n = 0; n < e.count; n++) {
+            if ((msg = CheckDataBlock(e.bno + n)) != nullptr) {
+                FS_TRACE_WARN("check: ino#%u: block %u(@%u): %s\n",
+                              ino, e.start + n, e.bno + n, msg);
+                conforming_ = false;
+            }
+        }
+        block_count += e.count;
+        next_blk = e.start + e.count;
+    }
+
+    if (next_blk > fbl::round_up(inode->size, kMinfsBlockSize) / kMinfsBlockSize) {
+        FS_TRACE_WARN("check: ino#%u: filesize too small\n", ino);
+        conforming_ = false;
+    }
+    if (block_count != inode->block_count) {
+        FS_TRACE_WARN("check: ino#%u: block count %u, actual blocks %u\n",
+             ino, inode->block_count, block_count);
+        conforming_ = false;
+    }
+    return ZX_OK;
+}
+
 zx_status_t MinfsChecker::CheckFile(minfs_inode_t* inode, ino_t ino) {
+    if (inode->flags & kMinfsInodeFlagExtents) {
+        return CheckExtents(inode, ino);
+    }
+
     xprintf("Direct blocks: \n");
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         xprintf(" %d,", inode->dnum[n]);
@@ -521,6 +586,16 @@ zx_status_t minfs_check(fbl::unique_ptr<Bcache> bc) {
         return -1;
     }
     const minfs_info_t* info = reinterpret_cast<const minfs_info_t*>(data);
+    // Check the filesystem as it will be once mounted, with the committed
+    // contents of the journal in place.
+    if ((status = minfs_journal_replay(bc.get(), info)) != ZX_OK) {
+        FS_TRACE_ERROR("minfs_check: could not replay journal: %d\n", status);
+        return status;
+    }
+    if (bc->Readblk(0, data) < 0) {
+        FS_TRACE_ERROR("minfs: could not read info block\n");
+        return -1;
+    }
     minfs_dump_info(info);
     if ((status = minfs_check_info(info, bc.get())) != ZX_OK) {
         FS_TRACE_ERROR("minfs_check: check_info failure: %d\n", status);
@@ -45,6 +45,9 @@ public:
     // assuming the filesystem is non-resizable.
     uint32_t Maxblk() const { return blockmax_; };
 
+    // Whether freed blocks should be reported to the device with BLOCKIO_TRIM.
+    bool TrimSupported() const { return trim_supported_; }
+
 #ifdef __Fuchsia__
     ssize_t GetDevicePath(char* out, size_t out_len);
     zx_status_t AttachVmo(zx_handle_t vmo, vmoid_t* out);
@@ -135,6 +138,7 @@ private:
 #endif
     fbl::unique_fd fd_{};
     uint32_t blockmax_{};
+    bool trim_supported_{};
 };
 
 } // namespace minfs
@@ -42,7 +42,13 @@ typedef uint32_t ino_t;
 
 constexpr uint64_t kMinfsMagic0         = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1         = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion        = 0x00000005;
+constexpr uint32_t kMinfsVersion        = 0x00000007;
+// The last version without extent-mapped inodes.  It is still mounted, but
+// new inodes are left block-mapped, so older drivers can still read it.
+constexpr uint32_t kMinfsVersionBlockMap = 0x00000006;
+// The last version without a metadata journal.  Its superblock predates the
+// journal fields, which read as zero, so it is mounted as having no journal.
+constexpr uint32_t kMinfsVersionNoJournal = 0x00000005;
 
 constexpr ino_t kMinfsRootIno           = 1;
 constexpr uint32_t kMinfsFlagClean      = 0x00000001; // Currently unused
@@ -72,6 +78,15 @@ constexpr uint32_t kMinfsMagicDir  = MinfsMagic(kMinfsTypeDir);
 constexpr uint32_t kMinfsMagicFile = MinfsMagic(kMinfsTypeFile);
 constexpr uint32_t MinfsMagicType(uint32_t n) { return n & 0xFF; }
 
+constexpr uint32_t kMinfsInodeFlagExtents = 0x00000001; // Data is mapped by extents
+
+// The metadata journal starts right after the superblock; see
+// minfs_journal_info_t below.
+constexpr blk_t kMinfsJournalStart           = 1;
+constexpr uint32_t kMinfsDefaultJournalBlocks = 256;
+// Journals smaller than this aren't worth having, and are left out.
+constexpr uint32_t kMinfsMinJournalBlocks     = 16;
+
 constexpr size_t kFVMBlockInodeBmStart = 0x10000;
 constexpr size_t kFVMBlockDataBmStart  = 0x20000;
 constexpr size_t kFVMBlockInodeStart   = 0x30000;
@@ -99,9 +114,13 @@ typedef struct {
     uint32_t abm_slices;    // Slices allocated to block bitmap
     uint32_t ino_slices;    // Slices allocated to inode table
     uint32_t dat_slices;    // Slices allocated to file data section
+    blk_t journal_block;            // first blockno of the metadata journal
+    uint32_t journal_block_count;   // blocks in the journal (0 if there is none)
 } minfs_info_t;
 
 // Notes:
+// - the journal, if any, sits between the info block and the ibm; on FVM
+//   it must fit in the first slice, along with the info block
 // - the ibm, abm, ino, and dat regions must be in that order
 //   and may not overlap
 // - the abm has an entry for every block on the volume, including
@@ -115,6 +134,54 @@ typedef struct {
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
 
+// Metadata journal
+//
+// Metadata updates are appended to the journal before they are written to
+// their home locations; after a crash, the committed entries are written out
+// again on mount.  The first block of the journal holds a
+// minfs_journal_info_t, and the remaining blocks form a ring of entries.  An
+// entry is a minfs_journal_entry_t header block followed by |block_count|
+// payload blocks, wrapping around at the end of the ring.  An entry is only
+// valid if its sequence number is the one expected next and its checksum
+// matches, which also rejects entries which were torn by a crash.
+
+constexpr uint64_t kMinfsJournalMagic      = 0x6c6e726a53466e4dULL; // "MnFSjrnl"
+constexpr uint64_t kMinfsJournalEntryMagic = 0x7972746e53466e4dULL; // "MnFSntry"
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;       // Sequence number of the entry at |start|
+    uint32_t start;     // Ring offset (in blocks) of the oldest entry to replay
+    uint32_t checksum;  // fnv1a32 of this structure, with |checksum| set to zero
+} minfs_journal_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t block_count;   // Payload blocks following this header
+    uint32_t checksum;      // Of this block (with |checksum| zero) and the payload
+    blk_t target[];         // Home location of each payload block
+} minfs_journal_entry_t;
+
+constexpr uint32_t kMinfsJournalMaxEntryBlocks =
+    (kMinfsBlockSize - sizeof(minfs_journal_entry_t)) / sizeof(blk_t);
+
+typedef struct {
+    blk_t start;            // First block of the file which the extent maps
+    blk_t bno;              // Data block which holds it
+    uint32_t count;         // Length of the extent, in blocks
+} minfs_extent_t;
+
+typedef struct {
+    blk_t bno;              // Data block which holds the leaf
+    uint32_t count;         // Extents in the leaf
+} minfs_extent_leaf_t;
+
+constexpr uint32_t kMinfsInlineExtents = (kMinfsDirect + kMinfsIndirect + kMinfsDoublyIndirect) *
+                                         sizeof(blk_t) / sizeof(minfs_extent_t);
+constexpr uint32_t kMinfsExtentsPerLeaf = kMinfsBlockSize / sizeof(minfs_extent_t);
+constexpr uint32_t kMinfsExtentLeaves   = kMinfsBlockSize / sizeof(minfs_extent_leaf_t);
+
 typedef struct {
     uint32_t magic;
     uint32_t size;
@@ -125,15 +192,33 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
-    blk_t dnum[kMinfsDirect];    // direct blocks
-    blk_t inum[kMinfsIndirect];  // indirect blocks
-    blk_t dinum[kMinfsDoublyIndirect]; // doubly indirect blocks
+    uint32_t flags;                 // kMinfsInodeFlag*
+    uint32_t extent_count;          // with kMinfsInodeFlagExtents
+    blk_t extent_index;             // with more than kMinfsInlineExtents extents
+    uint32_t rsvd[2];
+    union {
+        struct {
+            blk_t dnum[kMinfsDirect];    // direct blocks
+            blk_t inum[kMinfsIndirect];  // indirect blocks
+            blk_t dinum[kMinfsDoublyIndirect]; // doubly indirect blocks
+        };
+        minfs_extent_t extents[kMinfsInlineExtents]; // with kMinfsInodeFlagExtents
+    };
 } minfs_inode_t;
 
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// Notes:
+// - inodes with kMinfsInodeFlagExtents map their data through extents,
+//   rather than direct and indirect blocks; extents are sorted by |start|
+//   and do not overlap, and blocks which no extent maps read as zeroes
+// - up to kMinfsInlineExtents extents are held in the inode itself; beyond
+//   that, |extent_index| is a data block holding an array of
+//   minfs_extent_leaf_t, and each leaf is a data block holding |count|
+//   extents.  The extents of the leaves, in order, form the map
+// - like indirect blocks, the index and leaves count towards |block_count|
+
 typedef struct {
     ino_t ino;                      // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -51,6 +51,8 @@ private:
                                ino_t parent, uint32_t flags);
     const char* CheckDataBlock(blk_t bno);
     zx_status_t CheckFile(minfs_inode_t* inode, ino_t ino);
+    // Like CheckFile, for inodes which map their data through extents.
+    zx_status_t CheckExtents(minfs_inode_t* inode, ino_t ino);
 
     fbl::unique_ptr<Minfs> fs_;
     RawBitmap checked_inodes_;
@@ -67,6 +69,9 @@ private:
 };
 
 zx_status_t minfs_check_info(const minfs_info_t* info, Bcache* bc);
+// Any committed journal entries are replayed onto the image before it is
+// checked, exactly as mount would, so checking a filesystem which was not
+// cleanly unmounted writes to it.
 zx_status_t minfs_check(fbl::unique_ptr<Bcache> bc);
 
 #ifndef __Fuchsia__
@@ -75,6 +80,7 @@ zx_status_t minfs_check(fbl::unique_ptr<Bcache> bc);
 // |end| indicates the end of the minfs partition (in bytes)
 // |extent_lengths| contains the length (in bytes) of each minfs extent: currently this includes
 // the superblock, inode bitmap, block bitmap, inode table, and data blocks.
+// Like minfs_check, this may write replayed journal entries to |fd|.
 zx_status_t minfs_fsck(fbl::unique_fd fd, off_t start, off_t end,
                        const fbl::Vector<size_t>& extent_lengths);
 #endif
@@ -0,0 +1,126 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file describes the metadata journal of MinFS, which makes each
+// filesystem operation reach the disk atomically.
+
+#pragma once
+
+#include <inttypes.h>
+
+#ifdef __Fuchsia__
+#include <bitmap/rle-bitmap.h>
+#include <fbl/array.h>
+#endif
+
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+
+#include <fs/mapped-vmo.h>
+
+#include <minfs/bcache.h>
+#include <minfs/format.h>
+
+namespace minfs {
+
+// Fills |blk| with the info block of an empty journal.
+void minfs_journal_init(void* blk);
+
+// Writes the committed entries of the journal out to their home locations,
+// and marks the journal as empty.
+//
+// The journal may hold newer copies of any metadata -- including the
+// superblock -- so this must run before anything else is read from the
+// filesystem.
+zx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info);
+
+#ifdef __Fuchsia__
+
+class WritebackWork;
+
+// Journal commits batches of WritebackWork, which have been copied into the
+// writeback buffer.
+//
+// The metadata of a batch is written to the journal as a single entry, along
+// with the file data, and is only written to its home location once the entry
+// is on stable storage.  Home locations are only known to be up to date after
+// a checkpoint, which happens whenever the journal fills up.
+//
+// Only the writeback thread may use the Journal once it has been created.
+class Journal {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Journal);
+
+    // Creates a Journal for the filesystem described by |info|, which must
+    // already have been replayed.  Batches may hold up to |max_blocks| blocks.
+    static zx_status_t Create(Bcache* bc, const minfs_info_t* info, size_t max_blocks,
+                              fbl::unique_ptr<Journal>* out);
+    ~Journal();
+
+    // The most blocks of metadata which a batch may hold.  A unit of work
+    // larger than this is still written out, just not atomically.
+    size_t Capacity() const;
+
+    // Writes out the |count| units of work in |works|, whose blocks are held
+    // in |buffer| (attached as |vmoid|), and finishes each of them.
+    //
+    // After an I/O error, nothing more is written, so the filesystem on disk
+    // stays as it was after the last successful commit.
+    void Commit(fbl::unique_ptr<WritebackWork>* works, size_t count,
+                const MappedVmo* buffer, vmoid_t vmoid);
+
+    // Makes sure every committed block is in its home location, and empties
+    // the journal.
+    zx_status_t Checkpoint();
+
+private:
+    class RequestBatch;
+
+    // A single block written by a batch.
+    struct Block {
+        blk_t dev;          // Home location
+        uint32_t buf;       // Offset within the writeback buffer
+        uint32_t order;     // Position within the batch
+        bool journal;
+    };
+
+    Journal(Bcache* bc, const minfs_info_t* info, fbl::unique_ptr<MappedVmo> vmo,
+            fbl::Array<Block> blocks);
+
+    // Sorts the blocks of a batch by home location, dropping all but the
+    // last write to each.  Returns the number which remain.
+    size_t SortBlocks(size_t count);
+
+    // Adds writes of the first |count| (sorted) blocks which are, or are not,
+    // |journal|ed to |batch|, from |vmoid|.
+    void AddWrites(RequestBatch* batch, size_t count, bool journal, vmoid_t vmoid) const;
+
+    // Records the first error, after which nothing is written.
+    zx_status_t Fail(zx_status_t status);
+
+    Bcache* bc_;
+    const blk_t start_block_;
+    // Blocks in the ring of entries, which follows the info block.
+    const uint32_t ring_blocks_;
+    // Mirrors the journal on disk: the info block, followed by the ring.
+    fbl::unique_ptr<MappedVmo> vmo_;
+    vmoid_t vmoid_ = VMOID_INVALID;
+
+    // Position and sequence number of the next entry.
+    uint32_t head_ = 0;
+    uint64_t seq_ = 0;
+    // Blocks of the ring used since the last checkpoint.
+    uint32_t used_ = 0;
+    // Blocks journaled since the last checkpoint.  Replay may overwrite them,
+    // so they must not be written in place (as file data) until the next
+    // checkpoint.
+    bitmap::RleBitmap live_;
+
+    fbl::Array<Block> blocks_;
+    bool failed_ = false;
+};
+
+#endif
+
+} // namespace minfs
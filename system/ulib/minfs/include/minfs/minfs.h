@@ -10,6 +10,7 @@
 #include <inttypes.h>
 
 #ifdef __Fuchsia__
+#include <bitmap/rle-bitmap.h>
 #include <fbl/auto_lock.h>
 #include <fs/remote.h>
 #include <fs/watcher.h>
@@ -18,11 +19,12 @@
 #endif
 
 #include <fbl/algorithm.h>
-#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_resizing_hash_table.h>
 #include <fbl/intrusive_single_list.h>
 #include <fbl/macros.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
 
 #include <fs/block-txn.h>
 #include <fs/mapped-vmo.h>
@@ -30,8 +32,6 @@
 #include <fs/vfs.h>
 #include <fs/vnode.h>
 
-#include <zircon/misc/fnv1hash.h>
-
 #include <minfs/format.h>
 #include "writeback.h"
 
@@ -101,9 +101,43 @@ public:
     // Allocate a new data block.
     zx_status_t BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno);
 
+    // How much of the space set aside by BlocksReserve an allocation may use.
+    enum class BlockReserve {
+        kNone,  // None of it, nor the slack kept for extent leaves.
+        kSlack, // Only the slack: extent index and leaf blocks.
+        kAll,   // All of it: the data which the blocks were reserved for.
+    };
+
+    // Allocate a run of up to |count| contiguous data blocks, starting at
+    // |hint| if that block is free.  Returns the first block in |out_bno|,
+    // and the length of the run in |out_count|.
+    zx_status_t BlocksNew(WriteTxn* txn, blk_t hint, blk_t count, BlockReserve reserve,
+                          blk_t* out_bno, blk_t* out_count);
+
     // free block in block bitmap
     zx_status_t BlockFree(WriteTxn* txn, blk_t bno);
 
+    // free |count| contiguous blocks in block bitmap
+    zx_status_t BlocksFree(WriteTxn* txn, blk_t bno, blk_t count);
+
+    // Whether new inodes map their data through extents.
+    bool ExtentsSupported() const { return info_.version == kMinfsVersion; }
+
+#ifdef __Fuchsia__
+    // Sets aside |count| free blocks, for file data which will be allocated
+    // later on (see VnodeMinfs::AllocatePending).
+    zx_status_t BlocksReserve(uint32_t count);
+    void BlocksUnreserve(uint32_t count);
+
+    // Tracks the vnodes which hold reserved blocks, keeping them alive until
+    // they are allocated.
+    zx_status_t AddPendingVnode(fbl::RefPtr<VnodeMinfs> vn);
+    void RemovePendingVnode(VnodeMinfs* vn);
+
+    // Allocates the reserved blocks of every vnode.
+    zx_status_t AllocatePending();
+#endif
+
     // free ino in inode bitmap, release all blocks held by inode
     zx_status_t InoFree(VnodeMinfs* vn, WriteTxn* txn);
 
@@ -196,8 +230,13 @@ private:
 
     // Vnodes exist in the hash table as long as one or more reference exists;
     // when the Vnode is deleted, it is immediately removed from the map.
-    using HashTable = fbl::HashTable<ino_t, VnodeMinfs*>;
+    using HashTable = fbl::ResizingHashTable<ino_t, VnodeMinfs*>;
     HashTable vnode_hash_ __TA_GUARDED(hash_lock_){};
+
+#ifdef __Fuchsia__
+    uint32_t reserved_blocks_{};
+    fbl::Vector<fbl::RefPtr<VnodeMinfs>> pending_vnodes_{};
+#endif
 };
 
 struct DirArgs {
@@ -213,8 +252,6 @@ struct DirectoryOffset {
     size_t off_prev; // Offset in directory of previous record
 };
 
-#define INO_HASH(ino) fnv1a_tiny(ino, kMinfsHashBits)
-
 class VnodeMinfs final : public fs::Vnode,
                          public fbl::SinglyLinkedListable<VnodeMinfs*>,
                          public fbl::Recyclable<VnodeMinfs> {
@@ -225,11 +262,12 @@ public:
     static zx_status_t AllocateHollow(Minfs* fs, fbl::RefPtr<VnodeMinfs>* out);
 
     bool IsDirectory() const { return inode_.magic == kMinfsMagicDir; }
+    bool HasExtents() const { return (inode_.flags & kMinfsInodeFlagExtents) != 0; }
     bool IsUnlinked() const { return inode_.link_count == 0; }
     zx_status_t CanUnlink() const;
 
     ino_t GetKey() const { return ino_; }
-    static size_t GetHash(ino_t key) { return INO_HASH(key); }
+    static size_t GetHash(ino_t key) { return key; }
 
     zx_status_t UnlinkChild(WritebackWork* wb, fbl::RefPtr<VnodeMinfs> child,
                             minfs_dirent_t* de, DirectoryOffset* offs);
@@ -243,6 +281,11 @@ public:
     zx_status_t WriteExactInternal(WriteTxn* txn, const void* data, size_t len,
                                    size_t off);
     zx_status_t TruncateInternal(WriteTxn* txn, size_t len);
+#ifdef __Fuchsia__
+    // Allocates the blocks of the file which were written without one, in
+    // runs which are as long as possible, and writes them out.
+    zx_status_t AllocatePending();
+#endif
     zx_status_t Ioctl(uint32_t op, const void* in_buf, size_t in_len, void* out_buf,
                       size_t out_len, size_t* out_actual) final;
     zx_status_t Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name) final;
@@ -391,7 +434,56 @@ private:
                                            size_t count, uint32_t dib_vmo_offset,
                                            uint32_t ib_vmo_offset, blk_t* diarray, bool* dirty);
 
+    // Extent-mapped inodes only (see HasExtents).
+    //
+    // The extents are read into |extents_| when first needed, and changes
+    // are made there before being written back with ExtentsSync.
+
+    zx_status_t ExtentsLoad();
+    // Returns the index of the first extent which ends after block |n| of
+    // the file: the one which maps |n|, if any, or else the next one.
+    size_t ExtentFind(blk_t n) const;
+    zx_status_t GetBnoExtents(WriteTxn* txn, blk_t n, blk_t* bno);
+    // Allocates blocks for the start of the range of |count| blocks at |n|,
+    // if they aren't mapped already.  Sets |*out_mapped| to the number of
+    // blocks at |n| which are now mapped, all by a single extent.
+    zx_status_t ExtentsAllocate(WriteTxn* txn, blk_t n, blk_t count,
+                                Minfs::BlockReserve reserve, blk_t* out_mapped);
+    // Adds |extent| to the map, at index |index|, merging it with its
+    // neighbours where possible.
+    zx_status_t ExtentInsert(WriteTxn* txn, size_t index, const minfs_extent_t& extent);
+    // Releases all blocks of the file from |start| onwards.
+    zx_status_t ExtentsShrink(WriteTxn* txn, blk_t start);
+    // Releases all blocks of the file, along with the map itself.
+    zx_status_t ExtentsFree(WriteTxn* txn);
+    // Writes out the map, after the |old_count| extents at |first| have been
+    // replaced by the |new_count| extents now there.  Blocks for the leaves
+    // are allocated first, so if that fails, nothing has been written.
+    zx_status_t ExtentsSync(WriteTxn* txn, size_t first, size_t old_count, size_t new_count);
+    void ExtentsFreeTree(WriteTxn* txn);
+    // Writes out leaf |leaf|, which holds the extents from index |first|.
+    zx_status_t ExtentsWriteLeaf(WriteTxn* txn, size_t leaf, size_t first);
+    zx_status_t ExtentsWriteIndex(WriteTxn* txn);
+
 #ifdef __Fuchsia__
+    // Finds block |slot| of the extent VMO, growing it if needed.
+    zx_status_t ExtentsVmoBlock(uint32_t slot, void** out);
+    // Picks a block of the extent VMO for a new leaf, preferring one an
+    // earlier leaf gave up, as long as |txn| doesn't still refer to it.
+    uint32_t ExtentsPickSlot(WriteTxn* txn, size_t* free_index);
+    void ExtentsReleaseSlot(uint32_t slot);
+    // Reads the data of the file into |vmo_|.
+    void EnqueueExtentReads(ReadTxn* txn);
+
+    // Regular files which map their data through extents only allocate
+    // blocks when they are written back, rather than when they are written.
+    bool DelaysAllocation() const { return HasExtents() && !IsDirectory(); }
+    // Reserves a block for block |n| of the file, which has been written
+    // into |vmo_| but has no block yet.
+    zx_status_t DelayAllocation(blk_t n);
+    // Releases the reservations of blocks which will never be written.
+    void DropPending();
+
     // Reads the block at |offset| in memory
     void ReadIndirectVmoBlock(uint32_t offset, uint32_t** entry);
     // Clears the block at |offset| in memory
@@ -433,7 +525,9 @@ private:
     // a VMO into memory when it is read/written.
     zx::vmo vmo_{};
 
-    // vmo_indirect_ contains all indirect and doubly indirect blocks in the following order:
+    // For inodes with HasExtents(), vmo_indirect_ holds the extent index,
+    // followed by the leaves.  Otherwise, it contains all indirect and
+    // doubly indirect blocks in the following order:
     // First kMinfsIndirect blocks                                - initial set of indirect blocks
     // Next kMinfsDoublyIndirect blocks                           - doubly indirect blocks
     // Next kMinfsDoublyIndirect * kMinfsDirectPerIndirect blocks - indirect blocks pointed to
@@ -443,6 +537,11 @@ private:
     vmoid_t vmoid_{};
     vmoid_t vmoid_indirect_{};
 
+    // Blocks of the file which have been written into |vmo_|, but have no
+    // block yet.
+    bitmap::RleBitmap pending_{};
+    uint32_t pending_count_{};
+
     // Use the watcher container to implement a directory watcher
     void Notify(fbl::StringPiece name, unsigned event) final;
     zx_status_t WatchDir(fs::Vfs* vfs, const vfs_watch_dir_t* cmd) final;
@@ -456,6 +555,24 @@ private:
     fs::RemoteContainer remoter_{};
     fs::WatcherContainer watcher_{};
 #endif
+    // The extent map, for inodes with HasExtents().
+    struct ExtentLeaf {
+        blk_t bno;
+        uint32_t count;
+        // Block of the extent VMO which holds the leaf.  A block is only
+        // handed to another leaf once no transaction refers to it, since the
+        // transaction would write the new leaf over the old one's block.
+        uint32_t slot;
+    };
+    fbl::Vector<minfs_extent_t> extents_{};
+    fbl::Vector<ExtentLeaf> leaves_{};
+    bool extents_loaded_{};
+#ifdef __Fuchsia__
+    uint32_t next_leaf_slot_ = 1;
+    // Blocks of the extent VMO which no leaf holds any more.
+    fbl::Vector<uint32_t> free_leaf_slots_{};
+#endif
+
     // This field tracks the current number of file descriptors with
     // an open reference to this Vnode. Notably, this is distinct from the
     // VnodeMinfs's own refcount, since there may still be filesystem
@@ -16,6 +16,7 @@
 #include <fbl/macros.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
 
 #include <fs/block-txn.h>
 #include <fs/mapped-vmo.h>
@@ -24,6 +25,7 @@
 
 #include <minfs/bcache.h>
 #include <minfs/format.h>
+#include <minfs/journal.h>
 #include <minfs/queue.h>
 
 namespace minfs {
@@ -39,6 +41,7 @@ typedef struct {
     size_t vmo_offset;
     size_t dev_offset;
     size_t length;
+    bool journal;       // Metadata, which goes through the journal (if any)
 } write_request_t;
 
 class WritebackBuffer;
@@ -55,28 +58,62 @@ public:
     explicit WriteTxn(Bcache* bc) : bc_(bc) {}
     ~WriteTxn() {
         ZX_DEBUG_ASSERT_MSG(count_ == 0, "WriteTxn still has pending requests");
+        ZX_DEBUG_ASSERT_MSG(trims_.size() == 0, "WriteTxn still has pending trims");
     }
 
     // Identify that a block should be written to disk
     // as a later point in time.
     void Enqueue(zx_handle_t vmo, uint64_t relative_block, uint64_t absolute_block,
                  uint64_t nblocks);
+    // Like Enqueue, but for the contents of regular files, which are written
+    // in place rather than through the journal.
+    void EnqueueData(zx_handle_t vmo, uint64_t relative_block, uint64_t absolute_block,
+                     uint64_t nblocks);
     size_t Count() const { return count_; }
     write_request_t* Requests() { return &requests_[0]; }
 
+    // Identify that a range of blocks no longer holds anything worth keeping.
+    // Trims are sent after the writes of the transaction and the flush behind
+    // them, and skip any range the transaction wrote, so a block which is
+    // freed and allocated again within one transaction keeps its new
+    // contents.  Trimming is only a hint, so a range is only dropped if there
+    // is no memory left to remember it.
+    void Trim(uint64_t absolute_block, uint64_t nblocks);
+    size_t TrimCount() const { return trims_.size(); }
+    const block_fifo_request_t* Trims() const { return trims_.get(); }
+
     // Activate the transaction, writing it out to disk.
     //
     // Each transaction uses the |vmo| / |vmoid| pair supplied, since the
     // transactions should be all reading from a single in-memory buffer.
-    zx_status_t Flush(zx_handle_t vmo, vmoid_t vmoid);
+    //
+    // If |sync| is set, the transaction ends with a flush of the device, so
+    // it is on stable storage (along with everything written before it) once
+    // this returns.
+    zx_status_t Flush(zx_handle_t vmo, vmoid_t vmoid, bool sync);
 
     size_t BlkCount() const;
+    // The number of blocks which are enqueued as metadata.
+    size_t JournalBlkCount() const;
+
+    // Drops all the enqueued requests, once they have been written out by
+    // someone else.
+    void Clear() {
+        count_ = 0;
+        trims_.reset();
+    }
 
 private:
     friend class WritebackBuffer;
+    void EnqueueRequest(zx_handle_t vmo, uint64_t relative_block, uint64_t absolute_block,
+                        uint64_t nblocks, bool journal);
+
     Bcache* bc_;
     size_t count_ = 0;
     write_request_t requests_[MAX_TXN_MESSAGES];
+    // Unlike the writes, these can't be sent before the transaction is, so
+    // there is no bound on how many there may be.
+    fbl::Vector<block_fifo_request_t> trims_;
 };
 
 #else
@@ -107,12 +144,18 @@ public:
     // consumed.
     size_t Complete(zx_handle_t vmo, vmoid_t vmoid);
 
+    // Signals the completion (if any) and resets the WritebackWork, once the
+    // Journal has written out the enqueued work.
+    void Finish();
+
     // Adds a completion to the WritebackWork, such that it will be signalled
-    // when the WritebackWork is flushed to disk.
+    // when the WritebackWork, and all work enqueued before it, is on stable
+    // storage.
     // If no completion is set, nothing will get signalled.
     //
     // Only one completion may be set for each WritebackWork unit.
     void SetCompletion(completion_t* completion);
+    bool HasCompletion() const { return completion_ != nullptr; }
 #else
     void Complete();
 #endif
@@ -141,8 +184,15 @@ private:
 class WritebackBuffer {
 public:
     // Calls constructor, return an error if anything goes wrong.
+    //
+    // If a |journal| is supplied, the queued work is committed through it in
+    // batches; otherwise each unit of work is written out on its own.
     static zx_status_t Create(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer,
+                              fbl::unique_ptr<Journal> journal,
                               fbl::unique_ptr<WritebackBuffer>* out);
+
+    // The size of the buffer, in blocks.
+    size_t Capacity() const { return cap_; }
     ~WritebackBuffer();
 
     // Enqueues work into the writeback buffer.
@@ -156,7 +206,8 @@ public:
     void Enqueue(fbl::unique_ptr<WritebackWork> work) __TA_EXCLUDES(writeback_lock_);
 
 private:
-    WritebackBuffer(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer);
+    WritebackBuffer(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer,
+                    fbl::unique_ptr<Journal> journal);
 
     // Blocks until |blocks| blocks of data are free for the caller.
     // Returns |ZX_OK| with the lock still held in this case.
@@ -177,6 +228,11 @@ private:
 
     static int WritebackThread(void* arg);
 
+    // Commits as much of the queued work as fits in one journal entry,
+    // returning the number of blocks of the buffer it consumed.
+    // Called with the lock held, but releases it while the work is written.
+    size_t CommitBatchLocked() __TA_REQUIRES(writeback_lock_);
+
     // The waiter struct may be used as a stack-allocated queue for producers.
     // It allows them to take turns putting data into the buffer when it is
     // mostly full.
@@ -206,6 +262,7 @@ private:
     bool unmounting_ __TA_GUARDED(writeback_lock_){false};
     fbl::unique_ptr<MappedVmo> buffer_{};
     vmoid_t buffer_vmoid_ = VMOID_INVALID;
+    fbl::unique_ptr<Journal> journal_{};
     // The units of all the following are "MinFS blocks".
     size_t start_ __TA_GUARDED(writeback_lock_){};
     size_t len_ __TA_GUARDED(writeback_lock_){};
@@ -0,0 +1,533 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __Fuchsia__
+#include <zircon/syscalls.h>
+#endif
+
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fs/trace.h>
+#include <zircon/misc/fnv1hash.h>
+
+#include <minfs/journal.h>
+#include <minfs/minfs.h>
+#include <minfs/writeback.h>
+
+namespace minfs {
+namespace {
+
+// Continues an fnv1a32 hash with |len| more bytes.
+uint32_t checksum_update(uint32_t n, const void* ptr, size_t len) {
+    const uint8_t* data = static_cast<const uint8_t*>(ptr);
+    while (len-- > 0) {
+        n = (n ^ (*data++)) * FNV32_PRIME;
+    }
+    return n;
+}
+
+uint32_t info_checksum(const minfs_journal_info_t* jinfo) {
+    minfs_journal_info_t copy = *jinfo;
+    copy.checksum = 0;
+    return fnv1a32(&copy, sizeof(copy));
+}
+
+bool info_valid(const minfs_journal_info_t* jinfo, uint32_t ring_blocks) {
+    return (jinfo->magic == kMinfsJournalMagic) && (jinfo->start < ring_blocks) &&
+           (jinfo->checksum == info_checksum(jinfo));
+}
+
+void info_fill(void* blk, uint64_t seq, uint32_t start) {
+    memset(blk, 0, kMinfsBlockSize);
+    minfs_journal_info_t* jinfo = static_cast<minfs_journal_info_t*>(blk);
+    jinfo->magic = kMinfsJournalMagic;
+    jinfo->seq = seq;
+    jinfo->start = start;
+    jinfo->checksum = info_checksum(jinfo);
+}
+
+// Picks the first sequence number of a new journal, so that entries left on
+// the disk by an earlier filesystem can't be mistaken for its own.
+uint64_t random_seq() {
+    uint64_t seq = 0;
+#ifdef __Fuchsia__
+    size_t actual;
+    zx_cprng_draw(&seq, sizeof(seq), &actual);
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &seq, sizeof(seq)) != sizeof(seq)) {
+            seq = 0;
+        }
+        close(fd);
+    }
+    seq ^= static_cast<uint64_t>(time(nullptr)) << 32;
+#endif
+    return seq;
+}
+
+// Whether |info| describes a journal which fits the layout of the filesystem.
+bool journal_present(const minfs_info_t* info) {
+    return (info->magic0 == kMinfsMagic0) && (info->magic1 == kMinfsMagic1) &&
+           ((info->version == kMinfsVersion) || (info->version == kMinfsVersionBlockMap)) &&
+           (info->journal_block == kMinfsJournalStart) &&
+           (info->journal_block_count >= kMinfsMinJournalBlocks) &&
+           (info->journal_block + info->journal_block_count <= info->ibm_block);
+}
+
+// Returns the device block of position |pos| in the ring of entries.
+blk_t ring_block(const minfs_info_t* info, uint32_t pos) {
+    return info->journal_block + 1 + pos % (info->journal_block_count - 1);
+}
+
+} // namespace
+
+void minfs_journal_init(void* blk) {
+    info_fill(blk, random_seq(), 0);
+}
+
+zx_status_t minfs_journal_replay(Bcache* bc, const minfs_info_t* info) {
+    if (!journal_present(info)) {
+        // Either there is no journal, or the superblock is broken in a way
+        // which minfs_check_info will report.
+        return ZX_OK;
+    }
+#ifndef __Fuchsia__
+    if (bc->extent_lengths_.size() != 0) {
+        // Sparse images only hold the start of the journal; they are written
+        // by host tools, which never leave anything in it.
+        return ZX_OK;
+    }
+#endif
+
+    const uint32_t ring_blocks = info->journal_block_count - 1;
+    zx_status_t status;
+    uint8_t blk[kMinfsBlockSize];
+    if ((status = bc->Readblk(info->journal_block, blk)) != ZX_OK) {
+        return status;
+    }
+    minfs_journal_info_t jinfo;
+    memcpy(&jinfo, blk, sizeof(jinfo));
+    if (!info_valid(&jinfo, ring_blocks)) {
+        // The info block was never written (or was lost), so no entry can
+        // be trusted; the journal is started afresh on mount.
+        return ZX_OK;
+    }
+
+    // Committed entries follow one another from |start|, each carrying the
+    // next sequence number.  The first one which doesn't (or whose checksum
+    // doesn't match, because the crash interrupted it) ends the journal.
+    uint8_t header[kMinfsBlockSize];
+    minfs_journal_entry_t* entry = reinterpret_cast<minfs_journal_entry_t*>(header);
+    uint64_t seq = jinfo.seq;
+    uint32_t pos = jinfo.start;
+    uint32_t consumed = 0;
+    size_t entries = 0;
+    while (consumed + 2 <= ring_blocks) {
+        if ((status = bc->Readblk(ring_block(info, pos), header)) != ZX_OK) {
+            return status;
+        }
+        if ((entry->magic != kMinfsJournalEntryMagic) || (entry->seq != seq) ||
+            (entry->block_count == 0) || (entry->block_count > kMinfsJournalMaxEntryBlocks) ||
+            (consumed + 1 + entry->block_count > ring_blocks)) {
+            break;
+        }
+        bool valid = true;
+        for (uint32_t i = 0; i < entry->block_count; i++) {
+            blk_t target = entry->target[i];
+            if ((target != 0 && target < info->ibm_block) || target >= bc->Maxblk()) {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid) {
+            break;
+        }
+
+        uint32_t checksum = entry->checksum;
+        entry->checksum = 0;
+        uint32_t n = checksum_update(FNV32_OFFSET_BASIS, header, kMinfsBlockSize);
+        for (uint32_t i = 0; i < entry->block_count; i++) {
+            if ((status = bc->Readblk(ring_block(info, pos + 1 + i), blk)) != ZX_OK) {
+                return status;
+            }
+            n = checksum_update(n, blk, kMinfsBlockSize);
+        }
+        if (n != checksum) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < entry->block_count; i++) {
+            if ((status = bc->Readblk(ring_block(info, pos + 1 + i), blk)) != ZX_OK) {
+                return status;
+            }
+            if ((status = bc->Writeblk(entry->target[i], blk)) != ZX_OK) {
+                return status;
+            }
+        }
+        entries++;
+        seq++;
+        pos = (pos + 1 + entry->block_count) % ring_blocks;
+        consumed += 1 + entry->block_count;
+    }
+
+    if (entries == 0) {
+        return ZX_OK;
+    }
+    FS_TRACE_WARN("minfs: replayed %zu journal entries\n", entries);
+
+    // The replayed blocks must be on disk before the journal forgets them.
+    if (bc->Sync() != 0) {
+        return ZX_ERR_IO;
+    }
+    info_fill(blk, seq, pos);
+    if ((status = bc->Writeblk(info->journal_block, blk)) != ZX_OK) {
+        return status;
+    }
+    return bc->Sync() == 0 ? ZX_OK : ZX_ERR_IO;
+}
+
+#ifdef __Fuchsia__
+
+// Sends block requests to the device, as few transactions as possible at a
+// time, keeping the first error.
+class Journal::RequestBatch {
+public:
+    explicit RequestBatch(Bcache* bc) : bc_(bc) {}
+
+    // |vmo_block|, |dev_block| and |nblocks| are in units of blocks.
+    void Add(uint32_t opcode, vmoid_t vmoid, uint64_t vmo_block, uint64_t dev_block,
+             uint64_t nblocks) {
+        if (count_ == fbl::count_of(requests_)) {
+            Send();
+        }
+        block_fifo_request_t* request = &requests_[count_++];
+        request->txnid = bc_->TxnId();
+        request->vmoid = vmoid;
+        request->opcode = opcode;
+        request->vmo_offset = vmo_block * kMinfsBlockSize;
+        request->dev_offset = dev_block * kMinfsBlockSize;
+        request->length = nblocks * kMinfsBlockSize;
+    }
+
+    zx_status_t Send() {
+        if (count_ != 0) {
+            zx_status_t status = bc_->Txn(requests_, count_);
+            if (status_ == ZX_OK) {
+                status_ = status;
+            }
+            count_ = 0;
+        }
+        return status_;
+    }
+
+private:
+    Bcache* bc_;
+    block_fifo_request_t requests_[MAX_TXN_MESSAGES];
+    size_t count_ = 0;
+    zx_status_t status_ = ZX_OK;
+};
+
+zx_status_t Journal::Create(Bcache* bc, const minfs_info_t* info, size_t max_blocks,
+                            fbl::unique_ptr<Journal>* out) {
+    if (!journal_present(info)) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    zx_status_t status;
+    fbl::unique_ptr<MappedVmo> vmo;
+    if ((status = MappedVmo::Create(info->journal_block_count * kMinfsBlockSize,
+                                    "minfs-journal", &vmo)) != ZX_OK) {
+        return status;
+    }
+    fbl::AllocChecker ac;
+    fbl::Array<Block> blocks(new (&ac) Block[max_blocks], max_blocks);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    fbl::unique_ptr<Journal> journal(new (&ac) Journal(bc, info, fbl::move(vmo),
+                                                       fbl::move(blocks)));
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    if ((status = bc->AttachVmo(journal->vmo_->GetVmo(), &journal->vmoid_)) != ZX_OK) {
+        return status;
+    }
+
+    // Carry on from where the last mount (or replay) left off.
+    void* blk = journal->vmo_->GetData();
+    if ((status = bc->Readblk(journal->start_block_, blk)) != ZX_OK) {
+        return status;
+    }
+    const minfs_journal_info_t* jinfo = static_cast<const minfs_journal_info_t*>(blk);
+    if (!info_valid(jinfo, journal->ring_blocks_)) {
+        minfs_journal_init(blk);
+        if ((status = bc->Writeblk(journal->start_block_, blk)) != ZX_OK) {
+            return status;
+        } else if (bc->Sync() != 0) {
+            return ZX_ERR_IO;
+        }
+    }
+    journal->seq_ = jinfo->seq;
+    journal->head_ = jinfo->start;
+
+    *out = fbl::move(journal);
+    return ZX_OK;
+}
+
+Journal::Journal(Bcache* bc, const minfs_info_t* info, fbl::unique_ptr<MappedVmo> vmo,
+                 fbl::Array<Block> blocks) :
+    bc_(bc), start_block_(info->journal_block), ring_blocks_(info->journal_block_count - 1),
+    vmo_(fbl::move(vmo)), blocks_(fbl::move(blocks)) {}
+
+Journal::~Journal() {
+    if (vmoid_ != VMOID_INVALID) {
+        block_fifo_request_t request;
+        request.txnid = bc_->TxnId();
+        request.vmoid = vmoid_;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        bc_->Txn(&request, 1);
+    }
+}
+
+size_t Journal::Capacity() const {
+    size_t capacity = fbl::min(static_cast<size_t>(ring_blocks_ - 1), blocks_.size());
+    return fbl::min(capacity, static_cast<size_t>(kMinfsJournalMaxEntryBlocks));
+}
+
+size_t Journal::SortBlocks(size_t count) {
+    qsort(blocks_.get(), count, sizeof(Block), [](const void* a, const void* b) {
+        const Block* x = static_cast<const Block*>(a);
+        const Block* y = static_cast<const Block*>(b);
+        if (x->dev != y->dev) {
+            return x->dev < y->dev ? -1 : 1;
+        }
+        return x->order < y->order ? -1 : (x->order > y->order ? 1 : 0);
+    });
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && blocks_[i + 1].dev == blocks_[i].dev) {
+            continue;
+        }
+        blocks_[out++] = blocks_[i];
+    }
+    return out;
+}
+
+void Journal::AddWrites(RequestBatch* batch, size_t count, bool journal, vmoid_t vmoid) const {
+    size_t i = 0;
+    while (i < count) {
+        if (blocks_[i].journal != journal) {
+            i++;
+            continue;
+        }
+        size_t run = 1;
+        while (i + run < count && blocks_[i + run].journal == journal &&
+               blocks_[i + run].dev == blocks_[i].dev + run &&
+               blocks_[i + run].buf == blocks_[i].buf + run) {
+            run++;
+        }
+        batch->Add(BLOCKIO_WRITE, vmoid, blocks_[i].buf, blocks_[i].dev, run);
+        i += run;
+    }
+}
+
+zx_status_t Journal::Fail(zx_status_t status) {
+    if (!failed_) {
+        FS_TRACE_ERROR("minfs: journal write failed (%d); no further writes\n", status);
+        failed_ = true;
+    }
+    return status;
+}
+
+void Journal::Commit(fbl::unique_ptr<WritebackWork>* works, size_t count,
+                     const MappedVmo* buffer, vmoid_t vmoid) {
+    TRACE_DURATION("minfs", "Journal::Commit");
+    bool sync = false;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        WriteTxn* txn = works[i]->txn();
+        sync |= works[i]->HasCompletion();
+        for (size_t r = 0; r < txn->Count(); r++) {
+            const write_request_t& request = txn->Requests()[r];
+            for (size_t b = 0; b < request.length; b++) {
+                ZX_DEBUG_ASSERT(n < blocks_.size());
+                blocks_[n].dev = static_cast<blk_t>(request.dev_offset + b);
+                blocks_[n].buf = static_cast<uint32_t>(request.vmo_offset + b);
+                blocks_[n].order = static_cast<uint32_t>(n);
+                blocks_[n].journal = request.journal;
+                n++;
+            }
+        }
+    }
+    n = SortBlocks(n);
+
+    // A block which was journaled as metadata, and has since been freed and
+    // reused for file data, would be overwritten if the journal was replayed
+    // now, so the journal is emptied before the block is written.
+    uint32_t meta = 0;
+    bool reused = false;
+    for (size_t i = 0; i < n; i++) {
+        if (blocks_[i].journal) {
+            meta++;
+        } else if (live_.Get(blocks_[i].dev, blocks_[i].dev + 1)) {
+            reused = true;
+        }
+    }
+    if (reused || used_ + 1 + meta > ring_blocks_) {
+        Checkpoint();
+    }
+
+    if (!failed_) {
+        RequestBatch batch(bc_);
+        AddWrites(&batch, n, false, vmoid);
+        const bool journaled = meta != 0 && meta <= Capacity();
+        if (journaled) {
+            uint8_t* ring = static_cast<uint8_t*>(vmo_->GetData()) + kMinfsBlockSize;
+            const uint8_t* data = static_cast<const uint8_t*>(buffer->GetData());
+            minfs_journal_entry_t* entry =
+                reinterpret_cast<minfs_journal_entry_t*>(ring + head_ * kMinfsBlockSize);
+            memset(entry, 0, kMinfsBlockSize);
+            entry->magic = kMinfsJournalEntryMagic;
+            entry->seq = seq_;
+            entry->block_count = meta;
+            uint32_t k = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (blocks_[i].journal) {
+                    entry->target[k] = blocks_[i].dev;
+                    memcpy(ring + ((head_ + 1 + k) % ring_blocks_) * kMinfsBlockSize,
+                           data + static_cast<size_t>(blocks_[i].buf) * kMinfsBlockSize,
+                           kMinfsBlockSize);
+                    k++;
+                }
+            }
+            uint32_t checksum = checksum_update(FNV32_OFFSET_BASIS, entry, kMinfsBlockSize);
+            for (k = 0; k < meta; k++) {
+                checksum = checksum_update(checksum, ring + ((head_ + 1 + k) % ring_blocks_) *
+                                           kMinfsBlockSize, kMinfsBlockSize);
+            }
+            entry->checksum = checksum;
+
+            const uint32_t len = 1 + meta;
+            const uint32_t first = fbl::min(len, ring_blocks_ - head_);
+            batch.Add(BLOCKIO_WRITE, vmoid_, 1 + head_, start_block_ + 1 + head_, first);
+            if (first != len) {
+                batch.Add(BLOCKIO_WRITE, vmoid_, 1, start_block_ + 1, len - first);
+            }
+            sync = true;
+        } else if (meta != 0) {
+            // Too large for the journal: written in place, without the
+            // guarantee that it happens atomically.
+            AddWrites(&batch, n, true, vmoid);
+            sync = true;
+        }
+        if (sync) {
+            // The flush is a barrier, so it also covers the writes ahead of
+            // it in this transaction.
+            batch.Add(BLOCKIO_SYNC, VMOID_INVALID, 0, 0, 0);
+        }
+        zx_status_t status = batch.Send();
+        if (status != ZX_OK) {
+            Fail(status);
+        } else if (journaled) {
+            // The entry is on disk, so the metadata may go to its home
+            // location.  Those writes reach stable storage with the next
+            // flush; until then, replay would redo them.
+            RequestBatch home(bc_);
+            AddWrites(&home, n, true, vmoid);
+            if ((status = home.Send()) != ZX_OK) {
+                Fail(status);
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (blocks_[i].journal &&
+                    live_.Set(blocks_[i].dev, blocks_[i].dev + 1) != ZX_OK) {
+                    // Without a record of the block, the journal has to be
+                    // emptied before anything else is written.
+                    used_ = ring_blocks_;
+                }
+            }
+
+            const uint32_t len = 1 + meta;
+            const uint32_t first = fbl::min(len, ring_blocks_ - head_);
+            ZX_ASSERT(zx_vmo_op_range(vmo_->GetVmo(), ZX_VMO_OP_DECOMMIT,
+                                      (1 + head_) * kMinfsBlockSize, first * kMinfsBlockSize,
+                                      nullptr, 0) == ZX_OK);
+            if (first != len) {
+                ZX_ASSERT(zx_vmo_op_range(vmo_->GetVmo(), ZX_VMO_OP_DECOMMIT, kMinfsBlockSize,
+                                          (len - first) * kMinfsBlockSize, nullptr, 0) == ZX_OK);
+            }
+            head_ = (head_ + len) % ring_blocks_;
+            seq_++;
+            used_ = fbl::min(used_ + len, ring_blocks_);
+        }
+    }
+
+    // Trims go out last, and leave alone any block this batch wrote, which
+    // may have been freed and allocated again.  A failed trim costs nothing
+    // but the hint, so it is ignored.
+    if (!failed_) {
+        RequestBatch trims(bc_);
+        for (size_t i = 0; i < count; i++) {
+            WriteTxn* txn = works[i]->txn();
+            for (size_t t = 0; t < txn->TrimCount(); t++) {
+                const block_fifo_request_t& trim = txn->Trims()[t];
+                size_t lo = 0;
+                size_t hi = n;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (blocks_[mid].dev < trim.dev_offset) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                if (lo < n && blocks_[lo].dev < trim.dev_offset + trim.length) {
+                    continue;
+                }
+                trims.Add(BLOCKIO_TRIM, VMOID_INVALID, 0, trim.dev_offset, trim.length);
+            }
+        }
+        trims.Send();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        works[i]->Finish();
+    }
+}
+
+zx_status_t Journal::Checkpoint() {
+    if (failed_) {
+        return ZX_ERR_BAD_STATE;
+    } else if (used_ == 0) {
+        return ZX_OK;
+    }
+    TRACE_DURATION("minfs", "Journal::Checkpoint");
+
+    // Everything written home so far must be on disk before the journal
+    // forgets about it; the flushes on either side of the info block are
+    // barriers.
+    info_fill(vmo_->GetData(), seq_, head_);
+    RequestBatch batch(bc_);
+    batch.Add(BLOCKIO_SYNC, VMOID_INVALID, 0, 0, 0);
+    batch.Add(BLOCKIO_WRITE, vmoid_, 0, start_block_, 1);
+    batch.Add(BLOCKIO_SYNC, VMOID_INVALID, 0, 0, 0);
+    zx_status_t status = batch.Send();
+    if (status != ZX_OK) {
+        return Fail(status);
+    }
+    used_ = 0;
+    live_.ClearAll();
+    return ZX_OK;
+}
+
+#endif  // __Fuchsia__
+
+} // namespace minfs
@@ -24,6 +24,7 @@
 #endif
 
 #include <minfs/fsck.h>
+#include <minfs/journal.h>
 #include <minfs/minfs.h>
 
 // #define DEBUG_PRINTF
@@ -74,6 +75,8 @@ void minfs_dump_info(const minfs_info_t* info) {
     xprintf("minfs: inodes:  %10u (size %u)\n", info->inode_count, info->inode_size);
     xprintf("minfs: allocated blocks  @ %10u\n", info->alloc_block_count);
     xprintf("minfs: allocated inodes  @ %10u\n", info->alloc_inode_count);
+    xprintf("minfs: journal      @ %10u (%u blocks)\n", info->journal_block,
+            info->journal_block_count);
     xprintf("minfs: inode bitmap @ %10u\n", info->ibm_block);
     xprintf("minfs: alloc bitmap @ %10u\n", info->abm_block);
     xprintf("minfs: inode table  @ %10u\n", info->ino_block);
@@ -97,7 +100,8 @@ zx_status_t minfs_check_info(const minfs_info_t* info, Bcache* bc) {
         FS_TRACE_ERROR("minfs: bad magic\n");
         return ZX_ERR_INVALID_ARGS;
     }
-    if (info->version != kMinfsVersion) {
+    if (info->version != kMinfsVersion && info->version != kMinfsVersionBlockMap &&
+        info->version != kMinfsVersionNoJournal) {
         FS_TRACE_ERROR("minfs: FS Version: %08x. Driver version: %08x\n", info->version,
               kMinfsVersion);
         return ZX_ERR_INVALID_ARGS;
@@ -107,6 +111,19 @@ zx_status_t minfs_check_info(const minfs_info_t* info, Bcache* bc) {
         FS_TRACE_ERROR("minfs: bsz/isz %u/%u unsupported\n", info->block_size, info->inode_size);
         return ZX_ERR_INVALID_ARGS;
     }
+    if ((info->version == kMinfsVersionNoJournal) &&
+        ((info->journal_block != 0) || (info->journal_block_count != 0))) {
+        FS_TRACE_ERROR("minfs: version %08x cannot have a journal\n", info->version);
+        return ZX_ERR_INVALID_ARGS;
+    }
+    if ((info->journal_block_count != 0) &&
+        ((info->journal_block != kMinfsJournalStart) ||
+         (info->journal_block_count < kMinfsMinJournalBlocks) ||
+         (info->journal_block + info->journal_block_count > info->ibm_block))) {
+        FS_TRACE_ERROR("minfs: invalid journal (%u blocks @ %u)\n", info->journal_block_count,
+                       info->journal_block);
+        return ZX_ERR_INVALID_ARGS;
+    }
     if ((info->flags & kMinfsFlagFVM) == 0) {
         if (info->dat_block + info->block_count > max) {
             FS_TRACE_ERROR("minfs: too large for device\n");
@@ -114,6 +131,10 @@ zx_status_t minfs_check_info(const minfs_info_t* info, Bcache* bc) {
         }
     } else {
         const size_t kBlocksPerSlice = info->slice_size / kMinfsBlockSize;
+        if (info->journal_block + info->journal_block_count > kBlocksPerSlice) {
+            FS_TRACE_ERROR("minfs: Journal does not fit in the first slice\n");
+            return ZX_ERR_INVALID_ARGS;
+        }
 #ifdef __Fuchsia__
         fvm_info_t fvm_info;
         if (bc->FVMQuery(&fvm_info) != ZX_OK) {
@@ -259,7 +280,15 @@ zx_status_t Minfs::InodeSync(WriteTxn* txn, ino_t ino, const minfs_inode_t* inod
 
 #ifdef __Fuchsia__
 zx_status_t Minfs::Sync(completion_t* completion) {
+    zx_status_t status;
     fbl::unique_ptr<WritebackWork> wb(new WritebackWork(bc_.get()));
+    if ((status = AllocatePending()) != ZX_OK) {
+        // Write back everything else, but don't claim the data which couldn't
+        // be allocated is on disk.
+        FS_TRACE_ERROR("minfs: Failed to write back some files: %d\n", status);
+        EnqueueWork(fbl::move(wb));
+        return status;
+    }
     wb->SetCompletion(completion);
     EnqueueWork(fbl::move(wb));
     return ZX_OK;
@@ -313,6 +342,13 @@ zx_status_t Minfs::InoFree(VnodeMinfs* vn, WriteTxn* txn) {
 
     blk_t bitbno = vn->ino_ / kMinfsBlockBits;
     txn->Enqueue(ibm_id, bitbno, info_.ibm_block + bitbno, 1);
+
+    if (vn->HasExtents()) {
+        zx_status_t status = vn->ExtentsFree(txn);
+        CountUpdate(txn);
+        return status;
+    }
+
     uint32_t block_count = vn->inode_.block_count;
 
     // release all direct blocks
@@ -700,7 +736,12 @@ zx_status_t Minfs::VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) {
 }
 
 zx_status_t Minfs::BlockFree(WriteTxn* txn, blk_t bno) {
+    return BlocksFree(txn, bno, 1);
+}
+
+zx_status_t Minfs::BlocksFree(WriteTxn* txn, blk_t bno, blk_t count) {
     ValidateBno(bno);
+    ValidateBno(bno + count - 1);
 
 #ifdef __Fuchsia__
     auto bbm_id = block_map_.StorageUnsafe()->GetVmo();
@@ -708,22 +749,65 @@ zx_status_t Minfs::BlockFree(WriteTxn* txn, blk_t bno) {
     auto bbm_id = block_map_.StorageUnsafe()->GetData();
 #endif
 
-    block_map_.Clear(bno, bno + 1);
-    info_.alloc_block_count--;
+    block_map_.Clear(bno, bno + count);
+    info_.alloc_block_count -= count;
     blk_t bitbno = bno / kMinfsBlockBits;
-    txn->Enqueue(bbm_id, bitbno, info_.abm_block + bitbno, 1);
+    blk_t bitbno_end = (bno + count - 1) / kMinfsBlockBits + 1;
+    txn->Enqueue(bbm_id, bitbno, info_.abm_block + bitbno, bitbno_end - bitbno);
+    if (bc_->TrimSupported()) {
+        txn->Trim(info_.dat_block + bno, count);
+    }
     return CountUpdate(txn);
 }
 
+#ifdef __Fuchsia__
+// A few blocks are kept back from reservations, for the extent leaves which
+// are needed when the reserved blocks are allocated.
+constexpr uint32_t kMinfsReserveSlack = 8;
+#endif
+
 // Allocate a new data block from the block bitmap.
 //
 // If hint is nonzero it indicates which block number to start the search for
 // free blocks from.
 zx_status_t Minfs::BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno) {
+    blk_t count;
+    return BlocksNew(txn, hint, 1, BlockReserve::kNone, out_bno, &count);
+}
+
+// Allocate a run of new data blocks from the block bitmap.
+//
+// The run starts at |hint| if that block is free, so that it carries on from
+// whatever was allocated before it.  Otherwise, the first run of |count| free
+// blocks after |hint| is used, or failing that, the first free block at all.
+zx_status_t Minfs::BlocksNew(WriteTxn* txn, blk_t hint, blk_t count, BlockReserve reserve,
+                             blk_t* out_bno, blk_t* out_count) {
+    ZX_DEBUG_ASSERT(count > 0);
+#ifdef __Fuchsia__
+    // Stay clear of the blocks promised to data which hasn't been allocated
+    // yet, so that allocating it later can't run out of space.
+    uint32_t keep = 0;
+    if (reserve != BlockReserve::kAll && reserved_blocks_ > 0) {
+        keep = reserved_blocks_ + (reserve == BlockReserve::kNone ? kMinfsReserveSlack : 0);
+    }
+    while (info_.alloc_block_count + keep >= info_.block_count) {
+        if (AddBlocks() != ZX_OK) {
+            return ZX_ERR_NO_SPACE;
+        }
+    }
+    count = fbl::min(count, info_.block_count - info_.alloc_block_count - keep);
+#endif
+    if (hint >= block_map_.size()) {
+        hint = 0;
+    }
+
     size_t bitoff_start;
     zx_status_t status;
-    if ((status = block_map_.Find(false, hint, block_map_.size(), 1, &bitoff_start)) != ZX_OK) {
-        if ((status = block_map_.Find(false, 0, hint, 1, &bitoff_start)) != ZX_OK) {
+    if (hint != 0 && !block_map_.Get(hint, hint + 1)) {
+        bitoff_start = hint;
+    } else if ((status = block_map_.Find(false, hint, block_map_.size(), count,
+                                         &bitoff_start)) != ZX_OK) {
+        if ((status = block_map_.Find(false, 0, block_map_.size(), 1, &bitoff_start)) != ZX_OK) {
             size_t old_size = block_map_.size();
             if ((status = AddBlocks()) != ZX_OK) {
                 return status;
@@ -734,29 +818,86 @@ zx_status_t Minfs::BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno) {
         }
     }
 
-    status = block_map_.Set(bitoff_start, bitoff_start + 1);
+    size_t bitoff_end = block_map_.Scan(bitoff_start,
+                                        fbl::min(bitoff_start + count, block_map_.size()), false);
+    status = block_map_.Set(bitoff_start, bitoff_end);
     assert(status == ZX_OK);
-    info_.alloc_block_count++;
     blk_t bno = static_cast<blk_t>(bitoff_start);
+    blk_t allocated = static_cast<blk_t>(bitoff_end - bitoff_start);
+    info_.alloc_block_count += allocated;
     ValidateBno(bno);
 
-    // obtain the in-memory bitmap block
+    // obtain the in-memory bitmap blocks
     blk_t bmbno_rel = bno / kMinfsBlockBits;       // bmbno relative to bitmap
+    blk_t bmbno_end = (bno + allocated - 1) / kMinfsBlockBits + 1;
     blk_t bmbno_abs = info_.abm_block + bmbno_rel; // bmbno relative to block device
 
 // commit the bitmap
 #ifdef __Fuchsia__
-    txn->Enqueue(block_map_.StorageUnsafe()->GetVmo(), bmbno_rel, bmbno_abs, 1);
+    txn->Enqueue(block_map_.StorageUnsafe()->GetVmo(), bmbno_rel, bmbno_abs,
+                 bmbno_end - bmbno_rel);
 #else
-    void* bmdata = fs::GetBlock<kMinfsBlockSize>(block_map_.StorageUnsafe()->GetData(), bmbno_rel);
-    bc_->Writeblk(bmbno_abs, bmdata);
+    for (blk_t n = bmbno_rel; n < bmbno_end; n++) {
+        void* bmdata = fs::GetBlock<kMinfsBlockSize>(block_map_.StorageUnsafe()->GetData(), n);
+        bc_->Writeblk(info_.abm_block + n, bmdata);
+    }
 #endif
     *out_bno = bno;
+    *out_count = allocated;
 
     CountUpdate(txn);
     return ZX_OK;
 }
 
+#ifdef __Fuchsia__
+zx_status_t Minfs::BlocksReserve(uint32_t count) {
+    while (info_.alloc_block_count + reserved_blocks_ + count + kMinfsReserveSlack >
+           info_.block_count) {
+        if (AddBlocks() != ZX_OK) {
+            return ZX_ERR_NO_SPACE;
+        }
+    }
+    reserved_blocks_ += count;
+    return ZX_OK;
+}
+
+void Minfs::BlocksUnreserve(uint32_t count) {
+    ZX_DEBUG_ASSERT(reserved_blocks_ >= count);
+    reserved_blocks_ -= count;
+}
+
+zx_status_t Minfs::AddPendingVnode(fbl::RefPtr<VnodeMinfs> vn) {
+    fbl::AllocChecker ac;
+    pending_vnodes_.push_back(fbl::move(vn), &ac);
+    return ac.check() ? ZX_OK : ZX_ERR_NO_MEMORY;
+}
+
+void Minfs::RemovePendingVnode(VnodeMinfs* vn) {
+    for (size_t i = 0; i < pending_vnodes_.size(); i++) {
+        if (pending_vnodes_[i].get() == vn) {
+            pending_vnodes_.erase(i);
+            return;
+        }
+    }
+}
+
+zx_status_t Minfs::AllocatePending() {
+    zx_status_t result = ZX_OK;
+    size_t i = 0;
+    while (i < pending_vnodes_.size()) {
+        // Hold on to the vnode, since allocating all of its blocks drops it
+        // from the list.  Vnodes which fail keep their place.
+        fbl::RefPtr<VnodeMinfs> vn = pending_vnodes_[i];
+        zx_status_t status = vn->AllocatePending();
+        if (status != ZX_OK) {
+            result = status;
+            i++;
+        }
+    }
+    return result;
+}
+#endif
+
 zx_status_t Minfs::CountUpdate(WriteTxn* txn) {
     zx_status_t status = ZX_OK;
 
@@ -895,7 +1036,15 @@ zx_status_t Minfs::Create(Minfs** out, fbl::unique_ptr<Bcache> bc, const minfs_i
         return status;
     }
 
-    if ((status = WritebackBuffer::Create(fs->bc_.get(), fbl::move(buffer),
+    fbl::unique_ptr<Journal> journal;
+    if (fs->info_.journal_block_count != 0 &&
+        (status = Journal::Create(fs->bc_.get(), &fs->info_, kWriteBufferSize / kMinfsBlockSize,
+                                  &journal)) != ZX_OK) {
+        FS_TRACE_ERROR("Minfs::Create failed to create journal: %d\n", status);
+        return status;
+    }
+
+    if ((status = WritebackBuffer::Create(fs->bc_.get(), fbl::move(buffer), fbl::move(journal),
                                           &fs->writeback_)) != ZX_OK) {
         return status;
     }
@@ -914,6 +1063,9 @@ zx_status_t Minfs::Create(Minfs** out, fbl::unique_ptr<Bcache> bc, const minfs_i
         }
     }
 #endif
+    // The bitmaps were read straight into their storage.
+    fs->block_map_.RecomputeSummary();
+    fs->inode_map_.RecomputeSummary();
 
     *out = fs.release();
     return ZX_OK;
@@ -930,6 +1082,17 @@ zx_status_t minfs_mount(fbl::RefPtr<VnodeMinfs>* out, fbl::unique_ptr<Bcache> bc
     }
     const minfs_info_t* info = reinterpret_cast<minfs_info_t*>(blk);
 
+    // The journal may hold newer metadata than the disk, including a newer
+    // info block.
+    if ((status = minfs_journal_replay(bc.get(), info)) != ZX_OK) {
+        FS_TRACE_ERROR("minfs: could not replay journal\n");
+        return status;
+    }
+    if ((status = bc->Readblk(0, &blk)) != ZX_OK) {
+        FS_TRACE_ERROR("minfs: could not read info block\n");
+        return status;
+    }
+
     Minfs* fs;
     if ((status = Minfs::Create(&fs, fbl::move(bc), info)) != ZX_OK) {
         FS_TRACE_ERROR("minfs: mount failed\n");
@@ -977,6 +1140,7 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
 
     uint32_t blocks = 0;
     uint32_t inodes = 0;
+    uint32_t journal_blocks = 0;
 
 #ifdef __Fuchsia__
     fvm_info_t fvm_info;
@@ -1030,12 +1194,21 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
 
         inodes = static_cast<uint32_t>(info.ino_slices * info.slice_size / kMinfsInodeSize);
         blocks = static_cast<uint32_t>(info.dat_slices * info.slice_size / kMinfsBlockSize);
+        // The journal shares the first slice with the superblock.
+        journal_blocks = fbl::min(kMinfsDefaultJournalBlocks,
+                                  static_cast<uint32_t>(kBlocksPerSlice - kMinfsJournalStart));
     }
 #endif
     if ((info.flags & kMinfsFlagFVM) == 0) {
         inodes = 32768;
         blocks = bc->Maxblk();
+        journal_blocks = fbl::min(kMinfsDefaultJournalBlocks, blocks / 64);
     }
+    if (journal_blocks < kMinfsMinJournalBlocks) {
+        journal_blocks = 0;
+    }
+    info.journal_block = journal_blocks ? kMinfsJournalStart : 0;
+    info.journal_block_count = journal_blocks;
 
     // determine how many blocks of inodes, allocation bitmaps,
     // and inode bitmaps there are
@@ -1048,7 +1221,8 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
     info.alloc_inode_count = 0;
     if ((info.flags & kMinfsFlagFVM) == 0) {
         // Aligning distinct data areas to 8 block groups.
-        uint32_t non_dat_blocks = (8 + fbl::round_up(ibmblks, 8u) + inoblks);
+        uint32_t ibm_block = fbl::round_up(kMinfsJournalStart + journal_blocks, 8u);
+        uint32_t non_dat_blocks = (ibm_block + fbl::round_up(ibmblks, 8u) + inoblks);
         if (non_dat_blocks >= blocks) {
             fprintf(stderr, "mkfs: Partition size (%" PRIu64 " bytes) is too small\n",
                     static_cast<uint64_t>(blocks) * kMinfsBlockSize);
@@ -1058,7 +1232,7 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
         uint32_t dat_block_count = blocks - non_dat_blocks;
         abmblks = (dat_block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
         info.block_count = dat_block_count - fbl::round_up(abmblks, 8u);
-        info.ibm_block = 8;
+        info.ibm_block = ibm_block;
         info.abm_block = info.ibm_block + fbl::round_up(ibmblks, 8u);
         info.ino_block = info.abm_block + fbl::round_up(abmblks, 8u);
         info.dat_block = info.ino_block + inoblks;
@@ -1145,9 +1319,18 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 2;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = 1;
+    ino[kMinfsRootIno].flags = kMinfsInodeFlagExtents;
+    ino[kMinfsRootIno].extent_count = 1;
+    ino[kMinfsRootIno].extents[0].start = 0;
+    ino[kMinfsRootIno].extents[0].bno = 1;
+    ino[kMinfsRootIno].extents[0].count = 1;
     bc->Writeblk(info.ino_block, blk);
 
+    if (info.journal_block_count != 0) {
+        minfs_journal_init(blk);
+        bc->Writeblk(info.journal_block, blk);
+    }
+
     memset(blk, 0, sizeof(blk));
     memcpy(blk, &info, sizeof(info));
     bc->Writeblk(0, blk);
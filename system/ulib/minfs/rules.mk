@@ -10,6 +10,8 @@ MODULE_TYPE := userlib
 
 COMMON_SRCS := \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/extents.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/vnode.cpp \
     $(LOCAL_DIR)/writeback.cpp \
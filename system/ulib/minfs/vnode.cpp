@@ -39,6 +39,17 @@ zx_time_t minfs_gettime_utc() {
     return time;
 }
 
+#ifdef __Fuchsia__
+// The most blocks a file keeps in memory before allocating them, which is
+// also the most file data written back by a single unit of work.
+constexpr uint32_t kMinfsMaxPendingBlocks = 512;
+
+// The most requests a single extent allocation may add to a transaction:
+// the data, three updates of the block bitmap, the superblock, three
+// extent leaves, the extent index and the inode.
+constexpr size_t kMinfsAllocationRequests = 10;
+#endif
+
 } // namespace anonymous
 
 namespace minfs {
@@ -208,6 +219,10 @@ zx_status_t VnodeMinfs::BlocksShrinkDoublyIndirect(WriteTxn *txn, uint32_t ibind
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 zx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, blk_t start) {
+    if (HasExtents()) {
+        return ExtentsShrink(txn, start);
+    }
+
     bool dirty = false;
     zx_status_t status = ZX_OK;
     size_t size = (kMinfsIndirect + kMinfsDoublyIndirect) * kMinfsBlockSize;
@@ -375,6 +390,17 @@ zx_status_t VnodeMinfs::InitVmo() {
     }
     ReadTxn txn(fs_->bc_.get());
 
+    if (HasExtents()) {
+        if ((status = ExtentsLoad()) != ZX_OK) {
+            vmo_.reset();
+            return status;
+        }
+        EnqueueExtentReads(&txn);
+        status = txn.Flush();
+        ValidateVmoTail();
+        return status;
+    }
+
     // Initialize all direct blocks
     blk_t bno;
     for (uint32_t d = 0; d < kMinfsDirect; d++) {
@@ -625,6 +651,10 @@ void VnodeMinfs::ClearIndirectBlock(blk_t bno) {
 
 // Get the bno corresponding to the nth logical block within the file.
 zx_status_t VnodeMinfs::GetBno(WriteTxn* txn, blk_t n, blk_t* bno) {
+    if (HasExtents()) {
+        return GetBnoExtents(txn, n, bno);
+    }
+
     bool dirty = false;
 
     if (n < kMinfsDirect) {
@@ -1129,8 +1159,9 @@ void VnodeMinfs::Purge(WriteTxn* txn) {
         fbl::AutoLock lock(&fs_->hash_lock_);
         fs_->VnodeReleaseLocked(this);
     }
+    DropPending();
     // TODO(smklein): Only init indirect vmo if it's needed
-    if (InitIndirectVmo() == ZX_OK) {
+    if (HasExtents() || InitIndirectVmo() == ZX_OK) {
         fs_->InoFree(this, txn);
     } else {
         fprintf(stderr, "minfs: Failed to Init Indirect VMO while purging %u\n", ino_);
@@ -1150,6 +1181,16 @@ zx_status_t VnodeMinfs::Close() {
         Purge(wb->txn());
         fs_->EnqueueWork(fbl::move(wb));
     }
+#ifdef __Fuchsia__
+    if (fd_count_ == 0 && pending_count_ > 0) {
+        // Nothing else is likely to be written next to the file's data now.
+        zx_status_t status;
+        if ((status = AllocatePending()) != ZX_OK) {
+            FS_TRACE_ERROR("minfs: ino#%u: Failed to allocate blocks: %d\n", ino_, status);
+            return status;
+        }
+    }
+#endif
     return ZX_OK;
 }
 
@@ -1246,6 +1287,15 @@ zx_status_t VnodeMinfs::Write(const void* data, size_t len, size_t offset,
         wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
         fs_->EnqueueWork(fbl::move(wb));
     }
+#ifdef __Fuchsia__
+    if (pending_count_ >= kMinfsMaxPendingBlocks) {
+        // The data has been written into the VMO, so a failure here only
+        // delays its allocation until the next attempt.
+        if ((status = AllocatePending()) != ZX_OK) {
+            FS_TRACE_ERROR("minfs: ino#%u: Failed to allocate blocks: %d\n", ino_, status);
+        }
+    }
+#endif
     return ZX_OK;
 }
 
@@ -1300,11 +1350,19 @@ zx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
 
         // Update this block on-disk
         blk_t bno;
-        if ((status = GetBno(txn, n, &bno)) != ZX_OK) {
+        if ((status = GetBno(DelaysAllocation() ? nullptr : txn, n, &bno)) != ZX_OK) {
             goto done;
         }
-        ZX_DEBUG_ASSERT(bno != 0);
-        txn->Enqueue(vmo_.get(), n, bno + fs_->info_.dat_block, 1);
+        if (bno == 0) {
+            ZX_DEBUG_ASSERT(DelaysAllocation());
+            if ((status = DelayAllocation(n)) != ZX_OK) {
+                goto done;
+            }
+        } else if (IsDirectory()) {
+            txn->Enqueue(vmo_.get(), n, bno + fs_->info_.dat_block, 1);
+        } else {
+            txn->EnqueueData(vmo_.get(), n, bno + fs_->info_.dat_block, 1);
+        }
 #else
         blk_t bno;
         if ((status = GetBno(txn, n, &bno)) != ZX_OK) {
@@ -1350,6 +1408,94 @@ done:
     return ZX_OK;
 }
 
+#ifdef __Fuchsia__
+zx_status_t VnodeMinfs::DelayAllocation(blk_t n) {
+    if (pending_.Get(n, n + 1)) {
+        return ZX_OK;
+    }
+
+    zx_status_t status;
+    if ((status = fs_->BlocksReserve(1)) != ZX_OK) {
+        return status;
+    }
+    if (pending_count_ == 0 &&
+        (status = fs_->AddPendingVnode(fbl::WrapRefPtr(this))) != ZX_OK) {
+        fs_->BlocksUnreserve(1);
+        return status;
+    }
+    if ((status = pending_.Set(n, n + 1)) != ZX_OK) {
+        fs_->BlocksUnreserve(1);
+        if (pending_count_ == 0) {
+            fs_->RemovePendingVnode(this);
+        }
+        return status;
+    }
+    pending_count_++;
+    return ZX_OK;
+}
+
+void VnodeMinfs::DropPending() {
+    if (pending_count_ == 0) {
+        return;
+    }
+    fs_->BlocksUnreserve(pending_count_);
+    pending_.ClearAll();
+    pending_count_ = 0;
+    fs_->RemovePendingVnode(this);
+}
+
+zx_status_t VnodeMinfs::AllocatePending() {
+    TRACE_DURATION("minfs", "VnodeMinfs::AllocatePending", "ino", ino_, "blocks",
+                   pending_count_);
+    zx_status_t status = ZX_OK;
+    fbl::unique_ptr<WritebackWork> wb;
+    uint32_t wb_blocks = 0;
+    while (pending_count_ > 0) {
+        if (wb == nullptr) {
+            fbl::AllocChecker ac;
+            wb.reset(new (&ac) WritebackWork(fs_->bc_.get()));
+            if (!ac.check()) {
+                status = ZX_ERR_NO_MEMORY;
+                break;
+            }
+            wb_blocks = 0;
+        }
+
+        // Map as much of the first run as possible with a single extent.
+        const blk_t n = static_cast<blk_t>(pending_.begin()->bitoff);
+        const blk_t count = static_cast<blk_t>(
+                fbl::min<size_t>(pending_.begin()->bitlen, kMinfsMaxPendingBlocks - wb_blocks));
+        blk_t mapped;
+        blk_t bno;
+        if ((status = ExtentsAllocate(wb->txn(), n, count, Minfs::BlockReserve::kAll,
+                                      &mapped)) != ZX_OK ||
+            (status = GetBnoExtents(nullptr, n, &bno)) != ZX_OK) {
+            break;
+        }
+        wb->txn()->EnqueueData(vmo_.get(), n, bno + fs_->info_.dat_block, mapped);
+        pending_.Clear(n, n + mapped);
+        pending_count_ -= mapped;
+        fs_->BlocksUnreserve(mapped);
+        wb_blocks += mapped;
+
+        if (wb_blocks == kMinfsMaxPendingBlocks ||
+            wb->txn()->Count() + kMinfsAllocationRequests >= MAX_TXN_MESSAGES - 1) {
+            wb->PinVnode(fbl::WrapRefPtr(this));
+            fs_->EnqueueWork(fbl::move(wb));
+        }
+    }
+    if (wb != nullptr && wb->txn()->Count() > 0) {
+        wb->PinVnode(fbl::WrapRefPtr(this));
+        fs_->EnqueueWork(fbl::move(wb));
+    }
+
+    if (pending_count_ == 0) {
+        fs_->RemovePendingVnode(this);
+    }
+    return status;
+}
+#endif
+
 zx_status_t VnodeMinfs::Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name) {
     TRACE_DURATION("minfs", "VnodeMinfs::Lookup", "name", name);
     ZX_DEBUG_ASSERT(fs::vfs_valid_name(name));
@@ -1384,7 +1530,12 @@ zx_status_t VnodeMinfs::Getattr(vnattr_t* a) {
     a->inode = ino_;
     a->size = inode_.size;
     a->blksize = kMinfsBlockSize;
-    a->blkcount = inode_.block_count * (kMinfsBlockSize / VNATTR_BLKSIZE);
+    uint32_t block_count = inode_.block_count;
+#ifdef __Fuchsia__
+    // Blocks which are still to be allocated are in use already.
+    block_count += pending_count_;
+#endif
+    a->blkcount = block_count * (kMinfsBlockSize / VNATTR_BLKSIZE);
     a->nlink = inode_.link_count;
     a->create_time = inode_.create_time;
     a->modify_time = inode_.modify_time;
@@ -1524,6 +1675,9 @@ zx_status_t VnodeMinfs::Allocate(Minfs* fs, uint32_t type, fbl::RefPtr<VnodeMinf
     (*out)->inode_.magic = MinfsMagic(type);
     (*out)->inode_.create_time = (*out)->inode_.modify_time = minfs_gettime_utc();
     (*out)->inode_.link_count = (type == kMinfsTypeDir ? 2 : 1);
+    if (fs->ExtentsSupported()) {
+        (*out)->inode_.flags = kMinfsInodeFlagExtents;
+    }
     return ZX_OK;
 }
 
@@ -1681,12 +1835,21 @@ zx_status_t VnodeMinfs::Truncate(size_t len) {
         return ZX_ERR_NOT_FILE;
     }
 
+    zx_status_t status;
+#ifdef __Fuchsia__
+    // Give the blocks which are still pending a home first, so that the
+    // truncation sees the whole file.
+    if ((status = AllocatePending()) != ZX_OK) {
+        return status;
+    }
+#endif
+
     fbl::AllocChecker ac;
     fbl::unique_ptr<WritebackWork> wb(new (&ac) WritebackWork(fs_->bc_.get()));
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
     }
-    zx_status_t status = TruncateInternal(wb->txn(), len);
+    status = TruncateInternal(wb->txn(), len);
     if (status == ZX_OK) {
         // Successful truncates update inode
         InodeSync(wb->txn(), kMxFsSyncMtime);
@@ -1742,7 +1905,11 @@ zx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
                 if ((r = VmoWriteExact(bdata, len - adjust, kMinfsBlockSize)) != ZX_OK) {
                     return ZX_ERR_IO;
                 }
-                txn->Enqueue(vmo_.get(), rel_bno, bno + fs_->info_.dat_block, 1);
+                if (IsDirectory()) {
+                    txn->Enqueue(vmo_.get(), rel_bno, bno + fs_->info_.dat_block, 1);
+                } else {
+                    txn->EnqueueData(vmo_.get(), rel_bno, bno + fs_->info_.dat_block, 1);
+                }
 #else
                 if (fs_->bc_->Readblk(bno + fs_->info_.dat_block, bdata)) {
                     return ZX_ERR_IO;
@@ -1933,9 +2100,6 @@ zx_status_t VnodeMinfs::Sync() {
     } else if ((status = completion_wait(&completion, ZX_SEC(15))) != ZX_OK) {
         FS_TRACE_ERROR("VnodeMinfs::Sync Completion wait failure: %d\n", status);
         return status;
-    } else if ((status = fs_->bc_->Sync()) != ZX_OK) {
-        FS_TRACE_ERROR("VnodeMinfs::Sync block device sync failure: %d\n", status);
-        return status;
     }
     return ZX_OK;
 }
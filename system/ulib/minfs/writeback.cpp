@@ -11,6 +11,7 @@
 #endif
 
 #include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
 #include <fbl/intrusive_hash_table.h>
 #include <fbl/intrusive_single_list.h>
 #include <fbl/macros.h>
@@ -29,9 +30,19 @@ namespace minfs {
 
 void WriteTxn::Enqueue(zx_handle_t vmo, uint64_t relative_block,
                        uint64_t absolute_block, uint64_t nblocks) {
+    EnqueueRequest(vmo, relative_block, absolute_block, nblocks, true);
+}
+
+void WriteTxn::EnqueueData(zx_handle_t vmo, uint64_t relative_block,
+                           uint64_t absolute_block, uint64_t nblocks) {
+    EnqueueRequest(vmo, relative_block, absolute_block, nblocks, false);
+}
+
+void WriteTxn::EnqueueRequest(zx_handle_t vmo, uint64_t relative_block,
+                              uint64_t absolute_block, uint64_t nblocks, bool journal) {
     validate_vmo_size(vmo, static_cast<blk_t>(relative_block));
     for (size_t i = 0; i < count_; i++) {
-        if (requests_[i].vmo != vmo) {
+        if (requests_[i].vmo != vmo || requests_[i].journal != journal) {
             continue;
         }
 
@@ -55,6 +66,7 @@ void WriteTxn::Enqueue(zx_handle_t vmo, uint64_t relative_block,
     requests_[count_].vmo_offset = relative_block;
     requests_[count_].dev_offset = absolute_block;
     requests_[count_].length = nblocks;
+    requests_[count_].journal = journal;
     count_++;
 
     // "-1" so we can split a txn into two if we need to wrap around the log.
@@ -62,7 +74,29 @@ void WriteTxn::Enqueue(zx_handle_t vmo, uint64_t relative_block,
                   "Enqueueing too many messages for one operation");
 }
 
-zx_status_t WriteTxn::Flush(zx_handle_t vmo, vmoid_t vmoid) {
+void WriteTxn::Trim(uint64_t absolute_block, uint64_t nblocks) {
+    for (size_t i = 0; i < trims_.size(); i++) {
+        if (trims_[i].dev_offset + trims_[i].length == absolute_block) {
+            trims_[i].length += nblocks;
+            return;
+        } else if (absolute_block + nblocks == trims_[i].dev_offset) {
+            trims_[i].dev_offset = absolute_block;
+            trims_[i].length += nblocks;
+            return;
+        }
+    }
+
+    // Like the writes, these are kept in blocks until we Flush().
+    block_fifo_request_t trim = {};
+    trim.opcode = BLOCKIO_TRIM;
+    trim.vmoid = VMOID_INVALID;
+    trim.dev_offset = absolute_block;
+    trim.length = nblocks;
+    fbl::AllocChecker ac;
+    trims_.push_back(trim, &ac);
+}
+
+zx_status_t WriteTxn::Flush(zx_handle_t vmo, vmoid_t vmoid, bool sync) {
     ZX_DEBUG_ASSERT(vmo != ZX_HANDLE_INVALID);
     ZX_DEBUG_ASSERT(vmoid != VMOID_INVALID);
 
@@ -76,9 +110,53 @@ zx_status_t WriteTxn::Flush(zx_handle_t vmo, vmoid_t vmoid) {
         blk_reqs[i].dev_offset = requests_[i].dev_offset * kMinfsBlockSize;
         blk_reqs[i].length = requests_[i].length * kMinfsBlockSize;
     }
+    size_t blk_count = count_;
+    if (sync || trims_.size() != 0) {
+        // The flush is a barrier, so it also covers the writes ahead of it in
+        // this transaction.  Trims wait behind it, so that blocks are only
+        // discarded once the metadata which freed them is on disk.
+        ZX_DEBUG_ASSERT(blk_count < MAX_TXN_MESSAGES);
+        blk_reqs[blk_count].txnid = bc_->TxnId();
+        blk_reqs[blk_count].vmoid = vmoid;
+        blk_reqs[blk_count].opcode = BLOCKIO_SYNC;
+        blk_reqs[blk_count].vmo_offset = 0;
+        blk_reqs[blk_count].dev_offset = 0;
+        blk_reqs[blk_count].length = 0;
+        blk_count++;
+    }
 
     // Actually send the operations to the underlying block device.
-    zx_status_t status = bc_->Txn(blk_reqs, count_);
+    zx_status_t status = bc_->Txn(blk_reqs, blk_count);
+
+    // Trims go out last, and leave alone any block this transaction wrote,
+    // which may have been freed and allocated again.  A failed trim costs
+    // nothing but the hint, so it is ignored.
+    if (status == ZX_OK && trims_.size() != 0) {
+        size_t n = 0;
+        for (size_t t = 0; t < trims_.size(); t++) {
+            bool overlaps = false;
+            for (size_t i = 0; i < count_; i++) {
+                if (requests_[i].dev_offset < trims_[t].dev_offset + trims_[t].length &&
+                    trims_[t].dev_offset < requests_[i].dev_offset + requests_[i].length) {
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (overlaps) {
+                continue;
+            }
+            trims_[n] = trims_[t];
+            trims_[n].txnid = bc_->TxnId();
+            trims_[n].dev_offset *= kMinfsBlockSize;
+            trims_[n].length *= kMinfsBlockSize;
+            n++;
+        }
+        // The block fifo takes at most MAX_TXN_MESSAGES at a time.
+        for (size_t sent = 0; sent < n; sent += MAX_TXN_MESSAGES) {
+            bc_->Txn(&trims_[sent], fbl::min<size_t>(n - sent, MAX_TXN_MESSAGES));
+        }
+    }
+    trims_.reset();
 
     // Decommit the pages that we used in the buffer to store the outgoing data
     size_t decommit_offset = 0;
@@ -114,6 +192,16 @@ size_t WriteTxn::BlkCount() const {
     return blocks_needed;
 }
 
+size_t WriteTxn::JournalBlkCount() const {
+    size_t blocks_needed = 0;
+    for (size_t i = 0; i < count_; i++) {
+        if (requests_[i].journal) {
+            blocks_needed += requests_[i].length;
+        }
+    }
+    return blocks_needed;
+}
+
 #endif  // __Fuchsia__
 
 WritebackWork::WritebackWork(Bcache* bc) :
@@ -125,6 +213,7 @@ WritebackWork::WritebackWork(Bcache* bc) :
 void WritebackWork::Reset() {
 #ifdef __Fuchsia__
     ZX_DEBUG_ASSERT(txn_.Count() == 0);
+    ZX_DEBUG_ASSERT(txn_.TrimCount() == 0);
     completion_ = nullptr;
 #endif
     while (0 < node_count_) {
@@ -137,7 +226,7 @@ void WritebackWork::Reset() {
 // consumed
 size_t WritebackWork::Complete(zx_handle_t vmo, vmoid_t vmoid) {
     size_t blk_count = txn_.BlkCount();
-    txn_.Flush(vmo, vmoid);
+    txn_.Flush(vmo, vmoid, completion_ != nullptr);
     if (completion_ != nullptr) {
         completion_signal(completion_);
     }
@@ -145,6 +234,14 @@ size_t WritebackWork::Complete(zx_handle_t vmo, vmoid_t vmoid) {
     return blk_count;
 }
 
+void WritebackWork::Finish() {
+    txn_.Clear();
+    if (completion_ != nullptr) {
+        completion_signal(completion_);
+    }
+    Reset();
+}
+
 void WritebackWork::SetCompletion(completion_t* completion) {
     ZX_DEBUG_ASSERT(completion_ == nullptr);
     completion_ = completion;
@@ -172,8 +269,10 @@ void WritebackWork::PinVnode(fbl::RefPtr<VnodeMinfs> vn) {
 #ifdef __Fuchsia__
 
 zx_status_t WritebackBuffer::Create(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer,
+                                    fbl::unique_ptr<Journal> journal,
                                     fbl::unique_ptr<WritebackBuffer>* out) {
-    fbl::unique_ptr<WritebackBuffer> wb(new WritebackBuffer(bc, fbl::move(buffer)));
+    fbl::unique_ptr<WritebackBuffer> wb(new WritebackBuffer(bc, fbl::move(buffer),
+                                                            fbl::move(journal)));
     if (wb->buffer_->GetSize() % kMinfsBlockSize != 0) {
         return ZX_ERR_INVALID_ARGS;
     } else if (cnd_init(&wb->consumer_cvar_) != thrd_success) {
@@ -194,8 +293,9 @@ zx_status_t WritebackBuffer::Create(Bcache* bc, fbl::unique_ptr<MappedVmo> buffe
     return ZX_OK;
 }
 
-WritebackBuffer::WritebackBuffer(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer) :
-    bc_(bc), unmounting_(false), buffer_(fbl::move(buffer)),
+WritebackBuffer::WritebackBuffer(Bcache* bc, fbl::unique_ptr<MappedVmo> buffer,
+                                 fbl::unique_ptr<Journal> journal) :
+    bc_(bc), unmounting_(false), buffer_(fbl::move(buffer)), journal_(fbl::move(journal)),
     cap_(buffer_->GetSize() / kMinfsBlockSize) {}
 
 WritebackBuffer::~WritebackBuffer() {
@@ -296,6 +396,7 @@ void WritebackBuffer::CopyToBufferLocked(WriteTxn* txn) {
             reqs[i].dev_offset = dev_offset;
             reqs[i].vmo_offset = 0;
             reqs[i].length = wb_len;
+            reqs[i].journal = reqs[i - 1].journal;
             txn->count_++;
         }
     }
@@ -335,11 +436,60 @@ void WritebackBuffer::Enqueue(fbl::unique_ptr<WritebackWork> work) {
     cnd_signal(&consumer_cvar_);
 }
 
+size_t WritebackBuffer::CommitBatchLocked() {
+    TRACE_DURATION("minfs", "WritebackBuffer::CommitBatchLocked");
+    // Take as much queued work as one journal entry holds.  Work which
+    // arrives while this batch is being written waits for the next one.
+    constexpr size_t kMaxBatch = 64;
+    fbl::unique_ptr<WritebackWork> batch[kMaxBatch];
+    size_t count = 0;
+    size_t blocks = 0;
+    size_t journal_blocks = 0;
+    while (count < kMaxBatch && !work_queue_.is_empty()) {
+        size_t work_journal_blocks = work_queue_.front().txn()->JournalBlkCount();
+        if (count != 0 && journal_blocks + work_journal_blocks > journal_->Capacity()) {
+            break;
+        }
+        journal_blocks += work_journal_blocks;
+        blocks += work_queue_.front().txn()->BlkCount();
+        batch[count++] = work_queue_.pop();
+    }
+    const size_t start = start_;
+
+    writeback_lock_.Release();
+    journal_->Commit(batch, count, buffer_.get(), buffer_vmoid_);
+    for (size_t i = 0; i < count; i++) {
+        TRACE_FLOW_END("minfs", "writeback", reinterpret_cast<trace_flow_id_t>(batch[i].get()));
+        batch[i] = nullptr;
+    }
+
+    // Decommit the part of the buffer which has been written out.
+    size_t len = fbl::min(blocks, cap_ - start);
+    if (len != 0) {
+        ZX_ASSERT(zx_vmo_op_range(buffer_->GetVmo(), ZX_VMO_OP_DECOMMIT,
+                                  start * kMinfsBlockSize, len * kMinfsBlockSize,
+                                  nullptr, 0) == ZX_OK);
+    }
+    if (blocks != len) {
+        ZX_ASSERT(zx_vmo_op_range(buffer_->GetVmo(), ZX_VMO_OP_DECOMMIT, 0,
+                                  (blocks - len) * kMinfsBlockSize, nullptr, 0) == ZX_OK);
+    }
+    writeback_lock_.Acquire();
+    return blocks;
+}
+
 int WritebackBuffer::WritebackThread(void* arg) {
     WritebackBuffer* b = reinterpret_cast<WritebackBuffer*>(arg);
 
     b->writeback_lock_.Acquire();
     while (true) {
+        while (b->journal_ != nullptr && !b->work_queue_.is_empty()) {
+            size_t blks_consumed = b->CommitBatchLocked();
+            b->start_ = (b->start_ + blks_consumed) % b->cap_;
+            b->len_ -= blks_consumed;
+            cnd_signal(&b->producer_cvar_);
+        }
+
         while (!b->work_queue_.is_empty()) {
             auto work = b->work_queue_.pop();
             TRACE_DURATION("minfs", "WritebackBuffer::WritebackThread");
@@ -364,6 +514,11 @@ int WritebackBuffer::WritebackThread(void* arg) {
         // Before waiting, we should check if we're unmounting.
         if (b->unmounting_) {
             b->writeback_lock_.Release();
+            if (b->journal_ != nullptr) {
+                // Leave the journal empty, so the next mount has nothing to
+                // replay.
+                b->journal_->Checkpoint();
+            }
             b->bc_->FreeTxnId();
             return 0;
         }
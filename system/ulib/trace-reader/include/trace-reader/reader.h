@@ -8,6 +8,7 @@
 
 #include <fbl/function.h>
 #include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_resizing_hash_table.h>
 #include <fbl/macros.h>
 #include <fbl/string.h>
 #include <fbl/string_piece.h>
@@ -128,8 +129,10 @@ private:
         // std::unordered_map<> here.  In particular, the table entries are
         // small enough that it doesn't make sense to heap allocate them
         // individually.
-        fbl::HashTable<trace_string_index_t, fbl::unique_ptr<StringTableEntry>> string_table;
-        fbl::HashTable<trace_thread_index_t, fbl::unique_ptr<ThreadTableEntry>> thread_table;
+        fbl::ResizingHashTable<trace_string_index_t,
+                               fbl::unique_ptr<StringTableEntry>> string_table;
+        fbl::ResizingHashTable<trace_thread_index_t,
+                               fbl::unique_ptr<ThreadTableEntry>> thread_table;
 
         // Used by the hash table.
         ProviderId GetKey() const { return id; }
@@ -18,10 +18,13 @@
 #define VIRTIO_BLK_F_FLUSH      (1u << 9)
 #define VIRTIO_BLK_F_TOPOLOGY   (1u << 10)
 #define VIRTIO_BLK_F_CONFIG_WCE (1u << 11)
+#define VIRTIO_BLK_F_MQ         (1u << 12)
+#define VIRTIO_BLK_F_DISCARD    (1u << 13)
 
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_T_DISCARD    11
 
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
@@ -42,6 +45,20 @@ typedef struct virtio_blk_config {
     uint32_t seg_max;
     virtio_blk_geometry_t geometry;
     uint32_t blk_size;
+    // VIRTIO_BLK_F_TOPOLOGY
+    uint8_t physical_block_exp;
+    uint8_t alignment_offset;
+    uint16_t min_io_size;
+    uint32_t opt_io_size;
+    // VIRTIO_BLK_F_CONFIG_WCE
+    uint8_t writeback;
+    uint8_t unused0;
+    // VIRTIO_BLK_F_MQ
+    uint16_t num_queues;
+    // VIRTIO_BLK_F_DISCARD
+    uint32_t max_discard_sectors;
+    uint32_t max_discard_seg;
+    uint32_t discard_sector_alignment;
 } __PACKED virtio_blk_config_t;
 
 typedef struct virtio_blk_req {
@@ -50,4 +67,11 @@ typedef struct virtio_blk_req {
     uint64_t sector;
 } __PACKED virtio_blk_req_t;
 
+// The data of a VIRTIO_BLK_T_DISCARD request, one per range.
+typedef struct virtio_blk_discard {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+} __PACKED virtio_blk_discard_t;
+
 __END_CDECLS
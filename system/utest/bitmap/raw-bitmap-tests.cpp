@@ -5,9 +5,13 @@
 #include <bitmap/raw-bitmap.h>
 #include <bitmap/storage.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <unittest/unittest.h>
+#include <zircon/syscalls.h>
 
 namespace bitmap {
 namespace tests {
@@ -441,6 +445,128 @@ static bool GrowFailure(void) {
     END_TEST;
 }
 
+// Large enough to be searched through a summary with several levels.
+constexpr size_t kSummarizedSize = (1 << 16) + 17;
+
+// Returns the first bit at or after |bitoff| which isn't |is_set|, looking at
+// one bit at a time.
+template <typename RawBitmap>
+static size_t SlowScan(const RawBitmap& bitmap, size_t bitoff, bool is_set) {
+    while (bitoff < bitmap.size() && bitmap.GetOne(bitoff) == is_set) {
+        bitoff++;
+    }
+    return bitoff;
+}
+
+template <typename RawBitmap>
+static bool SummaryScan(void) {
+    BEGIN_TEST;
+
+    RawBitmap bitmap;
+    EXPECT_EQ(bitmap.Reset(kSummarizedSize), ZX_OK);
+    EXPECT_EQ(bitmap.Scan(0, kSummarizedSize, false), kSummarizedSize);
+    EXPECT_EQ(bitmap.Scan(0, kSummarizedSize, true), 0u);
+
+    unsigned int seed = 0;
+    for (size_t round = 0; round < 200; round++) {
+        size_t start = rand_r(&seed) % kSummarizedSize;
+        size_t len = rand_r(&seed) % ((round % 8 == 0) ? 30000 : 100);
+        size_t end = fbl::min(kSummarizedSize, start + len);
+        if (rand_r(&seed) % 3) {
+            EXPECT_EQ(bitmap.Set(start, end), ZX_OK);
+        } else {
+            EXPECT_EQ(bitmap.Clear(start, end), ZX_OK);
+        }
+
+        size_t bitoff = rand_r(&seed) % kSummarizedSize;
+        EXPECT_EQ(bitmap.Scan(bitoff, kSummarizedSize, false),
+                  SlowScan(bitmap, bitoff, false));
+        EXPECT_EQ(bitmap.Scan(bitoff, kSummarizedSize, true),
+                  SlowScan(bitmap, bitoff, true));
+    }
+
+    END_TEST;
+}
+
+template <typename RawBitmap>
+static bool SummaryFind(void) {
+    BEGIN_TEST;
+
+    RawBitmap bitmap;
+    EXPECT_EQ(bitmap.Reset(kSummarizedSize), ZX_OK);
+    EXPECT_EQ(bitmap.Set(0, kSummarizedSize), ZX_OK);
+
+    // Leave a single free bit, and a free run of three bits further on.
+    EXPECT_EQ(bitmap.ClearOne(1000), ZX_OK);
+    EXPECT_EQ(bitmap.Clear(40000, 40003), ZX_OK);
+
+    size_t bitoff_start;
+    EXPECT_EQ(bitmap.Find(false, 0, kSummarizedSize, 1, &bitoff_start), ZX_OK);
+    EXPECT_EQ(bitoff_start, 1000u);
+    EXPECT_EQ(bitmap.Find(false, 1001, kSummarizedSize, 1, &bitoff_start), ZX_OK);
+    EXPECT_EQ(bitoff_start, 40000u);
+    EXPECT_EQ(bitmap.Find(false, 0, kSummarizedSize, 2, &bitoff_start), ZX_OK);
+    EXPECT_EQ(bitoff_start, 40000u);
+    EXPECT_EQ(bitmap.Find(false, 0, kSummarizedSize, 4, &bitoff_start), ZX_ERR_NO_RESOURCES);
+    EXPECT_EQ(bitmap.Find(false, 40003, kSummarizedSize, 1, &bitoff_start),
+              ZX_ERR_NO_RESOURCES);
+
+    // Filling the holes makes the bitmap full again.
+    EXPECT_EQ(bitmap.SetOne(1000), ZX_OK);
+    EXPECT_EQ(bitmap.Set(40000, 40003), ZX_OK);
+    EXPECT_EQ(bitmap.Find(false, 0, kSummarizedSize, 1, &bitoff_start), ZX_ERR_NO_RESOURCES);
+    EXPECT_EQ(bitmap.Find(true, 0, kSummarizedSize, kSummarizedSize, &bitoff_start), ZX_OK);
+    EXPECT_EQ(bitoff_start, 0u);
+
+    END_TEST;
+}
+
+template <typename RawBitmap>
+static bool SummaryRecompute(void) {
+    BEGIN_TEST;
+
+    RawBitmap bitmap;
+    EXPECT_EQ(bitmap.Reset(kSummarizedSize), ZX_OK);
+
+    // Modify the bits behind the bitmap's back, as loading it from disk does.
+    size_t* data = static_cast<size_t*>(const_cast<void*>(bitmap.StorageUnsafe()->GetData()));
+    data[100] = 1;
+    bitmap.RecomputeSummary();
+    EXPECT_EQ(bitmap.Scan(0, kSummarizedSize, false), 100 * kBits);
+
+    END_TEST;
+}
+
+// Searches for free bits in a mostly full bitmap, where the free bits are
+// spread thinly across it.
+static bool FindFragmentedBenchmark(void) {
+    BEGIN_TEST;
+
+    constexpr size_t kSize = 1 << 22;
+    constexpr size_t kHoles = 64;
+    constexpr size_t kFinds = 100000;
+    RawBitmapGeneric<DefaultStorage> bitmap;
+    ASSERT_EQ(bitmap.Reset(kSize), ZX_OK);
+    ASSERT_EQ(bitmap.Set(0, kSize), ZX_OK);
+    for (size_t i = 0; i < kHoles; i++) {
+        ASSERT_EQ(bitmap.ClearOne((kSize / kHoles) * i + 17), ZX_OK);
+    }
+
+    uint64_t start = zx_ticks_get();
+    for (size_t i = 0; i < kFinds; i++) {
+        size_t hint = (i * 7919) % kSize;
+        size_t bitoff_start;
+        if (bitmap.Find(false, hint, kSize, 1, &bitoff_start) != ZX_OK) {
+            ASSERT_EQ(bitmap.Find(false, 0, hint, 1, &bitoff_start), ZX_OK);
+        }
+    }
+    uint64_t elapsed = zx_ticks_get() - start;
+    printf("Benchmark find in fragmented bitmap: [%10lu] nsec per find\n",
+           elapsed * 1000000000 / zx_ticks_per_second() / kFinds);
+
+    END_TEST;
+}
+
 #define RUN_TEMPLATIZED_TEST(test, specialization) RUN_TEST(test<specialization>)
 #define ALL_TESTS(specialization)                           \
     RUN_TEMPLATIZED_TEST(InitializedEmpty, specialization)  \
@@ -453,7 +579,10 @@ static bool GrowFailure(void) {
     RUN_TEMPLATIZED_TEST(ClearSubrange, specialization)     \
     RUN_TEMPLATIZED_TEST(BoundaryArguments, specialization) \
     RUN_TEMPLATIZED_TEST(ClearAll, specialization)          \
-    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)
+    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)     \
+    RUN_TEMPLATIZED_TEST(SummaryScan, specialization)       \
+    RUN_TEMPLATIZED_TEST(SummaryFind, specialization)       \
+    RUN_TEMPLATIZED_TEST(SummaryRecompute, specialization)
 
 BEGIN_TEST_CASE(raw_bitmap_tests)
 ALL_TESTS(RawBitmapGeneric<DefaultStorage>)
@@ -461,6 +590,7 @@ ALL_TESTS(RawBitmapGeneric<VmoStorage>)
 RUN_TEST(GrowAcrossPage<RawBitmapGeneric<VmoStorage>>)
 RUN_TEST(GrowShrink<RawBitmapGeneric<VmoStorage>>)
 RUN_TEST(GrowFailure<RawBitmapGeneric<DefaultStorage>>)
+RUN_TEST_PERFORMANCE(FindFragmentedBenchmark)
 END_TEST_CASE(raw_bitmap_tests);
 
 } // namespace tests
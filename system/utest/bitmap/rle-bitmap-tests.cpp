@@ -2,10 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <bitmap/rle-bitmap.h>
 #include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
+#include <fbl/array.h>
 #include <unittest/unittest.h>
+#include <zircon/syscalls.h>
 
 namespace bitmap {
 namespace tests {
@@ -354,6 +359,157 @@ static bool SetOutOfOrder(void) {
     END_TEST;
 }
 
+// Large enough that a linear walk of the ranges would be noticeably slow.
+constexpr size_t kManyRanges = 200000;
+
+static bool ManyRanges(void) {
+    BEGIN_TEST;
+
+    RleBitmap bitmap;
+    // Set every other bit, creating one range per bit.  Insert the ranges
+    // back to front to exercise insertion ahead of existing ranges.
+    for (size_t i = kManyRanges; i-- > 0;) {
+        ASSERT_EQ(bitmap.Set(2 * i, 2 * i + 1), ZX_OK);
+    }
+    EXPECT_EQ(bitmap.num_ranges(), kManyRanges);
+
+    for (size_t i = 0; i < kManyRanges; i += 997) {
+        size_t first_unset = 0;
+        EXPECT_TRUE(bitmap.Get(2 * i, 2 * i + 1));
+        EXPECT_FALSE(bitmap.Get(2 * i, 2 * i + 2, &first_unset));
+        EXPECT_EQ(first_unset, 2 * i + 1);
+    }
+
+    // Ranges come back in order.
+    size_t expected = 0;
+    for (auto& range : bitmap) {
+        EXPECT_EQ(range.bitoff, expected);
+        EXPECT_EQ(range.bitlen, 1U);
+        expected += 2;
+    }
+    EXPECT_EQ(expected, 2 * kManyRanges);
+
+    // Filling in the gaps of the first half merges it into one range.
+    for (size_t i = 0; i < kManyRanges / 2; i++) {
+        ASSERT_EQ(bitmap.Set(2 * i + 1, 2 * i + 2), ZX_OK);
+    }
+    EXPECT_EQ(bitmap.num_ranges(), kManyRanges / 2);
+    EXPECT_TRUE(bitmap.Get(0, kManyRanges + 1));
+
+    // One set across the second half merges everything.
+    ASSERT_EQ(bitmap.Set(kManyRanges, 2 * kManyRanges), ZX_OK);
+    EXPECT_EQ(bitmap.num_ranges(), 1U);
+    EXPECT_TRUE(bitmap.Get(0, 2 * kManyRanges));
+
+    // Punch holes back into it, then clear a span covering many of them.
+    for (size_t i = 0; i < kManyRanges; i++) {
+        ASSERT_EQ(bitmap.Clear(2 * i + 1, 2 * i + 2), ZX_OK);
+    }
+    EXPECT_EQ(bitmap.num_ranges(), kManyRanges);
+    ASSERT_EQ(bitmap.Clear(3, 2 * kManyRanges - 3), ZX_OK);
+    EXPECT_EQ(bitmap.num_ranges(), 3U);
+    EXPECT_TRUE(bitmap.Get(0, 1));
+    EXPECT_TRUE(bitmap.Get(2, 3));
+    EXPECT_FALSE(bitmap.Get(3, 2 * kManyRanges - 3));
+    EXPECT_TRUE(bitmap.Get(2 * kManyRanges - 2, 2 * kManyRanges - 1));
+
+    END_TEST;
+}
+
+static bool RandomAgainstReference(void) {
+    BEGIN_TEST;
+
+    constexpr size_t kBits = 4096;
+    constexpr size_t kIterations = 20000;
+    fbl::AllocChecker ac;
+    fbl::Array<bool> reference(new (&ac) bool[kBits](), kBits);
+    ASSERT_TRUE(ac.check());
+
+    RleBitmap bitmap;
+    srand(4);
+    for (size_t i = 0; i < kIterations; i++) {
+        size_t bitoff = rand() % kBits;
+        size_t bitmax = bitoff + rand() % (kBits - bitoff + 1);
+        bool set = rand() % 2;
+        if (set) {
+            ASSERT_EQ(bitmap.Set(bitoff, bitmax), ZX_OK);
+        } else {
+            ASSERT_EQ(bitmap.Clear(bitoff, bitmax), ZX_OK);
+        }
+        for (size_t j = bitoff; j < bitmax; j++) {
+            reference[j] = set;
+        }
+
+        // Compare the ranges against the reference, checking that they are
+        // ordered, non-empty, and neither overlap nor touch.
+        size_t next = 0;
+        size_t ranges = 0;
+        for (auto& range : bitmap) {
+            ASSERT_GT(range.bitlen, 0U);
+            ASSERT_TRUE(ranges == 0 || range.bitoff > next);
+            for (size_t j = next; j < range.bitoff; j++) {
+                ASSERT_FALSE(reference[j]);
+            }
+            for (size_t j = range.bitoff; j < range.bitoff + range.bitlen; j++) {
+                ASSERT_TRUE(reference[j]);
+            }
+            next = range.bitoff + range.bitlen;
+            ranges++;
+        }
+        for (size_t j = next; j < kBits; j++) {
+            ASSERT_FALSE(reference[j]);
+        }
+        ASSERT_EQ(bitmap.num_ranges(), ranges);
+
+        size_t first_unset = 0;
+        size_t expected = bitoff;
+        while (expected < kBits && reference[expected]) {
+            expected++;
+        }
+        bitmap.Get(bitoff, kBits, &first_unset);
+        ASSERT_EQ(first_unset, expected);
+    }
+
+    END_TEST;
+}
+
+static bool ManyRangesBenchmark(void) {
+    BEGIN_TEST;
+
+    RleBitmap bitmap;
+    uint64_t start = zx_ticks_get();
+    for (size_t i = 0; i < kManyRanges; i++) {
+        // Spread the insertions out so they don't always land at one end.
+        size_t bit = 2 * ((i * 7919) % kManyRanges);
+        ASSERT_EQ(bitmap.Set(bit, bit + 1), ZX_OK);
+    }
+    uint64_t elapsed = zx_ticks_get() - start;
+    ASSERT_EQ(bitmap.num_ranges(), kManyRanges);
+    printf("Benchmark set with %zu ranges: [%10lu] nsec per set\n", kManyRanges,
+           elapsed * 1000000000 / zx_ticks_per_second() / kManyRanges);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < kManyRanges; i++) {
+        size_t bit = 2 * ((i * 7919) % kManyRanges);
+        ASSERT_TRUE(bitmap.Get(bit, bit + 1));
+    }
+    elapsed = zx_ticks_get() - start;
+    printf("Benchmark get with %zu ranges: [%10lu] nsec per get\n", kManyRanges,
+           elapsed * 1000000000 / zx_ticks_per_second() / kManyRanges);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < kManyRanges; i++) {
+        size_t bit = 2 * ((i * 7919) % kManyRanges);
+        ASSERT_EQ(bitmap.Clear(bit, bit + 1), ZX_OK);
+    }
+    elapsed = zx_ticks_get() - start;
+    ASSERT_EQ(bitmap.num_ranges(), 0U);
+    printf("Benchmark clear with %zu ranges: [%10lu] nsec per clear\n", kManyRanges,
+           elapsed * 1000000000 / zx_ticks_per_second() / kManyRanges);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(rle_bitmap_tests)
 RUN_TEST(InitializedEmpty)
 RUN_TEST(SingleBit)
@@ -368,6 +524,9 @@ RUN_TEST(BoundaryArguments)
 RUN_TEST(NoAlloc)
 RUN_TEST(ClearAll)
 RUN_TEST(SetOutOfOrder)
+RUN_TEST(ManyRanges)
+RUN_TEST(RandomAgainstReference)
+RUN_TEST_PERFORMANCE(ManyRangesBenchmark)
 END_TEST_CASE(rle_bitmap_tests);
 
 } // namespace tests
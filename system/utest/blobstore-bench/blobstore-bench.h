@@ -21,7 +21,11 @@ typedef enum {
     CREATE, // create blob
     TRUNCATE, // truncate blob
     WRITE, // write data to blob
+    MOUNT, // remount the filesystem
+    LOOKUP, // stat a blob which is not open
     OPEN, // open fd to blob
+    OPEN_FIRST, // open fd to a blob which hasn't been opened since mount
+    READ_FIRST, // read first page of a freshly opened blob
     READ, // read data from blob
     CLOSE, // close blob fd
     UNLINK, // unlink blob
@@ -56,6 +60,8 @@ private:
 
     // tests
     bool create_blobs();
+    bool remount_blobstore();
+    bool lookup_blobs();
     bool read_blobs();
     bool unlink_blobs();
 
@@ -22,6 +22,7 @@ MODULE_STATIC_LIBS := \
 MODULE_LIBS := \
     system/ulib/c \
     system/ulib/fdio \
+    system/ulib/fs-management \
     system/ulib/zircon \
     system/ulib/unittest \
 
@@ -0,0 +1,191 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include <blobstore/common.h>
+#include <blobstore/fsck.h>
+#include <blobstore/host.h>
+#include <fbl/string.h>
+#include <fbl/unique_fd.h>
+#include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
+#include <unittest/unittest.h>
+
+// Tests for building blobstore images on the host from a synthetic corpus of
+// many small blobs and a few large ones.  The benchmark reports how fast the
+// corpus is added with one thread and with one thread per CPU; run with -v to
+// see the results.
+
+namespace {
+
+constexpr size_t kSmallBlobs = 2000;
+constexpr size_t kMaxSmallBlobSize = 256 * 1024;
+constexpr size_t kLargeBlobs = 2;
+constexpr size_t kLargeBlobSize = 24 * 1024 * 1024;
+
+char gTestDir[PATH_MAX];
+fbl::Vector<fbl::String> gCorpus;
+size_t gCorpusBytes = 0;
+
+// A cheap, deterministic generator, so the corpus is the same from run to run.
+uint64_t Next(uint64_t* state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return *state >> 33;
+}
+
+bool WriteBlob(size_t index, size_t size, uint64_t* state) {
+    BEGIN_HELPER;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/blob-%zu", gTestDir, index);
+    fbl::unique_fd fd(open(path, O_RDWR | O_CREAT | O_TRUNC, 0644));
+    ASSERT_TRUE(fd, "Unable to create blob");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[size]);
+    ASSERT_TRUE(ac.check());
+    // Half random and half zeros, so that compression has something to do.
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = i < size / 2 ? static_cast<uint8_t>(Next(state)) : 0;
+    }
+    ASSERT_EQ(write(fd.get(), data.get(), size), static_cast<ssize_t>(size));
+    gCorpus.push_back(fbl::String(path));
+    gCorpusBytes += size;
+    END_HELPER;
+}
+
+bool CreateCorpus() {
+    BEGIN_HELPER;
+    uint64_t state = 1;
+    for (size_t i = 0; i < kSmallBlobs; ++i) {
+        ASSERT_TRUE(WriteBlob(i, 1 + Next(&state) % kMaxSmallBlobSize, &state));
+    }
+    for (size_t i = 0; i < kLargeBlobs; ++i) {
+        ASSERT_TRUE(WriteBlob(kSmallBlobs + i, kLargeBlobSize, &state));
+    }
+    END_HELPER;
+}
+
+bool DestroyCorpus() {
+    BEGIN_HELPER;
+    for (size_t i = 0; i < gCorpus.size(); ++i) {
+        ASSERT_EQ(unlink(gCorpus[i].c_str()), 0);
+    }
+    gCorpus.reset();
+    ASSERT_EQ(rmdir(gTestDir), 0, "Failed to remove test path");
+    END_HELPER;
+}
+
+// Formats a new image at |path| big enough for the corpus, adds the corpus to
+// it with |threads| threads, and returns how long adding took in |out_ns|.
+bool BuildImage(const char* path, bool compress, unsigned threads, uint64_t* out_ns) {
+    BEGIN_HELPER;
+    fbl::unique_fd fd(open(path, O_RDWR | O_CREAT | O_TRUNC, 0644));
+    ASSERT_TRUE(fd, "Unable to create image");
+    size_t size = fbl::round_up(2 * gCorpusBytes + (64 << 20), blobstore::kBlobstoreBlockSize);
+    ASSERT_EQ(ftruncate(fd.get(), size), 0);
+    uint64_t block_count;
+    ASSERT_EQ(blobstore::blobstore_get_blockcount(fd.get(), &block_count), ZX_OK);
+    ASSERT_EQ(blobstore::blobstore_mkfs(fd.get(), block_count), 0);
+
+    fbl::RefPtr<blobstore::Blobstore> bs;
+    ASSERT_EQ(blobstore::blobstore_create(&bs, fbl::move(fd)), ZX_OK);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_EQ(blobstore::blobstore_add_blobs(bs.get(), gCorpus, compress, threads), ZX_OK);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ASSERT_EQ(blobstore::blobstore_check(bs), ZX_OK);
+    *out_ns = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+    END_HELPER;
+}
+
+bool SameContents(const char* a, const char* b) {
+    BEGIN_HELPER;
+    fbl::unique_fd fda(open(a, O_RDONLY));
+    fbl::unique_fd fdb(open(b, O_RDONLY));
+    ASSERT_TRUE(fda && fdb);
+    uint8_t bufa[blobstore::kBlobstoreBlockSize];
+    uint8_t bufb[blobstore::kBlobstoreBlockSize];
+    while (true) {
+        ssize_t ra = read(fda.get(), bufa, sizeof(bufa));
+        ssize_t rb = read(fdb.get(), bufb, sizeof(bufb));
+        ASSERT_EQ(ra, rb, "Images differ in size");
+        ASSERT_GE(ra, 0);
+        if (ra == 0) {
+            break;
+        }
+        ASSERT_EQ(memcmp(bufa, bufb, ra), 0, "Images differ");
+    }
+    END_HELPER;
+}
+
+bool AddBlobsIsDeterministic() {
+    BEGIN_TEST;
+    char serial[PATH_MAX];
+    char parallel[PATH_MAX];
+    snprintf(serial, sizeof(serial), "%s/serial.img", gTestDir);
+    snprintf(parallel, sizeof(parallel), "%s/parallel.img", gTestDir);
+    uint64_t ns;
+    ASSERT_TRUE(BuildImage(serial, true, 1, &ns));
+    ASSERT_TRUE(BuildImage(parallel, true, 7, &ns));
+    EXPECT_TRUE(SameContents(serial, parallel));
+    ASSERT_EQ(unlink(serial), 0);
+    ASSERT_EQ(unlink(parallel), 0);
+    END_TEST;
+}
+
+bool BenchAddBlobs(bool compress) {
+    BEGIN_HELPER;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/bench.img", gTestDir);
+    unsigned cpus = fbl::max(std::thread::hardware_concurrency(), 1u);
+    const unsigned runs[] = {1, cpus};
+    for (size_t i = 0; i < (cpus > 1 ? 2 : 1); ++i) {
+        unsigned t = runs[i];
+        uint64_t ns;
+        ASSERT_TRUE(BuildImage(path, compress, t, &ns));
+        unittest_printf("%s, %u thread(s): %zu blobs, %zu MB in %" PRIu64 " ms, %" PRIu64
+                        " MB/s\n", compress ? "compressed" : "uncompressed", t,
+                        gCorpus.size(), gCorpusBytes >> 20, ns / 1000000,
+                        ns == 0 ? 0 : gCorpusBytes * 1000 / ns);
+    }
+    ASSERT_EQ(unlink(path), 0);
+    END_HELPER;
+}
+
+bool AddBlobsBench() {
+    BEGIN_TEST;
+    EXPECT_TRUE(BenchAddBlobs(false));
+    EXPECT_TRUE(BenchAddBlobs(true));
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(blobstore_host_tests)
+RUN_TEST_MEDIUM(AddBlobsIsDeterministic)
+RUN_TEST_LARGE(AddBlobsBench)
+END_TEST_CASE(blobstore_host_tests)
+
+int main(int argc, char** argv) {
+    snprintf(gTestDir, sizeof(gTestDir), "/tmp/blobstore-host-test-XXXXXX");
+    if (mkdtemp(gTestDir) == nullptr || !CreateCorpus()) {
+        fprintf(stderr, "Unable to create the test corpus\n");
+        return -1;
+    }
+    int result = unittest_run_all_tests(argc, argv) ? 0 : -1;
+    if (!DestroyCorpus()) {
+        return -1;
+    }
+    return result;
+}
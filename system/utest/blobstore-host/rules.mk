@@ -0,0 +1,39 @@
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := hostapp
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/main.cpp \
+    system/ulib/bitmap/raw-bitmap.cpp \
+
+MODULE_NAME := blobstore-host-test
+
+MODULE_COMPILEFLAGS := \
+    -Werror-implicit-function-declaration \
+    -Wstrict-prototypes -Wwrite-strings \
+    -Isystem/ulib/bitmap/include \
+    -Isystem/ulib/blobstore/include \
+    -Isystem/ulib/digest/include \
+    -Isystem/ulib/fbl/include \
+    -Isystem/ulib/fdio/include \
+    -Isystem/ulib/fs/include \
+    -Isystem/ulib/unittest/include \
+    -Ithird_party/ulib/uboringssl/include \
+
+MODULE_HOST_LIBS := \
+    third_party/ulib/uboringssl.hostlib \
+    system/ulib/blobstore.hostlib \
+    system/ulib/digest.hostlib \
+    system/ulib/fbl.hostlib \
+    system/ulib/pretty.hostlib \
+    system/ulib/unittest.hostlib \
+
+MODULE_DEFINES += DISABLE_THREAD_ANNOTATIONS
+
+include make/module.mk
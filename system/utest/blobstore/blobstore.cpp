@@ -22,6 +22,7 @@
 #include <blobstore/format.h>
 #include <digest/digest.h>
 #include <digest/merkle-tree.h>
+#include <fdio/vfs.h>
 #include <fs-management/mount.h>
 #include <fs-management/ramdisk.h>
 #include <fvm/fvm.h>
@@ -349,7 +350,11 @@ typedef struct blob_info {
 
 // Creates, writes, reads (to verify) and operates on a blob.
 // Returns the result of the post-processing 'func' (true == success).
-static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out) {
+//
+// If |compressible| is set, the blob is mostly made of repeated runs of
+// bytes, rather than entirely random data.
+static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out,
+                         bool compressible = false) {
     // Generate a Blob of random data
     fbl::AllocChecker ac;
     fbl::unique_ptr<blob_info_t> info(new (&ac) blob_info_t);
@@ -359,7 +364,11 @@ static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out) {
     static unsigned int seed = static_cast<unsigned int>(zx_ticks_get());
 
     for (size_t i = 0; i < size_data; i++) {
-        info->data[i] = (char)rand_r(&seed);
+        if (compressible && (i % 64) != 0) {
+            info->data[i] = info->data[i - 1];
+        } else {
+            info->data[i] = (char)rand_r(&seed);
+        }
     }
     info->size_data = size_data;
 
@@ -843,6 +852,94 @@ static bool CreateUmountRemountSmall(void) {
     END_TEST;
 }
 
+template <fs_test_type_t TestType>
+static bool CompressibleBlob(void) {
+    BEGIN_TEST;
+    test_info_t test_info;
+    ASSERT_EQ(StartBlobstoreTest<TestType>(&test_info), 0, "Mounting Blobstore");
+
+    for (size_t i = 15; i < 21; i++) {
+        fbl::unique_ptr<blob_info_t> info;
+        ASSERT_TRUE(GenerateBlob(1 << i, &info, true));
+
+        int fd;
+        ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                             info->data.get(), info->size_data, &fd));
+        ASSERT_EQ(close(fd), 0);
+
+        // The blob should occupy less space than its data, Merkle tree included.
+        struct stat s;
+        ASSERT_EQ(stat(info->path, &s), 0);
+        ASSERT_LT(static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE, info->size_data, "Blob was not compressed");
+
+        // Drop the cached copy, and read the blob back from disk: first a
+        // range from the middle, then the whole blob.
+        ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+        ASSERT_EQ(MountBlobstore(test_info.ramdisk_path), 0, "Could not re-mount blobstore");
+
+        fd = open(info->path, O_RDONLY);
+        ASSERT_GT(fd, 0, "Failed to open blob");
+        size_t off = info->size_data / 2 + 1;
+        size_t len = fbl::min(info->size_data - off, static_cast<size_t>(3 * blobstore::kBlobstoreBlockSize));
+        fbl::AllocChecker ac;
+        fbl::unique_ptr<char[]> buf(new (&ac) char[len]);
+        ASSERT_TRUE(ac.check());
+        ASSERT_EQ(pread(fd, buf.get(), len, off), static_cast<ssize_t>(len));
+        ASSERT_EQ(memcmp(buf.get(), &info->data[off], len), 0, "Read data, but it was bad");
+        ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+        ASSERT_EQ(close(fd), 0, "Could not close blob");
+        ASSERT_EQ(unlink(info->path), 0);
+    }
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(&test_info), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Sets the version in the superblock of the unmounted blobstore at |path|.
+static bool SetVersion(const char* path, uint32_t version) {
+    int fd = open(path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+    blobstore::blobstore_info_t info;
+    ASSERT_EQ(pread(fd, &info, sizeof(info), 0), sizeof(info));
+    info.version = version;
+    ASSERT_EQ(pwrite(fd, &info, sizeof(info), 0), sizeof(info));
+    ASSERT_EQ(close(fd), 0);
+    return true;
+}
+
+// A version 4 image, from before compression, still mounts, but blobs written
+// to it are stored uncompressed so that older drivers can read them.
+template <fs_test_type_t TestType>
+static bool Version4(void) {
+    BEGIN_TEST;
+    test_info_t test_info;
+    ASSERT_EQ(StartBlobstoreTest<TestType>(&test_info), 0, "Mounting Blobstore");
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    ASSERT_TRUE(SetVersion(test_info.ramdisk_path, blobstore::kBlobstoreVersionNoCompression));
+    ASSERT_EQ(MountBlobstore(test_info.ramdisk_path), 0, "Could not mount version 4 blobstore");
+
+    fbl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob(1 << 18, &info, true));
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+    struct stat s;
+    ASSERT_EQ(stat(info->path, &s), 0);
+    ASSERT_GE(static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE, info->size_data,
+              "Blob was compressed");
+
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(test_info.ramdisk_path), 0, "Could not re-mount blobstore");
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+    ASSERT_EQ(close(fd), 0, "Could not close blob");
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(&test_info), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 enum TestState {
     empty,
     configured,
@@ -1607,6 +1704,8 @@ RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedBlob)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedDigest)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EdgeAllocation)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CreateUmountRemountSmall)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, CompressibleBlob)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, Version4)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EarlyRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WaitForRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WriteSeekIgnored)
@@ -0,0 +1,94 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include <digest/digest.h>
+#include <digest/merkle-tree.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+// Compares the throughput of building and checking a Merkle tree when whole
+// nodes are hashed several at a time against hashing them one by one, which
+// is what happens when CreateUpdate is handed a single node per call.  Run
+// with -v to see the results.
+
+namespace {
+
+using digest::Digest;
+using digest::MerkleTree;
+
+constexpr size_t kNodeSize = MerkleTree::kNodeSize;
+constexpr size_t kDataLen = 16 * 1024 * 1024;
+constexpr int kIterations = 4;
+
+uint64_t ticks_to_ns(uint64_t ticks) {
+    return static_cast<uint64_t>(static_cast<__uint128_t>(ticks) * ZX_SEC(1) /
+                                 zx_ticks_per_second());
+}
+
+void print_rate(const char* name, uint64_t ticks) {
+    uint64_t ns = ticks_to_ns(ticks);
+    uint64_t mb_per_sec = ns == 0 ? 0 : (kDataLen * kIterations * 1000) / ns;
+    unittest_printf("%s: %" PRIu64 ".%03" PRIu64 " GB/s\n", name, mb_per_sec / 1000,
+                    mb_per_sec % 1000);
+}
+
+bool create_bench() {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kDataLen]);
+    ASSERT_TRUE(ac.check(), "");
+    size_t tree_len = MerkleTree::GetTreeLength(kDataLen);
+    fbl::unique_ptr<uint8_t[]> tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check(), "");
+    for (size_t i = 0; i < kDataLen; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+
+    Digest batched;
+    uint64_t start = zx_ticks_get();
+    for (int i = 0; i < kIterations; ++i) {
+        ASSERT_EQ(ZX_OK, MerkleTree::Create(data.get(), kDataLen, tree.get(), tree_len, &batched),
+                  "");
+    }
+    uint64_t create_ticks = zx_ticks_get() - start;
+
+    start = zx_ticks_get();
+    for (int i = 0; i < kIterations; ++i) {
+        ASSERT_EQ(ZX_OK, MerkleTree::Verify(data.get(), kDataLen, tree.get(), tree_len, 0,
+                                            kDataLen, batched),
+                  "");
+    }
+    uint64_t verify_ticks = zx_ticks_get() - start;
+
+    Digest sequential;
+    start = zx_ticks_get();
+    for (int i = 0; i < kIterations; ++i) {
+        MerkleTree mt;
+        ASSERT_EQ(ZX_OK, mt.CreateInit(kDataLen, tree_len), "");
+        for (size_t off = 0; off < kDataLen; off += kNodeSize) {
+            ASSERT_EQ(ZX_OK, mt.CreateUpdate(data.get() + off, kNodeSize, tree.get()), "");
+        }
+        ASSERT_EQ(ZX_OK, mt.CreateFinal(tree.get(), &sequential), "");
+    }
+    uint64_t sequential_ticks = zx_ticks_get() - start;
+
+    EXPECT_TRUE(batched == sequential, "root digests differ");
+    print_rate("Create, one node at a time", sequential_ticks);
+    print_rate("Create, batched nodes", create_ticks);
+    print_rate("Verify, batched nodes", verify_ticks);
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(MerkleTreeBench)
+RUN_NAMED_TEST("create and verify", create_bench)
+END_TEST_CASE(MerkleTreeBench)
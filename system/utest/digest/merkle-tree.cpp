@@ -5,8 +5,10 @@
 #include <digest/merkle-tree.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <digest/digest.h>
+#include <fbl/algorithm.h>
 #include <zircon/assert.h>
 #include <zircon/status.h>
 #include <unittest/unittest.h>
@@ -378,6 +380,74 @@ bool CreateByteByByte(void) {
     END_TEST;
 }
 
+// Passing a node at a time to CreateUpdate hashes each node on its own, while
+// passing everything at once lets whole nodes be hashed several at a time.
+// Both must produce the same tree.
+bool CreateNodeByNode(void) {
+    BEGIN_TEST_WITH_RC;
+    static uint8_t tree[kNodeSize * 3];
+    for (uint64_t i = 0; i < kUnalignedLarge; ++i) {
+        gData[i] = static_cast<uint8_t>((i * 2654435761u) >> 24);
+    }
+    size_t tree_len = MerkleTree::GetTreeLength(kUnalignedLarge);
+    MerkleTree merkleTree;
+    ASSERT_OK(merkleTree.CreateInit(kUnalignedLarge, tree_len));
+    for (uint64_t i = 0; i < kUnalignedLarge; i += kNodeSize) {
+        size_t len = fbl::min(kNodeSize, kUnalignedLarge - i);
+        ASSERT_OK(merkleTree.CreateUpdate(gData + i, len, tree));
+    }
+    Digest actual;
+    ASSERT_OK(merkleTree.CreateFinal(tree, &actual));
+    Digest expected;
+    ASSERT_OK(MerkleTree::Create(gData, kUnalignedLarge, gTree, tree_len,
+                                 &expected));
+    ASSERT_TRUE(actual == expected, "Incorrect root digest");
+    ASSERT_EQ(0, memcmp(tree, gTree, tree_len), "Incorrect tree");
+    ASSERT_OK(MerkleTree::Verify(gData, kUnalignedLarge, tree, tree_len, 0,
+                                 kUnalignedLarge, expected));
+    // Restore the data the other tests expect.
+    memset(gData, 0xff, sizeof(gData));
+    END_TEST;
+}
+
+bool CreateFromLeafDigests(void) {
+    BEGIN_TEST_WITH_RC;
+    static uint8_t tree[kNodeSize * 3];
+    const size_t lens[] = {kNodeSize + 1, kSmall, kLarge, kUnalignedLarge};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+        size_t data_len = lens[i];
+        size_t tree_len = MerkleTree::GetTreeLength(data_len);
+        // Hash the leaves in two pieces, split at a node boundary.
+        size_t split = fbl::round_down(data_len / 2, kNodeSize);
+        memset(tree, 0xa5, sizeof(tree));
+        ASSERT_OK(MerkleTree::CreateLeafDigests(gData, data_len, 0, split,
+                                                tree, tree_len));
+        ASSERT_OK(MerkleTree::CreateLeafDigests(gData, data_len, split,
+                                                data_len - split, tree,
+                                                tree_len));
+        Digest actual;
+        ASSERT_OK(MerkleTree::CreateFromLeafDigests(data_len, tree, tree_len,
+                                                    &actual));
+        Digest expected;
+        ASSERT_OK(MerkleTree::Create(gData, data_len, gTree, tree_len,
+                                     &expected));
+        ASSERT_TRUE(actual == expected, "Incorrect root digest");
+        ASSERT_EQ(0, memcmp(tree, gTree, tree_len), "Incorrect tree");
+    }
+    // Ranges must cover whole nodes.
+    size_t tree_len = MerkleTree::GetTreeLength(kSmall);
+    ASSERT_ERR(ZX_ERR_INVALID_ARGS,
+               MerkleTree::CreateLeafDigests(gData, kSmall, 1, kNodeSize, tree,
+                                             tree_len));
+    ASSERT_ERR(ZX_ERR_INVALID_ARGS,
+               MerkleTree::CreateLeafDigests(gData, kSmall, 0, kNodeSize - 1,
+                                             tree, tree_len));
+    ASSERT_ERR(ZX_ERR_OUT_OF_RANGE,
+               MerkleTree::CreateLeafDigests(gData, kSmall, kNodeSize, kSmall,
+                                             tree, tree_len));
+    END_TEST;
+}
+
 bool CreateMissingData(void) {
     BEGIN_TEST_WITH_RC;
     size_t tree_len = MerkleTree::GetTreeLength(kSmall);
@@ -603,6 +673,20 @@ bool VerifyBadTree(void) {
     END_TEST;
 }
 
+bool VerifyBadTreeAbovePartialNode(void) {
+    BEGIN_TEST_WITH_RC;
+    size_t tree_len = MerkleTree::GetTreeLength(kLarge);
+    Digest digest;
+    ASSERT_OK(MerkleTree::Create(gData, kLarge, gTree, tree_len, &digest));
+    // Corrupt the digest of the second node; the first node's digest shares
+    // its tree node and must still be checked against the level above it.
+    gTree[Digest::kLength] ^= 1;
+    ASSERT_ERR(
+        ZX_ERR_IO_DATA_INTEGRITY,
+        MerkleTree::Verify(gData, kLarge, gTree, tree_len, 0, 1, digest));
+    END_TEST;
+}
+
 bool VerifyGoodPartOfBadLeaves(void) {
     BEGIN_TEST_WITH_RC;
     size_t tree_len = MerkleTree::GetTreeLength(kSmall);
@@ -719,6 +803,8 @@ RUN_TEST(CreateAll)
 RUN_TEST(CreateFinalCAll)
 RUN_TEST(CreateCAll)
 RUN_TEST(CreateByteByByte)
+RUN_TEST(CreateNodeByNode)
+RUN_TEST(CreateFromLeafDigests)
 RUN_TEST(CreateMissingData)
 RUN_TEST(CreateMissingTree)
 RUN_TEST(CreateTreeTooSmall)
@@ -737,6 +823,7 @@ RUN_TEST(VerifyZeroLength)
 RUN_TEST(VerifyBadRoot)
 RUN_TEST(VerifyGoodPartOfBadTree)
 RUN_TEST(VerifyBadTree)
+RUN_TEST(VerifyBadTreeAbovePartialNode)
 RUN_TEST(VerifyGoodPartOfBadLeaves)
 RUN_TEST(VerifyBadLeaves)
 RUN_TEST(CreateAndVerifyHugePRNGData)
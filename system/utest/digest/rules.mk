@@ -11,6 +11,7 @@ MODULE_TYPE := usertest
 MODULE_SRCS += \
     $(LOCAL_DIR)/digest.cpp \
     $(LOCAL_DIR)/merkle-tree.cpp \
+    $(LOCAL_DIR)/merkle-tree-bench.cpp \
     $(LOCAL_DIR)/main.c
 
 MODULE_NAME := digest-test
@@ -0,0 +1,60 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unittest/unittest.h>
+#include <fbl/intrusive_resizing_hash_table.h>
+#include <fbl/tests/intrusive_containers/intrusive_doubly_linked_list_checker.h>
+#include <fbl/tests/intrusive_containers/intrusive_singly_linked_list_checker.h>
+#include <fbl/tests/intrusive_containers/test_environment_utils.h>
+
+namespace fbl {
+namespace tests {
+namespace intrusive_containers {
+
+// The resizing hash table sanity checker implementation is shared across
+// ResizingHashTables of all bucket types.
+class ResizingHashTableChecker {
+public:
+    template <typename ContainerType>
+    static bool SanityCheck(const ContainerType& container) {
+        using BucketType    = typename ContainerType::BucketType;
+        using BucketChecker = typename BucketType::CheckerType;
+        using KeyTraits     = typename ContainerType::KeyTraits;
+
+        BEGIN_TEST;
+
+        // The old buckets which have already been moved must be empty.
+        if (container.old_buckets_ != nullptr) {
+            ASSERT_LT(container.migrate_ndx_, container.old_bucket_count(), "");
+            for (size_t i = 0; i < container.migrate_ndx_; ++i)
+                ASSERT_TRUE(container.GetBucket(i).is_empty(), "");
+        } else {
+            ASSERT_EQ(0u, container.migrate_ndx_, "");
+        }
+
+        // Demand that every bucket pass its sanity check.  Keep a running total
+        // of the total size of the ResizingHashTable in the process.
+        size_t total_size = 0;
+        for (size_t i = 0; i < container.total_buckets(); ++i) {
+            const BucketType& bucket = container.GetBucket(i);
+            ASSERT_TRUE(BucketChecker::SanityCheck(bucket), "");
+            total_size += SizeUtils<BucketType>::size(bucket);
+
+            // For every element in the bucket, make sure that it is in the
+            // bucket that lookups of its key will search.
+            for (const auto& obj : bucket)
+                ASSERT_EQ(container.Locate(KeyTraits::GetKey(obj)), i, "");
+        }
+
+        EXPECT_EQ(container.size(), total_size, "");
+
+        END_TEST;
+    }
+};
+
+}  // namespace intrusive_containers
+}  // namespace tests
+}  // namespace fbl
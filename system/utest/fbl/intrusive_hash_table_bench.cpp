@@ -0,0 +1,83 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+
+#include <fbl/alloc_checker.h>
+#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_resizing_hash_table.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+
+// Compares a fixed size HashTable against a ResizingHashTable holding enough
+// elements that the fixed table's chains get long.  The keys look like the
+// addresses of futexes, which is one of the tables this matters for.  Run
+// with -v to see the timings.
+
+namespace {
+
+struct BenchObj : public fbl::SinglyLinkedListable<BenchObj*> {
+    uintptr_t key;
+    uintptr_t GetKey() const { return key; }
+    static size_t GetHash(uintptr_t key) { return key >> 3; }
+};
+
+using FixedTable = fbl::HashTable<uintptr_t, BenchObj*>;
+using ResizingTable = fbl::ResizingHashTable<uintptr_t, BenchObj*>;
+
+constexpr size_t kBenchObjCount = 4096;
+
+zx_time_t ticks_to_ns(uint64_t ticks) {
+    return static_cast<zx_time_t>(
+        static_cast<__uint128_t>(ticks) * ZX_SEC(1) / zx_ticks_per_second());
+}
+
+template <typename TableType>
+bool bench_table(const char* name, BenchObj* objs) {
+    BEGIN_HELPER;
+
+    TableType table;
+
+    uint64_t start = zx_ticks_get();
+    for (size_t i = 0; i < kBenchObjCount; ++i)
+        table.insert(&objs[i]);
+    uint64_t inserted = zx_ticks_get();
+
+    size_t found = 0;
+    for (size_t i = 0; i < kBenchObjCount; ++i)
+        found += table.find(objs[i].key).IsValid();
+    uint64_t looked_up = zx_ticks_get();
+
+    EXPECT_EQ(kBenchObjCount, found, "");
+    table.clear();
+
+    unittest_printf("%s: %" PRIi64 " ns per insert, %" PRIi64 " ns per lookup\n", name,
+                    ticks_to_ns(inserted - start) / static_cast<zx_time_t>(kBenchObjCount),
+                    ticks_to_ns(looked_up - inserted) / static_cast<zx_time_t>(kBenchObjCount));
+
+    END_HELPER;
+}
+
+bool insert_and_find_bench() {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<BenchObj[]> objs(new (&ac) BenchObj[kBenchObjCount]);
+    ASSERT_TRUE(ac.check(), "");
+    for (size_t i = 0; i < kBenchObjCount; ++i)
+        objs[i].key = 0x10000000 + i * sizeof(uint32_t) * 16;
+
+    EXPECT_TRUE(bench_table<FixedTable>("HashTable", objs.get()), "");
+    EXPECT_TRUE(bench_table<ResizingTable>("ResizingHashTable", objs.get()), "");
+
+    END_TEST;
+}
+
+}  // namespace
+
+BEGIN_TEST_CASE(hash_table_bench)
+RUN_NAMED_TEST("insert and find", insert_and_find_bench)
+END_TEST_CASE(hash_table_bench);
@@ -0,0 +1,309 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <unittest/unittest.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/intrusive_single_list.h>
+#include <fbl/intrusive_resizing_hash_table.h>
+#include <fbl/unique_ptr.h>
+#include <fbl/tests/intrusive_containers/associative_container_test_environment.h>
+#include <fbl/tests/intrusive_containers/intrusive_resizing_hash_table_checker.h>
+#include <fbl/tests/intrusive_containers/test_thunks.h>
+
+namespace fbl {
+namespace tests {
+namespace intrusive_containers {
+
+using OtherKeyType  = uint16_t;
+using OtherHashType = uint32_t;
+static constexpr OtherHashType kOtherNumBuckets = 23;
+
+// ResizingHashTables want the full hash of the key rather than a bucket index,
+// so the test objects' hash function mods by a large prime instead.
+static constexpr size_t kHashModulus = 0xfffffffb;
+
+template <typename PtrType>
+struct OtherHashTraits {
+    using ObjType = typename ::fbl::internal::ContainerPtrTraits<PtrType>::ValueType;
+    using BucketStateType = SinglyLinkedListNodeState<PtrType>;
+
+    // Linked List Traits
+    static BucketStateType& node_state(ObjType& obj) {
+        return obj.other_container_state_.bucket_state_;
+    }
+
+    // Keyed Object Traits
+    static OtherKeyType GetKey(const ObjType& obj) {
+        return obj.other_container_state_.key_;
+    }
+
+    static bool LessThan(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 <  key2;
+    }
+
+    static bool EqualTo(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 == key2;
+    }
+
+    // Hash Traits
+    static OtherHashType GetHash(const OtherKeyType& key) {
+        return static_cast<OtherHashType>((key * 0xaee58187) % kOtherNumBuckets);
+    }
+
+    // Set key is a trait which is only used by the tests, not by the containers
+    // themselves.
+    static void SetKey(ObjType& obj, OtherKeyType key) {
+        obj.other_container_state_.key_ = key;
+    }
+};
+
+template <typename PtrType>
+struct OtherHashState {
+private:
+    friend struct OtherHashTraits<PtrType>;
+    OtherKeyType key_;
+    typename OtherHashTraits<PtrType>::BucketStateType bucket_state_;
+};
+
+template <typename PtrType>
+class RHTSLLTraits {
+public:
+    using ObjType = typename ::fbl::internal::ContainerPtrTraits<PtrType>::ValueType;
+
+    using ContainerType           = ResizingHashTable<size_t, PtrType>;
+    using ContainableBaseClass    = SinglyLinkedListable<PtrType>;
+    using ContainerStateType      = SinglyLinkedListNodeState<PtrType>;
+    using KeyType                 = typename ContainerType::KeyType;
+    using HashType                = typename ContainerType::HashType;
+
+    using OtherContainerTraits    = OtherHashTraits<PtrType>;
+    using OtherContainerStateType = OtherHashState<PtrType>;
+    using OtherBucketType         = SinglyLinkedList<PtrType, OtherContainerTraits>;
+    using OtherContainerType      = ResizingHashTable<OtherKeyType,
+                                                      PtrType,
+                                                      OtherBucketType,
+                                                      OtherHashType,
+                                                      OtherContainerTraits,
+                                                      OtherContainerTraits>;
+
+    using TestObjBaseType  = HashedTestObjBase<typename ContainerType::KeyType,
+                                               typename ContainerType::HashType,
+                                               kHashModulus>;
+};
+
+DEFINE_TEST_OBJECTS(RHTSLL);
+using UMTE = DEFINE_TEST_THUNK(Associative, RHTSLL, Unmanaged);
+using UPTE = DEFINE_TEST_THUNK(Associative, RHTSLL, UniquePtr);
+using RPTE = DEFINE_TEST_THUNK(Associative, RHTSLL, RefPtr);
+
+BEGIN_TEST_CASE(resizing_hashtable_sll_tests)
+//////////////////////////////////////////
+// General container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("Clear (unmanaged)",            UMTE::ClearTest)
+RUN_NAMED_TEST("Clear (unique)",               UPTE::ClearTest)
+RUN_NAMED_TEST("Clear (RefPtr)",               RPTE::ClearTest)
+
+RUN_NAMED_TEST("ClearUnsafe (unmanaged)",      UMTE::ClearUnsafeTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("ClearUnsafe (unique)",         UPTE::ClearUnsafeTest)
+RUN_NAMED_TEST("ClearUnsafe (RefPtr)",         RPTE::ClearUnsafeTest)
+#endif
+
+RUN_NAMED_TEST("IsEmpty (unmanaged)",          UMTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (unique)",             UPTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (RefPtr)",             RPTE::IsEmptyTest)
+
+RUN_NAMED_TEST("Iterate (unmanaged)",          UMTE::IterateTest)
+RUN_NAMED_TEST("Iterate (unique)",             UPTE::IterateTest)
+RUN_NAMED_TEST("Iterate (RefPtr)",             RPTE::IterateTest)
+
+// Hashtables with singly linked list bucket can perform direct
+// iterator/reference erase operations, but the operations will be O(n)
+RUN_NAMED_TEST("IterErase (unmanaged)",        UMTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (unique)",           UPTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (RefPtr)",           RPTE::IterEraseTest)
+
+RUN_NAMED_TEST("DirectErase (unmanaged)",      UMTE::DirectEraseTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("DirectErase (unique)",         UPTE::DirectEraseTest)
+#endif
+RUN_NAMED_TEST("DirectErase (RefPtr)",         RPTE::DirectEraseTest)
+
+RUN_NAMED_TEST("MakeIterator (unmanaged)",     UMTE::MakeIteratorTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("MakeIterator (unique)",        UPTE::MakeIteratorTest)
+#endif
+RUN_NAMED_TEST("MakeIterator (RefPtr)",        RPTE::MakeIteratorTest)
+
+// HashTables with SinglyLinkedList buckets cannot iterate backwards (because
+// their buckets cannot iterate backwards)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("ReverseIterErase (unmanaged)", UMTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (unique)",    UPTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (RefPtr)",    RPTE::ReverseIterEraseTest)
+
+RUN_NAMED_TEST("ReverseIterate (unmanaged)",   UMTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (unique)",      UPTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (RefPtr)",      RPTE::ReverseIterateTest)
+#endif
+
+// Hash tables do not support swapping or Rvalue operations (Assignment or
+// construction) as doing so would be an O(n) operation (With 'n' == to the
+// number of buckets in the hashtable)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("Swap (unmanaged)",             UMTE::SwapTest)
+RUN_NAMED_TEST("Swap (unique)",                UPTE::SwapTest)
+RUN_NAMED_TEST("Swap (RefPtr)",                RPTE::SwapTest)
+
+RUN_NAMED_TEST("Rvalue Ops (unmanaged)",       UMTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (unique)",          UPTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (RefPtr)",          RPTE::RvalueOpsTest)
+#endif
+
+RUN_NAMED_TEST("Scope (unique)",               UPTE::ScopeTest)
+RUN_NAMED_TEST("Scope (RefPtr)",               RPTE::ScopeTest)
+
+RUN_NAMED_TEST("TwoContainer (unmanaged)",     UMTE::TwoContainerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("TwoContainer (unique)",        UPTE::TwoContainerTest)
+#endif
+RUN_NAMED_TEST("TwoContainer (RefPtr)",        RPTE::TwoContainerTest)
+
+RUN_NAMED_TEST("IterCopyPointer (unmanaged)",  UMTE::IterCopyPointerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("IterCopyPointer (unique)",     UPTE::IterCopyPointerTest)
+#endif
+RUN_NAMED_TEST("IterCopyPointer (RefPtr)",     RPTE::IterCopyPointerTest)
+
+RUN_NAMED_TEST("EraseIf (unmanaged)",          UMTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (unique)",             UPTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (RefPtr)",             RPTE::EraseIfTest)
+
+RUN_NAMED_TEST("FindIf (unmanaged)",           UMTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (unique)",              UPTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (RefPtr)",              RPTE::FindIfTest)
+
+//////////////////////////////////////////
+// Associative container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("InsertByKey (unmanaged)",      UMTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (unique)",         UPTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (RefPtr)",         RPTE::InsertByKeyTest)
+
+RUN_NAMED_TEST("FindByKey (unmanaged)",        UMTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (unique)",           UPTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (RefPtr)",           RPTE::FindByKeyTest)
+
+RUN_NAMED_TEST("EraseByKey (unmanaged)",       UMTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (unique)",          UPTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (RefPtr)",          RPTE::EraseByKeyTest)
+
+RUN_NAMED_TEST("InsertOrFind (unmanaged)",     UMTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (unique)",        UPTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (RefPtr)",        RPTE::InsertOrFindTest)
+
+RUN_NAMED_TEST("InsertOrReplace (unmanaged)",  UMTE::InsertOrReplaceTest)
+RUN_NAMED_TEST("InsertOrReplace (unique)",     UPTE::InsertOrReplaceTest)
+RUN_NAMED_TEST("InsertOrReplace (RefPtr)",     RPTE::InsertOrReplaceTest)
+END_TEST_CASE(resizing_hashtable_sll_tests);
+
+// Growth tests.  These use keys which look like aligned addresses, the sort of
+// key which piles up in a few buckets if the table doesn't mix its hashes.
+struct GrowthTestObj : public SinglyLinkedListable<GrowthTestObj*> {
+    uintptr_t key;
+    uintptr_t GetKey() const { return key; }
+    static size_t GetHash(uintptr_t key) { return key; }
+};
+
+using GrowthTable = ResizingHashTable<uintptr_t, GrowthTestObj*>;
+static constexpr size_t kGrowthObjCount = 1000;
+
+static bool GrowTest() {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<GrowthTestObj[]> objs(new (&ac) GrowthTestObj[kGrowthObjCount]);
+    ASSERT_TRUE(ac.check(), "");
+
+    GrowthTable table;
+    EXPECT_EQ(GrowthTable::kMinBuckets, table.bucket_count(), "");
+
+    for (size_t i = 0; i < kGrowthObjCount; ++i) {
+        objs[i].key = 0x1000 + i * 64;
+        table.insert(&objs[i]);
+
+        // Everything stays findable while buckets are being moved.
+        ASSERT_TRUE(ResizingHashTableChecker::SanityCheck(table), "");
+        if ((i % 97) == 0) {
+            for (size_t j = 0; j <= i; ++j)
+                ASSERT_EQ(&objs[j], &(*table.find(objs[j].key)), "");
+        }
+    }
+
+    EXPECT_EQ(kGrowthObjCount, table.size(), "");
+    EXPECT_GE(table.bucket_count(), kGrowthObjCount, "");
+
+    size_t visited = 0;
+    for (const auto& obj : table) {
+        (void)obj;
+        ++visited;
+    }
+    EXPECT_EQ(kGrowthObjCount, visited, "");
+
+    // Erase every other object while iterating.
+    for (auto iter = table.begin(); iter.IsValid();) {
+        if ((iter->key / 64) & 1)
+            table.erase(iter++);
+        else
+            ++iter;
+    }
+    EXPECT_TRUE(ResizingHashTableChecker::SanityCheck(table), "");
+    EXPECT_EQ(kGrowthObjCount / 2, table.size(), "");
+    for (size_t i = 0; i < kGrowthObjCount; ++i)
+        EXPECT_EQ((i & 1) == 0, table.find(objs[i].key).IsValid(), "");
+
+    // Clearing shrinks the table back down.
+    table.clear();
+    EXPECT_TRUE(table.is_empty(), "");
+    EXPECT_EQ(GrowthTable::kMinBuckets, table.bucket_count(), "");
+    EXPECT_TRUE(ResizingHashTableChecker::SanityCheck(table), "");
+
+    END_TEST;
+}
+
+static bool GrowWithEraseTest() {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<GrowthTestObj[]> objs(new (&ac) GrowthTestObj[kGrowthObjCount]);
+    ASSERT_TRUE(ac.check(), "");
+
+    // Erasing right behind the inserts keeps the table near a growth
+    // threshold for the whole run.
+    GrowthTable table;
+    for (size_t i = 0; i < kGrowthObjCount; ++i) {
+        objs[i].key = i * 8;
+        table.insert(&objs[i]);
+        if (i >= GrowthTable::kMinBuckets) {
+            const uintptr_t key = objs[i - GrowthTable::kMinBuckets].key;
+            ASSERT_EQ(&objs[i - GrowthTable::kMinBuckets], table.erase(key), "");
+        }
+        ASSERT_TRUE(ResizingHashTableChecker::SanityCheck(table), "");
+    }
+
+    EXPECT_EQ(GrowthTable::kMinBuckets, table.size(), "");
+    table.clear();
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(resizing_hashtable_growth_tests)
+RUN_NAMED_TEST("Grow",                         GrowTest)
+RUN_NAMED_TEST("GrowWithErase",                GrowWithEraseTest)
+END_TEST_CASE(resizing_hashtable_growth_tests);
+
+}  // namespace intrusive_containers
+}  // namespace tests
+}  // namespace fbl
@@ -20,6 +20,8 @@ fbl_common_tests := \
     $(LOCAL_DIR)/intrusive_doubly_linked_list_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_dll_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_sll_tests.cpp \
+    $(LOCAL_DIR)/intrusive_resizing_hash_table_dll_tests.cpp \
+    $(LOCAL_DIR)/intrusive_resizing_hash_table_sll_tests.cpp \
     $(LOCAL_DIR)/intrusive_singly_linked_list_tests.cpp \
     $(LOCAL_DIR)/intrusive_wavl_tree_tests.cpp \
     $(LOCAL_DIR)/main.c \
@@ -44,6 +46,10 @@ fbl_device_tests += \
     $(LOCAL_DIR)/ref_counted_tests.cpp \
     $(LOCAL_DIR)/slab_allocator_tests.cpp \
 
+# The hash table benchmark needs zx_ticks_get.
+fbl_device_tests += \
+    $(LOCAL_DIR)/intrusive_hash_table_bench.cpp \
+
 fbl_host_tests := $(fbl_common_tests)
 
 # Userspace tests.
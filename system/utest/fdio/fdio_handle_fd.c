@@ -150,6 +150,49 @@ bool ppoll_immediate_timeout_test(void) {
     END_TEST;
 }
 
+bool ppoll_many_test(void) {
+    BEGIN_TEST;
+
+    // More fds than zx_object_wait_many() accepts in a single call.
+    enum { kPipeCount = ZX_WAIT_MANY_MAX_ITEMS * 3 };
+    int fds[kPipeCount][2];
+    struct pollfd poll_fds[kPipeCount];
+    for (size_t i = 0; i < kPipeCount; i++) {
+        ASSERT_EQ(pipe(fds[i]), 0, "pipe() failed");
+        poll_fds[i].fd = fds[i][0];
+        poll_fds[i].events = POLLIN;
+        poll_fds[i].revents = 0;
+    }
+
+    struct timespec timeout = {0, 0};
+    EXPECT_EQ(0, ppoll(poll_fds, kPipeCount, &timeout, NULL), "no fds should be readable");
+
+    const size_t kReady[] = {1, ZX_WAIT_MANY_MAX_ITEMS + 2, kPipeCount - 1};
+    for (size_t i = 0; i < countof(kReady); i++) {
+        char c = 'a';
+        ASSERT_EQ(write(fds[kReady[i]][1], &c, 1), 1, "write() failed");
+    }
+
+    EXPECT_EQ((int)countof(kReady), ppoll(poll_fds, kPipeCount, NULL, NULL),
+              "wrong number of readable fds");
+    size_t next = 0;
+    for (size_t i = 0; i < kPipeCount; i++) {
+        if (next < countof(kReady) && kReady[next] == i) {
+            EXPECT_EQ(POLLIN, poll_fds[i].revents, "fd should be readable");
+            next++;
+        } else {
+            EXPECT_EQ(0, poll_fds[i].revents, "fd should not be readable");
+        }
+    }
+
+    for (size_t i = 0; i < kPipeCount; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+
+    END_TEST;
+}
+
 bool transfer_fd_test(void) {
     BEGIN_TEST;
 
@@ -198,5 +241,6 @@ RUN_TEST(ppoll_negative_test);
 RUN_TEST(ppoll_null_test);
 RUN_TEST(ppoll_overflow_test);
 RUN_TEST(ppoll_immediate_timeout_test);
+RUN_TEST(ppoll_many_test);
 RUN_TEST(transfer_fd_test);
 END_TEST_CASE(fdio_handle_fd_test)
@@ -397,6 +397,46 @@ bool socketpair_shutdown_peer_rd_during_send_test(void) {
     END_TEST;
 }
 
+// poll() on more fds than zx_object_wait_many() takes keeps its waits armed
+// between calls.  Data which arrived and was read again between two polls
+// must not be reported by the second one.
+#define POLL_MANY_PAIRS 12
+
+bool socketpair_poll_many_stale_test(void) {
+    BEGIN_TEST;
+
+    int fds[POLL_MANY_PAIRS][2];
+    struct pollfd pfds[POLL_MANY_PAIRS];
+    for (int i = 0; i < POLL_MANY_PAIRS; i++) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]), 0, "socketpair failed");
+        pfds[i].fd = fds[i][1];
+        pfds[i].events = POLLIN;
+    }
+
+    // Make the first pair readable, so the first poll returns with the
+    // waits on every other pair still armed.
+    char c = 'a';
+    ASSERT_EQ(write(fds[0][0], &c, 1), 1, "write failed");
+    ASSERT_EQ(poll(pfds, POLL_MANY_PAIRS, 1000), 1, "poll failed");
+    EXPECT_EQ(pfds[0].revents, POLLIN, "");
+    ASSERT_EQ(read(fds[0][1], &c, 1), 1, "read failed");
+
+    // Fire the armed wait on the last pair, and drain it again.
+    ASSERT_EQ(write(fds[POLL_MANY_PAIRS - 1][0], &c, 1), 1, "write failed");
+    ASSERT_EQ(read(fds[POLL_MANY_PAIRS - 1][1], &c, 1), 1, "read failed");
+
+    EXPECT_EQ(poll(pfds, POLL_MANY_PAIRS, 0), 0, "poll reported a drained fd as readable");
+    for (int i = 0; i < POLL_MANY_PAIRS; i++) {
+        EXPECT_EQ(pfds[i].revents, 0, "");
+    }
+
+    for (int i = 0; i < POLL_MANY_PAIRS; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(fdio_socketpair_test)
 RUN_TEST(socketpair_test);
 RUN_TEST(socketpair_shutdown_rd_test);
@@ -408,4 +448,5 @@ RUN_TEST(socketpair_shutdown_self_rd_during_recv_test);
 RUN_TEST(socketpair_shutdown_peer_wr_during_recv_test);
 RUN_TEST(socketpair_shutdown_self_wr_during_send_test);
 RUN_TEST(socketpair_shutdown_peer_rd_during_send_test);
+RUN_TEST(socketpair_poll_many_stale_test);
 END_TEST_CASE(fdio_socketpair_test)
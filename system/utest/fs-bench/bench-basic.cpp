@@ -106,6 +106,31 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+// Many small appends, synced at the end.  The filesystem's writeback ends up
+// sending lots of small adjacent writes to the block device, which is what
+// the block server's request merging is meant to help with.
+template <size_t DataSize, size_t NumOps>
+bool benchmark_small_sequential_writes(void) {
+    BEGIN_TEST;
+    int fd = open(MOUNT_POINT "/smallwrites", O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+    printf("\nBenchmarking Small Sequential Writes (%lu x %lu bytes)\n", NumOps, DataSize);
+
+    uint8_t data[DataSize];
+    memset(data, kMagicByte, sizeof(data));
+
+    uint64_t start = zx_ticks_get();
+    for (size_t i = 0; i < NumOps; i++) {
+        ASSERT_EQ(write(fd, data, DataSize), DataSize);
+    }
+    ASSERT_EQ(fsync(fd), 0);
+    time_end("write + sync", start);
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(MOUNT_POINT "/smallwrites"), 0);
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr kComponentLength = fbl::constexpr_strlen(START_STRING);
@@ -202,14 +227,64 @@ bool benchmark_path_walk(void) {
     END_TEST;
 }
 
+// Creates, renames and unlinks many empty files.  This is almost all
+// metadata, so it measures how cheaply the filesystem commits it.
+template <size_t NumFiles>
+bool benchmark_metadata_churn(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Metadata Churn (%lu files)\n", NumFiles);
+    char path[PATH_MAX];
+    char renamed[PATH_MAX];
+    uint64_t start;
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/churn_%zu", i);
+        int fd = open(path, O_CREAT | O_RDWR | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "Cannot create file");
+        ASSERT_EQ(close(fd), 0);
+    }
+    time_end("create", start);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/churn_%zu", i);
+        snprintf(renamed, sizeof(renamed), MOUNT_POINT "/churned_%zu", i);
+        ASSERT_EQ(rename(path, renamed), 0);
+    }
+    time_end("rename", start);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(renamed, sizeof(renamed), MOUNT_POINT "/churned_%zu", i);
+        ASSERT_EQ(unlink(renamed), 0);
+    }
+    time_end("unlink", start);
+
+    int fd = open(MOUNT_POINT, O_DIRECTORY | O_RDONLY);
+    ASSERT_GE(fd, 0);
+    start = zx_ticks_get();
+    ASSERT_EQ(syncfs(fd), 0);
+    time_end("sync", start);
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 8192>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 16384>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<256 * KB, 256>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<1 * MB, 64>))
+RUN_TEST_PERFORMANCE((benchmark_write_read<4 * MB, 16>))
+RUN_TEST_PERFORMANCE((benchmark_small_sequential_writes<512, 4096>))
+RUN_TEST_PERFORMANCE((benchmark_small_sequential_writes<4 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<125>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<250>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<500>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<1000>))
+RUN_TEST_PERFORMANCE((benchmark_metadata_churn<1000>))
+RUN_TEST_PERFORMANCE((benchmark_metadata_churn<4000>))
 END_TEST_CASE(basic_benchmarks)
@@ -4,16 +4,24 @@
 
 // Tests for MinFS-specific behavior.
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <fbl/algorithm.h>
+#include <fdio/vfs.h>
 #include <minfs/format.h>
 #include <unittest/unittest.h>
+#include <zircon/device/ramdisk.h>
 #include <zircon/device/vfs.h>
 
 #include "filesystems.h"
+#include "misc.h"
 
 namespace {
 
@@ -43,6 +51,171 @@ bool QueryInfo(size_t expected_nodes) {
     return true;
 }
 
+// Makes the ramdisk under test keep only what has been flushed, so it can
+// lose the rest in a crash.
+bool SimulateWriteCache(void) {
+    BEGIN_HELPER;
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+    ASSERT_GE(ioctl_ramdisk_simulate_write_cache(fd), 0, "Could not simulate write cache");
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+// Puts the ramdisk to sleep once |blocks| more blocks have been written.
+bool SleepAfter(uint64_t blocks) {
+    BEGIN_HELPER;
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+    ASSERT_GE(ioctl_ramdisk_sleep_after(fd, &blocks), 0, "Could not put disk to sleep");
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+// Cuts the power: nothing more reaches the disk, and whatever it hasn't
+// flushed is lost.  Then brings the filesystem back up the way a reboot
+// would, checking it on the way.
+bool CrashAndRecover(void) {
+    BEGIN_HELPER;
+    ASSERT_TRUE(SleepAfter(0));
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+    ASSERT_GE(ioctl_ramdisk_simulate_crash(fd), 0, "Could not simulate crash");
+
+    // The disk is asleep, so unmounting can't write anything either.
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_GE(ioctl_ramdisk_wake_up(fd), 0, "Could not wake up disk");
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0, "Inconsistent after crash");
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    END_HELPER;
+}
+
+bool CreateSynced(const char* name) {
+    BEGIN_HELPER;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", MOUNT_PATH, name);
+    int fd = open(path, O_CREAT | O_RDWR | O_EXCL, 0644);
+    ASSERT_GT(fd, 0, "Failed to create file");
+    ASSERT_EQ(fsync(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+bool CheckExists(const char* name) {
+    BEGIN_HELPER;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", MOUNT_PATH, name);
+    int fd = open(path, O_RDWR);
+    ASSERT_GT(fd, 0, "Synced file lost in crash");
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+// Creates, renames and unlinks files without syncing, leaving a dozen of
+// them behind.  Errors are ignored, since the disk may fall asleep halfway.
+void ChurnFiles(int round) {
+    char path[128];
+    char renamed[128];
+    for (int i = 0; i < 32; i++) {
+        snprintf(path, sizeof(path), "%s/churn_%d_%d", MOUNT_PATH, round, i);
+        snprintf(renamed, sizeof(renamed), "%s/churned_%d_%d", MOUNT_PATH, round, i);
+        int fd = open(path, O_CREAT | O_RDWR, 0644);
+        if (fd > 0) {
+            write(fd, path, strlen(path));
+            close(fd);
+        }
+        if (i % 3 == 0) {
+            rename(path, renamed);
+        } else if (i % 3 == 1) {
+            unlink(path);
+        }
+    }
+}
+
+// Fills |buf| with a pattern which differs for each block of each file.
+void FillBlock(uint8_t* buf, uint32_t seed, uint32_t block) {
+    for (size_t i = 0; i < minfs::kMinfsBlockSize; i++) {
+        buf[i] = static_cast<uint8_t>((seed * 31 + block * 7 + i) % 251);
+    }
+}
+
+bool CheckBlock(int fd, uint32_t seed, uint32_t block, bool hole) {
+    BEGIN_HELPER;
+    uint8_t expected[minfs::kMinfsBlockSize];
+    uint8_t actual[minfs::kMinfsBlockSize];
+    if (hole) {
+        memset(expected, 0, sizeof(expected));
+    } else {
+        FillBlock(expected, seed, block);
+    }
+    ASSERT_EQ(pread(fd, actual, sizeof(actual), block * minfs::kMinfsBlockSize),
+              sizeof(actual));
+    ASSERT_EQ(memcmp(expected, actual, sizeof(actual)), 0, "Block has the wrong contents");
+    END_HELPER;
+}
+
+// Turns the freshly made filesystem under test into an image of an older
+// |version|, as an older mkfs would have left it: block-mapped root, and
+// nothing in the journal.  Version 5 images have no journal at all.
+bool MakeOldVersion(uint32_t version) {
+    BEGIN_HELPER;
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+
+    uint8_t blk[minfs::kMinfsBlockSize];
+    ASSERT_EQ(pread(fd, blk, sizeof(blk), 0), sizeof(blk));
+    minfs::minfs_info_t info;
+    memcpy(&info, blk, sizeof(info));
+    ASSERT_EQ(info.version, minfs::kMinfsVersion);
+    ASSERT_NE(info.journal_block_count, 0, "Test disk has no journal");
+    minfs::blk_t journal_block = info.journal_block;
+    info.version = version;
+    if (version == minfs::kMinfsVersionNoJournal) {
+        info.journal_block = 0;
+        info.journal_block_count = 0;
+    }
+    memcpy(blk, &info, sizeof(info));
+    ASSERT_EQ(pwrite(fd, blk, sizeof(blk), 0), sizeof(blk));
+
+    // An unwritten journal info block starts the journal afresh.
+    memset(blk, 0, sizeof(blk));
+    ASSERT_EQ(pwrite(fd, blk, sizeof(blk), journal_block * minfs::kMinfsBlockSize),
+              sizeof(blk));
+
+    off_t ino_off = info.ino_block * minfs::kMinfsBlockSize;
+    ASSERT_EQ(pread(fd, blk, sizeof(blk), ino_off), sizeof(blk));
+    minfs::minfs_inode_t* root = reinterpret_cast<minfs::minfs_inode_t*>(blk) +
+                                 minfs::kMinfsRootIno;
+    ASSERT_EQ(root->flags, minfs::kMinfsInodeFlagExtents);
+    ASSERT_EQ(root->extent_count, 1);
+    ASSERT_EQ(root->extents[0].start, 0);
+    ASSERT_EQ(root->extents[0].count, 1);
+    minfs::blk_t bno = root->extents[0].bno;
+    memset(root->extents, 0, sizeof(root->extents));
+    root->flags = 0;
+    root->extent_count = 0;
+    root->dnum[0] = bno;
+    ASSERT_EQ(pwrite(fd, blk, sizeof(blk), ino_off), sizeof(blk));
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0, "Old version image is inconsistent");
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    END_HELPER;
+}
+
+bool CheckVersion(uint32_t version) {
+    BEGIN_HELPER;
+    int fd = open(test_disk_path, O_RDONLY);
+    ASSERT_GE(fd, 0, "Could not open test disk");
+    minfs::minfs_info_t info;
+    ASSERT_EQ(pread(fd, &info, sizeof(info), 0), sizeof(info));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(info.version, version);
+    END_HELPER;
+}
+
 }  // namespace
 
 bool TestQueryInfo(void) {
@@ -63,9 +236,236 @@ bool TestQueryInfo(void) {
     END_TEST;
 }
 
+// Metadata which was synced before a crash is found again on remount, even
+// though it may only have reached the journal.
+bool TestJournalReplay(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(SimulateWriteCache());
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "replay_%d", i);
+        ASSERT_TRUE(CreateSynced(name));
+    }
+    ASSERT_TRUE(CrashAndRecover());
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "replay_%d", i);
+        ASSERT_TRUE(CheckExists(name));
+    }
+    END_TEST;
+}
+
+// Crashes partway through a stream of metadata operations, at many points,
+// including halfway through a write.  Each time, the filesystem must come back
+// consistent and with everything which was synced.
+bool TestJournalTornWrites(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(SimulateWriteCache());
+    // The point of the crash, in 512 byte device blocks.
+    const uint64_t kCrashPoints[] = { 1, 2, 7, 16, 17, 33, 64, 100, 160, 257, 400, 1000 };
+    for (size_t i = 0; i < fbl::count_of(kCrashPoints); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "synced_%zu", i);
+        ASSERT_TRUE(CreateSynced(name));
+        ASSERT_TRUE(SleepAfter(kCrashPoints[i]));
+        ChurnFiles(static_cast<int>(i));
+        ASSERT_TRUE(CrashAndRecover());
+        for (size_t j = 0; j <= i; j++) {
+            snprintf(name, sizeof(name), "synced_%zu", j);
+            ASSERT_TRUE(CheckExists(name));
+        }
+    }
+    END_TEST;
+}
+
+// Writes two files at once, one in order and one backwards with holes, so
+// that the second needs more extents than fit in the inode.  Both have to
+// come back intact, and with fsck's approval, after a remount and after
+// being truncated (which brings the second back down to a few extents).
+bool TestExtents(void) {
+    BEGIN_TEST;
+    constexpr uint32_t kBlocks = 512;
+    int seq = open(MOUNT_PATH "/sequential", O_CREAT | O_RDWR | O_EXCL, 0644);
+    ASSERT_GT(seq, 0);
+    int sparse = open(MOUNT_PATH "/sparse", O_CREAT | O_RDWR | O_EXCL, 0644);
+    ASSERT_GT(sparse, 0);
+
+    uint8_t buf[minfs::kMinfsBlockSize];
+    for (uint32_t i = 0; i < kBlocks; i++) {
+        FillBlock(buf, 1, i);
+        ASSERT_EQ(write(seq, buf, sizeof(buf)), sizeof(buf));
+        if (i % 4 == 0) {
+            uint32_t block = 2 * (kBlocks / 4 - i / 4) - 1;
+            FillBlock(buf, 2, block);
+            ASSERT_EQ(pwrite(sparse, buf, sizeof(buf), block * minfs::kMinfsBlockSize),
+                      sizeof(buf));
+        }
+    }
+
+    // Blocks which are written but not yet allocated still count.
+    struct stat st;
+    ASSERT_EQ(fstat(seq, &st), 0);
+    ASSERT_GE(st.st_blocks * VNATTR_BLKSIZE, kBlocks * minfs::kMinfsBlockSize);
+    ASSERT_EQ(close(seq), 0);
+    ASSERT_EQ(close(sparse), 0);
+    ASSERT_TRUE(check_remount());
+
+    seq = open(MOUNT_PATH "/sequential", O_RDWR);
+    ASSERT_GT(seq, 0);
+    sparse = open(MOUNT_PATH "/sparse", O_RDWR);
+    ASSERT_GT(sparse, 0);
+    for (uint32_t i = 0; i < kBlocks; i++) {
+        ASSERT_TRUE(CheckBlock(seq, 1, i, false));
+    }
+    for (uint32_t i = 0; i < kBlocks / 2; i++) {
+        ASSERT_TRUE(CheckBlock(sparse, 2, i, i % 2 == 0));
+    }
+
+    // Cut both files in the middle of an extent.
+    ASSERT_EQ(ftruncate(seq, (kBlocks / 3) * minfs::kMinfsBlockSize + 100), 0);
+    ASSERT_EQ(ftruncate(sparse, (kBlocks / 32) * minfs::kMinfsBlockSize), 0);
+    ASSERT_EQ(close(seq), 0);
+    ASSERT_EQ(close(sparse), 0);
+    ASSERT_TRUE(check_remount());
+
+    seq = open(MOUNT_PATH "/sequential", O_RDWR);
+    ASSERT_GT(seq, 0);
+    sparse = open(MOUNT_PATH "/sparse", O_RDWR);
+    ASSERT_GT(sparse, 0);
+    for (uint32_t i = 0; i < kBlocks / 3; i++) {
+        ASSERT_TRUE(CheckBlock(seq, 1, i, false));
+    }
+    for (uint32_t i = 0; i < kBlocks / 32; i++) {
+        ASSERT_TRUE(CheckBlock(sparse, 2, i, i % 2 == 0));
+    }
+    ASSERT_EQ(close(seq), 0);
+    ASSERT_EQ(close(sparse), 0);
+    ASSERT_EQ(unlink(MOUNT_PATH "/sequential"), 0);
+    ASSERT_EQ(unlink(MOUNT_PATH "/sparse"), 0);
+    ASSERT_TRUE(check_remount());
+    END_TEST;
+}
+
+// Fills the disk with a file whose blocks are allocated lazily, and then
+// tries to take the space promised to it with directories.  Once the disk is
+// full, fsync and close must still succeed, and the data must be there.
+bool TestFullDisk(void) {
+    BEGIN_TEST;
+    int fd = open(MOUNT_PATH "/full", O_CREAT | O_RDWR | O_EXCL, 0644);
+    ASSERT_GT(fd, 0);
+
+    uint8_t buf[minfs::kMinfsBlockSize];
+    uint32_t blocks = 0;
+    while (true) {
+        FillBlock(buf, 3, blocks);
+        ssize_t r = write(fd, buf, sizeof(buf));
+        if (r != sizeof(buf)) {
+            ASSERT_EQ(r, -1, "Short write at the end of the disk");
+            ASSERT_EQ(errno, ENOSPC);
+            break;
+        }
+        blocks++;
+    }
+    ASSERT_GT(blocks, 0);
+
+    constexpr int kDirs = 16;
+    for (int i = 0; i < kDirs; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/full_dir_%d", MOUNT_PATH, i);
+        mkdir(path, 0755);
+    }
+
+    ASSERT_EQ(fsync(fd), 0, "Data which was accepted could not be written");
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(check_remount());
+
+    fd = open(MOUNT_PATH "/full", O_RDONLY);
+    ASSERT_GT(fd, 0);
+    for (uint32_t i = 0; i < blocks; i++) {
+        ASSERT_TRUE(CheckBlock(fd, 3, i, false));
+    }
+    ASSERT_EQ(close(fd), 0);
+    for (int i = 0; i < kDirs; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/full_dir_%d", MOUNT_PATH, i);
+        rmdir(path);
+    }
+    ASSERT_EQ(unlink(MOUNT_PATH "/full"), 0);
+    ASSERT_TRUE(check_remount());
+    END_TEST;
+}
+
+// A version 6 image still mounts, replays its journal after a crash and passes
+// fsck, and keeps its version.
+bool TestVersion6(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(MakeOldVersion(minfs::kMinfsVersionBlockMap));
+    ASSERT_TRUE(SimulateWriteCache());
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "v6_%d", i);
+        ASSERT_TRUE(CreateSynced(name));
+    }
+    ASSERT_TRUE(CrashAndRecover());
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "v6_%d", i);
+        ASSERT_TRUE(CheckExists(name));
+    }
+
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_TRUE(CheckVersion(minfs::kMinfsVersionBlockMap));
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0);
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    END_TEST;
+}
+
+// A version 5 image, which has no journal, still mounts, keeps its files
+// across a remount and passes fsck, and keeps its version.
+bool TestVersion5(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(MakeOldVersion(minfs::kMinfsVersionNoJournal));
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "v5_%d", i);
+        ASSERT_TRUE(CreateSynced(name));
+    }
+
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_TRUE(CheckVersion(minfs::kMinfsVersionNoJournal));
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0);
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "v5_%d", i);
+        ASSERT_TRUE(CheckExists(name));
+    }
+    END_TEST;
+}
+
 #define RUN_MINFS_TESTS(name, CASE_TESTS) \
     FS_TEST_CASE(name, DEFAULT_DISK_SIZE, CASE_TESTS, FS_TEST_FVM, minfs, 1)
 
+#define RUN_MINFS_TESTS_NORMAL(name, CASE_TESTS) \
+    FS_TEST_CASE(name, (1llu << 26), CASE_TESTS, FS_TEST_NORMAL, minfs, 1)
+
 RUN_MINFS_TESTS(FsMinfsTestsFvm,
     RUN_TEST_MEDIUM(TestQueryInfo)
 )
+
+RUN_MINFS_TESTS_NORMAL(FsMinfsExtentTests,
+    RUN_TEST_MEDIUM(TestExtents)
+    RUN_TEST_MEDIUM(TestFullDisk)
+)
+
+// These need the ramdisk itself underneath the filesystem, and keep a second
+// copy of it, so they use a small disk.
+RUN_MINFS_TESTS_NORMAL(FsMinfsCrashTests,
+    RUN_TEST_MEDIUM(TestJournalReplay)
+    RUN_TEST_MEDIUM(TestJournalTornWrites)
+)
+
+RUN_MINFS_TESTS_NORMAL(FsMinfsVersionTests,
+    RUN_TEST_MEDIUM(TestVersion5)
+    RUN_TEST_MEDIUM(TestVersion6)
+)
@@ -1790,6 +1790,89 @@ static bool TestPersistenceSimple(void) {
     END_TEST;
 }
 
+// Grow two partitions one slice at a time on a disk with a large slice
+// table, where each extension is dominated by the cost of updating the FVM
+// metadata.  The result must survive a rebind, which relies on both copies of
+// the metadata having been kept up to date.
+static bool TestGrowSliceBySlice(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_driver[PATH_MAX];
+    constexpr uint64_t kBlkSize = 512;
+    constexpr uint64_t kBlkCount = 1 << 22;
+    constexpr uint64_t kSliceSize = 64 * (1 << 10);
+    constexpr size_t kGrowCount = 2048;
+    ASSERT_EQ(StartFVMTest(kBlkSize, kBlkCount, kSliceSize, ramdisk_path,
+                           fvm_driver), 0, "error mounting FVM");
+
+    int fd = open(fvm_driver, O_RDWR);
+    ASSERT_GT(fd, 0);
+
+    alloc_req_t request;
+    memset(&request, 0, sizeof(request));
+    request.slice_count = 1;
+    memcpy(request.guid, kTestUniqueGUID, GUID_LEN);
+    strcpy(request.name, kTestPartName1);
+    memcpy(request.type, kTestPartGUIDData, GUID_LEN);
+    int data_fd = fvm_allocate_partition(fd, &request);
+    ASSERT_GT(data_fd, 0);
+    memcpy(request.guid, kTestUniqueGUID2, GUID_LEN);
+    strcpy(request.name, kTestPartName2);
+    memcpy(request.type, kTestPartGUIDBlob, GUID_LEN);
+    int blob_fd = fvm_allocate_partition(fd, &request);
+    ASSERT_GT(blob_fd, 0);
+
+    // Alternate between the partitions, so neither is physically contiguous.
+    extend_request_t erequest;
+    erequest.length = 1;
+    uint64_t start = zx_ticks_get();
+    for (size_t i = 1; i <= kGrowCount; i++) {
+        erequest.offset = i;
+        ASSERT_EQ(ioctl_block_fvm_extend(data_fd, &erequest), 0);
+        ASSERT_EQ(ioctl_block_fvm_extend(blob_fd, &erequest), 0);
+    }
+    uint64_t ticks_per_usec = zx_ticks_per_second() / 1000000;
+    printf("Benchmark grow slice by slice: [%10lu] usec per extension\n",
+           (zx_ticks_get() - start) / ticks_per_usec / (2 * kGrowCount));
+
+    // Punch holes into one partition and fill them again, which splits and
+    // merges the runs of free slices.
+    for (size_t i = 1; i <= kGrowCount; i += 2) {
+        erequest.offset = i;
+        ASSERT_EQ(ioctl_block_fvm_shrink(data_fd, &erequest), 0);
+    }
+    for (size_t i = 1; i <= kGrowCount; i += 2) {
+        erequest.offset = i;
+        ASSERT_EQ(ioctl_block_fvm_extend(data_fd, &erequest), 0);
+    }
+    ASSERT_EQ(close(data_fd), 0);
+    ASSERT_EQ(close(blob_fd), 0);
+
+    const partition_entry_t entries[] = {
+        {kTestPartName1, 1},
+        {kTestPartName2, 2},
+    };
+    fd = FVMRebind(fd, ramdisk_path, entries, fbl::count_of(entries));
+    ASSERT_GT(fd, 0, "Failed to rebind FVM driver");
+
+    data_fd = open_partition(kTestUniqueGUID, kTestPartGUIDData, 0, nullptr);
+    ASSERT_GT(data_fd, 0, "Couldn't re-open Data VPart");
+    blob_fd = open_partition(kTestUniqueGUID2, kTestPartGUIDBlob, 0, nullptr);
+    ASSERT_GT(blob_fd, 0, "Couldn't re-open Blob VPart");
+    block_info_t info;
+    ASSERT_GE(ioctl_block_get_info(data_fd, &info), 0);
+    ASSERT_EQ(info.block_count * info.block_size, kSliceSize * (kGrowCount + 1));
+    ASSERT_GE(ioctl_block_get_info(blob_fd, &info), 0);
+    ASSERT_EQ(info.block_count * info.block_size, kSliceSize * (kGrowCount + 1));
+
+    ASSERT_EQ(close(data_fd), 0);
+    ASSERT_EQ(close(blob_fd), 0);
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(FVMCheck(fvm_driver, kSliceSize), 0);
+    ASSERT_EQ(EndFVMTest(ramdisk_path), 0, "unmounting FVM");
+    END_TEST;
+}
+
 static bool TestCorruptMount(void) {
     BEGIN_TEST;
     char ramdisk_path[PATH_MAX];
@@ -2795,6 +2878,7 @@ RUN_TEST_LARGE((TestRandomOpMultithreaded<5, /* persistent= */ true>))
 RUN_TEST_LARGE((TestRandomOpMultithreaded<10, /* persistent= */ true>))
 RUN_TEST_LARGE((TestRandomOpMultithreaded<25, /* persistent= */ true>))
 RUN_TEST_MEDIUM(TestCorruptMount)
+RUN_TEST_PERFORMANCE(TestGrowSliceBySlice)
 END_TEST_CASE(fvm_tests)
 
 int main(int argc, char** argv) {
@@ -5,7 +5,13 @@
 #include <sys/random.h>
 
 #include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
 #include <unittest/unittest.h>
+#include <zircon/syscalls.h>
 
 bool getentropy_valid() {
     BEGIN_TEST;
@@ -42,9 +48,113 @@ bool getentropy_too_big() {
     END_TEST;
 }
 
+// Draws of every size up to a few times the pool, so requests both fit in
+// what's left of the pool and run past it.
+bool arc4random_buf_sizes() {
+    BEGIN_TEST;
+
+    for (size_t len = 1; len <= 3 * ZX_CPRNG_DRAW_MAX_LEN; len += 7) {
+        uint8_t a[3 * ZX_CPRNG_DRAW_MAX_LEN] = {};
+        uint8_t b[3 * ZX_CPRNG_DRAW_MAX_LEN] = {};
+        arc4random_buf(a, len);
+        arc4random_buf(b, len);
+        if (len >= 16) {
+            EXPECT_NE(memcmp(a, b, len), 0, "repeated output");
+        }
+        for (size_t i = len; i < sizeof(a); ++i) {
+            ASSERT_EQ(a[i], 0, "wrote past the end of the buffer");
+        }
+    }
+
+    END_TEST;
+}
+
+bool arc4random_uniform_bounds() {
+    BEGIN_TEST;
+
+    EXPECT_EQ(arc4random_uniform(0), 0u);
+    EXPECT_EQ(arc4random_uniform(1), 0u);
+
+    const uint32_t bounds[] = {2, 3, 10, 1000, 0x80000001u, UINT32_MAX};
+    for (uint32_t bound : bounds) {
+        for (int i = 0; i < 1000; ++i) {
+            EXPECT_LT(arc4random_uniform(bound), bound);
+        }
+    }
+
+    // Every value of a small range should come up.
+    bool seen[6] = {};
+    for (int i = 0; i < 1000; ++i) {
+        seen[arc4random_uniform(6)] = true;
+    }
+    for (bool s : seen) {
+        EXPECT_TRUE(s);
+    }
+
+    END_TEST;
+}
+
+constexpr int kBenchThreads = 4;
+constexpr size_t kBenchDraws = 20000;
+
+int getentropy_thread(void*) {
+    for (size_t i = 0; i < kBenchDraws; ++i) {
+        uint32_t value;
+        if (getentropy(&value, sizeof(value)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int arc4random_thread(void*) {
+    for (size_t i = 0; i < kBenchDraws; ++i) {
+        arc4random();
+    }
+    return 0;
+}
+
+bool bench(const char* name, thrd_start_t fn) {
+    BEGIN_HELPER;
+
+    thrd_t threads[kBenchThreads];
+    zx_time_t start = zx_time_get(ZX_CLOCK_MONOTONIC);
+    for (auto& thread : threads) {
+        ASSERT_EQ(thrd_create(&thread, fn, nullptr), thrd_success);
+    }
+    for (auto& thread : threads) {
+        int result;
+        ASSERT_EQ(thrd_join(thread, &result), thrd_success);
+        EXPECT_EQ(result, 0);
+    }
+    zx_time_t elapsed = zx_time_get(ZX_CLOCK_MONOTONIC) - start;
+
+    uint64_t bytes = kBenchThreads * kBenchDraws * sizeof(uint32_t);
+    uint64_t usec = elapsed / ZX_USEC(1);
+    unittest_printf("%s, %d threads: %" PRIu64 " KB/s\n", name, kBenchThreads,
+                    usec ? bytes * 1000000 / usec / 1024 : 0);
+
+    END_HELPER;
+}
+
+// Compares taking four bytes at a time from the kernel with taking them from
+// arc4random's pool, from several threads at once.  Run with -v to see the
+// results.
+bool small_draw_bench() {
+    BEGIN_TEST;
+
+    EXPECT_TRUE(bench("getentropy", getentropy_thread));
+    EXPECT_TRUE(bench("arc4random", arc4random_thread));
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(getentropy_tests)
 RUN_TEST(getentropy_valid);
 RUN_TEST(getentropy_too_big);
+RUN_TEST(arc4random_buf_sizes);
+RUN_TEST(arc4random_uniform_bounds);
+RUN_TEST_MEDIUM(small_draw_bench);
 END_TEST_CASE(getentropy_tests)
 
 int main(int argc, char** argv) {
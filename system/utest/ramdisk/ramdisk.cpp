@@ -16,10 +16,12 @@
 #include <unistd.h>
 
 #include <block-client/client.h>
+#include <fs-management/mount.h>
 #include <fs-management/ramdisk.h>
 #include <zircon/device/block.h>
 #include <zircon/device/ramdisk.h>
 #include <zircon/syscalls.h>
+#include <zircon/syscalls/object.h>
 #include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
@@ -1060,6 +1062,278 @@ bool ramdisk_test_fifo_bad_client_bad_vmo(void) {
     END_TEST;
 }
 
+bool ramdisk_test_fifo_sync_survives_crash(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk(PAGE_SIZE, 512);
+    ASSERT_GE(ioctl_ramdisk_simulate_write_cache(fd), 0, "Failed to enable write cache");
+
+    zx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), ZX_OK);
+
+    uint64_t vmo_size = PAGE_SIZE * 3;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(vmo_size, 0, &vmo), ZX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), vmo_size);
+    size_t actual;
+    ASSERT_EQ(zx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), ZX_OK);
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    zx_handle_t xfer_vmo;
+    ASSERT_EQ(zx_handle_duplicate(vmo, ZX_RIGHT_SAME_RIGHTS, &xfer_vmo), ZX_OK);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    // The first two pages are followed by a barrier, the last page is not
+    block_fifo_request_t requests[2] = {};
+    requests[0].txnid      = txnid;
+    requests[0].vmoid      = vmoid;
+    requests[0].opcode     = BLOCKIO_WRITE;
+    requests[0].length     = PAGE_SIZE * 2;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    requests[1].txnid      = txnid;
+    requests[1].opcode     = BLOCKIO_SYNC;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], fbl::count_of(requests)), ZX_OK);
+
+    requests[0].length     = PAGE_SIZE;
+    requests[0].vmo_offset = PAGE_SIZE * 2;
+    requests[0].dev_offset = PAGE_SIZE * 2;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK);
+
+    ASSERT_GE(ioctl_ramdisk_simulate_crash(fd), 0, "Failed to simulate crash");
+
+    // Only the synced pages are left; the unsynced one reverts to zeroes
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(zx_vmo_write(vmo, out.get(), 0, vmo_size, &actual), ZX_OK);
+    requests[0].opcode     = BLOCKIO_READ;
+    requests[0].length     = vmo_size;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK);
+    ASSERT_EQ(zx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), ZX_OK);
+    ASSERT_EQ(memcmp(buf.get(), out.get(), PAGE_SIZE * 2), 0, "Synced data lost");
+    memset(buf.get(), 0, PAGE_SIZE);
+    ASSERT_EQ(memcmp(buf.get(), out.get() + PAGE_SIZE * 2, PAGE_SIZE), 0,
+              "Unsynced data survived the crash");
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK);
+    ASSERT_EQ(zx_handle_close(vmo), ZX_OK);
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
+bool ramdisk_test_sleep_after(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk(PAGE_SIZE, 512);
+    const size_t len = PAGE_SIZE * 4;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[len]);
+    ASSERT_TRUE(ac.check());
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[len]());
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), len);
+
+    // Fall asleep halfway through a four page write
+    uint64_t blocks = 2;
+    ASSERT_GE(ioctl_ramdisk_sleep_after(fd, &blocks), 0, "Failed to arm sleep");
+    ASSERT_NE(write(fd, buf.get(), len), (ssize_t)len, "Write should have been cut short");
+
+    // While asleep, nothing gets through
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    ASSERT_LT(read(fd, out.get(), PAGE_SIZE), 0, "Read succeeded while asleep");
+    ASSERT_LT(write(fd, buf.get(), PAGE_SIZE), 0, "Write succeeded while asleep");
+
+    // Once awake, only the pages written before falling asleep are there
+    ASSERT_GE(ioctl_ramdisk_wake_up(fd), 0, "Failed to wake up");
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    ASSERT_EQ(read(fd, out.get(), len), (ssize_t)len);
+    ASSERT_EQ(memcmp(buf.get(), out.get(), PAGE_SIZE * 2), 0, "Pages before sleep lost");
+    memset(buf.get(), 0, PAGE_SIZE * 2);
+    ASSERT_EQ(memcmp(buf.get(), out.get() + PAGE_SIZE * 2, PAGE_SIZE * 2), 0,
+              "Pages written after falling asleep");
+
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
+bool ramdisk_test_fifo_trim(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk(PAGE_SIZE, 512);
+    block_info_t info;
+    ASSERT_GE(ioctl_block_get_info(fd, &info), 0, "Failed to get block info");
+    ASSERT_TRUE(info.flags & BLOCK_FLAG_TRIM_SUPPORT, "Ramdisk should support trim");
+
+    zx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), ZX_OK);
+
+    uint64_t vmo_size = PAGE_SIZE * 3;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(vmo_size, 0, &vmo), ZX_OK, "Failed to create VMO");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), vmo_size);
+    size_t actual;
+    ASSERT_EQ(zx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), ZX_OK);
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    zx_handle_t xfer_vmo;
+    ASSERT_EQ(zx_handle_duplicate(vmo, ZX_RIGHT_SAME_RIGHTS, &xfer_vmo), ZX_OK);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    // Write three pages, then trim the middle one in the same transaction
+    block_fifo_request_t requests[2] = {};
+    requests[0].txnid      = txnid;
+    requests[0].vmoid      = vmoid;
+    requests[0].opcode     = BLOCKIO_WRITE;
+    requests[0].length     = vmo_size;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    requests[1].txnid      = txnid;
+    requests[1].opcode     = BLOCKIO_TRIM;
+    requests[1].length     = PAGE_SIZE;
+    requests[1].dev_offset = PAGE_SIZE;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], fbl::count_of(requests)), ZX_OK);
+
+    // The trim is ordered after the write, so the ramdisk reads it back as
+    // zeroes, and leaves its neighbours alone
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(zx_vmo_write(vmo, out.get(), 0, vmo_size, &actual), ZX_OK);
+    requests[0].opcode = BLOCKIO_READ;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK);
+    ASSERT_EQ(zx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), ZX_OK);
+    ASSERT_EQ(memcmp(buf.get(), out.get(), PAGE_SIZE), 0, "Data before the trim lost");
+    ASSERT_EQ(memcmp(buf.get() + PAGE_SIZE * 2, out.get() + PAGE_SIZE * 2, PAGE_SIZE), 0,
+              "Data after the trim lost");
+    memset(buf.get(), 0, PAGE_SIZE);
+    ASSERT_EQ(memcmp(buf.get(), out.get() + PAGE_SIZE, PAGE_SIZE), 0,
+              "Trimmed data survived");
+
+    // Trims past the end of the device are rejected
+    requests[1].dev_offset = PAGE_SIZE * 512;
+    ASSERT_NE(block_fifo_txn(client, &requests[1], 1), ZX_OK);
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), ZX_OK);
+    ASSERT_EQ(zx_handle_close(vmo), ZX_OK);
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
+// Looks up how much memory is committed to the VMO |koid|, which this process
+// has mapped.
+static bool get_committed_bytes(zx_koid_t koid, uint64_t* out) {
+    BEGIN_HELPER;
+    size_t actual, avail;
+    ASSERT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_VMOS, nullptr, 0,
+                                 &actual, &avail), ZX_OK);
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<zx_info_vmo_t[]> vmos(new (&ac) zx_info_vmo_t[avail]);
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_VMOS, vmos.get(),
+                                 avail * sizeof(zx_info_vmo_t), &actual, &avail), ZX_OK);
+    bool found = false;
+    for (size_t i = 0; i < actual; i++) {
+        if (vmos[i].koid == koid) {
+            *out = vmos[i].committed_bytes;
+            found = true;
+            break;
+        }
+    }
+    ASSERT_TRUE(found, "Ramdisk VMO is not mapped");
+    END_HELPER;
+}
+
+bool ramdisk_test_filesystem_trim(void) {
+    BEGIN_TEST;
+    constexpr size_t kDiskSize = 32 * (1 << 20);
+    constexpr size_t kFileSize = 8 * (1 << 20);
+    constexpr char kMountPath[] = "/tmp/ramdisk-trim-test";
+
+    // Build the ramdisk on a VMO we keep mapped, so we can see how much
+    // memory it holds once the ramdisk owns it
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(kDiskSize, 0, &vmo), ZX_OK);
+    zx_info_handle_basic_t basic;
+    ASSERT_EQ(zx_object_get_info(vmo, ZX_INFO_HANDLE_BASIC, &basic, sizeof(basic),
+                                 nullptr, nullptr), ZX_OK);
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, kDiskSize, ZX_VM_FLAG_PERM_READ,
+                          &addr), ZX_OK);
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(create_ramdisk_from_vmo(vmo, ramdisk_path), 0);
+
+    ASSERT_EQ(mkfs(ramdisk_path, DISK_FORMAT_MINFS, launch_stdio_sync,
+                   &default_mkfs_options), ZX_OK);
+    ASSERT_EQ(mkdir(kMountPath, 0755), 0);
+    int fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(mount(fd, kMountPath, DISK_FORMAT_MINFS, &default_mount_options,
+                    launch_stdio_async), ZX_OK);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/file", kMountPath);
+    fd = open(path, O_CREAT | O_RDWR | O_EXCL, 0644);
+    ASSERT_GE(fd, 0);
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[kFileSize]);
+    ASSERT_TRUE(ac.check());
+    fill_random(buf.get(), kFileSize);
+    ASSERT_EQ(write(fd, buf.get(), kFileSize), static_cast<ssize_t>(kFileSize));
+    ASSERT_EQ(fsync(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    uint64_t full;
+    ASSERT_TRUE(get_committed_bytes(basic.koid, &full));
+    ASSERT_GE(full, kFileSize);
+
+    // Deleting the file trims its blocks, which hands their memory back
+    ASSERT_EQ(unlink(path), 0);
+    fd = open(kMountPath, O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(syncfs(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    uint64_t emptied;
+    ASSERT_TRUE(get_committed_bytes(basic.koid, &emptied));
+    ASSERT_LE(emptied + kFileSize * 3 / 4, full, "Deleted file still takes up memory");
+
+    ASSERT_EQ(umount(kMountPath), ZX_OK);
+    ASSERT_EQ(rmdir(kMountPath), 0);
+    ASSERT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, kDiskSize), ZX_OK);
+    fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(ramdisk_tests)
 RUN_TEST_SMALL(ramdisk_test_simple)
 RUN_TEST_SMALL(ramdisk_test_vmo)
@@ -1081,6 +1355,10 @@ RUN_TEST_SMALL(ramdisk_test_fifo_bad_client_vmoid)
 RUN_TEST_SMALL(ramdisk_test_fifo_bad_client_txnid)
 RUN_TEST_SMALL(ramdisk_test_fifo_bad_client_unaligned_request)
 RUN_TEST_SMALL(ramdisk_test_fifo_bad_client_bad_vmo)
+RUN_TEST_SMALL(ramdisk_test_fifo_sync_survives_crash)
+RUN_TEST_SMALL(ramdisk_test_fifo_trim)
+RUN_TEST_MEDIUM(ramdisk_test_filesystem_trim)
+RUN_TEST_SMALL(ramdisk_test_sleep_after)
 END_TEST_CASE(ramdisk_tests)
 
 } // namespace tests
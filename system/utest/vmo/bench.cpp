@@ -188,6 +188,39 @@ int vmo_run_benchmark() {
 
     zx_handle_close(vmo);
 
+    // build a deep chain of clones, closing each link as we go, and compare
+    // read faulting through it with read faulting through a single clone
+    const size_t chain_size = 2*1024*1024;
+    const size_t chain_depth = 1000;
+    zx_vmo_create(chain_size, 0, &vmo);
+    zx_vmo_op_range(vmo, ZX_VMO_OP_COMMIT, 0, chain_size, nullptr, 0);
+
+    const size_t depths[] = { 1, chain_depth };
+    for (size_t depth : depths) {
+        zx_handle_t clone = ZX_HANDLE_INVALID;
+        zx_vmo_clone(vmo, ZX_VMO_CLONE_COPY_ON_WRITE, 0, chain_size, &clone);
+        for (size_t i = 1; i < depth; i++) {
+            zx_handle_t next;
+            zx_vmo_clone(clone, ZX_VMO_CLONE_COPY_ON_WRITE, 0, chain_size, &next);
+            zx_handle_close(clone);
+            clone = next;
+        }
+
+        zx_vmar_map(zx_vmar_root_self(), 0, clone, 0, chain_size, ZX_VM_FLAG_PERM_READ, &ptr);
+
+        t = time_it([&](){
+            for (size_t i = 0; i < chain_size; i += PAGE_SIZE) {
+                __UNUSED char a = ((volatile char *)ptr)[i];
+            }
+        });
+        printf("\ttook %" PRIu64 " nsecs to read fault in clone of size %zu at depth %zu\n", t, chain_size, depth);
+
+        zx_vmar_unmap(zx_vmar_root_self(), ptr, chain_size);
+        zx_handle_close(clone);
+    }
+
+    zx_handle_close(vmo);
+
     printf("done with benchmark\n");
 
     return 0;
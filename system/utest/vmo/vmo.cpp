@@ -1044,6 +1044,110 @@ bool vmo_clone_commit_test() {
     END_TEST;
 }
 
+// Looks up the process's view of the VMO behind |h|.
+static bool get_vmo_info(zx_handle_t h, zx_info_vmo_t* out) {
+    BEGIN_HELPER;
+
+    zx_info_handle_basic_t basic;
+    ASSERT_EQ(ZX_OK, zx_object_get_info(h, ZX_INFO_HANDLE_BASIC, &basic, sizeof(basic),
+                                        nullptr, nullptr), "get basic info");
+
+    size_t actual, avail;
+    ASSERT_EQ(ZX_OK, zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_VMOS, nullptr, 0,
+                                        &actual, &avail), "count vmos");
+    zx_info_vmo_t* vmos = static_cast<zx_info_vmo_t*>(calloc(avail, sizeof(*vmos)));
+    ASSERT_NONNULL(vmos, "alloc vmo info");
+    zx_status_t status = zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_VMOS, vmos,
+                                            avail * sizeof(*vmos), &actual, &avail);
+    bool found = false;
+    for (size_t i = 0; status == ZX_OK && i < actual; i++) {
+        if (vmos[i].koid == basic.koid && (vmos[i].flags & ZX_INFO_VMO_VIA_HANDLE)) {
+            *out = vmos[i];
+            found = true;
+            break;
+        }
+    }
+    free(vmos);
+    ASSERT_EQ(ZX_OK, status, "get vmo info");
+    ASSERT_TRUE(found, "find vmo info");
+
+    END_HELPER;
+}
+
+// build a long chain of clones, closing each intermediate clone as we go, and
+// make sure the chain collapses without changing what the clones see
+bool vmo_clone_chain_collapse_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+    const size_t depth = 1000;
+    size_t bytes_handled;
+
+    // create a vmo with a known value in each page
+    zx_handle_t vmo;
+    ASSERT_EQ(ZX_OK, zx_vmo_create(size, 0, &vmo), "vm_object_create");
+    for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+        uint64_t val = off;
+        EXPECT_EQ(ZX_OK, zx_vmo_write(vmo, &val, off, sizeof(val), &bytes_handled), "write");
+    }
+
+    // clone the clone over and over, giving every link a page of its own
+    // before closing it so there's something to migrate down the chain
+    zx_handle_t clone = ZX_HANDLE_INVALID;
+    ASSERT_EQ(ZX_OK, zx_vmo_clone(vmo, ZX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone), "vm_clone");
+    for (uint64_t i = 1; i < depth; i++) {
+        uint64_t val = i;
+        EXPECT_EQ(ZX_OK, zx_vmo_write(clone, &val, (i % 3) * PAGE_SIZE, sizeof(val),
+                                      &bytes_handled), "write to clone");
+
+        zx_handle_t next = ZX_HANDLE_INVALID;
+        ASSERT_EQ(ZX_OK, zx_vmo_clone(clone, ZX_VMO_CLONE_COPY_ON_WRITE, 0, size, &next),
+                  "vm_clone");
+        EXPECT_EQ(ZX_OK, zx_handle_close(clone), "handle_close");
+        clone = next;
+    }
+
+    // the last write to each of the first three pages wins, the fourth page
+    // still comes from the original
+    for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+        uint64_t val;
+        EXPECT_EQ(ZX_OK, zx_vmo_read(clone, &val, off, sizeof(val), &bytes_handled), "read");
+        uint64_t expected = off;
+        if (off / PAGE_SIZE < 3) {
+            expected = depth - 1;
+            while (expected % 3 != off / PAGE_SIZE)
+                expected--;
+        }
+        EXPECT_EQ(expected, val, "read back from clone");
+    }
+
+    // the original is untouched
+    for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+        uint64_t val;
+        EXPECT_EQ(ZX_OK, zx_vmo_read(vmo, &val, off, sizeof(val), &bytes_handled), "read");
+        EXPECT_EQ(off, val, "read back from original");
+    }
+
+    // and the surviving clone hangs directly off of it
+    zx_info_vmo_t vmo_info, clone_info;
+    ASSERT_TRUE(get_vmo_info(vmo, &vmo_info), "");
+    ASSERT_TRUE(get_vmo_info(clone, &clone_info), "");
+    EXPECT_EQ(vmo_info.koid, clone_info.parent_koid, "clone parent");
+    EXPECT_EQ(1u, vmo_info.num_children, "original children");
+
+    // writes to the original are still visible where the clone has no copy
+    uint64_t val = 1234;
+    EXPECT_EQ(ZX_OK, zx_vmo_write(vmo, &val, 3 * PAGE_SIZE, sizeof(val), &bytes_handled), "write");
+    val = 0;
+    EXPECT_EQ(ZX_OK, zx_vmo_read(clone, &val, 3 * PAGE_SIZE, sizeof(val), &bytes_handled), "read");
+    EXPECT_EQ(1234u, val, "read back original write from clone");
+
+    EXPECT_EQ(ZX_OK, zx_handle_close(clone), "handle_close");
+    EXPECT_EQ(ZX_OK, zx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
 bool vmo_cache_test() {
     BEGIN_TEST;
 
@@ -1331,6 +1435,7 @@ RUN_TEST(vmo_clone_test_3);
 RUN_TEST(vmo_clone_test_4);
 RUN_TEST(vmo_clone_decommit_test);
 RUN_TEST(vmo_clone_commit_test);
+RUN_TEST(vmo_clone_chain_collapse_test);
 RUN_TEST(vmo_clone_rights_test);
 END_TEST_CASE(vmo_tests)
 
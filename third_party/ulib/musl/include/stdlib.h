@@ -14,6 +14,9 @@ extern "C" {
 
 #define __NEED_size_t
 #define __NEED_wchar_t
+#if defined(_GNU_SOURCE) || defined(_BSD_SOURCE)
+#define __NEED_uint32_t
+#endif
 
 #include <bits/alltypes.h>
 
@@ -137,6 +140,9 @@ int mkostemps(char*, int, int);
 void* valloc(size_t);
 void* memalign(size_t, size_t);
 int clearenv(void);
+uint32_t arc4random(void);
+void arc4random_buf(void*, size_t);
+uint32_t arc4random_uniform(uint32_t);
 #define WCOREDUMP(s) ((s)&0x80)
 #define WIFCONTINUED(s) ((s) == 0xffff)
 #endif
@@ -44,6 +44,7 @@ endif
 LOCAL_CFLAGS += -ffreestanding
 
 LOCAL_SRCS := \
+    $(LOCAL_DIR)/zircon/arc4random.c \
     $(LOCAL_DIR)/zircon/get_startup_handle.c \
     $(LOCAL_DIR)/zircon/getentropy.c \
     $(LOCAL_DIR)/zircon/internal.c \
@@ -0,0 +1,72 @@
+#define _ALL_SOURCE
+#include <stdlib.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+#include <zircon/syscalls.h>
+
+// arc4random hands out bytes from a pool filled by the kernel's CPRNG, so
+// that the common small requests take a syscall per ZX_CPRNG_DRAW_MAX_LEN
+// bytes rather than one apiece.  Bytes are wiped from the pool as soon as
+// they are handed out.
+
+static struct {
+    mtx_t lock;
+    size_t avail;
+    uint8_t buf[ZX_CPRNG_DRAW_MAX_LEN];
+} pool = {
+    .lock = MTX_INIT,
+};
+
+static void draw(void* out, size_t len) {
+    size_t actual;
+    zx_status_t status = _zx_cprng_draw(out, len, &actual);
+    // There is no way to report failure to the caller.
+    if (status != ZX_OK || actual != len)
+        __builtin_trap();
+}
+
+void arc4random_buf(void* out, size_t len) {
+    uint8_t* p = out;
+
+    // Large requests bypass the pool.
+    while (len >= sizeof(pool.buf)) {
+        draw(p, sizeof(pool.buf));
+        p += sizeof(pool.buf);
+        len -= sizeof(pool.buf);
+    }
+    if (len == 0)
+        return;
+
+    mtx_lock(&pool.lock);
+    if (pool.avail < len) {
+        draw(pool.buf, sizeof(pool.buf));
+        pool.avail = sizeof(pool.buf);
+    }
+    uint8_t* src = pool.buf + sizeof(pool.buf) - pool.avail;
+    memcpy(p, src, len);
+    memset(src, 0, len);
+    pool.avail -= len;
+    mtx_unlock(&pool.lock);
+}
+
+uint32_t arc4random(void) {
+    uint32_t value;
+    arc4random_buf(&value, sizeof(value));
+    return value;
+}
+
+uint32_t arc4random_uniform(uint32_t upper_bound) {
+    if (upper_bound < 2)
+        return 0;
+
+    // Values below |min| would make the low results more likely, so throw
+    // them away.  Less than half of the range is ever rejected.
+    uint32_t min = -upper_bound % upper_bound;
+    for (;;) {
+        uint32_t value = arc4random();
+        if (value >= min)
+            return value % upper_bound;
+    }
+}